@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2016 Hiroka Ihara
+ *
+ * This file is part of libU3D.
+ *
+ * libU3D is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libU3D is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libU3D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "u3d_internal.hh"
+
+//Checks the free list of BufferAllocator and the pages of BufferArena over
+//the memory backend. Exits with a nonzero status on a failure.
+
+static unsigned int failures = 0;
+
+static void check(const char *title, bool passed)
+{
+    std::printf("%-40s %s\n", title, passed ? "ok" : "FAILED");
+    if(!passed) failures++;
+}
+
+static void test_allocator()
+{
+    U3D::BufferAllocator allocator(1024);
+    size_t a = allocator.allocate(100, 16), b = allocator.allocate(100, 16), c = allocator.allocate(100, 16);
+    check("first fit, aligned", a == 0 && b == 112 && c == 224);
+    //The padding left by the alignment is a block of its own.
+    check("free size after allocation", allocator.get_free_size() == 1024 - 300 && allocator.get_free_block_count() == 3);
+    check("largest free block", allocator.get_largest_free_block() == 1024 - 324);
+
+    allocator.free(b, 100);
+    check("hole merges with the padding around it", allocator.get_free_block_count() == 2 && allocator.get_free_size() == 1024 - 200);
+    check("hole is reused first", allocator.allocate(100, 16) == b);
+    allocator.free(b, 100);
+    allocator.free(a, 100);
+    check("free coalesces with the next block", allocator.get_free_block_count() == 2 && allocator.get_free_size() == 1024 - 100);
+    allocator.free(c, 100);
+    check("free coalesces on both sides", allocator.get_free_block_count() == 1 && allocator.get_largest_free_block() == 1024);
+
+    check("empty allocation fails", allocator.allocate(0, 16) == U3D::BufferAllocator::NO_SPACE);
+    check("oversized allocation fails", allocator.allocate(1025, 1) == U3D::BufferAllocator::NO_SPACE);
+    size_t d = allocator.allocate(1000, 1);
+    check("alignment beyond the space left fails", d == 0 && allocator.allocate(8, 512) == U3D::BufferAllocator::NO_SPACE);
+    check("unaligned fit succeeds", allocator.allocate(24, 1) == 1000 && allocator.get_free_size() == 0);
+    check("full allocator fails", allocator.allocate(1, 1) == U3D::BufferAllocator::NO_SPACE && allocator.get_largest_free_block() == 0);
+
+    U3D::BufferAllocator empty(0);
+    check("allocator without capacity fails", empty.allocate(1, 1) == U3D::BufferAllocator::NO_SPACE && empty.get_free_block_count() == 0);
+}
+
+static void test_arena()
+{
+    U3D::MemoryBufferBackend *backend = new U3D::MemoryBufferBackend();
+    U3D::BufferArena arena(backend, 4096);
+    std::vector<uint8_t> data(1000);
+    for(size_t i = 0; i < data.size(); i++) data[i] = static_cast<uint8_t>(i * 7);
+
+    U3D::BufferArena::Range ranges[4];
+    for(int i = 0; i < 4; i++) ranges[i] = arena.allocate(1000, &data[0]);
+    U3D::BufferArena::Statistics stats = arena.get_statistics();
+    check("ranges share a page", stats.page_count == 1 && backend->get_buffer_count() == 1 && ranges[3].buffer == ranges[0].buffer);
+    check("ranges are aligned", ranges[1].offset % U3D::BufferArena::ALIGNMENT == 0 && ranges[1].offset >= 1000);
+    const uint8_t *contents = backend->get_contents(ranges[2].buffer);
+    check("contents are uploaded", contents != NULL && memcmp(contents + ranges[2].offset, &data[0], data.size()) == 0);
+
+    U3D::BufferArena::Range extra = arena.allocate(1000, NULL);
+    stats = arena.get_statistics();
+    check("full page opens another", stats.page_count == 2 && extra.page == 1 && stats.capacity == 8192);
+
+    arena.free(ranges[1]);
+    arena.free(ranges[2]);
+    stats = arena.get_statistics();
+    check("freed ranges coalesce", stats.used == 3000 && stats.largest_free_block >= 2000);
+    U3D::BufferArena::Range reused = arena.allocate(1900, NULL);
+    check("coalesced hole is reused", reused.page == 0 && reused.offset == ranges[1].offset);
+
+    U3D::BufferArena::Range large = arena.allocate(10000, NULL);
+    stats = arena.get_statistics();
+    check("oversized range gets its own page", large.page == 2 && large.offset == 0 && stats.capacity == 8192 + 10000);
+
+    U3D::BufferArena::Range none = arena.allocate(0, &data[0]);
+    check("empty range takes nothing", none.size == 0 && none.buffer == 0 && arena.get_statistics().page_count == 3);
+    size_t used = arena.get_statistics().used;
+    arena.free(none);
+    check("freeing an empty range is ignored", arena.get_statistics().used == used);
+
+    bool thrown = false;
+    try {
+        backend->upload(ranges[0].buffer, 4000, 200, &data[0]);
+    } catch(const U3D::Error&) {
+        thrown = true;
+    }
+    check("overrunning upload throws", thrown);
+
+    //Writes longer than the range are dropped rather than spilling into the next.
+    std::vector<uint8_t> zeros(2000, 0);
+    arena.write(ranges[0], &zeros[0], zeros.size());
+    check("oversized write is ignored", memcmp(backend->get_contents(ranges[0].buffer) + ranges[0].offset, &data[0], data.size()) == 0);
+    std::vector<uint8_t> read_back(1000);
+    arena.write(ranges[3], &zeros[0], 500);
+    arena.read(ranges[3], &read_back[0]);
+    check("partial write and read back", read_back[0] == 0 && read_back[499] == 0 && read_back[500] == data[500]);
+
+    arena.free(ranges[0]);
+    arena.free(ranges[3]);
+    arena.free(reused);
+    arena.free(extra);
+    arena.free(large);
+    stats = arena.get_statistics();
+    check("everything freed", stats.used == 0 && stats.free_block_count == 3 && stats.largest_free_block == 10000);
+}
+
+//The first page is sized to hold a reservation larger than a page.
+static void test_reserve()
+{
+    U3D::BufferArena arena(new U3D::MemoryBufferBackend(), 1024);
+    arena.reserve(5000);
+    U3D::BufferArena::Range a = arena.allocate(3000, NULL), b = arena.allocate(1500, NULL);
+    check("reserved page holds the geometry", arena.get_statistics().page_count == 1 && a.page == 0 && b.page == 0);
+    arena.reserve(100000);
+    check("reserve only sizes the first page", arena.get_statistics().capacity == 5000);
+}
+
+int main()
+{
+    test_allocator();
+    test_arena();
+    test_reserve();
+
+    if(failures > 0) {
+        std::printf("%u checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
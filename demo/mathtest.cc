@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2016 Hiroka Ihara
+ *
+ * This file is part of libU3D.
+ *
+ * libU3D is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libU3D is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libU3D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "u3d_internal.hh"
+
+//Checks the vector kernels of Matrix4f and the batch transforms against
+//their portable versions. Exits with a nonzero status on a mismatch.
+
+static unsigned int failures = 0;
+
+static float random_float(float lo, float hi)
+{
+    return lo + (hi - lo) * rand() / RAND_MAX;
+}
+
+//Difference relative to the larger magnitude, or absolute below 1. Sums
+//of large terms cancelling out near zero are off by more than an ulp.
+static float get_error(const float *a, const float *b, size_t count)
+{
+    float error = 0;
+    for(size_t i = 0; i < count; i++) {
+        float scale = std::max(1.0f, std::max(fabsf(a[i]), fabsf(b[i])));
+        error = std::max(error, fabsf(a[i] - b[i]) / scale);
+    }
+    return error;
+}
+
+static float get_error(const U3D::Matrix4f& a, const U3D::Matrix4f& b)
+{
+    return get_error(a.m[0], b.m[0], 16);
+}
+
+static void check(const char *title, float error, float tolerance)
+{
+    bool passed = error <= tolerance;
+    std::printf("%-24s max error %.3g %s\n", title, error, passed ? "ok" : "FAILED");
+    if(!passed) failures++;
+}
+
+//Rotations, a non-uniform scale and a translation row
+static U3D::Matrix4f create_affine()
+{
+    U3D::Matrix4f ret = U3D::Matrix4f::create_X_rotation(random_float(-3, 3)) * U3D::Matrix4f::create_Y_rotation(random_float(-3, 3));
+    ret = ret * U3D::Matrix4f::create_Z_rotation(random_float(-3, 3));
+    U3D::Matrix4f scale;
+    scale.m[0][0] = random_float(0.5f, 4), scale.m[1][1] = random_float(0.5f, 4), scale.m[2][2] = random_float(0.5f, 4);
+    ret = ret * scale;
+    ret.translate(U3D::Vector3f(random_float(-100, 100), random_float(-100, 100), random_float(-100, 100)));
+    return ret;
+}
+
+//Every entry set, with a dominant diagonal to keep it well conditioned
+static U3D::Matrix4f create_general()
+{
+    U3D::Matrix4f ret;
+    for(int i = 0; i < 4; i++) {
+        for(int j = 0; j < 4; j++) {
+            ret.m[i][j] = random_float(-1, 1) + (i == j ? 4.0f : 0.0f);
+        }
+    }
+    return ret;
+}
+
+static void test_matrices(const std::vector<U3D::Matrix4f>& matrices)
+{
+    float product_error = 0, inverse_error = 0, identity_error = 0, normal_error = 0;
+    for(size_t i = 0; i < matrices.size(); i++) {
+        const U3D::Matrix4f& a = matrices[i];
+        const U3D::Matrix4f& b = matrices[(i + 1) % matrices.size()];
+        product_error = std::max(product_error, get_error(a * b, a.multiply_scalar(b)));
+        U3D::Matrix4f inverse = a.inverse();
+        inverse_error = std::max(inverse_error, get_error(inverse, a.inverse_scalar()));
+        identity_error = std::max(identity_error, get_error(a * inverse, U3D::Matrix4f()));
+        normal_error = std::max(normal_error, get_error(a.create_normal_matrix(), a.create_normal_matrix_scalar()));
+    }
+    check("operator*", product_error, 1E-6f);
+    check("inverse", inverse_error, 1E-5f);
+    check("inverse identity", identity_error, 1E-4f);
+    check("create_normal_matrix", normal_error, 1E-6f);
+}
+
+//The translation row has to come out of the inverse of an affine transform.
+static void test_affine_inverse(const std::vector<U3D::Matrix4f>& matrices)
+{
+    float error = 0;
+    for(size_t i = 0; i < matrices.size(); i++) {
+        error = std::max(error, get_error(matrices[i].inverse(), matrices[i].affine_inverse()));
+    }
+    check("inverse affine", error, 1E-5f);
+}
+
+//Points and normals interleaved as in a vertex buffer, six floats apart
+static void test_vertices(const std::vector<U3D::Matrix4f>& matrices)
+{
+    const size_t count = 1003, stride = 6;
+    std::vector<float> src(count * stride), dst(src.size()), ref(src.size());
+    for(size_t i = 0; i < src.size(); i++) {
+        src[i] = random_float(-50, 50);
+    }
+    float point_error = 0, normal_error = 0;
+    for(size_t i = 0; i < matrices.size(); i++) {
+        U3D::transform_points(matrices[i], &src[0], &dst[0], count, stride);
+        U3D::transform_points_scalar(matrices[i], &src[0], &ref[0], count, stride);
+        U3D::transform_normals(matrices[i], &src[3], &dst[3], count, stride);
+        U3D::transform_normals_scalar(matrices[i], &src[3], &ref[3], count, stride);
+        point_error = std::max(point_error, get_error(&dst[0], &ref[0], dst.size()));
+        for(size_t j = 0; j < count; j++) {
+            normal_error = std::max(normal_error, get_error(&dst[j * stride + 3], &ref[j * stride + 3], 3));
+        }
+    }
+    check("transform_points", point_error, 1E-4f);
+    check("transform_normals", normal_error, 1E-5f);
+}
+
+static void test_boxes(const std::vector<U3D::Matrix4f>& matrices)
+{
+    std::vector<U3D::BoundingBox3f> src(257), dst(src.size()), ref(src.size());
+    for(size_t i = 1; i < src.size(); i++) {
+        src[i].extend(U3D::Vector3f(random_float(-10, 10), random_float(-10, 10), random_float(-10, 10)));
+        src[i].extend(U3D::Vector3f(random_float(-10, 10), random_float(-10, 10), random_float(-10, 10)));
+    }
+    float error = 0;
+    bool empty_kept = true;
+    for(size_t i = 0; i < matrices.size(); i++) {
+        U3D::transform_boxes(matrices[i], &src[0], &dst[0], src.size());
+        U3D::transform_boxes_scalar(matrices[i], &src[0], &ref[0], src.size());
+        empty_kept = empty_kept && dst[0].empty();
+        for(size_t j = 1; j < src.size(); j++) {
+            error = std::max(error, get_error(&dst[j].min.x, &ref[j].min.x, 3));
+            error = std::max(error, get_error(&dst[j].max.x, &ref[j].max.x, 3));
+        }
+    }
+    check("transform_boxes", empty_kept ? error : 1.0f, 1E-5f);
+}
+
+static void test_chains(const std::vector<U3D::Matrix4f>& matrices)
+{
+    float error = 0;
+    for(size_t length = 0; length <= 8; length++) {
+        for(size_t i = 0; i + length <= matrices.size(); i += 8) {
+            error = std::max(error, get_error(U3D::multiply_chain(&matrices[i], length), U3D::multiply_chain_scalar(&matrices[i], length)));
+        }
+    }
+    check("multiply_chain", error, 1E-5f);
+}
+
+int main()
+{
+    srand(1);
+    std::vector<U3D::Matrix4f> affine, general;
+    for(int i = 0; i < 64; i++) {
+        affine.push_back(create_affine());
+        general.push_back(create_general());
+    }
+    U3D::Matrix4f projection;
+    U3D::Matrix4f::create_perspective_projection(projection, 0.8f, 1.5f, 0.1f, 100.0f);
+    general.push_back(projection);
+    std::vector<U3D::Matrix4f> all(affine);
+    all.insert(all.end(), general.begin(), general.end());
+
+#ifdef __SSE2__
+    std::printf("SSE2 kernels against the scalar versions\n");
+#else
+    std::printf("Scalar build; kernels and scalar versions are the same code\n");
+#endif
+    test_matrices(all);
+    test_affine_inverse(affine);
+    test_vertices(all);
+    test_boxes(all);
+    //Chains of rotations with translations stay well scaled.
+    test_chains(affine);
+
+    if(failures > 0) {
+        std::printf("%u checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
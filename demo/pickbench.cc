@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2016 Hiroka Ihara
+ *
+ * This file is part of libU3D.
+ *
+ * libU3D is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libU3D is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libU3D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "u3d_internal.hh"
+
+//Ray picking throughput on synthetic scenes: one dense mesh, and a grid
+//assembly of many instances of a small mesh.
+
+static void create_sphere(std::vector<U3D::Vector3f>& triangles, int segments)
+{
+    const float pi = 3.1415927f;
+    for(int i = 0; i < segments; i++) {
+        float theta0 = pi * i / segments, theta1 = pi * (i + 1) / segments;
+        for(int j = 0; j < segments; j++) {
+            float phi0 = 2 * pi * j / segments, phi1 = 2 * pi * (j + 1) / segments;
+            U3D::Vector3f a(sinf(theta0) * cosf(phi0), sinf(theta0) * sinf(phi0), cosf(theta0));
+            U3D::Vector3f b(sinf(theta1) * cosf(phi0), sinf(theta1) * sinf(phi0), cosf(theta1));
+            U3D::Vector3f c(sinf(theta1) * cosf(phi1), sinf(theta1) * sinf(phi1), cosf(theta1));
+            U3D::Vector3f d(sinf(theta0) * cosf(phi1), sinf(theta0) * sinf(phi1), cosf(theta0));
+            triangles.push_back(a), triangles.push_back(b), triangles.push_back(c);
+            triangles.push_back(a), triangles.push_back(c), triangles.push_back(d);
+        }
+    }
+}
+
+static double get_seconds(Uint64 start)
+{
+    return static_cast<double>(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+}
+
+//Casts a grid of rays from a camera on the +Z axis toward the scene bounds.
+static void run(const char *title, const U3D::PickingScene& scene, const U3D::BoundingBox3f& bounds, U3D::WorkerPool *pool)
+{
+    const int resolution = 512;
+    U3D::Vector3f center = bounds.center(), extent = bounds.max - bounds.min;
+    U3D::Vector3f eye = center + U3D::Vector3f(0, 0, 2 * std::max(extent.x, extent.y) + extent.z);
+    std::vector<U3D::Ray> rays;
+    rays.reserve(resolution * resolution);
+    for(int y = 0; y < resolution; y++) {
+        for(int x = 0; x < resolution; x++) {
+            U3D::Vector3f target(bounds.min.x + extent.x * (x + 0.5f) / resolution, bounds.min.y + extent.y * (y + 0.5f) / resolution, center.z);
+            rays.push_back(U3D::Ray(eye, (target - eye).normalize()));
+        }
+    }
+    std::vector<U3D::RayHit> hits(rays.size());
+    Uint64 start = SDL_GetPerformanceCounter();
+    scene.intersect(&rays[0], &hits[0], rays.size(), pool);
+    double seconds = get_seconds(start);
+    size_t hit_count = 0;
+    for(size_t i = 0; i < hits.size(); i++) {
+        if(hits[i].valid()) hit_count++;
+    }
+    std::printf("%-10s %2u threads: %8.0f rays/s (%lu of %lu rays hit)\n", title, pool != NULL ? pool->get_thread_count() : 1,
+                rays.size() / seconds, static_cast<unsigned long>(hit_count), static_cast<unsigned long>(rays.size()));
+}
+
+static void benchmark(const char *title, const std::vector<U3D::Vector3f>& triangles, int grid, U3D::WorkerPool& pool)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    U3D::MeshBVH serial_mesh(triangles);
+    double serial_seconds = get_seconds(start);
+    start = SDL_GetPerformanceCounter();
+    U3D::MeshBVH mesh(triangles, &pool);
+    double parallel_seconds = get_seconds(start);
+    U3D::PickingScene scene;
+    U3D::BoundingBox3f bounds;
+    for(int y = 0; y < grid; y++) {
+        for(int x = 0; x < grid; x++) {
+            U3D::Matrix4f transform = U3D::Matrix4f::create_Z_rotation(0.1f * (x + y));
+            transform.translate(U3D::Vector3f(3.0f * x, 3.0f * y, 0));
+            scene.add_instance(&mesh, transform);
+            bounds.extend(mesh.get_bounds().transform(transform));
+        }
+    }
+    start = SDL_GetPerformanceCounter();
+    scene.build(&pool);
+    double scene_seconds = get_seconds(start);
+    std::printf("%-10s %u faces x %d instances, mesh build %.1f ms serial / %.1f ms parallel, scene build %.1f ms\n", title,
+                mesh.get_face_count(), grid * grid, serial_seconds * 1000, parallel_seconds * 1000, scene_seconds * 1000);
+    run(title, scene, bounds, NULL);
+    run(title, scene, bounds, &pool);
+}
+
+int main(int argc, char *argv[])
+{
+    int threads = argc > 1 ? atoi(argv[1]) : 0;
+    U3D::WorkerPool pool(threads);
+
+    std::vector<U3D::Vector3f> dense;
+    create_sphere(dense, 512);
+    benchmark("dense", dense, 1, pool);
+
+    std::vector<U3D::Vector3f> part;
+    create_sphere(part, 24);
+    benchmark("assembly", part, 64, pool);
+
+    return 0;
+}
@@ -0,0 +1,251 @@
+/*
+ * Copyright (C) 2016 Hiroka Ihara
+ *
+ * This file is part of libU3D.
+ *
+ * libU3D is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libU3D is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libU3D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "u3d_internal.hh"
+
+//Compares the texel layout conversions against plain per-texel loops, over
+//counts around each vector width and from every alignment of the buffers.
+//Exits with a nonzero status on a failure.
+
+static unsigned int failures = 0;
+
+static void check(const char *title, bool passed)
+{
+    std::printf("%-40s %s\n", title, passed ? "ok" : "FAILED");
+    if(!passed) failures++;
+}
+
+//Counts cover every tail length past two blocks of the widest kernels.
+static const size_t MAX_COUNT = 50, MAX_OFFSET = 16, GUARD = 32;
+static const uint8_t FILL = 0xA5;
+
+//Source texels with every byte value, from a fixed sequence
+static std::vector<uint8_t> create_source(size_t size)
+{
+    std::vector<uint8_t> bytes(size);
+    uint32_t state = 12345;
+    for(size_t i = 0; i < size; i++) {
+        state = state * 1103515245 + 12345;
+        bytes[i] = static_cast<uint8_t>(state >> 16);
+    }
+    return bytes;
+}
+
+//A kernel under test and its reference, both taking count texels
+struct Conversion
+{
+    virtual ~Conversion() {}
+    virtual size_t get_source_size() const = 0;
+    virtual size_t get_output_size() const = 0;
+    virtual void convert(const uint8_t *src, size_t count, uint8_t *dst) const = 0;
+    virtual void reference(const uint8_t *src, size_t count, uint8_t *dst) const = 0;
+};
+
+//Runs a conversion from each offset of its source and output, and checks
+//that it writes the reference texels and nothing around them.
+static bool compare(const Conversion& conversion)
+{
+    size_t in = conversion.get_source_size(), out = conversion.get_output_size();
+    std::vector<uint8_t> source = create_source(in * MAX_COUNT + MAX_OFFSET);
+    std::vector<uint8_t> expected(out * MAX_COUNT), output(out * MAX_COUNT + MAX_OFFSET + 2 * GUARD);
+    for(size_t count = 0; count <= MAX_COUNT; count++) {
+        for(size_t src_offset = 0; src_offset < MAX_OFFSET; src_offset++) {
+            for(size_t dst_offset = 0; dst_offset < MAX_OFFSET; dst_offset += 3) {
+                const uint8_t *src = &source[src_offset];
+                conversion.reference(src, count, &expected[0]);
+                std::fill(output.begin(), output.end(), FILL);
+                uint8_t *dst = &output[GUARD + dst_offset];
+                conversion.convert(src, count, dst);
+                if(memcmp(dst, &expected[0], out * count) != 0) return false;
+                for(size_t i = 0; i < output.size(); i++) {
+                    if((&output[i] < dst || &output[i] >= dst + out * count) && output[i] != FILL) return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+struct ExpandRGB : public Conversion
+{
+    bool swap_red_blue;
+    ExpandRGB(bool swap_red_blue) : swap_red_blue(swap_red_blue) {}
+    size_t get_source_size() const { return 3; }
+    size_t get_output_size() const { return 4; }
+    void convert(const uint8_t *src, size_t count, uint8_t *dst) const
+    {
+        U3D::expand_rgb_to_rgba(src, count, swap_red_blue, dst);
+    }
+    void reference(const uint8_t *src, size_t count, uint8_t *dst) const
+    {
+        for(size_t i = 0; i < count; i++) {
+            dst[4 * i] = src[3 * i + (swap_red_blue ? 2 : 0)];
+            dst[4 * i + 1] = src[3 * i + 1];
+            dst[4 * i + 2] = src[3 * i + (swap_red_blue ? 0 : 2)];
+            dst[4 * i + 3] = 255;
+        }
+    }
+};
+
+struct Swizzle : public Conversion
+{
+    uint32_t shifts[4];
+    bool opaque;
+    //The shifts of GL_UNSIGNED_INT_8_8_8_8 when reversed is not set
+    Swizzle(bool reversed, bool bgr, bool opaque) : opaque(opaque)
+    {
+        for(int j = 0; j < 4; j++) shifts[j] = reversed ? 8 * j : 24 - 8 * j;
+        if(bgr) std::swap(shifts[0], shifts[2]);
+    }
+    size_t get_source_size() const { return 4; }
+    size_t get_output_size() const { return 4; }
+    void convert(const uint8_t *src, size_t count, uint8_t *dst) const
+    {
+        U3D::swizzle_to_rgba(src, count, shifts, opaque, dst);
+    }
+    //Texels are little-endian words, whatever the byte order of the host.
+    void reference(const uint8_t *src, size_t count, uint8_t *dst) const
+    {
+        for(size_t i = 0; i < count; i++) {
+            for(int j = 0; j < 4; j++) dst[4 * i + j] = src[4 * i + shifts[j] / 8];
+            if(opaque) dst[4 * i + 3] = 255;
+        }
+    }
+};
+
+struct ExpandLuminance : public Conversion
+{
+    size_t get_source_size() const { return 1; }
+    size_t get_output_size() const { return 4; }
+    void convert(const uint8_t *src, size_t count, uint8_t *dst) const
+    {
+        U3D::expand_luminance_to_rgba(src, count, dst);
+    }
+    void reference(const uint8_t *src, size_t count, uint8_t *dst) const
+    {
+        for(size_t i = 0; i < count; i++) {
+            dst[4 * i] = dst[4 * i + 1] = dst[4 * i + 2] = src[i];
+            dst[4 * i + 3] = 255;
+        }
+    }
+};
+
+struct ExpandLuminanceAlpha : public Conversion
+{
+    size_t get_source_size() const { return 2; }
+    size_t get_output_size() const { return 4; }
+    void convert(const uint8_t *src, size_t count, uint8_t *dst) const
+    {
+        U3D::expand_luminance_alpha_to_rgba(src, count, dst);
+    }
+    void reference(const uint8_t *src, size_t count, uint8_t *dst) const
+    {
+        for(size_t i = 0; i < count; i++) {
+            dst[4 * i] = dst[4 * i + 1] = dst[4 * i + 2] = src[2 * i];
+            dst[4 * i + 3] = src[2 * i + 1];
+        }
+    }
+};
+
+struct ExpandAlpha : public Conversion
+{
+    size_t get_source_size() const { return 1; }
+    size_t get_output_size() const { return 4; }
+    void convert(const uint8_t *src, size_t count, uint8_t *dst) const
+    {
+        U3D::expand_alpha_to_rgba(src, count, dst);
+    }
+    void reference(const uint8_t *src, size_t count, uint8_t *dst) const
+    {
+        for(size_t i = 0; i < count; i++) {
+            dst[4 * i] = dst[4 * i + 1] = dst[4 * i + 2] = 0;
+            dst[4 * i + 3] = src[i];
+        }
+    }
+};
+
+//Keeps the given channels of RGBA texels, in order
+struct Extract : public Conversion
+{
+    int first, second;
+    Extract(int first, int second = -1) : first(first), second(second) {}
+    size_t get_source_size() const { return 4; }
+    size_t get_output_size() const { return second < 0 ? 1 : 2; }
+    void convert(const uint8_t *src, size_t count, uint8_t *dst) const
+    {
+        if(second >= 0) {
+            U3D::extract_luminance_alpha(src, count, dst);
+        } else if(first == 0) {
+            U3D::extract_luminance(src, count, dst);
+        } else {
+            U3D::extract_alpha(src, count, dst);
+        }
+    }
+    void reference(const uint8_t *src, size_t count, uint8_t *dst) const
+    {
+        size_t size = get_output_size();
+        for(size_t i = 0; i < count; i++) {
+            dst[size * i] = src[4 * i + first];
+            if(second >= 0) dst[size * i + 1] = src[4 * i + second];
+        }
+    }
+};
+
+//Runs each layout of Texture::decode through the conversion to RGBA
+static void test_convert_image()
+{
+    std::vector<uint8_t> source = create_source(4 * 37);
+    U3D::TextureImage image;
+    image.width = 37, image.height = 1;
+    image.format = GL_BGR, image.type = GL_UNSIGNED_BYTE, image.internal_format = GL_RGB;
+    image.pixels.assign(source.begin(), source.begin() + 3 * 37);
+    U3D::convert_image(image, GL_RGBA);
+    std::vector<uint8_t> expected(4 * 37);
+    ExpandRGB(true).reference(&source[0], 37, &expected[0]);
+    check("BGR image converted to RGBA", image.format == GL_RGBA && image.internal_format == GL_RGB && image.pixels == expected);
+
+    U3D::convert_image(image, GL_LUMINANCE_ALPHA);
+    std::vector<uint8_t> pairs(2 * 37);
+    Extract(0, 3).reference(&expected[0], 37, &pairs[0]);
+    check("RGBA image converted to luminance", image.format == GL_LUMINANCE_ALPHA && image.internal_format == GL_LUMINANCE_ALPHA &&
+          image.pixels == pairs);
+}
+
+int main()
+{
+    check("RGB expanded", compare(ExpandRGB(false)));
+    check("BGR expanded", compare(ExpandRGB(true)));
+    check("packed RGBA swizzled", compare(Swizzle(false, false, false)));
+    check("reversed BGRA swizzled", compare(Swizzle(true, true, false)));
+    check("opaque texels swizzled", compare(Swizzle(true, false, true)));
+    check("opaque BGR texels swizzled", compare(Swizzle(false, true, true)));
+    check("luminance expanded", compare(ExpandLuminance()));
+    check("luminance and alpha expanded", compare(ExpandLuminanceAlpha()));
+    check("alpha expanded", compare(ExpandAlpha()));
+    check("luminance extracted", compare(Extract(0)));
+    check("alpha extracted", compare(Extract(3)));
+    check("luminance and alpha extracted", compare(Extract(0, 3)));
+    test_convert_image();
+
+    if(failures > 0) {
+        std::printf("%u checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2016 Hiroka Ihara
+ *
+ * This file is part of libU3D.
+ *
+ * libU3D is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libU3D is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libU3D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "u3d_internal.hh"
+
+//Submits one frame of models through RenderQueue in the order they were
+//added and sorted, and counts the binds each issues on a recording device.
+//Exits with a nonzero status when sorting does not save what it should.
+
+static unsigned int failures = 0;
+
+static void check(const char *title, bool passed)
+{
+    std::printf("%-40s %s\n", title, passed ? "ok" : "FAILED");
+    if(!passed) failures++;
+}
+
+//Model uniforms are not what is measured here.
+struct NullBlock : public U3D::UniformBlock
+{
+    void load(U3D::RenderDevice&, U3D::ShaderProgram&) {}
+};
+
+static const int PROGRAM_COUNT = 2, TEXTURE_COUNT = 3, MODEL_COUNT = 24, MODELS_PER_PAGE = 8;
+
+//Locations are left unresolved apart from the position, as no GL is bound.
+static void create_program(U3D::ShaderProgram& program, GLuint name)
+{
+    program = U3D::ShaderProgram();
+    program.program = name;
+    program.vertex_position = 0;
+    program.vertex_normal = program.vertex_diffuse = program.vertex_specular = -1;
+    for(int i = 0; i < 8; i++) program.vertex_texcoord[i] = program.texture_region[i] = -1;
+    program.PVM_matrix = program.modelview_matrix = program.normal_matrix = -1;
+    program.instance_model_matrix = program.instance_normal_matrix = -1;
+    program.view_matrix = program.view_normal_matrix = program.projection_matrix = -1;
+    program.material_diffuse = program.material_specular = program.material_ambient = -1;
+    program.material_emissive = program.material_reflectivity = -1;
+    program.light_count = program.light_color = program.light_position = -1;
+    program.light_direction = program.light_attenuation = -1;
+}
+
+static void print_counters(const char *title, const U3D::RecordingRenderDevice::Counters& counters)
+{
+    std::printf("%-8s programs %3u  textures %3u  buffers %3u  draws %3u  vertices %5u\n", title,
+                counters.program_binds, counters.texture_binds, counters.buffer_binds, counters.draw_calls, counters.vertices);
+}
+
+int main()
+{
+    //Pages of eight triangles, each padded to 48 bytes, so that the models
+    //are spread over three buffers
+    U3D::BufferArena arena(new U3D::MemoryBufferBackend(), MODELS_PER_PAGE * 3 * U3D::BufferArena::ALIGNMENT);
+    U3D::ShaderProgram programs[PROGRAM_COUNT];
+    U3D::ShaderGroup groups[PROGRAM_COUNT];
+    U3D::Material material;
+    for(int i = 0; i < PROGRAM_COUNT; i++) {
+        create_program(programs[i], 10 + i);
+        groups[i].program = &programs[i];
+        groups[i].material.configure(&material);
+        groups[i].shader_channels = 1;
+    }
+    std::vector<U3D::RenderGroup *> render_groups;
+    GLfloat triangle[9] = {0, 0, 0, 1, 0, 0, 0, 1, 0};
+    for(int i = 0; i < MODEL_COUNT; i++) {
+        render_groups.push_back(new U3D::RenderGroup(arena, GL_TRIANGLES, 1));
+        render_groups.back()->load(0, triangle, U3D::RenderGroup::BUFFER_POSITION_MASK, 3);
+    }
+    check("models fill three buffers", arena.get_statistics().page_count == 3);
+
+    //Models added in scene order, cycling through programs and textures
+    U3D::RenderQueue queue;
+    NullBlock model;
+    for(int i = 0; i < MODEL_COUNT; i++) {
+        GLuint textures[8] = {static_cast<GLuint>(100 + i % TEXTURE_COUNT), 0, 0, 0, 0, 0, 0, 0};
+        queue.add(&groups[i % PROGRAM_COUNT], &programs[i % PROGRAM_COUNT], textures, render_groups[i], 0, &model);
+    }
+
+    U3D::RecordingRenderDevice device;
+    U3D::RenderStats unsorted_stats = queue.submit(device, NULL, false);
+    U3D::RecordingRenderDevice::Counters unsorted = device.get_counters();
+    for(int i = 0; i < PROGRAM_COUNT; i++) {
+        programs[i].model_serial = programs[i].material_serial = programs[i].light_serial = 0;
+    }
+    device.reset();
+    U3D::RenderStats sorted_stats = queue.submit(device, NULL);
+    U3D::RecordingRenderDevice::Counters sorted = device.get_counters();
+    print_counters("unsorted", unsorted);
+    print_counters("sorted", sorted);
+
+    check("every model is drawn either way", unsorted.draw_calls == MODEL_COUNT && sorted.draw_calls == MODEL_COUNT && sorted.vertices == unsorted.vertices);
+    check("stats match the binds issued", sorted_stats.program_switches == sorted.program_binds && sorted_stats.texture_switches == sorted.texture_binds &&
+          unsorted_stats.program_switches == unsorted.program_binds && unsorted_stats.texture_switches == unsorted.texture_binds);
+    check("unsorted binds every program and texture", unsorted.program_binds == MODEL_COUNT && unsorted.texture_binds == MODEL_COUNT);
+    check("sorted binds each program once", sorted.program_binds == PROGRAM_COUNT);
+    check("sorted binds each texture once per program", sorted.texture_binds == PROGRAM_COUNT * TEXTURE_COUNT);
+    check("sorting saves binds overall", sorted.program_binds + sorted.texture_binds + sorted.buffer_binds <
+          unsorted.program_binds + unsorted.texture_binds + unsorted.buffer_binds);
+
+    for(unsigned int i = 0; i < render_groups.size(); i++) {
+        delete render_groups[i];
+    }
+    if(failures > 0) {
+        std::printf("%u checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
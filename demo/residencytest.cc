@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) 2016 Hiroka Ihara
+ *
+ * This file is part of libU3D.
+ *
+ * libU3D is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libU3D is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libU3D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "u3d_internal.hh"
+
+//Streams the levels of a few textures through TextureResidency over the
+//memory backend, and checks which levels the budget keeps and when the
+//finer ones come back. Exits with a nonzero status on a failure.
+
+static unsigned int failures = 0;
+
+static void check(const char *title, bool passed)
+{
+    std::printf("%-40s %s\n", title, passed ? "ok" : "FAILED");
+    if(!passed) failures++;
+}
+
+static const int TEXTURE_COUNT = 4;
+static const uint32_t SIZE = 256;
+
+static void create_image(U3D::TextureImage& image, int seed)
+{
+    image = U3D::TextureImage();
+    image.width = image.height = SIZE;
+    image.format = GL_RGBA;
+    image.internal_format = GL_RGBA;
+    image.pixels.resize(4 * SIZE * SIZE);
+    for(size_t i = 0; i < image.pixels.size(); i++) image.pixels[i] = static_cast<uint8_t>(i * (seed + 1));
+    U3D::generate_mipmaps(image, U3D::TextureOptions::BOX, false);
+}
+
+//Records the textures loaded, in order, and the thread loading them.
+//Loads run on one worker at a time, and are read once the pool is idle.
+class RecordingSource : public U3D::TextureSource
+{
+    int id;
+    bool fails;
+    std::vector<int> *loads;
+    SDL_threadID *thread;
+public:
+    RecordingSource(int id, bool fails, std::vector<int> *loads, SDL_threadID *thread) : id(id), fails(fails), loads(loads), thread(thread) {}
+    bool load(U3D::TextureImage& image)
+    {
+        create_image(image, id);
+        loads->push_back(id);
+        *thread = SDL_ThreadID();
+        return !fails;
+    }
+};
+
+struct Fixture
+{
+    //Declared first, as a load may still record into them while the
+    //residency is destroyed
+    std::vector<int> loads;
+    SDL_threadID thread;
+    U3D::MemoryTextureBackend *backend;
+    U3D::TextureResidency residency;
+    GLuint textures[TEXTURE_COUNT];
+    //Bytes of the full chain and of the levels kept in system memory
+    size_t full_size, kept_size;
+    //Textures are added with sources failing from the given one on, and
+    //updated until only the levels kept remain in system memory.
+    Fixture(int failing = TEXTURE_COUNT) : thread(0), backend(new U3D::MemoryTextureBackend()), residency(backend, 0)
+    {
+        for(int i = 0; i < TEXTURE_COUNT; i++) {
+            U3D::TextureImage image;
+            create_image(image, i);
+            textures[i] = residency.add(image, new RecordingSource(i, i >= failing, &loads, &thread));
+        }
+        full_size = residency.get_statistics().full_size / TEXTURE_COUNT;
+        residency.update();
+        residency.update();
+        kept_size = residency.get_statistics().system_size / TEXTURE_COUNT;
+    }
+    //Draws the textures from first to last, each over fewer pixels.
+    void draw(int first, int last)
+    {
+        for(int i = first; i < last; i++) residency.request(textures[i], static_cast<float>(SIZE - i));
+    }
+    bool has_levels(unsigned int a, unsigned int b, unsigned int c, unsigned int d)
+    {
+        unsigned int levels[TEXTURE_COUNT] = {a, b, c, d};
+        for(int i = 0; i < TEXTURE_COUNT; i++) {
+            if(residency.get_resident_level(textures[i]) != levels[i]) return false;
+        }
+        return true;
+    }
+    bool within_budget()
+    {
+        return backend->get_resident_size() + residency.get_statistics().system_size <= residency.get_statistics().budget;
+    }
+};
+
+//The budget holds two full chains, and the others keep their levels of
+//INITIAL_SIZE, which stay in system memory as well.
+static void test_budget()
+{
+    Fixture fixture;
+    U3D::TextureResidency& residency = fixture.residency;
+    check("textures start at their kept levels", fixture.has_levels(2, 2, 2, 2) && fixture.backend->get_width(fixture.textures[0]) == 64);
+    residency.set_budget(TEXTURE_COUNT * fixture.kept_size + 2 * fixture.full_size + 2 * fixture.kept_size);
+
+    fixture.draw(0, TEXTURE_COUNT);
+    residency.update();
+    check("largest drawn fill the budget first", fixture.has_levels(0, 0, 2, 2) && fixture.within_budget());
+    check("finer levels are loaded again", fixture.loads.size() == 2 && fixture.loads[0] == 0 && fixture.loads[1] == 1);
+
+    fixture.draw(2, TEXTURE_COUNT);
+    residency.update();
+    check("least recently drawn are evicted", fixture.has_levels(2, 2, 0, 0) && fixture.within_budget());
+    check("evictions are counted", residency.get_statistics().eviction_count == 2);
+    check("evicted levels are loaded again", fixture.loads.size() == 4 && fixture.loads[2] == 2 && fixture.loads[3] == 3);
+
+    unsigned int upload_count = fixture.backend->get_upload_count();
+    residency.update();
+    check("undrawn textures keep their levels", fixture.has_levels(2, 2, 0, 0) && fixture.backend->get_upload_count() == upload_count);
+}
+
+//Loads run on the pool, and their levels are uploaded by the update after.
+static void test_background_loads()
+{
+    U3D::WorkerPool pool(1);
+    Fixture fixture;
+    U3D::TextureResidency& residency = fixture.residency;
+    residency.set_worker_pool(&pool);
+    //One full chain loaded or uploaded per update
+    residency.set_upload_limit(fixture.full_size);
+
+    fixture.draw(0, TEXTURE_COUNT);
+    residency.update();
+    check("levels wait for their load", fixture.has_levels(2, 2, 2, 2) && residency.get_statistics().load_count == 1);
+    pool.wait();
+    check("source loads on a worker", fixture.loads.size() == 1 && fixture.thread != SDL_ThreadID());
+
+    //Each texture is loaded on one update and uploaded on the next.
+    int frames[TEXTURE_COUNT] = {0, 0, 0, 0};
+    for(int frame = 1; frame <= 4 * TEXTURE_COUNT; frame++) {
+        fixture.draw(0, TEXTURE_COUNT);
+        residency.update();
+        pool.wait();
+        for(int i = 0; i < TEXTURE_COUNT; i++) {
+            if(frames[i] == 0 && residency.get_resident_level(fixture.textures[i]) == 0) frames[i] = frame;
+        }
+    }
+    check("every texture is streamed in", fixture.has_levels(0, 0, 0, 0) && residency.get_statistics().pending_load_count == 0);
+    bool ordered = fixture.loads.size() == TEXTURE_COUNT;
+    for(int i = 0; ordered && i < TEXTURE_COUNT; i++) {
+        ordered = fixture.loads[i] == i && frames[i] == 2 * i + 1;
+    }
+    check("loads follow the order of the draws", ordered);
+    check("loaded chains are uploaded", fixture.backend->get_width(fixture.textures[3]) == SIZE &&
+          fixture.backend->get_level_count(fixture.textures[3]) == 9);
+
+    //A load left running is waited for when the residency is destroyed.
+    residency.set_upload_limit(0);
+    residency.set_budget(2 * TEXTURE_COUNT * fixture.kept_size);
+    residency.update();
+    check("eviction does not wait for loads", fixture.has_levels(2, 2, 2, 2) && fixture.within_budget());
+    residency.set_budget(0);
+    fixture.draw(0, 1);
+    residency.update();
+    check("evicted levels load in the background", residency.get_resident_level(fixture.textures[0]) == 2 &&
+          residency.get_statistics().load_count == TEXTURE_COUNT + 1);
+}
+
+//Textures whose source fails keep the levels they have.
+static void test_failed_loads()
+{
+    U3D::WorkerPool pool(1);
+    Fixture fixture(2);
+    U3D::TextureResidency& residency = fixture.residency;
+    residency.set_worker_pool(&pool);
+    fixture.draw(0, TEXTURE_COUNT);
+    residency.update();
+    pool.wait();
+    fixture.draw(0, TEXTURE_COUNT);
+    residency.update();
+    check("failed loads keep the kept levels", fixture.has_levels(0, 0, 2, 2));
+    fixture.draw(0, TEXTURE_COUNT);
+    residency.update();
+    check("failed sources are not loaded again", residency.get_statistics().load_count == TEXTURE_COUNT &&
+          residency.get_statistics().pending_load_count == 0);
+}
+
+int main()
+{
+    test_budget();
+    test_background_loads();
+    test_failed_loads();
+
+    if(failures > 0) {
+        std::printf("%u checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) 2016 Hiroka Ihara
+ *
+ * This file is part of libU3D.
+ *
+ * libU3D is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libU3D is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libU3D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "u3d_internal.hh"
+
+//Builds scenes from the test files and checks them on a context without a
+//GPU, whose render groups are filled from the decoded models. Takes the
+//directory of the test files, ../tests by default. Exits with a nonzero
+//status on a failure.
+
+static unsigned int failures = 0;
+
+static void check(const char *title, bool passed)
+{
+    std::printf("%-40s %s\n", title, passed ? "ok" : "FAILED");
+    if(!passed) failures++;
+}
+
+static std::string test_dir = "../tests/";
+
+static U3D::GraphicsContext *create_context(U3D::FileStructure& model, const U3D::SceneGraph& scene)
+{
+    U3D::GraphicsContext *context = new U3D::GraphicsContext(new U3D::MemoryBufferBackend(), new U3D::RecordingRenderDevice());
+    for(unsigned int i = 0; i < scene.get_model_count(); i++) {
+        model.reload_render_group(context, scene.get_model_resource_name(i));
+    }
+    return context;
+}
+
+//Three instances of one box, each with a shader of its own
+static void test_static_batches()
+{
+    U3D::FileStructure model(test_dir + "threeLevelHierarchy.u3d");
+    U3D::SceneGraph *scene = model.create_scenegraph(model.get_first_view(), 0);
+    U3D::GraphicsContext *context = create_context(model, *scene);
+    const std::string& resource_name = scene->get_model_resource_name(0);
+    check("boxes are not batched alone", scene->create_static_batches(context) == 0 && context->get_render_group(resource_name) != NULL);
+    size_t used = context->get_buffer_arena().get_statistics().used;
+
+    U3D::StaticBatchOptions options;
+    options.min_sources = 1;
+    options.max_vertices = 8;
+    check("large models are not batched", scene->create_static_batches(context, options) == 0);
+
+    options.max_vertices = 1024;
+    check("batch per shader", scene->create_static_batches(context, options) == 3);
+    check("merged source is freed", context->get_render_group(resource_name) == NULL);
+    bool mapped = true;
+    for(unsigned int i = 0; i < 3; i++) {
+        std::string node_name;
+        unsigned int element = 1;
+        mapped = mapped && scene->get_static_source(i, 0, &node_name, &element) && element == 0 &&
+                 node_name == scene->get_model_node_name(i);
+        mapped = mapped && scene->get_static_source(i, 35, &node_name, NULL) && node_name == scene->get_model_node_name(i);
+        mapped = mapped && !scene->get_static_source(i, 36, &node_name, NULL) && !scene->get_static_source(i, -1, &node_name, NULL);
+    }
+    check("vertices map back to their nodes", mapped);
+    check("unknown batch maps to nothing", !scene->get_static_source(3, 0, NULL, NULL));
+
+    scene->release(context);
+    check("sources return with the batches", scene->get_static_batch_count() == 0 && context->get_render_group(resource_name) != NULL &&
+          context->get_buffer_arena().get_statistics().used == used);
+    delete scene;
+    delete context;
+}
+
+static bool near(const U3D::Vector3f& a, const U3D::Vector3f& b)
+{
+    return fabsf(a.x - b.x) < 1E-3f && fabsf(a.y - b.y) < 1E-3f && fabsf(a.z - b.z) < 1E-3f;
+}
+
+static bool contains(const U3D::BoundingBox3f& outer, const U3D::BoundingBox3f& inner)
+{
+    return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y && outer.min.z <= inner.min.z &&
+           outer.max.x >= inner.max.x && outer.max.y >= inner.max.y && outer.max.z >= inner.max.z;
+}
+
+//Box00 is instanced three times by the World, and the chain of Box03 and
+//Box04 below it is repeated under Box01 and Box02
+static void test_subgraph_bounds()
+{
+    U3D::FileStructure model(test_dir + "GetSubgraphBound.u3d");
+    U3D::SceneGraph *scene = model.create_scenegraph(model.get_first_view(), 0);
+    U3D::BoundingBox3f world, box00, box01, box02, box03, box04;
+    check("every node is bounded", scene->get_subgraph_bounds("", &world) && scene->get_subgraph_bounds("Box00", &box00) &&
+          scene->get_subgraph_bounds("Box01", &box01) && scene->get_subgraph_bounds("Box02", &box02) &&
+          scene->get_subgraph_bounds("Box03", &box03) && scene->get_subgraph_bounds("Box04", &box04));
+    check("unknown node is not bounded", !scene->get_subgraph_bounds("Box05", NULL));
+    check("subtree bounds", near(box01.min, U3D::Vector3f(-73.3644f, -112.028f, 0)) && near(box01.max, U3D::Vector3f(36.6816f, -2.98444f, 49.9811f)));
+    check("instances of a node are joined", near(box00.min, U3D::Vector3f(-166.691f, 33.9767f, 0)) && near(box00.max, U3D::Vector3f(120.018f, 120.018f, 39.9811f)));
+    U3D::BoundingBox3f joined = box00;
+    joined.extend(box01);
+    check("world joins its children", near(world.min, joined.min) && near(world.max, joined.max));
+    check("descendants lie within", contains(box01, box02) && contains(world, box03) && contains(box03, box04));
+    U3D::BoundingBox3f light;
+    check("nodes without models are empty", scene->get_subgraph_bounds("Omni01", &light) && light.empty());
+
+    //No render groups are loaded, so rendering only culls.
+    U3D::GraphicsContext *context = new U3D::GraphicsContext(new U3D::MemoryBufferBackend(), new U3D::RecordingRenderDevice());
+    U3D::Matrix4f view_matrix = scene->get_view_matrix();
+    const U3D::RenderStats& stats = scene->render(context);
+    check("whole scene in view", stats.models_drawn == 15 && stats.models_culled == 0);
+    U3D::Matrix4f shifted = view_matrix;
+    shifted.m[3][0] -= 250;
+    scene->set_view_matrix(shifted);
+    scene->render(context);
+    check("part of the scene in view", stats.models_drawn == 3 && stats.models_culled == 12);
+    scene->set_view_matrix(view_matrix * U3D::Matrix4f::create_Y_rotation(3.1415927f));
+    scene->render(context);
+    check("scene behind the view is culled", stats.models_drawn == 0 && stats.models_culled == 15);
+    scene->set_culling(false);
+    scene->render(context);
+    check("nothing culled when disabled", stats.models_drawn == 15 && stats.models_culled == 0);
+    scene->release(context);
+    delete scene;
+    delete context;
+}
+
+//Moves the chain of Box03 and Box04 under each instance of Box00, and none
+//of the instances of that chain under Box01 and Box02
+static void test_transform_update()
+{
+    U3D::FileStructure model(test_dir + "GetSubgraphBound.u3d");
+    U3D::SceneGraph *scene = model.create_scenegraph(model.get_first_view(), 0);
+    U3D::GraphicsContext *context = new U3D::GraphicsContext(new U3D::MemoryBufferBackend(), new U3D::RecordingRenderDevice());
+    const U3D::RenderStats& stats = scene->render(context);
+    std::vector<U3D::Matrix4f> original;
+    for(unsigned int i = 0; i < scene->get_model_count(); i++) {
+        original.push_back(scene->get_model_matrix(i));
+    }
+    U3D::BoundingBox3f box01_before;
+    scene->get_subgraph_bounds("Box01", &box01_before);
+
+    U3D::Node *node = model.get_node("Box03");
+    unsigned int slot = 0;
+    while(slot < node->parents.size() && node->parents[slot].name != "Box00") slot++;
+    //Box00 is only ever translated, so its chain is moved as far in the world.
+    U3D::Matrix4f offset;
+    offset.translate(U3D::Vector3f(10000, 0, 0));
+    check("transform is replaced", model.set_parent_transform("Box03", slot, offset * node->parents[slot].transform, scene));
+    check("unknown parent is refused", !model.set_parent_transform("Box03", node->parents.size(), offset, scene));
+
+    unsigned int moved = 0;
+    bool matched = true;
+    for(unsigned int i = 0; i < scene->get_model_count(); i++) {
+        U3D::Matrix4f expected = original[i];
+        const std::string& name = scene->get_model_node_name(i);
+        //The chains below Box00 are registered first.
+        if(i < 9 && name != "Box00") {
+            expected.translate(U3D::Vector3f(10000, 0, 0));
+            moved++;
+        }
+        for(int j = 0; j < 16; j++) {
+            matched = matched && fabsf((&expected.m[0][0])[j] - (&scene->get_model_matrix(i).m[0][0])[j]) < 1E-3f;
+        }
+    }
+    check("moved subtree and nothing else", matched && moved == 6);
+    std::vector<U3D::Matrix4f> world;
+    model.get_world_transforms(world, model.get_node("Box04"), model.get_node(""));
+    bool agrees = true;
+    for(unsigned int i = 0, k = 0; i < scene->get_model_count(); i++) {
+        if(scene->get_model_node_name(i) != "Box04") continue;
+        agrees = agrees && k < world.size() && memcmp(&world[k++], &scene->get_model_matrix(i), sizeof(U3D::Matrix4f)) == 0;
+    }
+    check("scene agrees with the hierarchy", agrees);
+
+    scene->render(context);
+    check("moved models leave the view", stats.models_drawn == 9 && stats.models_culled == 6);
+    U3D::BoundingBox3f box00, box01;
+    scene->get_subgraph_bounds("Box00", &box00);
+    scene->get_subgraph_bounds("Box01", &box01);
+    check("groups are refitted", box00.max.x > 10000 && near(box01.min, box01_before.min) && near(box01.max, box01_before.max));
+    scene->release(context);
+    delete scene;
+    delete context;
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc > 1) {
+        test_dir = std::string(argv[1]) + "/";
+    }
+    try {
+        test_static_batches();
+        test_subgraph_bounds();
+        test_transform_update();
+    } catch(const U3D::Error& err) {
+        std::printf("%s\n", err.what());
+        failures++;
+    }
+
+    if(failures > 0) {
+        std::printf("%u checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
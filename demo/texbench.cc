@@ -0,0 +1,241 @@
+/*
+ * Copyright (C) 2016 Hiroka Ihara
+ *
+ * This file is part of libU3D.
+ *
+ * libU3D is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libU3D is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libU3D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "u3d_internal.hh"
+
+//Mipmap filtering and block compression throughput and quality on synthetic
+//images, entirely on the CPU.
+
+static double get_seconds(Uint64 start)
+{
+    return static_cast<double>(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+}
+
+//Smooth gradients, fine stripes, hard edges and noise, with a soft round
+//alpha mask when requested.
+static void create_image(U3D::TextureImage& image, uint32_t size, bool alpha, unsigned int seed)
+{
+    image.width = image.height = size;
+    image.internal_format = alpha ? GL_RGBA : GL_RGB;
+    image.format = GL_RGBA, image.type = GL_UNSIGNED_BYTE;
+    image.pixels.resize(4 * size * size);
+    for(uint32_t y = 0; y < size; y++) {
+        for(uint32_t x = 0; x < size; x++) {
+            seed = seed * 1103515245 + 12345;
+            float u = static_cast<float>(x) / size, v = static_cast<float>(y) / size;
+            float stripes = 0.5f + 0.5f * sinf(40 * u + 25 * v * v);
+            bool checker = ((x / 32) + (y / 32)) % 2 == 0;
+            int noise = static_cast<int>((seed >> 16) % 17) - 8;
+            uint8_t *p = &image.pixels[4 * (y * size + x)];
+            p[0] = std::min(std::max(static_cast<int>(255 * u * stripes) + noise, 0), 255);
+            p[1] = std::min(std::max(static_cast<int>(checker ? 200 * v : 60) + noise, 0), 255);
+            p[2] = std::min(std::max(static_cast<int>(255 * (1 - u) * (1 - v)) + noise, 0), 255);
+            float d = sqrtf((u - 0.5f) * (u - 0.5f) + (v - 0.5f) * (v - 0.5f));
+            p[3] = alpha ? static_cast<uint8_t>(255 * std::min(std::max((0.45f - d) * 8, 0.0f), 1.0f)) : 255;
+        }
+    }
+}
+
+static void benchmark_filter(const char *title, const U3D::TextureImage& source, U3D::TextureOptions::MipmapFilter filter)
+{
+    U3D::TextureImage image = source;
+    Uint64 start = SDL_GetPerformanceCounter();
+    U3D::generate_mipmaps(image, filter, true);
+    double seconds = get_seconds(start);
+    std::printf("%-8s %4ux%-4u %2lu levels %8.1f Mtexel/s\n", title, source.width, source.height,
+                static_cast<unsigned long>(image.mipmaps.size() + 1), source.width * source.height / seconds * 1e-6);
+}
+
+static void benchmark_codec(const char *title, const U3D::TextureImage& source, bool alpha)
+{
+    std::vector<uint8_t> blocks(U3D::get_compressed_size(source.width, source.height, alpha)), decoded(source.pixels.size());
+    Uint64 start = SDL_GetPerformanceCounter();
+    (alpha ? U3D::encode_bc3 : U3D::encode_bc1)(&source.pixels[0], source.width, source.height, &blocks[0]);
+    double seconds = get_seconds(start);
+    (alpha ? U3D::decode_bc3 : U3D::decode_bc1)(&blocks[0], source.width, source.height, &decoded[0]);
+    double psnr = U3D::compute_psnr(&source.pixels[0], &decoded[0], source.width * source.height, alpha);
+    std::printf("%-8s %4ux%-4u %8.1f Mtexel/s  PSNR %5.2f dB  %lu -> %lu bytes\n", title, source.width, source.height,
+                source.width * source.height / seconds * 1e-6, psnr, static_cast<unsigned long>(source.pixels.size()),
+                static_cast<unsigned long>(blocks.size()));
+}
+
+//Decoded layouts brought to their storage format, as Texture::decode does
+static void benchmark_conversion(const char *title, GLenum format, GLenum type, size_t bytes_per_texel, GLenum target)
+{
+    U3D::TextureImage source;
+    source.width = source.height = 1024;
+    source.internal_format = GL_RGBA, source.format = format, source.type = type;
+    source.pixels.resize(bytes_per_texel * source.width * source.height);
+    for(size_t i = 0; i < source.pixels.size(); i++) source.pixels[i] = static_cast<uint8_t>(i * 7);
+    const int repeats = 16;
+    double seconds = 0;
+    for(int i = 0; i < repeats; i++) {
+        U3D::TextureImage image = source;
+        Uint64 start = SDL_GetPerformanceCounter();
+        U3D::convert_image(image, target);
+        seconds += get_seconds(start);
+    }
+    std::printf("%-16s %4ux%-4u %8.1f Mtexel/s\n", title, source.width, source.height, repeats * source.width * source.height / seconds * 1e-6);
+}
+
+//Whole texture pipelines run side by side, as create_context does.
+class ProcessTask : public U3D::WorkerPool::Task
+{
+    U3D::TextureOptions options;
+public:
+    U3D::TextureImage image;
+    double psnr;
+    ProcessTask(const U3D::TextureImage& image, const U3D::TextureOptions& options) : options(options), image(image), psnr(0) {}
+    void run()
+    {
+        psnr = U3D::process_image(image, options);
+    }
+};
+
+static void benchmark_pipeline(const U3D::TextureImage& source, int count, U3D::WorkerPool& pool)
+{
+    U3D::TextureOptions options;
+    options.mipmap_filter = U3D::TextureOptions::KAISER;
+    options.compress = true;
+    std::vector<ProcessTask *> tasks;
+    for(int i = 0; i < count; i++) tasks.push_back(new ProcessTask(source, options));
+    Uint64 start = SDL_GetPerformanceCounter();
+    for(int i = 0; i < count; i++) pool.submit(tasks[i]);
+    pool.wait();
+    double seconds = get_seconds(start);
+    size_t raw_size = 4 * tasks[0]->image.get_texel_count(), data_size = tasks[0]->image.get_data_size();
+    std::printf("pipeline %d images %2u threads %8.1f Mtexel/s  PSNR %5.2f dB  %lu -> %lu bytes per image (%.1fx)\n", count,
+                pool.get_thread_count(), count * source.width * source.height / seconds * 1e-6, tasks[0]->psnr,
+                static_cast<unsigned long>(raw_size), static_cast<unsigned long>(data_size), static_cast<double>(raw_size) / data_size);
+    for(int i = 0; i < count; i++) delete tasks[i];
+}
+
+//Packs many small textures of mixed sizes, as a scene of props would have,
+//into compressed pages.
+static void benchmark_atlas(int count, uint32_t page_size, uint32_t gutter, U3D::TextureOptions::MipmapFilter filter)
+{
+    std::vector<U3D::TextureImage> images(count);
+    unsigned int seed = 3;
+    for(int i = 0; i < count; i++) {
+        seed = seed * 1103515245 + 12345;
+        uint32_t size = 8 << ((seed >> 16) % 5);
+        create_image(images[i], size, false, seed);
+        seed = seed * 1103515245 + 12345;
+        images[i].height = size >> ((seed >> 16) % 3);
+        images[i].pixels.resize(4 * images[i].width * images[i].height);
+    }
+    U3D::TextureAtlasBuilder atlas(page_size, gutter, filter, true);
+    for(int i = 0; i < count; i++) atlas.add(&images[i]);
+    Uint64 start = SDL_GetPerformanceCounter();
+    atlas.build();
+    double seconds = get_seconds(start);
+    const U3D::TextureAtlasStats& stats = atlas.get_stats();
+    std::printf("atlas    %d textures -> %u pages of %u (gutter %u, %u levels)  occupancy %4.1f%%  %.2f ms\n", count, stats.page_count,
+                page_size, gutter, atlas.get_max_mip_levels(), 100 * stats.occupancy, seconds * 1e3);
+}
+
+//Creates the image of a prop again, as a file structure decodes it.
+class PropTextureSource : public U3D::TextureSource
+{
+    uint32_t size;
+    int seed;
+    int *load_count;
+public:
+    PropTextureSource(uint32_t size, int seed, int *load_count) : size(size), seed(seed), load_count(load_count) {}
+    bool load(U3D::TextureImage& image)
+    {
+        create_image(image, size, false, seed);
+        U3D::generate_mipmaps(image, U3D::TextureOptions::BOX, false);
+        (*load_count)++;
+        return true;
+    }
+};
+
+//Flies past a row of textured props, with the next eight in view, and
+//streams their levels under a budget through the memory backend.
+static void benchmark_residency(int count, uint32_t size, size_t budget)
+{
+    U3D::MemoryTextureBackend *backend = new U3D::MemoryTextureBackend();
+    U3D::TextureResidency residency(backend, budget);
+    std::vector<GLuint> textures(count);
+    int load_count = 0;
+    for(int i = 0; i < count; i++) {
+        U3D::TextureImage image;
+        create_image(image, size, false, i);
+        U3D::generate_mipmaps(image, U3D::TextureOptions::BOX, false);
+        textures[i] = residency.add(image, new PropTextureSource(size, i, &load_count));
+    }
+    size_t peak = 0, uploaded = backend->get_uploaded_size();
+    Uint64 start = SDL_GetPerformanceCounter();
+    int frames = 4 * count;
+    for(int frame = 0; frame < frames; frame++) {
+        float camera = 0.25f * frame;
+        for(int i = static_cast<int>(camera); i < std::min(count, static_cast<int>(camera) + 8); i++) {
+            residency.request(textures[i], 2048.0f / (1.0f + i - camera));
+        }
+        residency.update();
+        peak = std::max(peak, backend->get_resident_size());
+    }
+    double seconds = get_seconds(start);
+    U3D::TextureResidency::Statistics stats = residency.get_statistics();
+    std::printf("resident %d x %u  budget %lu KiB  peak %lu KiB of %lu KiB  system %lu KiB  streamed %lu KiB  loads %d  evictions %u  %.3f ms/frame\n",
+                count, size, static_cast<unsigned long>(budget >> 10), static_cast<unsigned long>(peak >> 10),
+                static_cast<unsigned long>(stats.full_size >> 10), static_cast<unsigned long>(stats.system_size >> 10),
+                static_cast<unsigned long>((backend->get_uploaded_size() - uploaded) >> 10), load_count, stats.eviction_count, seconds * 1e3 / frames);
+}
+
+int main(int argc, char *argv[])
+{
+    int threads = argc > 1 ? atoi(argv[1]) : 0;
+    U3D::WorkerPool pool(threads);
+
+    //A one texel checkerboard averages to 50% linear light, sRGB 188.
+    U3D::TextureImage checker;
+    create_image(checker, 2, false, 0);
+    for(int i = 0; i < 4; i++) memset(&checker.pixels[4 * i], i == 0 || i == 3 ? 255 : 0, 3);
+    U3D::generate_mipmaps(checker, U3D::TextureOptions::BOX, true);
+    std::printf("checker  gamma correct %u, linear ", checker.mipmaps[0].pixels[0]);
+    U3D::generate_mipmaps(checker, U3D::TextureOptions::BOX, false);
+    std::printf("%u\n", checker.mipmaps[0].pixels[0]);
+
+    U3D::TextureImage opaque, translucent;
+    create_image(opaque, 1024, false, 1);
+    create_image(translucent, 1024, true, 2);
+    benchmark_conversion("rgb->rgba", GL_RGB, GL_UNSIGNED_BYTE, 3, GL_RGBA);
+    benchmark_conversion("bgr->rgba", GL_BGR, GL_UNSIGNED_BYTE, 3, GL_RGBA);
+    benchmark_conversion("argb8888->rgba", GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, 4, GL_RGBA);
+    benchmark_conversion("l->rgba", GL_LUMINANCE, GL_UNSIGNED_BYTE, 1, GL_RGBA);
+    benchmark_conversion("la->rgba", GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, 2, GL_RGBA);
+    benchmark_conversion("rgb->l", GL_RGB, GL_UNSIGNED_BYTE, 3, GL_LUMINANCE);
+    benchmark_filter("box", opaque, U3D::TextureOptions::BOX);
+    benchmark_filter("kaiser", opaque, U3D::TextureOptions::KAISER);
+    benchmark_codec("bc1", opaque, false);
+    benchmark_codec("bc3", translucent, true);
+    benchmark_pipeline(opaque, 8, pool);
+    benchmark_pipeline(translucent, 8, pool);
+    benchmark_atlas(256, 1024, 0, U3D::TextureOptions::BOX);
+    benchmark_atlas(256, 1024, 8, U3D::TextureOptions::BOX);
+    benchmark_atlas(256, 1024, 8, U3D::TextureOptions::KAISER);
+    benchmark_residency(32, 512, 0);
+    benchmark_residency(32, 512, 8 << 20);
+    benchmark_residency(32, 512, 2 << 20);
+
+    return 0;
+}
@@ -110,10 +110,11 @@ int main(int argc, char *argv[])
         if(model.get_world_transform(&view_matrix, defaultview, model.get_node(""))) {
             U3D_LOG << "View matrix = " << std::endl << view_matrix << std::endl;
         }
-        U3D::Matrix4f inverse_view = view_matrix.inverse();
+        U3D::Matrix4f inverse_view = view_matrix.affine_inverse();
         U3D_LOG << "Inverse view matrix = " << std::endl << inverse_view << std::endl;
 
         U3D::SceneGraph *scenegraph = model.create_scenegraph(defaultview, 0);
+        U3D::Picker *picker = model.create_picker(*scenegraph);
 
         SDL_Window *window = SDL_CreateWindow("Universal 3D testbed", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 480, 360, SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
         if(!window) {
@@ -165,6 +166,19 @@ int main(int argc, char *argv[])
                             scenegraph->set_view_matrix(vu_matrix * vr_matrix);
                         }
                     }
+                    if(event.type == SDL_MOUSEBUTTONDOWN && event.button.button == SDL_BUTTON_RIGHT) {
+                        int width, height;
+                        SDL_GetWindowSize(window, &width, &height);
+                        float x = 2.0f * (event.button.x + 0.5f) / width - 1.0f;
+                        float y = 1.0f - 2.0f * (event.button.y + 0.5f) / height;
+                        U3D::Ray ray = scenegraph->get_pick_ray(x, y, static_cast<float>(width) / height);
+                        std::string node_name;
+                        U3D::RayHit hit;
+                        if(picker->pick(ray, &node_name, &hit)) {
+                            U3D_LOG << "Picked \"" << node_name << "\" face " << hit.face << " at " << (ray.origin + ray.direction * hit.t)
+                                    << " (u = " << hit.u << ", v = " << hit.v << ")" << std::endl;
+                        }
+                    }
                 }
                 viewer.render();
 
@@ -174,9 +188,11 @@ int main(int argc, char *argv[])
 
             } while(event.type != SDL_QUIT);
 
+            scenegraph->release(u3d_context);
             delete u3d_context;
         }
 
+        delete picker;
         delete scenegraph;
     } catch(const U3D::Error& err) {
         std::cerr << err.what() << std::endl;
@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2016 Hiroka Ihara
+ *
+ * This file is part of libU3D.
+ *
+ * libU3D is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libU3D is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libU3D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "u3d_internal.hh"
+
+namespace U3D
+{
+
+SkylinePacker::SkylinePacker(uint32_t width, uint32_t height) : width(width), height(height)
+{
+    Segment segment = {0, 0, width};
+    skyline.push_back(segment);
+}
+
+//Finds the lowest position over the segments spanned by a rectangle whose
+//left edge lies on the segment.
+bool SkylinePacker::fit(unsigned int index, uint32_t w, uint32_t h, uint32_t& y) const
+{
+    if(skyline[index].x + w > width) return false;
+    y = 0;
+    uint32_t remaining = w;
+    for(unsigned int i = index; remaining > 0; i++) {
+        y = std::max(y, skyline[i].y);
+        if(y + h > height) return false;
+        remaining -= std::min(remaining, skyline[i].width);
+    }
+    return true;
+}
+
+bool SkylinePacker::insert(uint32_t w, uint32_t h, uint32_t& x, uint32_t& y)
+{
+    unsigned int best = skyline.size();
+    uint32_t best_top = 0, best_width = 0;
+    for(unsigned int i = 0; i < skyline.size(); i++) {
+        uint32_t top;
+        if(!fit(i, w, h, top)) continue;
+        //Lowest top edge first, then the narrowest segment
+        if(best == skyline.size() || top + h < best_top || (top + h == best_top && skyline[i].width < best_width)) {
+            best = i, best_top = top + h, best_width = skyline[i].width, y = top;
+        }
+    }
+    if(best == skyline.size()) return false;
+    x = skyline[best].x;
+
+    Segment segment = {x, y + h, w};
+    skyline.insert(skyline.begin() + best, segment);
+    for(unsigned int i = best + 1; i < skyline.size(); i++) {
+        uint32_t end = segment.x + segment.width;
+        if(skyline[i].x >= end) break;
+        uint32_t shrink = std::min(end - skyline[i].x, skyline[i].width);
+        skyline[i].x += shrink, skyline[i].width -= shrink;
+        if(skyline[i].width > 0) break;
+        skyline.erase(skyline.begin() + i--);
+    }
+    for(unsigned int i = 0; i + 1 < skyline.size(); i++) {
+        if(skyline[i].y == skyline[i + 1].y) {
+            skyline[i].width += skyline[i + 1].width;
+            skyline.erase(skyline.begin() + i-- + 1);
+        }
+    }
+    return true;
+}
+
+namespace
+{
+struct TallerFirst
+{
+    const std::vector<const TextureImage *>& images;
+    TallerFirst(const std::vector<const TextureImage *>& images) : images(images) {}
+    bool operator()(unsigned int a, unsigned int b) const
+    {
+        if(images[a]->height != images[b]->height) return images[a]->height > images[b]->height;
+        return images[a]->width > images[b]->width;
+    }
+};
+}
+
+TextureAtlasBuilder::TextureAtlasBuilder(uint32_t page_size, uint32_t gutter, TextureOptions::MipmapFilter filter, bool compressed)
+: page_size(page_size), gutter(gutter), filter(filter)
+{
+    //Entries start on a texel of the coarsest kept mip level, and on a 4x4
+    //block of it in compressed pages, so that no block spans two entries.
+    alignment = (compressed ? 4u : 1u) << get_max_mip_levels();
+}
+
+unsigned int TextureAtlasBuilder::add(const TextureImage *image)
+{
+    Entry entry;
+    entry.image = image;
+    entry.x = entry.y = 0;
+    entry.packed = false;
+    entries.push_back(entry);
+    return entries.size() - 1;
+}
+
+//Texels of neighboring entries, or clamped at the page edge, spread into
+//a band along the border of an entry that each level widens by the reach
+//of the filter: none for the box filter, and five source texels for the
+//Kaiser filter. A level is kept while the band stays clear of the gutter
+//texel next to the image, which bilinear filtering reads at its edge.
+unsigned int TextureAtlasBuilder::get_max_mip_levels() const
+{
+    if(filter == TextureOptions::NO_MIPMAPS) return 0;
+    unsigned int levels = 0;
+    uint32_t band = 0;
+    while(true) {
+        band = filter == TextureOptions::KAISER ? (band + 6) / 2 : (band + 1) / 2;
+        if(band + 1 > (gutter >> (levels + 1))) break;
+        levels++;
+    }
+    return levels;
+}
+
+void TextureAtlasBuilder::build()
+{
+    std::vector<const TextureImage *> images;
+    std::vector<unsigned int> order;
+    for(unsigned int i = 0; i < entries.size(); i++) {
+        images.push_back(entries[i].image);
+        order.push_back(i);
+    }
+    std::sort(order.begin(), order.end(), TallerFirst(images));
+
+    std::vector<SkylinePacker> packers;
+    std::vector<uint32_t> extents;
+    uint64_t packed_texels = 0;
+    for(unsigned int i = 0; i < order.size(); i++) {
+        Entry& entry = entries[order[i]];
+        const TextureImage& image = *entry.image;
+        uint32_t w = (image.width + 2 * gutter + alignment - 1) / alignment * alignment;
+        uint32_t h = (image.height + 2 * gutter + alignment - 1) / alignment * alignment;
+        if(image.width == 0 || image.height == 0 || w > page_size || h > page_size) continue;
+        unsigned int page = 0;
+        while(page < packers.size() && !packers[page].insert(w, h, entry.x, entry.y)) page++;
+        if(page == packers.size()) {
+            packers.push_back(SkylinePacker(page_size, page_size));
+            packers.back().insert(w, h, entry.x, entry.y);
+            extents.push_back(0);
+        }
+        entry.packed = true;
+        entry.region.page = page;
+        extents[page] = std::max(extents[page], std::max(entry.x + w, entry.y + h));
+        packed_texels += static_cast<uint64_t>(image.width) * image.height;
+        stats.texture_count++;
+    }
+
+    //Pages shrink to the smallest power of two holding their entries, as
+    //the last one is rarely full.
+    pages.resize(packers.size());
+    uint64_t page_texels = 0;
+    for(unsigned int i = 0; i < pages.size(); i++) {
+        uint32_t size = alignment;
+        while(size < extents[i]) size *= 2;
+        size = std::min(size, page_size);
+        pages[i].width = pages[i].height = size;
+        pages[i].internal_format = GL_RGB, pages[i].format = GL_RGBA, pages[i].type = GL_UNSIGNED_BYTE;
+        pages[i].pixels.assign(4 * static_cast<size_t>(size) * size, 0);
+        page_texels += static_cast<uint64_t>(size) * size;
+    }
+    for(unsigned int i = 0; i < entries.size(); i++) {
+        if(!entries[i].packed) continue;
+        const TextureImage& image = *entries[i].image;
+        TextureImage& page = pages[entries[i].region.page];
+        float size = static_cast<float>(page.width);
+        entries[i].region.transform[0] = image.width / size;
+        entries[i].region.transform[1] = image.height / size;
+        entries[i].region.transform[2] = (entries[i].x + gutter) / size;
+        entries[i].region.transform[3] = (entries[i].y + gutter) / size;
+        if(image.internal_format == GL_RGBA) page.internal_format = GL_RGBA;
+        int32_t w = image.width, h = image.height, g = gutter;
+        for(int32_t y = -g; y < h + g; y++) {
+            int32_t source_y = ((y % h) + h) % h;
+            uint8_t *dst = &page.pixels[4 * ((entries[i].y + g + y) * static_cast<size_t>(page.width) + entries[i].x)];
+            const uint8_t *src = &image.pixels[4 * static_cast<size_t>(source_y) * w];
+            for(int32_t x = -g; x < w + g; x++) {
+                memcpy(dst + 4 * (x + g), src + 4 * (((x % w) + w) % w), 4);
+            }
+        }
+    }
+    stats.page_count = pages.size();
+    stats.occupancy = pages.empty() ? 0 : static_cast<double>(packed_texels) / page_texels;
+}
+
+bool TextureAtlasBuilder::get_region(unsigned int index, Region& region) const
+{
+    if(!entries[index].packed) return false;
+    region = entries[index].region;
+    return true;
+}
+
+}
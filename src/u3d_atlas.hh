@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2016 Hiroka Ihara
+ *
+ * This file is part of libU3D.
+ *
+ * libU3D is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libU3D is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libU3D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+namespace U3D
+{
+
+//Skyline bottom-left packing of rectangles into a fixed page.
+class SkylinePacker
+{
+    struct Segment
+    {
+        uint32_t x, y, width;
+    };
+    uint32_t width, height;
+    std::vector<Segment> skyline;
+    bool fit(unsigned int index, uint32_t w, uint32_t h, uint32_t& y) const;
+public:
+    SkylinePacker(uint32_t width, uint32_t height);
+    //Returns false when the rectangle fits nowhere.
+    bool insert(uint32_t w, uint32_t h, uint32_t& x, uint32_t& y);
+};
+
+struct TextureAtlasStats
+{
+    unsigned int page_count, texture_count;
+    //Texels of the packed textures over the texels of all pages
+    double occupancy;
+    //Bytes held by the pages and their mipmaps
+    size_t data_size;
+    TextureAtlasStats() : page_count(0), texture_count(0), occupancy(0), data_size(0) {}
+};
+
+//Packs small 8-bit RGBA images into square pages of at most page_size. Each image is surrounded
+//by a gutter holding its wrapped-around texels, so that filtering and the
+//mip levels the gutter covers sample as a repeating texture would.
+class TextureAtlasBuilder
+{
+public:
+    //Maps a texcoord wrapped into [0, 1) onto the page: scale in x and y,
+    //then offset in z and w.
+    struct Region
+    {
+        uint32_t page;
+        float transform[4];
+    };
+private:
+    struct Entry
+    {
+        const TextureImage *image;
+        uint32_t x, y;
+        Region region;
+        bool packed;
+    };
+    uint32_t page_size, gutter, alignment;
+    TextureOptions::MipmapFilter filter;
+    std::vector<Entry> entries;
+    std::vector<TextureImage> pages;
+    TextureAtlasStats stats;
+public:
+    //The filter and compression are those the pages will be processed with.
+    TextureAtlasBuilder(uint32_t page_size, uint32_t gutter, TextureOptions::MipmapFilter filter, bool compressed);
+    //The image must stay alive until build() returns. Returns its index.
+    unsigned int add(const TextureImage *image);
+    void build();
+    //Returns false for images too large for a page.
+    bool get_region(unsigned int index, Region& region) const;
+    //Mip levels below the base the pages may keep once mipmaps are generated
+    unsigned int get_max_mip_levels() const;
+    std::vector<TextureImage>& get_pages()
+    {
+        return pages;
+    }
+    const TextureAtlasStats& get_stats() const
+    {
+        return stats;
+    }
+};
+
+}
@@ -42,7 +42,8 @@ const uint8_t BitStreamReader::bit_reverse_table[256] =
     0x0F, 0x8F, 0x4F, 0xCF, 0x2F, 0xAF, 0x6F, 0xEF, 0x1F, 0x9F, 0x5F, 0xDF, 0x3F, 0xBF, 0x7F, 0xFF
 };
 
-BitStreamReader::BitStreamReader(const std::string& filename) : bit_position(0), high(0xFFFF), low(0), underflow(0), data_buffer(NULL), metadata_buffer(NULL)
+BitStreamReader::BitStreamReader(const std::string& filename) : bit_position(0), high(0xFFFF), low(0), underflow(0), data_buffer(NULL), metadata_buffer(NULL),
+  data_capacity(0), metadata_capacity(0), file_size(0)
 {
     ifs.open(filename.c_str(), std::ifstream::binary);
     if(!ifs.is_open()) {
@@ -56,14 +57,26 @@ bool BitStreamReader::open_block()
 {
     if(!ifs.is_open()) return false;
     reset();
+    block_position = ifs.tellg();
     type = read_word_direct();
     if(ifs.eof()) return false;
     data_size = read_word_direct();
     metadata_size = read_word_direct();
-    if(data_buffer != NULL) delete[] data_buffer;
-    if(metadata_buffer != NULL) delete[] metadata_buffer;
-    data_buffer = new uint32_t[(data_size + 3) / 4 + 1];
-    metadata_buffer = new uint32_t[(metadata_size + 3) / 4 + 1];
+    uint64_t block_end = static_cast<uint64_t>(static_cast<std::streamoff>(block_position)) + 12 + (data_size + 3) / 4 * 4 + (metadata_size + 3) / 4 * 4;
+    if(file_size > 0 && block_end > file_size) {
+        U3D_WARNING << "Block 0x" << std::hex << type << std::dec << " extends past the end of the file." << std::endl;
+        return false;
+    }
+    if((data_size + 3) / 4 + 1 > data_capacity) {
+        if(data_buffer != NULL) delete[] data_buffer;
+        data_capacity = (data_size + 3) / 4 + 1;
+        data_buffer = new uint32_t[data_capacity];
+    }
+    if((metadata_size + 3) / 4 + 1 > metadata_capacity) {
+        if(metadata_buffer != NULL) delete[] metadata_buffer;
+        metadata_capacity = (metadata_size + 3) / 4 + 1;
+        metadata_buffer = new uint32_t[metadata_capacity];
+    }
     ifs.read(reinterpret_cast<char *>(data_buffer), (data_size + 3) / 4 * 4);
     ifs.read(reinterpret_cast<char *>(metadata_buffer), (metadata_size + 3) / 4 * 4);
     data_buffer[(data_size + 3) / 4] = 0;
@@ -72,6 +85,43 @@ bool BitStreamReader::open_block()
     return true;
 }
 
+bool BitStreamReader::seek_block(std::streampos position)
+{
+    return seek(position) && open_block();
+}
+
+bool BitStreamReader::seek(std::streampos position)
+{
+    if(!ifs.is_open()) return false;
+    ifs.clear();
+    ifs.seekg(position);
+    return !ifs.fail();
+}
+
+void BitStreamReader::set_file_size(uint64_t size)
+{
+    std::streampos position = ifs.tellg();
+    ifs.seekg(0, std::ifstream::end);
+    uint64_t length = static_cast<std::streamoff>(ifs.tellg());
+    ifs.seekg(position);
+    if(size != length) {
+        U3D_WARNING << "Declared file size " << size << " differs from the actual size " << length << "." << std::endl;
+    }
+    file_size = length;
+}
+
+bool BitStreamReader::peek_type(uint32_t *type)
+{
+    if(!ifs.is_open()) return false;
+    std::streampos position = ifs.tellg();
+    uint32_t word = read_word_direct();
+    bool valid = !ifs.eof() && !ifs.fail();
+    ifs.clear();
+    ifs.seekg(position);
+    if(valid) *type = word;
+    return valid;
+}
+
 uint32_t BitStreamReader::read_static_symbol(uint32_t context)
 {
     size_t checkpoint = bit_position;
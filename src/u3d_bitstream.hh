@@ -34,6 +34,15 @@ enum ContextEnum {
     cDiffNormalZ, cNormalIdx, cPointCnt, cDiffDup, cSpecDup, cLineCnt, NumContexts
 };
 
+//Bytes of a block taken over from the reader together with the buffer
+//holding them. The buffer is freed with delete[], unless it is NULL.
+struct BlockPayload
+{
+    uint32_t *buffer;
+    const uint8_t *data;
+    uint32_t size;
+};
+
 class BitStreamReader
 {
     class DynamicContext
@@ -116,10 +125,14 @@ public:
     };
 private:
     std::ifstream ifs;
+    std::streampos block_position;
     size_t bit_position;
     uint32_t high, low, underflow, type;
     uint32_t data_size, metadata_size;
+    //Block buffers are kept between blocks and only grow.
     uint32_t *data_buffer, *metadata_buffer;
+    size_t data_capacity, metadata_capacity;
+    uint64_t file_size;
     static const uint8_t bit_reverse_table[256];
     DynamicContext dynamic_contexts[NumContexts];
 private:
@@ -137,6 +150,17 @@ public:
         if(metadata_buffer != NULL) delete[] metadata_buffer;
     }
     bool open_block();
+    bool seek_block(std::streampos position);
+    //Moves to a block boundary without opening the block.
+    bool seek(std::streampos position);
+    //Reads the type of the next block without consuming it.
+    bool peek_type(uint32_t *type);
+    std::streampos tell_block() const { return block_position; }
+    std::streampos tell() { return ifs.tellg(); }
+    //Blocks reaching past the end of the file are rejected. The declared size
+    //gives way to the actual length when they disagree.
+    void set_file_size(uint64_t size);
+    uint64_t get_file_size() const { return file_size; }
     template<typename T> T read()
     {
         T ret;
@@ -204,6 +228,17 @@ public:
         memcpy(ptr, (uint8_t *)data_buffer + ((bit_position + 7) / 8), size);
         return size;
     }
+    //Hands the unread bytes over without copying them. The next block is
+    //read into a new buffer.
+    void detach_remainder(BlockPayload& payload)
+    {
+        uint32_t offset = (bit_position + 7) / 8;
+        payload.buffer = data_buffer;
+        payload.data = reinterpret_cast<const uint8_t *>(data_buffer) + offset;
+        payload.size = offset < data_size ? data_size - offset : 0;
+        data_buffer = NULL;
+        data_capacity = 0;
+    }
     class ContextAdapter
     {
         BitStreamReader& reader;
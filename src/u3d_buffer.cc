@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2016 Hiroka Ihara
+ *
+ * This file is part of libU3D.
+ *
+ * libU3D is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libU3D is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libU3D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "u3d_internal.hh"
+
+namespace U3D
+{
+
+size_t BufferAllocator::allocate(size_t size, size_t alignment)
+{
+    if(size == 0) return NO_SPACE;
+    for(std::map<size_t, size_t>::iterator i = free_blocks.begin(); i != free_blocks.end(); i++) {
+        size_t block_offset = i->first, block_size = i->second;
+        size_t offset = (block_offset + alignment - 1) / alignment * alignment;
+        if(offset + size > block_offset + block_size) continue;
+        free_blocks.erase(i);
+        if(offset > block_offset) {
+            free_blocks[block_offset] = offset - block_offset;
+        }
+        if(offset + size < block_offset + block_size) {
+            free_blocks[offset + size] = block_offset + block_size - offset - size;
+        }
+        return offset;
+    }
+    return NO_SPACE;
+}
+
+void BufferAllocator::free(size_t offset, size_t size)
+{
+    std::map<size_t, size_t>::iterator next = free_blocks.lower_bound(offset);
+    if(next != free_blocks.end() && offset + size == next->first) {
+        size += next->second;
+        free_blocks.erase(next++);
+    }
+    if(next != free_blocks.begin()) {
+        std::map<size_t, size_t>::iterator prev = next;
+        prev--;
+        if(prev->first + prev->second == offset) {
+            prev->second += size;
+            return;
+        }
+    }
+    free_blocks[offset] = size;
+}
+
+size_t BufferAllocator::get_free_size() const
+{
+    size_t total = 0;
+    for(std::map<size_t, size_t>::const_iterator i = free_blocks.begin(); i != free_blocks.end(); i++) {
+        total += i->second;
+    }
+    return total;
+}
+
+size_t BufferAllocator::get_largest_free_block() const
+{
+    size_t largest = 0;
+    for(std::map<size_t, size_t>::const_iterator i = free_blocks.begin(); i != free_blocks.end(); i++) {
+        largest = std::max(largest, i->second);
+    }
+    return largest;
+}
+
+BufferArena::Range BufferArena::allocate(size_t size, const void *data)
+{
+    Range range;
+    if(size == 0) return range;
+    for(unsigned int i = 0; i < pages.size(); i++) {
+        size_t offset = pages[i].allocator.allocate(size, ALIGNMENT);
+        if(offset != BufferAllocator::NO_SPACE) {
+            range.buffer = pages[i].buffer, range.offset = offset, range.size = size, range.page = i;
+            break;
+        }
+    }
+    if(range.size == 0) {
+        //Oversized ranges get a page of their own.
+        size_t new_page_size = std::max(page_size, size);
+        pages.push_back(Page(backend->create_buffer(new_page_size), new_page_size));
+        range.buffer = pages.back().buffer;
+        range.offset = pages.back().allocator.allocate(size, ALIGNMENT);
+        range.size = size;
+        range.page = pages.size() - 1;
+    }
+    if(data != NULL) {
+        backend->upload(range.buffer, range.offset, size, data);
+    }
+    return range;
+}
+
+void BufferArena::free(const Range& range)
+{
+    if(range.size == 0 || range.page >= pages.size()) return;
+    pages[range.page].allocator.free(range.offset, range.size);
+}
+
+BufferArena::Statistics BufferArena::get_statistics() const
+{
+    Statistics stats;
+    stats.page_count = pages.size();
+    stats.capacity = stats.used = 0;
+    stats.free_block_count = stats.largest_free_block = 0;
+    for(std::vector<Page>::const_iterator i = pages.begin(); i != pages.end(); i++) {
+        stats.capacity += i->allocator.get_capacity();
+        stats.used += i->allocator.get_capacity() - i->allocator.get_free_size();
+        stats.free_block_count += i->allocator.get_free_block_count();
+        stats.largest_free_block = std::max(stats.largest_free_block, i->allocator.get_largest_free_block());
+    }
+    return stats;
+}
+
+}
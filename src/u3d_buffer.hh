@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2016 Hiroka Ihara
+ *
+ * This file is part of libU3D.
+ *
+ * libU3D is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libU3D is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libU3D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+namespace U3D
+{
+
+class BufferBackend
+{
+public:
+    virtual ~BufferBackend() {}
+    virtual GLuint create_buffer(size_t size) = 0;
+    virtual void upload(GLuint buffer, size_t offset, size_t size, const void *data) = 0;
+    virtual void download(GLuint buffer, size_t offset, size_t size, void *data) = 0;
+    virtual void delete_buffer(GLuint buffer) = 0;
+};
+
+class GLBufferBackend : public BufferBackend
+{
+public:
+    GLuint create_buffer(size_t size)
+    {
+        GLuint buffer;
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        return buffer;
+    }
+    void upload(GLuint buffer, size_t offset, size_t size, const void *data)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glBufferSubData(GL_ARRAY_BUFFER, offset, size, data);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    void download(GLuint buffer, size_t offset, size_t size, void *data)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glGetBufferSubData(GL_ARRAY_BUFFER, offset, size, data);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    void delete_buffer(GLuint buffer)
+    {
+        glDeleteBuffers(1, &buffer);
+    }
+};
+
+//Keeps buffer contents in system memory so that arenas can be exercised without a GPU.
+class MemoryBufferBackend : public BufferBackend
+{
+    std::map<GLuint, std::vector<uint8_t> > buffers;
+    GLuint next_name;
+public:
+    MemoryBufferBackend() : next_name(1) {}
+    GLuint create_buffer(size_t size)
+    {
+        buffers[next_name].resize(size);
+        return next_name++;
+    }
+    void upload(GLuint buffer, size_t offset, size_t size, const void *data)
+    {
+        std::vector<uint8_t>& contents = buffers[buffer];
+        if(offset + size > contents.size()) {
+            throw U3D_ERROR << "Upload of " << size << " bytes at " << offset << " overruns buffer " << buffer << ".";
+        }
+        memcpy(&contents[offset], data, size);
+    }
+    void download(GLuint buffer, size_t offset, size_t size, void *data)
+    {
+        std::vector<uint8_t>& contents = buffers[buffer];
+        if(offset + size > contents.size()) {
+            throw U3D_ERROR << "Download of " << size << " bytes at " << offset << " overruns buffer " << buffer << ".";
+        }
+        memcpy(data, &contents[offset], size);
+    }
+    void delete_buffer(GLuint buffer)
+    {
+        buffers.erase(buffer);
+    }
+    const uint8_t *get_contents(GLuint buffer) const
+    {
+        std::map<GLuint, std::vector<uint8_t> >::const_iterator i = buffers.find(buffer);
+        return (i != buffers.end() && !i->second.empty()) ? &i->second[0] : NULL;
+    }
+    size_t get_buffer_count() const { return buffers.size(); }
+};
+
+//First-fit offset allocator over a free list that coalesces adjacent blocks.
+class BufferAllocator
+{
+    size_t capacity;
+    std::map<size_t, size_t> free_blocks;
+public:
+    static const size_t NO_SPACE = ~static_cast<size_t>(0);
+    BufferAllocator(size_t capacity) : capacity(capacity)
+    {
+        if(capacity > 0) free_blocks[0] = capacity;
+    }
+    size_t allocate(size_t size, size_t alignment);
+    void free(size_t offset, size_t size);
+    size_t get_capacity() const { return capacity; }
+    size_t get_free_size() const;
+    size_t get_largest_free_block() const;
+    size_t get_free_block_count() const { return free_blocks.size(); }
+};
+
+class BufferArena
+{
+public:
+    struct Range
+    {
+        GLuint buffer;
+        size_t offset, size;
+        unsigned int page;
+        Range() : buffer(0), offset(0), size(0), page(0) {}
+    };
+    struct Statistics
+    {
+        size_t page_count, capacity, used;
+        size_t free_block_count, largest_free_block;
+    };
+    static const size_t DEFAULT_PAGE_SIZE = 4 << 20;
+    static const size_t ALIGNMENT = 16;
+private:
+    struct Page
+    {
+        GLuint buffer;
+        BufferAllocator allocator;
+        Page(GLuint buffer, size_t size) : buffer(buffer), allocator(size) {}
+    };
+    BufferBackend *backend;
+    std::vector<Page> pages;
+    size_t page_size;
+public:
+    //The arena takes ownership of the backend.
+    BufferArena(BufferBackend *backend, size_t page_size = DEFAULT_PAGE_SIZE) : backend(backend), page_size(page_size) {}
+    ~BufferArena()
+    {
+        for(std::vector<Page>::iterator i = pages.begin(); i != pages.end(); i++) {
+            backend->delete_buffer(i->buffer);
+        }
+        delete backend;
+    }
+    Range allocate(size_t size, const void *data);
+    void free(const Range& range);
+    //Creates the first page with room for size bytes when it exceeds the page size.
+    void reserve(size_t size)
+    {
+        if(pages.empty() && size > page_size) {
+            pages.push_back(Page(backend->create_buffer(size), size));
+        }
+    }
+    //Overwrites the head of a range that has already been allocated.
+    void write(const Range& range, const void *data, size_t size)
+    {
+        if(size > 0 && size <= range.size) backend->upload(range.buffer, range.offset, size, data);
+    }
+    //Reads the contents of a range back, which stalls on GPU-backed arenas.
+    void read(const Range& range, void *data)
+    {
+        if(range.size > 0) backend->download(range.buffer, range.offset, range.size, data);
+    }
+    Statistics get_statistics() const;
+    BufferBackend *get_backend() { return backend; }
+private:
+    BufferArena(const BufferArena&);
+    BufferArena& operator=(const BufferArena&);
+};
+
+}
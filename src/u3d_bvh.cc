@@ -0,0 +1,376 @@
+/*
+ * Copyright (C) 2016 Hiroka Ihara
+ *
+ * This file is part of libU3D.
+ *
+ * libU3D is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libU3D is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libU3D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "u3d_internal.hh"
+
+namespace U3D
+{
+
+static inline float get_axis(const Vector3f& v, int axis)
+{
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+//Assigns centroids to the SAH bins of one axis
+struct CentroidBinner
+{
+    const std::vector<Vector3f>& centroids;
+    int axis;
+    float offset, scale;
+    CentroidBinner(const std::vector<Vector3f>& centroids, int axis, float offset, float scale)
+    : centroids(centroids), axis(axis), offset(offset), scale(scale) {}
+    unsigned int operator()(uint32_t primitive) const
+    {
+        unsigned int bin = static_cast<unsigned int>((get_axis(centroids[primitive], axis) - offset) * scale);
+        return std::min(bin, BVH::BIN_COUNT - 1);
+    }
+};
+
+struct CentroidBelowBin
+{
+    CentroidBinner binner;
+    unsigned int bin;
+    CentroidBelowBin(const CentroidBinner& binner, unsigned int bin) : binner(binner), bin(bin) {}
+    bool operator()(uint32_t primitive) const
+    {
+        return binner(primitive) < bin;
+    }
+};
+
+struct CentroidLess
+{
+    const std::vector<Vector3f>& centroids;
+    int axis;
+    CentroidLess(const std::vector<Vector3f>& centroids, int axis) : centroids(centroids), axis(axis) {}
+    bool operator()(uint32_t a, uint32_t b) const
+    {
+        return get_axis(centroids[a], axis) < get_axis(centroids[b], axis);
+    }
+};
+
+//Computes the bounds of the range and partitions it. Returns begin when the range becomes a leaf.
+uint32_t BVH::Builder::split(Node& node, uint32_t begin, uint32_t end, unsigned int depth)
+{
+    BoundingBox3f centroid_bounds;
+    node.bounds = BoundingBox3f();
+    for(uint32_t i = begin; i < end; i++) {
+        node.bounds.extend(boxes[primitives[i]]);
+        centroid_bounds.extend(centroids[primitives[i]]);
+    }
+    uint32_t count = end - begin;
+    if(count <= MAX_LEAF_SIZE) return begin;
+    Vector3f extent = centroid_bounds.max - centroid_bounds.min;
+    int axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+    float width = get_axis(extent, axis);
+    uint32_t mid = begin;
+    if(width > 0 && depth < MAX_DEPTH) {
+        CentroidBinner binner(centroids, axis, get_axis(centroid_bounds.min, axis), BIN_COUNT / width);
+        BoundingBox3f bin_bounds[BIN_COUNT];
+        uint32_t bin_counts[BIN_COUNT] = {0};
+        for(uint32_t i = begin; i < end; i++) {
+            unsigned int bin = binner(primitives[i]);
+            bin_bounds[bin].extend(boxes[primitives[i]]);
+            bin_counts[bin]++;
+        }
+        //Sweep from the right, then evaluate every plane between two bins from the left.
+        float right_area[BIN_COUNT];
+        uint32_t right_count[BIN_COUNT];
+        BoundingBox3f accumulated;
+        uint32_t accumulated_count = 0;
+        for(unsigned int i = BIN_COUNT - 1; i > 0; i--) {
+            accumulated.extend(bin_bounds[i]);
+            accumulated_count += bin_counts[i];
+            right_area[i] = accumulated.surface_area();
+            right_count[i] = accumulated_count;
+        }
+        accumulated = BoundingBox3f();
+        accumulated_count = 0;
+        float best_cost = 1E+30f;
+        unsigned int best_bin = 0;
+        for(unsigned int i = 1; i < BIN_COUNT; i++) {
+            accumulated.extend(bin_bounds[i - 1]);
+            accumulated_count += bin_counts[i - 1];
+            if(accumulated_count == 0 || right_count[i] == 0) continue;
+            float cost = accumulated.surface_area() * accumulated_count + right_area[i] * right_count[i];
+            if(cost < best_cost) {
+                best_cost = cost;
+                best_bin = i;
+            }
+        }
+        if(best_bin > 0) {
+            mid = std::partition(primitives.begin() + begin, primitives.begin() + end, CentroidBelowBin(binner, best_bin)) - primitives.begin();
+        }
+    }
+    if(mid == begin || mid == end) {
+        mid = begin + count / 2;
+        std::nth_element(primitives.begin() + begin, primitives.begin() + mid, primitives.begin() + end, CentroidLess(centroids, axis));
+    }
+    return mid;
+}
+
+void BVH::Builder::build(std::vector<Node>& nodes, uint32_t index, uint32_t begin, uint32_t end, unsigned int depth)
+{
+    Node node;
+    uint32_t mid = split(node, begin, end, depth);
+    if(mid == begin) {
+        node.index = begin;
+        node.count = end - begin;
+        nodes[index] = node;
+        return;
+    }
+    uint32_t child = nodes.size();
+    node.index = child;
+    node.count = 0;
+    nodes[index] = node;
+    nodes.resize(child + 2);
+    build(nodes, child, begin, mid, depth + 1);
+    build(nodes, child + 1, mid, end, depth + 1);
+}
+
+//Builds one subtree into its own node list, to be merged into the tree afterwards
+class BVH::BuildTask : public WorkerPool::Task
+{
+public:
+    Builder& builder;
+    uint32_t slot, begin, end;
+    unsigned int depth;
+    std::vector<Node> nodes;
+    BuildTask(Builder& builder, uint32_t slot, uint32_t begin, uint32_t end, unsigned int depth)
+    : builder(builder), slot(slot), begin(begin), end(end), depth(depth) {}
+    void run()
+    {
+        nodes.resize(1);
+        builder.build(nodes, 0, begin, end, depth);
+    }
+};
+
+void BVH::build_parallel(Builder& builder, WorkerPool& pool)
+{
+    //Split the top of the tree breadth-first until every thread has a few subtrees to build.
+    std::deque<BuildTask *> frontier;
+    frontier.push_back(new BuildTask(builder, 0, 0, primitives.size(), 0));
+    nodes.resize(1);
+    size_t target = 4 * pool.get_thread_count();
+    while(!frontier.empty() && frontier.size() < target) {
+        BuildTask *task = frontier.front();
+        frontier.pop_front();
+        Node node;
+        uint32_t mid = builder.split(node, task->begin, task->end, task->depth);
+        if(mid == task->begin) {
+            node.index = task->begin;
+            node.count = task->end - task->begin;
+            nodes[task->slot] = node;
+        } else {
+            uint32_t child = nodes.size();
+            node.index = child;
+            node.count = 0;
+            nodes[task->slot] = node;
+            nodes.resize(child + 2);
+            frontier.push_back(new BuildTask(builder, child, task->begin, mid, task->depth + 1));
+            frontier.push_back(new BuildTask(builder, child + 1, mid, task->end, task->depth + 1));
+        }
+        delete task;
+    }
+    for(std::deque<BuildTask *>::iterator i = frontier.begin(); i != frontier.end(); i++) {
+        pool.submit(*i);
+    }
+    pool.wait();
+    //The root of each subtree replaces its slot and the rest is appended,
+    //so local node k > 0 lands at base + k - 1.
+    for(std::deque<BuildTask *>::iterator i = frontier.begin(); i != frontier.end(); i++) {
+        std::vector<Node>& local = (*i)->nodes;
+        uint32_t base = nodes.size();
+        for(uint32_t k = 0; k < local.size(); k++) {
+            Node node = local[k];
+            if(node.count == 0) node.index += base - 1;
+            if(k == 0) {
+                nodes[(*i)->slot] = node;
+            } else {
+                nodes.push_back(node);
+            }
+        }
+        delete *i;
+    }
+}
+
+void BVH::build(const std::vector<BoundingBox3f>& boxes, WorkerPool *pool)
+{
+    static const size_t PARALLEL_THRESHOLD = 4096;
+    nodes.clear();
+    primitives.resize(boxes.size());
+    if(boxes.empty()) return;
+    std::vector<Vector3f> centroids(boxes.size());
+    for(uint32_t i = 0; i < boxes.size(); i++) {
+        primitives[i] = i;
+        centroids[i] = boxes[i].center();
+    }
+    Builder builder(boxes, centroids, primitives);
+    if(pool != NULL && pool->get_thread_count() > 1 && boxes.size() >= PARALLEL_THRESHOLD) {
+        build_parallel(builder, *pool);
+    } else {
+        nodes.reserve(2 * boxes.size() / MAX_LEAF_SIZE + 1);
+        nodes.resize(1);
+        builder.build(nodes, 0, 0, boxes.size(), 0);
+    }
+}
+
+//Two-sided Moller-Trumbore test against the faces of a leaf
+struct MeshBVH::Visitor
+{
+    const std::vector<Vector3f>& vertices;
+    const Ray& ray;
+    float t_max, u, v;
+    unsigned int face;
+    Visitor(const std::vector<Vector3f>& vertices, const Ray& ray, float t_max)
+    : vertices(vertices), ray(ray), t_max(t_max), u(0), v(0), face(RayHit::NONE) {}
+    void intersect(uint32_t index)
+    {
+        const Vector3f *corners = &vertices[3 * index];
+        Vector3f edge1 = corners[1] - corners[0], edge2 = corners[2] - corners[0];
+        Vector3f p = ray.direction ^ edge2;
+        float det = edge1 * p;
+        if(det == 0.0f) return;
+        float inv_det = 1.0f / det;
+        Vector3f s = ray.origin - corners[0];
+        float hit_u = (s * p) * inv_det;
+        if(hit_u < 0.0f || hit_u > 1.0f) return;
+        Vector3f q = s ^ edge1;
+        float hit_v = (ray.direction * q) * inv_det;
+        if(hit_v < 0.0f || hit_u + hit_v > 1.0f) return;
+        float t = (edge2 * q) * inv_det;
+        if(t <= 0.0f || t >= t_max) return;
+        t_max = t;
+        u = hit_u;
+        v = hit_v;
+        face = index;
+    }
+};
+
+MeshBVH::MeshBVH(const std::vector<Vector3f>& triangles, WorkerPool *pool)
+: vertices(triangles.begin(), triangles.begin() + triangles.size() / 3 * 3)
+{
+    std::vector<BoundingBox3f> boxes(vertices.size() / 3);
+    for(size_t i = 0; i < boxes.size(); i++) {
+        boxes[i].extend(vertices[3 * i]);
+        boxes[i].extend(vertices[3 * i + 1]);
+        boxes[i].extend(vertices[3 * i + 2]);
+    }
+    bvh.build(boxes, pool);
+}
+
+bool MeshBVH::intersect(const Ray& ray, RayHit& hit) const
+{
+    Visitor visitor(vertices, ray, hit.t);
+    bvh.traverse(ray, visitor);
+    if(visitor.face == RayHit::NONE) return false;
+    hit.face = visitor.face;
+    hit.t = visitor.t_max;
+    hit.u = visitor.u;
+    hit.v = visitor.v;
+    return true;
+}
+
+//Moves the ray into the object space of each instance. The direction is not
+//renormalized so that distances stay comparable across instances.
+struct PickingScene::Visitor
+{
+    const std::vector<Instance>& instances;
+    const Ray& ray;
+    float t_max;
+    RayHit hit;
+    Visitor(const std::vector<Instance>& instances, const Ray& ray, float t_max) : instances(instances), ray(ray), t_max(t_max) {}
+    void intersect(uint32_t index)
+    {
+        const Instance& instance = instances[index];
+        Ray local(instance.inverse * ray.origin, instance.inverse.transform_direction(ray.direction));
+        RayHit local_hit;
+        local_hit.t = t_max;
+        if(instance.mesh->intersect(local, local_hit)) {
+            local_hit.instance = index;
+            hit = local_hit;
+            t_max = local_hit.t;
+        }
+    }
+};
+
+unsigned int PickingScene::add_instance(const MeshBVH *mesh, const Matrix4f& transform)
+{
+    Instance instance;
+    instance.mesh = mesh;
+    instance.transform = transform;
+    //Node transforms are general matrices in U3D, so the ray goes through the full inverse.
+    instance.inverse = transform.inverse();
+    instances.push_back(instance);
+    return instances.size() - 1;
+}
+
+void PickingScene::build(WorkerPool *pool)
+{
+    std::vector<BoundingBox3f> boxes(instances.size());
+    for(size_t i = 0; i < instances.size(); i++) {
+        boxes[i] = instances[i].mesh->get_bounds().transform(instances[i].transform);
+    }
+    bvh.build(boxes, pool);
+}
+
+bool PickingScene::intersect(const Ray& ray, RayHit& hit) const
+{
+    Visitor visitor(instances, ray, hit.t);
+    bvh.traverse(ray, visitor);
+    if(!visitor.hit.valid()) return false;
+    hit = visitor.hit;
+    return true;
+}
+
+class PickingScene::BatchTask : public WorkerPool::Task
+{
+    const PickingScene& scene;
+    const Ray *rays;
+    RayHit *hits;
+    size_t count;
+public:
+    BatchTask(const PickingScene& scene, const Ray *rays, RayHit *hits, size_t count) : scene(scene), rays(rays), hits(hits), count(count) {}
+    void run()
+    {
+        for(size_t i = 0; i < count; i++) {
+            hits[i] = RayHit();
+            scene.intersect(rays[i], hits[i]);
+        }
+    }
+};
+
+void PickingScene::intersect(const Ray *rays, RayHit *hits, size_t count, WorkerPool *pool) const
+{
+    if(pool == NULL || pool->get_thread_count() < 2) {
+        BatchTask(*this, rays, hits, count).run();
+        return;
+    }
+    size_t chunk = std::max(static_cast<size_t>(64), count / (4 * pool->get_thread_count()) + 1);
+    std::vector<BatchTask *> tasks;
+    for(size_t first = 0; first < count; first += chunk) {
+        tasks.push_back(new BatchTask(*this, rays + first, hits + first, std::min(chunk, count - first)));
+        pool->submit(tasks.back());
+    }
+    pool->wait();
+    for(std::vector<BatchTask *>::iterator i = tasks.begin(); i != tasks.end(); i++) {
+        delete *i;
+    }
+}
+
+}
@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2016 Hiroka Ihara
+ *
+ * This file is part of libU3D.
+ *
+ * libU3D is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libU3D is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libU3D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+namespace U3D
+{
+
+//Closest intersection found by a ray query. Barycentrics u and v weight the
+//second and third corners of the face.
+struct RayHit
+{
+    static const unsigned int NONE = ~0U;
+    unsigned int instance, face;
+    float t, u, v;
+    RayHit() : instance(NONE), face(NONE), t(1E+30f), u(0), v(0) {}
+    bool valid() const
+    {
+        return face != NONE;
+    }
+};
+
+//Bounding volume hierarchy over a set of boxes, split with binned SAH.
+class BVH
+{
+public:
+    //Interior nodes have count == 0 and their children at index and index + 1.
+    //Leaves reference count entries of the primitive list starting at index.
+    struct Node
+    {
+        BoundingBox3f bounds;
+        uint32_t index, count;
+    };
+    static const unsigned int MAX_LEAF_SIZE = 4, BIN_COUNT = 16;
+    //Splits below this depth fall back to the median to bound the traversal stack.
+    static const unsigned int MAX_DEPTH = 48;
+    static const unsigned int STACK_SIZE = 128;
+private:
+    std::vector<Node> nodes;
+    std::vector<uint32_t> primitives;
+    class BuildTask;
+    struct Builder
+    {
+        const std::vector<BoundingBox3f>& boxes;
+        const std::vector<Vector3f>& centroids;
+        std::vector<uint32_t>& primitives;
+        Builder(const std::vector<BoundingBox3f>& boxes, const std::vector<Vector3f>& centroids, std::vector<uint32_t>& primitives)
+        : boxes(boxes), centroids(centroids), primitives(primitives) {}
+        uint32_t split(Node& node, uint32_t begin, uint32_t end, unsigned int depth);
+        void build(std::vector<Node>& nodes, uint32_t index, uint32_t begin, uint32_t end, unsigned int depth);
+    };
+    void build_parallel(Builder& builder, WorkerPool& pool);
+    static bool intersect_box(const BoundingBox3f& box, const Ray& ray, const Vector3f& inv_direction, float t_max, float *t_near)
+    {
+        float t0 = 0, t1 = t_max;
+        float lo[3] = {box.min.x, box.min.y, box.min.z}, hi[3] = {box.max.x, box.max.y, box.max.z};
+        float o[3] = {ray.origin.x, ray.origin.y, ray.origin.z}, inv[3] = {inv_direction.x, inv_direction.y, inv_direction.z};
+        for(int i = 0; i < 3; i++) {
+            float a = (lo[i] - o[i]) * inv[i], b = (hi[i] - o[i]) * inv[i];
+            if(a > b) std::swap(a, b);
+            t0 = a > t0 ? a : t0;
+            t1 = b < t1 ? b : t1;
+            if(t0 > t1) return false;
+        }
+        *t_near = t0;
+        return true;
+    }
+public:
+    //Parallel when a pool is given and the set is large enough to pay for it.
+    void build(const std::vector<BoundingBox3f>& boxes, WorkerPool *pool = NULL);
+    //Calls visitor.intersect(primitive) for every leaf primitive whose node
+    //the ray enters before visitor.t_max, nearest node first.
+    template<class Visitor>
+    void traverse(const Ray& ray, Visitor& visitor) const
+    {
+        if(nodes.empty()) return;
+        Vector3f inv_direction(1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z);
+        uint32_t stack[STACK_SIZE];
+        unsigned int top = 0;
+        float t_near;
+        if(!intersect_box(nodes[0].bounds, ray, inv_direction, visitor.t_max, &t_near)) return;
+        stack[top++] = 0;
+        while(top > 0) {
+            const Node& node = nodes[stack[--top]];
+            if(node.count > 0) {
+                for(uint32_t i = node.index; i < node.index + node.count; i++) {
+                    visitor.intersect(primitives[i]);
+                }
+                continue;
+            }
+            float t_left, t_right;
+            bool left = intersect_box(nodes[node.index].bounds, ray, inv_direction, visitor.t_max, &t_left);
+            bool right = intersect_box(nodes[node.index + 1].bounds, ray, inv_direction, visitor.t_max, &t_right);
+            if(left && right) {
+                bool left_first = t_left <= t_right;
+                stack[top++] = left_first ? node.index + 1 : node.index;
+                stack[top++] = left_first ? node.index : node.index + 1;
+            } else if(left) {
+                stack[top++] = node.index;
+            } else if(right) {
+                stack[top++] = node.index + 1;
+            }
+        }
+    }
+    const BoundingBox3f& get_bounds() const
+    {
+        static const BoundingBox3f empty_box;
+        return nodes.empty() ? empty_box : nodes[0].bounds;
+    }
+    unsigned int get_node_count() const
+    {
+        return nodes.size();
+    }
+};
+
+//Triangle soup of one model resource in object space
+class MeshBVH
+{
+    //Three corners per face
+    std::vector<Vector3f> vertices;
+    BVH bvh;
+    struct Visitor;
+public:
+    MeshBVH(const std::vector<Vector3f>& triangles, WorkerPool *pool = NULL);
+    //Replaces hit with the closest face nearer than hit.t; the instance field is left untouched.
+    bool intersect(const Ray& ray, RayHit& hit) const;
+    const BoundingBox3f& get_bounds() const
+    {
+        return bvh.get_bounds();
+    }
+    unsigned int get_face_count() const
+    {
+        return vertices.size() / 3;
+    }
+};
+
+//Top-level hierarchy over mesh instances placed by their world transforms
+class PickingScene
+{
+    struct Instance
+    {
+        const MeshBVH *mesh;
+        Matrix4f transform, inverse;
+    };
+    std::vector<Instance> instances;
+    BVH bvh;
+    struct Visitor;
+    class BatchTask;
+public:
+    //Meshes are not owned and must outlive the scene. Returns the instance index.
+    unsigned int add_instance(const MeshBVH *mesh, const Matrix4f& transform);
+    //Must be called after the last add_instance and before any query.
+    void build(WorkerPool *pool = NULL);
+    bool intersect(const Ray& ray, RayHit& hit) const;
+    //Answers count independent rays, split across the pool when one is given.
+    void intersect(const Ray *rays, RayHit *hits, size_t count, WorkerPool *pool = NULL) const;
+    unsigned int get_instance_count() const
+    {
+        return instances.size();
+    }
+};
+
+//Picking scene of a SceneGraph, created by FileStructure::create_picker.
+class Picker
+{
+    friend class FileStructure;
+
+    std::map<std::string, MeshBVH *> meshes;
+    std::vector<std::string> node_names;
+    PickingScene scene;
+    Picker() {}
+    Picker(const Picker&);
+    Picker& operator=(const Picker&);
+public:
+    ~Picker()
+    {
+        for(std::map<std::string, MeshBVH *>::iterator i = meshes.begin(); i != meshes.end(); i++) delete i->second;
+    }
+    //Returns the model node hit first by the ray, or false when nothing is hit.
+    bool pick(const Ray& ray, std::string *node_name, RayHit *hit) const
+    {
+        RayHit result;
+        if(!scene.intersect(ray, result)) return false;
+        if(node_name != NULL) *node_name = node_names[result.instance];
+        if(hit != NULL) *hit = result;
+        return true;
+    }
+    const PickingScene& get_scene() const
+    {
+        return scene;
+    }
+};
+
+}
@@ -27,6 +27,7 @@ class SceneGraph;
 class Shading
 {
     friend class SceneGraph;
+    friend class FileStructure;
 
     uint32_t chain_index, attributes;
     static const uint32_t SHADING_MESH = 1, SHADING_LINE = 2, SHADING_POINT = 4, SHADING_GLYPH = 8;
@@ -53,14 +54,16 @@ public:
 class RenderGroup
 {
     friend class SceneGraph;
+    friend class RenderQueue;
 
     struct RenderElement {
-        GLuint buffer;
+        BufferArena::Range range;
         int count;
         uint32_t flags;
     };
     std::vector<RenderElement> elements;
     GLenum mode;
+    BufferArena& arena;
 public:
     static const uint32_t BUFFER_POSITION_MASK = 0x7;
     static const uint32_t BUFFER_NORMAL_MASK = 0x38;
@@ -68,64 +71,62 @@ public:
     static const uint32_t BUFFER_SPECULAR_MASK = 0x3C00;
     static const uint32_t BUFFER_TEXCOORD0_MASK = 0xC000;
 
-    RenderGroup(GLenum mode, int num_elements) : mode(mode) {
+    RenderGroup(BufferArena& arena, GLenum mode, int num_elements) : mode(mode), arena(arena) {
         elements.resize(num_elements);
         for(int i = 0; i < num_elements; i++) {
-            glGenBuffers(1, &elements[i].buffer);
+            elements[i].count = 0;
+            elements[i].flags = 0;
         }
     }
     ~RenderGroup() {
         for(unsigned int i = 0; i < elements.size(); i++) {
-            glDeleteBuffers(1, &elements[i].buffer);
+            arena.free(elements[i].range);
         }
     }
     void load(int index, const GLfloat *src, uint32_t flags, int count) {
-        glBindBuffer(GL_ARRAY_BUFFER, elements[index].buffer);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * __builtin_popcount(flags) * count, src, GL_STATIC_DRAW);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        arena.free(elements[index].range);
+        elements[index].range = arena.allocate(sizeof(GLfloat) * __builtin_popcount(flags) * count, src);
         elements[index].count = count;
         elements[index].flags = flags;
     }
-    void render(int index, GLuint program) {
+    //Sets up the attributes of an element and draws it; the caller binds its buffer.
+    void render(RenderDevice& device, int index, const ShaderProgram& program, GLsizei instances = 1) {
+        if(elements[index].count == 0) return;
         int stride = sizeof(GLfloat) * __builtin_popcount(elements[index].flags);
-        glBindBuffer(GL_ARRAY_BUFFER, elements[index].buffer);
-        GLint vertex_position = glGetAttribLocation(program, "vertex_position");
-        glEnableVertexAttribArray(vertex_position);
-        GLfloat *head = 0;
-        glVertexAttribPointer(vertex_position, 3, GL_FLOAT, GL_FALSE, stride, head);
-        head += 3;
+        size_t head = elements[index].range.offset;
+        device.vertex_attrib_pointer(program.vertex_position, 3, stride, head);
+        head += 3 * sizeof(GLfloat);
         if(elements[index].flags & BUFFER_NORMAL_MASK) {
-            GLint vertex_normal = glGetAttribLocation(program, "vertex_normal");
-            glEnableVertexAttribArray(vertex_normal);
-            glVertexAttribPointer(vertex_normal, 3, GL_FLOAT, GL_FALSE, stride, head);
-            head += 3;
+            if(program.vertex_normal >= 0) {
+                device.vertex_attrib_pointer(program.vertex_normal, 3, stride, head);
+            }
+            head += 3 * sizeof(GLfloat);
         }
         if(elements[index].flags & BUFFER_DIFFUSE_MASK) {
-            GLint vertex_diffuse = glGetAttribLocation(program, "vertex_diffuse");
-            glEnableVertexAttribArray(vertex_diffuse);
-            glVertexAttribPointer(vertex_diffuse, 4, GL_FLOAT, GL_FALSE, stride, head);
-            head += 4;
+            if(program.vertex_diffuse >= 0) {
+                device.vertex_attrib_pointer(program.vertex_diffuse, 4, stride, head);
+            }
+            head += 4 * sizeof(GLfloat);
         }
         if(elements[index].flags & BUFFER_SPECULAR_MASK) {
-            GLint vertex_specular = glGetAttribLocation(program, "vertex_specular");
-            glEnableVertexAttribArray(vertex_specular);
-            glVertexAttribPointer(vertex_specular, 4, GL_FLOAT, GL_FALSE, stride, head);
-            head += 4;
+            if(program.vertex_specular >= 0) {
+                device.vertex_attrib_pointer(program.vertex_specular, 4, stride, head);
+            }
+            head += 4 * sizeof(GLfloat);
         }
-        static const char *texcoord_attrib_names[8] = {
-            "vertex_texcoord0", "vertex_texcoord1", "vertex_texcoord2", "vertex_texcoord3",
-            "vertex_texcoord4", "vertex_texcoord5", "vertex_texcoord6", "vertex_texcoord7"
-        };
         for(int j = 0; j < 8; j++) {
             if(elements[index].flags & (BUFFER_TEXCOORD0_MASK << (2 * j))) {
-                GLint vertex_texcoord = glGetAttribLocation(program, texcoord_attrib_names[j]);
-                glEnableVertexAttribArray(vertex_texcoord);
-                glVertexAttribPointer(vertex_texcoord, 2, GL_FLOAT, GL_FALSE, stride, head);
-                head += 2;
+                if(program.vertex_texcoord[j] >= 0) {
+                    device.vertex_attrib_pointer(program.vertex_texcoord[j], 2, stride, head);
+                }
+                head += 2 * sizeof(GLfloat);
             }
         }
-        glDrawArrays(mode, 0, elements[index].count);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        if(instances > 1) {
+            device.draw_arrays_instanced(mode, 0, elements[index].count, instances);
+        } else {
+            device.draw_arrays(mode, 0, elements[index].count);
+        }
     }
 };
 
@@ -134,21 +135,90 @@ class SceneGraph;
 class ModelResource
 {
     friend class SceneGraph;
+    friend class FileStructure;
+public:
+    enum Type {
+        MESH = 0, POINT_SET, LINE_SET
+    };
+private:
+    Type type;
     Shading *shading;
+    //Bounds declared by the modifier chain, known before any continuation is decoded
+    BoundingBox3f chain_bounds;
+protected:
+    BoundingBox3f bounds;
+    //Positions already within the bounds, reset when the geometry is released
+    size_t bounded_positions;
+    //Bumped whenever the bounds grow
+    uint32_t bounds_serial;
+    //Positions are only ever appended while decoding, so each continuation
+    //only needs the ones it added.
+    void extend_bounds(const std::vector<Vector3f>& positions)
+    {
+        if(positions.size() <= bounded_positions) return;
+        for(std::vector<Vector3f>::const_iterator i = positions.begin() + bounded_positions; i != positions.end(); i++) {
+            bounds.extend(*i);
+        }
+        bounded_positions = positions.size();
+        bounds_serial++;
+    }
 public:
-    ModelResource() : shading(NULL) {}
+    ModelResource(Type type) : type(type), shading(NULL), bounded_positions(0), bounds_serial(0) {}
     virtual ~ModelResource() {
         if(shading != NULL) {
             delete shading;
         }
     }
-    virtual RenderGroup *create_render_group() = 0;
+    Type get_type() const
+    {
+        return type;
+    }
+    virtual RenderGroup *create_render_group(BufferArena& arena) const = 0;
+    //Frees the decoded geometry once it has been uploaded.
+    //The resource can be decoded again from its continuation blocks.
+    virtual void release_geometry() = 0;
+    //Extends the local bounds with the positions decoded since the last call.
+    //Bounds are kept when the geometry is released.
+    virtual void update_bounds() = 0;
+    //Appends three object space positions per face of the decoded geometry.
+    //Resources without faces append nothing.
+    virtual void get_triangles(std::vector<Vector3f>& triangles) const
+    {
+        (void)triangles;
+    }
+    //Estimate of the vertex buffer size at full resolution, from the declaration
+    virtual size_t get_buffer_size_hint() const
+    {
+        return 0;
+    }
+    const BoundingBox3f& get_bounds() const
+    {
+        return bounds;
+    }
+    uint32_t get_bounds_serial() const
+    {
+        return bounds_serial;
+    }
+    void set_chain_bounds(const BoundingBox3f& bounds)
+    {
+        chain_bounds = bounds;
+    }
+    const BoundingBox3f& get_chain_bounds() const
+    {
+        return chain_bounds;
+    }
     void add_shading_modifier(Shading *shading)
     {
         this->shading = shading;
     }
 };
 
+//Returns NULL unless the model resource is of the type T declares.
+template<typename T> T *resource_cast(ModelResource *resource)
+{
+    return resource != NULL && resource->get_type() == T::TYPE ? static_cast<T *>(resource) : NULL;
+}
+
 class CLOD_Object
 {
 protected:
@@ -188,6 +258,7 @@ protected:
     std::vector<Vector3f> positions, normals;
     std::vector<Color4f> diffuse_colors, specular_colors;
     std::vector<TexCoord4f> texcoords;
+    void release_vertex_data();
 public:
     CLOD_Object(bool clod_desc_flag, BitStreamReader& reader);
     CLOD_Object() : face_count(0), position_count(0), normal_count(0), diffuse_count(0), specular_count(0), texcoord_count(0) , min_res(0), max_res(0) {}
@@ -208,6 +279,11 @@ template<typename T> static inline void insert_unique(std::vector<T>& cont, T va
     }
 }
 
+template<typename T> static inline void release_vector(std::vector<T>& cont)
+{
+    std::vector<T>().swap(cont);
+}
+
 template<typename T> static inline void greater_unique_sort(std::vector<T>& cont)
 {
     std::sort(cont.begin(), cont.end(), std::greater<T>());
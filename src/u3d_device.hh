@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2016 Hiroka Ihara
+ *
+ * This file is part of libU3D.
+ *
+ * libU3D is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libU3D is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libU3D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+namespace U3D
+{
+
+//Receives all state changes and draw calls issued while rendering a scene.
+class RenderDevice
+{
+public:
+    virtual ~RenderDevice() {}
+    virtual void get_viewport(GLfloat viewport[4]) = 0;
+    virtual void use_program(GLuint program) = 0;
+    virtual void bind_texture(int unit, GLuint texture) = 0;
+    virtual void bind_buffer(GLuint buffer) = 0;
+    virtual void vertex_attrib_pointer(GLint location, int size, GLsizei stride, size_t offset) = 0;
+    virtual void vertex_attrib_divisor(GLint location, GLuint divisor) = 0;
+    virtual void disable_vertex_attrib(GLint location) = 0;
+    virtual void uniform1i(GLint location, GLint value) = 0;
+    virtual void uniform1f(GLint location, GLfloat value) = 0;
+    virtual void uniform4f(GLint location, GLfloat x, GLfloat y, GLfloat z, GLfloat w) = 0;
+    virtual void uniform4fv(GLint location, GLsizei count, const GLfloat *values) = 0;
+    virtual void uniform_matrix4fv(GLint location, GLsizei count, const GLfloat *values) = 0;
+    virtual void draw_arrays(GLenum mode, GLint first, GLsizei count) = 0;
+    virtual void draw_arrays_instanced(GLenum mode, GLint first, GLsizei count, GLsizei instances) = 0;
+};
+
+class GLRenderDevice : public RenderDevice
+{
+public:
+    void get_viewport(GLfloat viewport[4])
+    {
+        glGetFloatv(GL_VIEWPORT, viewport);
+    }
+    void use_program(GLuint program)
+    {
+        glUseProgram(program);
+    }
+    void bind_texture(int unit, GLuint texture)
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D, texture);
+    }
+    void bind_buffer(GLuint buffer)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    }
+    void vertex_attrib_pointer(GLint location, int size, GLsizei stride, size_t offset)
+    {
+        glEnableVertexAttribArray(location);
+        glVertexAttribPointer(location, size, GL_FLOAT, GL_FALSE, stride, reinterpret_cast<const GLvoid *>(offset));
+    }
+    void vertex_attrib_divisor(GLint location, GLuint divisor)
+    {
+        glVertexAttribDivisorARB(location, divisor);
+    }
+    void disable_vertex_attrib(GLint location)
+    {
+        glDisableVertexAttribArray(location);
+    }
+    void uniform1i(GLint location, GLint value)
+    {
+        glUniform1i(location, value);
+    }
+    void uniform1f(GLint location, GLfloat value)
+    {
+        glUniform1f(location, value);
+    }
+    void uniform4f(GLint location, GLfloat x, GLfloat y, GLfloat z, GLfloat w)
+    {
+        glUniform4f(location, x, y, z, w);
+    }
+    void uniform4fv(GLint location, GLsizei count, const GLfloat *values)
+    {
+        glUniform4fv(location, count, values);
+    }
+    void uniform_matrix4fv(GLint location, GLsizei count, const GLfloat *values)
+    {
+        glUniformMatrix4fv(location, count, GL_FALSE, values);
+    }
+    void draw_arrays(GLenum mode, GLint first, GLsizei count)
+    {
+        glDrawArrays(mode, first, count);
+    }
+    void draw_arrays_instanced(GLenum mode, GLint first, GLsizei count, GLsizei instances)
+    {
+        glDrawArraysInstancedARB(mode, first, count, instances);
+    }
+};
+
+//Counts the calls it receives instead of issuing them, so that the state
+//changes of a frame can be measured without a GPU.
+class RecordingRenderDevice : public RenderDevice
+{
+public:
+    struct Counters
+    {
+        unsigned int program_binds, texture_binds, buffer_binds;
+        unsigned int attribute_setups, uniform_uploads;
+        unsigned int draw_calls, vertices, instances;
+    };
+private:
+    Counters counters;
+    GLfloat viewport[4];
+public:
+    RecordingRenderDevice(GLfloat width = 640, GLfloat height = 480)
+    {
+        viewport[0] = viewport[1] = 0;
+        viewport[2] = width, viewport[3] = height;
+        reset();
+    }
+    void reset()
+    {
+        memset(&counters, 0, sizeof(counters));
+    }
+    const Counters& get_counters() const { return counters; }
+    void set_viewport(GLfloat width, GLfloat height)
+    {
+        viewport[2] = width, viewport[3] = height;
+    }
+    void get_viewport(GLfloat viewport[4])
+    {
+        memcpy(viewport, this->viewport, sizeof(this->viewport));
+    }
+    void use_program(GLuint) { counters.program_binds++; }
+    void bind_texture(int, GLuint) { counters.texture_binds++; }
+    void bind_buffer(GLuint) { counters.buffer_binds++; }
+    void vertex_attrib_pointer(GLint, int, GLsizei, size_t) { counters.attribute_setups++; }
+    void vertex_attrib_divisor(GLint, GLuint) {}
+    void disable_vertex_attrib(GLint) {}
+    void uniform1i(GLint, GLint) { counters.uniform_uploads++; }
+    void uniform1f(GLint, GLfloat) { counters.uniform_uploads++; }
+    void uniform4f(GLint, GLfloat, GLfloat, GLfloat, GLfloat) { counters.uniform_uploads++; }
+    void uniform4fv(GLint, GLsizei, const GLfloat *) { counters.uniform_uploads++; }
+    void uniform_matrix4fv(GLint, GLsizei, const GLfloat *) { counters.uniform_uploads++; }
+    void draw_arrays(GLenum, GLint, GLsizei count)
+    {
+        counters.draw_calls++;
+        counters.vertices += count;
+        counters.instances++;
+    }
+    void draw_arrays_instanced(GLenum, GLint, GLsizei count, GLsizei instances)
+    {
+        counters.draw_calls++;
+        counters.vertices += count * instances;
+        counters.instances += instances;
+    }
+};
+
+}
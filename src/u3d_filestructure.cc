@@ -23,16 +23,19 @@ namespace U3D
 {
 namespace
 {
-uint32_t read_modifier_count(BitStreamReader& reader)
+//Reads the optional bounding sphere or box of the chain, stored as a box.
+uint32_t read_modifier_count(BitStreamReader& reader, BoundingBox3f *bounds)
 {
     uint32_t attribute;
     reader >> attribute;
     if(attribute & 0x00000001) {
-        reader.read<Vector3f>();
-        reader.read<float>();
+        Vector3f center = reader.read<Vector3f>();
+        float radius = reader.read<float>();
+        bounds->extend(center - Vector3f(radius, radius, radius));
+        bounds->extend(center + Vector3f(radius, radius, radius));
     } else if(attribute & 0x00000002) {
-        reader.read<Vector3f>();
-        reader.read<Vector3f>();
+        bounds->extend(reader.read<Vector3f>());
+        bounds->extend(reader.read<Vector3f>());
     }
     reader.align_to_word();
     return reader.read<uint32_t>();
@@ -41,7 +44,8 @@ uint32_t read_modifier_count(BitStreamReader& reader)
 Node *create_node_modifier_chain(BitStreamReader& reader)
 {
     Node *head = NULL;
-    uint32_t count = read_modifier_count(reader);
+    BoundingBox3f bounds;
+    uint32_t count = read_modifier_count(reader, &bounds);
     for(unsigned int i = 0; i < count; i++) {
         BitStreamReader::SubBlock subblock(reader);
         std::string name = reader.read_str();
@@ -64,7 +68,7 @@ Node *create_node_modifier_chain(BitStreamReader& reader)
             break;
         case 0xFFFFFF45:    //Shading Modifier Block
             if(head != NULL) {
-                Model *model = dynamic_cast<Model *>(head);
+                Model *model = node_cast<Model>(head);
                 if(model != NULL) {
                     model->add_shading_modifier(new Shading(reader));
                 }
@@ -73,16 +77,21 @@ Node *create_node_modifier_chain(BitStreamReader& reader)
             break;
         default:
             std::fprintf(stderr, "Illegal modifier 0x%08X in a node modifier chain\n", subblock.get_type());
-            return head;
+            i = count;  //Stop at the first unknown modifier
+            break;
         }
     }
+    if(head != NULL) {
+        head->chain_bounds = bounds;
+    }
     return head;
 }
 
 ModelResource *create_model_modifier_chain(BitStreamReader& reader)
 {
     ModelResource *head = NULL;
-    uint32_t count = read_modifier_count(reader);
+    BoundingBox3f bounds;
+    uint32_t count = read_modifier_count(reader, &bounds);
     for(unsigned int i = 0; i < count; i++) {
         BitStreamReader::SubBlock subblock(reader);
         std::string name = reader.read_str();
@@ -111,16 +120,21 @@ ModelResource *create_model_modifier_chain(BitStreamReader& reader)
             break;
         default:
             std::fprintf(stderr, "Illegal modifier 0x%08X in an instance modifier chain\n", subblock.get_type());
-            return head;
+            i = count;  //Stop at the first unknown modifier
+            break;
         }
     }
+    if(head != NULL) {
+        head->set_chain_bounds(bounds);
+    }
     return head;
 }
 
 Texture *create_texture_modifier_chain(BitStreamReader& reader)
 {
     Texture *head = NULL;
-    uint32_t count = read_modifier_count(reader);
+    BoundingBox3f bounds;
+    uint32_t count = read_modifier_count(reader, &bounds);
     for(unsigned int i = 0; i < count; i++) {
         BitStreamReader::SubBlock subblock(reader);
         std::string name = reader.read_str();
@@ -137,7 +151,8 @@ Texture *create_texture_modifier_chain(BitStreamReader& reader)
     return head;
 }
 
-void read_header_block(BitStreamReader& reader) {
+//Returns the declaration size, and bounds later blocks by the file size.
+uint32_t read_header_block(BitStreamReader& reader) {
     uint16_t major_version, minor_version;
     uint32_t profile_identifier;
     uint32_t declaration_size;
@@ -147,10 +162,255 @@ void read_header_block(BitStreamReader& reader) {
     reader >> major_version >> minor_version >> profile_identifier >> declaration_size >> file_size >> character_encoding;
     units_scaling_factor = (profile_identifier & 0x8) ? reader.read<double>() : 1;
     U3D_LOG << "Scaling factor = " << units_scaling_factor << std::endl;
+    reader.set_file_size(file_size);
+    return declaration_size;
+}
+
+double get_elapsed_time(Uint64 start)
+{
+    return static_cast<double>(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+}
+
+//Decodes and processes one texture image into a buffer ready to be uploaded
+class TextureDecodeTask : public WorkerPool::Task
+{
+    const Texture *texture;
+    TextureOptions options;
+    const TextureCache *cache;
+public:
+    //Atlas entries are only converted to RGBA, as their page is processed.
+    bool atlas, cached;
+    //Every texture with the content, which all share the image
+    std::vector<std::string> names;
+    TextureContent content;
+    TextureImage image;
+    double decode_time, process_time, psnr;
+    //Exceptions cannot cross threads, so failures are kept as their messages.
+    std::string error;
+    TextureDecodeTask(const Texture *texture, const TextureOptions& options, const TextureCache *cache, const TextureContent& content, bool atlas)
+    : texture(texture), options(options), cache(cache), atlas(atlas), cached(false), content(content), decode_time(0), process_time(0), psnr(0) {}
+    //Produces the image again for a TextureResidency.
+    TextureSource *create_source() const;
+    void run()
+    {
+        Uint64 start = SDL_GetPerformanceCounter();
+        //Atlas entries are cached before processing, apart from the others.
+        ContentHasher key;
+        key.update(content.hash);
+        key.update(atlas);
+        if(cache != NULL && cache->load(key.get(), image)) {
+            decode_time = get_elapsed_time(start);
+            cached = true;
+            return;
+        }
+        try {
+            texture->decode(image);
+            decode_time = get_elapsed_time(start);
+            start = SDL_GetPerformanceCounter();
+            if(atlas) {
+                convert_image(image, GL_RGBA);
+            } else {
+                psnr = process_image(image, options);
+            }
+            process_time = get_elapsed_time(start);
+            if(cache != NULL && !cache->store(key.get(), image)) {
+                U3D_WARNING << "A decoded texture could not be stored in the cache." << std::endl;
+            }
+        } catch(const std::exception& e) {
+            error = e.what();
+        }
+    }
+};
+
+//Reads the image of a managed texture back from the cache, or decodes it
+//again from the texture, which the file structure keeps.
+class DecodedTextureSource : public TextureSource
+{
+    TextureDecodeTask task;
+public:
+    DecodedTextureSource(const Texture *texture, const TextureOptions& options, const TextureCache *cache, const TextureContent& content)
+    : task(texture, options, cache, content, false) {}
+    bool load(TextureImage& image)
+    {
+        task.run();
+        std::swap(image, task.image);
+        task.image = TextureImage();
+        return task.error.empty();
+    }
+};
+
+//Managed textures are not shared, so the source keeps the hash alone.
+TextureSource *TextureDecodeTask::create_source() const
+{
+    TextureContent key;
+    key.hash = content.hash;
+    return new DecodedTextureSource(texture, options, cache, key);
+}
+
+//Content of a texture as decoded with the options, hashed in the order
+//the texture cache has always keyed images by
+void get_texture_content(const Texture& texture, const TextureOptions& options, TextureContent& content)
+{
+    content.width = texture.get_width();
+    content.height = texture.get_height();
+    content.bytes.clear();
+    texture.append_content(content.bytes);
+    append_bytes(content.bytes, options.mipmap_filter);
+    append_bytes(content.bytes, options.gamma_correct);
+    append_bytes(content.bytes, options.compress);
+    ContentHasher hasher;
+    hasher.update(&content.bytes[0], content.bytes.size());
+    content.hash = hasher.get();
+}
+
+//Uploads a processed texture and adds it under every name of the task.
+//Textures left out of their atlas are neither shared nor managed.
+TextureTiming upload_texture(GraphicsContext& context, TextureDecodeTask *task)
+{
+    TextureTiming timing;
+    timing.name = task->names[0];
+    timing.cached = task->cached;
+    timing.decode_time = task->decode_time;
+    timing.process_time = task->process_time;
+    timing.texel_count = task->image.get_texel_count();
+    timing.data_size = task->image.get_data_size();
+    timing.psnr = task->psnr;
+    Uint64 start = SDL_GetPerformanceCounter();
+    if(!task->atlas && context.get_texture_residency() != NULL) {
+        //The residency owns its textures, so they are not offered to other contexts.
+        GLuint texture = context.add_managed_texture(task->names[0], task->image, task->create_source());
+        for(unsigned int j = 1; j < task->names.size(); j++) {
+            context.add_texture(task->names[j], texture);
+        }
+    } else {
+        GLuint texture = Texture::upload(task->image);
+        for(unsigned int j = 0; j < task->names.size(); j++) {
+            if(task->atlas) {
+                context.add_texture(task->names[j], texture);
+            } else {
+                context.add_texture(task->names[j], texture, task->content);
+            }
+        }
+    }
+    timing.upload_time = get_elapsed_time(start);
+    return timing;
+}
+
+//Decodes the textures left out by LoadOptions::lazy_textures when they are
+//first drawn. With a worker pool they decode in the background, and the
+//default texture stands in for them until the next frame after.
+class LazyTextureProvider : public TextureProvider
+{
+    //Reports itself finished to the provider from the worker.
+    class Task : public TextureDecodeTask
+    {
+        SDL_mutex *mutex;
+        std::vector<TextureDecodeTask *> *finished;
+    public:
+        Task(const Texture *texture, const TextureOptions& options, const TextureCache *cache, const TextureContent& content,
+            SDL_mutex *mutex, std::vector<TextureDecodeTask *> *finished)
+        : TextureDecodeTask(texture, options, cache, content, false), mutex(mutex), finished(finished) {}
+        void run()
+        {
+            TextureDecodeTask::run();
+            SDL_LockMutex(mutex);
+            finished->push_back(this);
+            SDL_UnlockMutex(mutex);
+        }
+    };
+    //Textures by name, whose content is only gathered when requested
+    std::map<std::string, const Texture *> entries;
+    TextureOptions options;
+    const TextureCache *cache;
+    WorkerPool *pool;
+    std::vector<TextureTiming> *timings;
+    SDL_mutex *mutex;
+    //Submitted tasks by content, until they are uploaded
+    std::map<ContentHash, TextureDecodeTask *> pending;
+    std::vector<TextureDecodeTask *> finished;
+public:
+    LazyTextureProvider(const TextureOptions& options, const TextureCache *cache, WorkerPool *pool, std::vector<TextureTiming> *timings)
+    : options(options), cache(cache), pool(pool), timings(timings)
+    {
+        mutex = SDL_CreateMutex();
+        if(mutex == NULL) {
+            throw U3D_ERROR << "Failed to create the mutex of a texture provider.";
+        }
+    }
+    ~LazyTextureProvider()
+    {
+        //The pool may be shared, but has no way to wait for some tasks only.
+        if(pool != NULL && !pending.empty()) pool->wait();
+        for(std::map<ContentHash, TextureDecodeTask *>::iterator i = pending.begin(); i != pending.end(); i++) {
+            delete i->second;
+        }
+        SDL_DestroyMutex(mutex);
+    }
+    void add(const std::string& name, const Texture *texture)
+    {
+        entries[name] = texture;
+    }
+    bool empty() const
+    {
+        return entries.empty();
+    }
+    void request(GraphicsContext& context, const std::string& name)
+    {
+        std::map<std::string, const Texture *>::const_iterator entry = entries.find(name);
+        if(entry == entries.end()) return;
+        TextureContent content;
+        get_texture_content(*entry->second, options, content);
+        if(context.get_texture_residency() == NULL && context.add_shared_texture(name, content)) return;
+        //The default texture is small enough to decode in place. It is taken
+        //first, as taking it may add finished textures.
+        bool background = pool != NULL && !name.empty();
+        GLuint stand_in = background ? context.acquire_texture(context.get_texture_handle("")) : 0;
+        std::map<ContentHash, TextureDecodeTask *>::iterator task = pending.find(content.hash);
+        if(task != pending.end() && task->second->content.matches(content)) {
+            task->second->names.push_back(name);
+        } else {
+            //A texture whose hash collides with a pending one is decoded in place.
+            if(task != pending.end()) background = false;
+            TextureDecodeTask *created = new Task(entry->second, options, cache, content, mutex, &finished);
+            created->names.push_back(name);
+            if(task == pending.end()) pending.insert(std::make_pair(content.hash, created));
+            if(!background) {
+                created->run();
+                update(context);
+                return;
+            }
+            pool->submit(created);
+        }
+        context.add_texture(name, stand_in);
+    }
+    void update(GraphicsContext& context)
+    {
+        std::vector<TextureDecodeTask *> tasks;
+        SDL_LockMutex(mutex);
+        tasks.swap(finished);
+        SDL_UnlockMutex(mutex);
+        for(std::vector<TextureDecodeTask *>::iterator i = tasks.begin(); i != tasks.end(); i++) {
+            TextureDecodeTask *task = *i;
+            std::map<ContentHash, TextureDecodeTask *>::iterator entry = pending.find(task->content.hash);
+            if(entry != pending.end() && entry->second == task) pending.erase(entry);
+            if(task->error.empty()) {
+                timings->push_back(upload_texture(context, task));
+            } else {
+                U3D_WARNING << "Texture " << task->names[0] << " could not be decoded: " << task->error << std::endl;
+            }
+            delete task;
+        }
+    }
+};
+
+bool is_continuation(uint32_t type)
+{
+    return type == 0xFFFFFF3B || type == 0xFFFFFF3C || type == 0xFFFFFF3E || type == 0xFFFFFF3F || type == 0xFFFFFF5C;
 }
 }
 
-FileStructure::FileStructure(const std::string& filename) : reader(filename)
+FileStructure::FileStructure(const std::string& filename, const LoadOptions& options)
+: reader(filename), file_resolver(filename), release_after_upload(false), options(options), declaration_end(0), continuation_start(-1), continuations_loaded(false), hierarchy_valid(false)
 {
     models[""] = new CLOD_Mesh();
     lights[""] = new LightResource();
@@ -160,12 +420,88 @@ FileStructure::FileStructure(const std::string& filename) : reader(filename)
     materials[""] = new Material();
     nodes[""] = static_cast<Node *>(new Group());
 
-    while(reader.open_block()) {
+    read_blocks(false, true);
+    if(options.structure_only) {
+        //Nothing but the defaults can be drawn until the continuations are loaded.
+        for(std::map<std::string, ModelResource *>::iterator i = models.begin(); i != models.end(); i++) {
+            if(!i->first.empty()) skipped_models.insert(i->first);
+        }
+        for(std::map<std::string, Texture *>::iterator i = textures.begin(); i != textures.end(); i++) {
+            if(!i->first.empty()) skipped_textures.insert(i->first);
+        }
+        return;
+    }
+    load_continuations();
+}
+
+void FileStructure::load_continuations()
+{
+    if(continuations_loaded) return;
+    continuations_loaded = true;
+    skipped_models.clear();
+    skipped_textures.clear();
+    if(continuation_start == std::streampos(-1) || !reader.seek(continuation_start)) return;
+    bool defer = options.region != NULL || options.reachable_only;
+    read_blocks(defer, false);
+    if(!defer) return;
+    //Deferred resources start out skipped and are decoded once selected.
+    std::set<std::string> model_names, shader_names, texture_names;
+    for(std::map<std::string, std::vector<std::streampos> >::iterator i = model_continuations.begin(); i != model_continuations.end(); i++) {
+        skipped_models.insert(i->first);
+        model_names.insert(i->first);
+    }
+    for(std::map<std::string, std::vector<std::streampos> >::iterator i = texture_continuations.begin(); i != texture_continuations.end(); i++) {
+        skipped_textures.insert(i->first);
+        texture_names.insert(i->first);
+    }
+    if(options.reachable_only) {
+        for(std::map<std::string, LitTextureShader *>::iterator i = shaders.begin(); i != shaders.end(); i++) {
+            skipped_shaders.insert(i->first);
+            shader_names.insert(i->first);
+        }
+        View *view = get_view(options.view_name.empty() ? "DefaultView" : options.view_name);
+        if(view == NULL && options.view_name.empty()) {
+            view = get_first_view();
+        }
+        if(view != NULL && decode_reachable(view, options.pass_index, options.region)) {
+            U3D_LOG << skipped_models.size() << " of " << model_continuations.size() << " models and " << skipped_textures.size() << " of "
+                    << texture_continuations.size() << " textures skipped." << std::endl;
+            return;
+        }
+        U3D_WARNING << "The view pass to load was not found; decoding every resource." << std::endl;
+    }
+    decode_selected(model_names, shader_names, texture_names, options.region);
+    U3D_LOG << skipped_models.size() << " of " << model_continuations.size() << " models skipped." << std::endl;
+}
+
+//Peeks at the next block and records where the continuation section starts.
+bool FileStructure::at_continuations()
+{
+    uint32_t type;
+    std::streampos position = reader.tell();
+    if(!reader.peek_type(&type)) return false;
+    if(is_continuation(type) || (declaration_end > 0 && static_cast<std::streamoff>(position) >= declaration_end)) {
+        continuation_start = position;
+        return true;
+    }
+    return false;
+}
+
+void FileStructure::read_blocks(bool defer_continuations, bool declarations_only)
+{
+    while(!(declarations_only && at_continuations()) && reader.open_block()) {
         std::string name;
 
         switch(reader.get_type()) {
         case 0x00443355:    //File Header Block
-            read_header_block(reader);
+            {
+                //Exporters commonly write the size of the header block alone,
+                //in which case the first continuation ends the declarations.
+                std::streamoff declaration_size = read_header_block(reader);
+                if(declaration_size > static_cast<std::streamoff>(reader.tell())) {
+                    declaration_end = declaration_size;
+                }
+            }
             break;
         case 0xFFFFFF14:    //Modifier Chain Block
             name = reader.read_str();
@@ -173,6 +509,7 @@ FileStructure::FileStructure(const std::string& filename) : reader(filename)
             switch(reader.read<uint32_t>()) {
             case 0:
                 nodes[name] = create_node_modifier_chain(reader);
+                hierarchy_valid = false;
                 break;
             case 1:
                 models[name] = create_model_modifier_chain(reader);
@@ -217,54 +554,24 @@ FileStructure::FileStructure(const std::string& filename) : reader(filename)
             break;
         case 0xFFFFFF5C:    //Texture Continuation
             name = reader.read_str();
-            if(textures[name] != NULL) {
-                Texture *decl = dynamic_cast<Texture *>(textures[name]);
-                if(decl != NULL) {
-                    decl->load_continuation(reader);
+            if(defer_continuations) {
+                texture_continuations[name].push_back(reader.tell_block());
+            } else {
+                std::map<std::string, Texture *>::iterator decl = textures.find(name);
+                if(decl != textures.end() && decl->second != NULL) {
+                    decl->second->load_continuation(reader);
                     std::fprintf(stderr, "Texture Continuation \"%s\"\n", name.c_str());
                 }
             }
             break;
         case 0xFFFFFF3B:    //CLOD Base Mesh Continuation
-            name = reader.read_str();
-            if(models[name] != NULL) {
-                CLOD_Mesh *decl = dynamic_cast<CLOD_Mesh *>(models[name]);
-                if(decl != NULL) {
-                    decl->create_base_mesh(reader);
-                    std::fprintf(stderr, "CLOD Base Mesh Continuation \"%s\"\n", name.c_str());
-                }
-            } else {
-                std::fprintf(stderr, "CLOD Base Mesh Continuation \"%s\" is not declared.\n", name.c_str());
-            }
-            break;
         case 0xFFFFFF3C:    //CLOD Progressive Mesh Continuation
-            name = reader.read_str();
-            if(models[name] != NULL) {
-                CLOD_Mesh *decl = dynamic_cast<CLOD_Mesh *>(models[name]);
-                if(decl != NULL) {
-                    decl->update_resolution(reader);
-                    std::fprintf(stderr, "CLOD Progressive Mesh Continuation \"%s\"\n", name.c_str());
-                }
-            }
-            break;
         case 0xFFFFFF3E:    //Point Set Continuation
-            name = reader.read_str();
-            if(models[name] != NULL) {
-                PointSet *decl = dynamic_cast<PointSet *>(models[name]);
-                if(decl != NULL) {
-                    decl->update_resolution(reader);
-                    std::fprintf(stderr, "Point Set Continuation \"%s\"\n", name.c_str());
-                }
-            }
-            break;
         case 0xFFFFFF3F:    //Line Set Continuation
             name = reader.read_str();
-            if(models[name] != NULL) {
-                LineSet *decl = dynamic_cast<LineSet *>(models[name]);
-                if(decl != NULL) {
-                    decl->update_resolution(reader);
-                    std::fprintf(stderr, "Line Set Continuation \"%s\"\n", name.c_str());
-                }
+            model_continuations[name].push_back(reader.tell_block());
+            if(!defer_continuations) {
+                decode_model_continuation(name);
             }
             break;
         default:
@@ -278,29 +585,424 @@ FileStructure::FileStructure(const std::string& filename) : reader(filename)
     }
 }
 
-GraphicsContext *FileStructure::create_context() {
+void FileStructure::decode_model_continuation(const std::string& name)
+{
+    std::map<std::string, ModelResource *>::iterator i = models.find(name);
+    if(i == models.end() || i->second == NULL) {
+        std::fprintf(stderr, "Model continuation \"%s\" is not declared.\n", name.c_str());
+        return;
+    }
+    switch(reader.get_type()) {
+    case 0xFFFFFF3B:    //CLOD Base Mesh Continuation
+        {
+            CLOD_Mesh *decl = resource_cast<CLOD_Mesh>(i->second);
+            if(decl != NULL) {
+                decl->create_base_mesh(reader);
+                std::fprintf(stderr, "CLOD Base Mesh Continuation \"%s\"\n", name.c_str());
+            }
+        }
+        break;
+    case 0xFFFFFF3C:    //CLOD Progressive Mesh Continuation
+        {
+            CLOD_Mesh *decl = resource_cast<CLOD_Mesh>(i->second);
+            if(decl != NULL) {
+                decl->update_resolution(reader);
+                std::fprintf(stderr, "CLOD Progressive Mesh Continuation \"%s\"\n", name.c_str());
+            }
+        }
+        break;
+    case 0xFFFFFF3E:    //Point Set Continuation
+        {
+            PointSet *decl = resource_cast<PointSet>(i->second);
+            if(decl != NULL) {
+                decl->update_resolution(reader);
+                std::fprintf(stderr, "Point Set Continuation \"%s\"\n", name.c_str());
+            }
+        }
+        break;
+    case 0xFFFFFF3F:    //Line Set Continuation
+        {
+            LineSet *decl = resource_cast<LineSet>(i->second);
+            if(decl != NULL) {
+                decl->update_resolution(reader);
+                std::fprintf(stderr, "Line Set Continuation \"%s\"\n", name.c_str());
+            }
+        }
+        break;
+    }
+    i->second->update_bounds();
+}
+
+//Lists the models whose instances all lie outside the region. Models are
+//bounded by the chain bounds of their resource, or else of the model node.
+void FileStructure::find_models_outside(const LoadRegion& region, std::set<std::string>& outside)
+{
+    std::map<std::string, BoundingBox3f> world_bounds;
+    std::set<std::string> unbounded;
+    for(std::map<std::string, Node *>::iterator i = nodes.begin(); i != nodes.end(); i++) {
+        Model *model = node_cast<Model>(i->second);
+        if(model == NULL) continue;
+        std::map<std::string, ModelResource *>::iterator model_rsc = models.find(model->resource_name);
+        if(model_rsc == models.end() || model_rsc->second == NULL) continue;
+        const BoundingBox3f& local_bounds = model_rsc->second->get_chain_bounds().empty() ? model->chain_bounds : model_rsc->second->get_chain_bounds();
+        if(local_bounds.empty()) {
+            unbounded.insert(model->resource_name);
+            continue;
+        }
+        std::vector<Matrix4f> world_transforms;
+        get_world_transforms(world_transforms, model, nodes[""]);
+        for(unsigned int j = 0; j < world_transforms.size(); j++) {
+            world_bounds[model->resource_name].extend(local_bounds.transform(world_transforms[j]));
+        }
+    }
+    for(std::map<std::string, BoundingBox3f>::iterator i = world_bounds.begin(); i != world_bounds.end(); i++) {
+        if(unbounded.count(i->first) == 0 && !region.intersects(i->second)) {
+            outside.insert(i->first);
+        }
+    }
+}
+
+void FileStructure::decode_selected(const std::set<std::string>& model_names, const std::set<std::string>& shader_names,
+                                    const std::set<std::string>& texture_names, const LoadRegion *region)
+{
+    std::set<std::string> outside;
+    if(region != NULL) {
+        find_models_outside(*region, outside);
+    }
+    for(std::set<std::string>::const_iterator i = model_names.begin(); i != model_names.end(); i++) {
+        if(skipped_models.count(*i) == 0) continue;
+        if(outside.count(*i) != 0) {
+            std::fprintf(stderr, "Model \"%s\" is outside the load region\n", i->c_str());
+        } else {
+            decode_model(*i);
+        }
+    }
+    for(std::set<std::string>::const_iterator i = shader_names.begin(); i != shader_names.end(); i++) {
+        skipped_shaders.erase(*i);
+    }
+    for(std::set<std::string>::const_iterator i = texture_names.begin(); i != texture_names.end(); i++) {
+        decode_texture(*i);
+    }
+}
+
+bool FileStructure::decode_reachable(const View *view, unsigned int pass_index, const LoadRegion *region)
+{
+    std::map<std::string, ViewResource *>::iterator view_rsc = views.find(view->resource_name);
+    if(view_rsc == views.end() || view_rsc->second == NULL || pass_index >= view_rsc->second->passes.size()) {
+        return false;
+    }
+    std::map<std::string, std::vector<std::pair<std::string, unsigned int> > > tree;
+    build_child_map(tree);
+    //Elements without a shader of their own use the default one.
+    std::set<std::string> visited, model_names, shader_names, texture_names;
+    shader_names.insert("");
+    std::vector<std::string> pending(1, view_rsc->second->passes[pass_index].root_node_name);
+    while(!pending.empty()) {
+        std::string name = pending.back();
+        pending.pop_back();
+        if(!visited.insert(name).second) continue;
+        std::map<std::string, Node *>::iterator node = nodes.find(name);
+        if(node == nodes.end() || node->second == NULL) continue;
+        Model *model = node_cast<Model>(node->second);
+        if(model != NULL && !model->resource_name.empty()) {
+            model_names.insert(model->resource_name);
+            const Shading *shading = model->shading;
+            std::map<std::string, ModelResource *>::iterator model_rsc = models.find(model->resource_name);
+            if(shading == NULL && model_rsc != models.end() && model_rsc->second != NULL) {
+                shading = model_rsc->second->shading;
+            }
+            if(shading != NULL) {
+                shader_names.insert(shading->shader_names.begin(), shading->shader_names.end());
+            }
+        }
+        std::map<std::string, std::vector<std::pair<std::string, unsigned int> > >::iterator children = tree.find(name);
+        if(children != tree.end()) {
+            for(unsigned int i = 0; i < children->second.size(); i++) {
+                pending.push_back(children->second[i].first);
+            }
+        }
+    }
+    for(std::set<std::string>::iterator i = shader_names.begin(); i != shader_names.end(); i++) {
+        std::map<std::string, LitTextureShader *>::iterator shader = shaders.find(*i);
+        if(shader == shaders.end() || shader->second == NULL) continue;
+        for(unsigned int j = 0; j < 8; j++) {
+            if(shader->second->shader_channels & (1 << j)) {
+                texture_names.insert(shader->second->texinfos[j].name);
+            }
+        }
+    }
+    decode_selected(model_names, shader_names, texture_names, region);
+    return true;
+}
+
+bool FileStructure::decode_texture(const std::string& name)
+{
+    std::map<std::string, Texture *>::iterator i = textures.find(name);
+    if(i == textures.end() || i->second == NULL) {
+        return false;
+    }
+    if(skipped_textures.erase(name) == 0) {
+        return true;
+    }
+    std::map<std::string, std::vector<std::streampos> >::iterator blocks = texture_continuations.find(name);
+    if(blocks == texture_continuations.end()) {
+        return true;
+    }
+    for(std::vector<std::streampos>::iterator j = blocks->second.begin(); j != blocks->second.end(); j++) {
+        if(!reader.seek_block(*j)) {
+            U3D_WARNING << "Failed to seek to a continuation of \"" << name << "\"." << std::endl;
+            return false;
+        }
+        reader.read_str();
+        i->second->load_continuation(reader);
+        std::fprintf(stderr, "Texture Continuation \"%s\"\n", name.c_str());
+    }
+    return true;
+}
+
+bool FileStructure::decode_model(const std::string& name)
+{
+    std::map<std::string, ModelResource *>::iterator i = models.find(name);
+    if(i == models.end()) {
+        return false;
+    }
+    skipped_models.erase(name);
+    i->second->release_geometry();
+    std::map<std::string, std::vector<std::streampos> >::iterator blocks = model_continuations.find(name);
+    if(blocks == model_continuations.end()) {
+        return true;
+    }
+    for(std::vector<std::streampos>::iterator j = blocks->second.begin(); j != blocks->second.end(); j++) {
+        if(!reader.seek_block(*j)) {
+            U3D_WARNING << "Failed to seek to a continuation of \"" << name << "\"." << std::endl;
+            return false;
+        }
+        reader.read_str();
+        decode_model_continuation(name);
+    }
+    return true;
+}
+
+bool FileStructure::reload_render_group(GraphicsContext *context, const std::string& name)
+{
+    if(!decode_model(name)) {
+        return false;
+    }
+    ModelResource *model = models[name];
+    context->add_render_group(name, model->create_render_group(context->get_buffer_arena()));
+    if(release_after_upload) {
+        model->release_geometry();
+    }
+    return true;
+}
+
+GraphicsContext *FileStructure::create_context(bool release_geometry, WorkerPool *pool) {
     GraphicsContext *context = new GraphicsContext();
+    release_after_upload = release_geometry;
+    context->get_shader_cache().set_binary_directory(options.program_binary_directory);
 
-    for(std::map<std::string, LitTextureShader *>::iterator i = shaders.begin(); i != shaders.end(); i++) {
-        context->add_shader_group(i->first, i->second->create_shader_group(materials[i->second->material_name]));
+    //Images decode on the workers while the shaders and meshes are set up.
+    TextureOptions texture_options = options.textures;
+    if(texture_options.compress && !GLEW_EXT_texture_compression_s3tc) {
+        U3D_WARNING << "S3TC is not supported; textures are left uncompressed." << std::endl;
+        texture_options.compress = false;
+    }
+    if(texture_options.atlas_threshold != 0 && !GLEW_ARB_shader_texture_lod) {
+        U3D_WARNING << "GL_ARB_shader_texture_lod is not supported; textures are not packed into atlases." << std::endl;
+        texture_options.atlas_threshold = 0;
+    }
+    //Streaming picks among the levels of complete mip chains.
+    if(texture_options.residency_budget != 0) {
+        if(texture_options.mipmap_filter == TextureOptions::NO_MIPMAPS) texture_options.mipmap_filter = TextureOptions::BOX;
+        TextureResidency *residency = new TextureResidency(new GLTextureBackend(), texture_options.residency_budget);
+        residency->set_worker_pool(pool != NULL ? pool : new WorkerPool(1), pool == NULL);
+        context->set_texture_residency(residency);
+    }
+    //Atlas entries are chosen by their declared size, as the shaders
+    //sampling them are generated before they are decoded.
+    std::set<std::string> atlas_textures;
+    std::vector<UriResolver *> resolvers;
+    if(options.uri_resolver != NULL) resolvers.push_back(options.uri_resolver);
+    resolvers.push_back(&file_resolver);
+    //Textures left for their first draw are decoded on the caller's pool.
+    LazyTextureProvider *provider = NULL;
+    if(options.lazy_textures) {
+        provider = new LazyTextureProvider(texture_options, options.texture_cache, pool, &texture_timings);
+        context->set_texture_provider(provider);
     }
+    //Textures with the same content and options are decoded once, and not
+    //at all when another context already holds them.
+    std::vector<TextureDecodeTask *> decode_tasks;
+    std::map<ContentHash, TextureDecodeTask *> unique_textures;
     for(std::map<std::string, Texture *>::iterator i = textures.begin(); i != textures.end(); i++) {
-        context->add_texture(i->first, i->second->load_texture());
+        if(skipped_textures.count(i->first) != 0 || i->second == NULL) continue;
+        i->second->resolve_uris(resolvers);
+        TextureContent content;
+        get_texture_content(*i->second, texture_options, content);
+        uint32_t threshold = texture_options.atlas_threshold;
+        bool atlas = threshold != 0 && i->second->get_width() <= threshold && i->second->get_height() <= threshold;
+        //The stand-in for lazy textures must be a texture of its own.
+        if(provider != NULL && i->first.empty()) atlas = false;
+        if(atlas) {
+            atlas_textures.insert(i->first);
+        } else if(context->get_texture_residency() == NULL && context->add_shared_texture(i->first, content)) {
+            continue;
+        } else if(provider != NULL) {
+            provider->add(i->first, i->second);
+            continue;
+        }
+        std::map<ContentHash, TextureDecodeTask *>::iterator task = unique_textures.find(content.hash);
+        if(task != unique_textures.end() && task->second->content.matches(content)) {
+            task->second->names.push_back(i->first);
+            continue;
+        }
+        //A texture whose hash collides with another's gets a task of its own.
+        decode_tasks.push_back(new TextureDecodeTask(i->second, texture_options, options.texture_cache, content, atlas));
+        decode_tasks.back()->names.push_back(i->first);
+        if(task == unique_textures.end()) unique_textures.insert(std::make_pair(content.hash, decode_tasks.back()));
+    }
+    WorkerPool *local_pool = NULL;
+    if(pool == NULL && decode_tasks.size() > 1) {
+        pool = local_pool = new WorkerPool();
     }
-    for(std::map<std::string, ModelResource *>::iterator i = models.begin(); i != models.end(); i++) {
-        context->add_render_group(i->first, i->second->create_render_group());
+    //The image libraries are loaded here, as loading them lazily is not thread safe.
+    IMG_Init(IMG_INIT_JPG | IMG_INIT_PNG | IMG_INIT_TIF);
+    for(unsigned int i = 0; i < decode_tasks.size(); i++) {
+        if(pool != NULL) {
+            pool->submit(decode_tasks[i]);
+        }
+    }
+    try {
+        for(std::map<std::string, LitTextureShader *>::iterator i = shaders.begin(); i != shaders.end(); i++) {
+            if(skipped_shaders.count(i->first) != 0) continue;
+            uint8_t atlas_channels = 0;
+            for(int j = 0; j < 8; j++) {
+                if((i->second->shader_channels & (1 << j)) && atlas_textures.count(i->second->texinfos[j].name) != 0) {
+                    atlas_channels |= 1 << j;
+                }
+            }
+            context->add_shader_group(i->first, i->second->create_shader_group(context->get_shader_cache(), materials[i->second->material_name], atlas_channels));
+        }
+        //Reserve one page for the declared geometry so that it shares a buffer.
+        size_t buffer_size = 0;
+        for(std::map<std::string, ModelResource *>::iterator i = models.begin(); i != models.end(); i++) {
+            if(skipped_models.count(i->first) == 0 && i->second != NULL) buffer_size += i->second->get_buffer_size_hint();
+        }
+        context->get_buffer_arena().reserve(buffer_size);
+        for(std::map<std::string, ModelResource *>::iterator i = models.begin(); i != models.end(); i++) {
+            if(skipped_models.count(i->first) != 0) continue;
+            context->add_render_group(i->first, i->second->create_render_group(context->get_buffer_arena()));
+            if(release_geometry) {
+                i->second->release_geometry();
+            }
+        }
+    } catch(...) {
+        //The tasks must not outlive this call.
+        if(pool != NULL) pool->wait();
+        delete local_pool;
+        for(unsigned int i = 0; i < decode_tasks.size(); i++) delete decode_tasks[i];
+        delete context;
+        throw;
     }
 
+    if(pool != NULL) {
+        pool->wait();
+    }
+    delete local_pool;
+    texture_timings.clear();
+    atlas_stats = TextureAtlasStats();
+    std::string error;
+    TextureAtlasBuilder atlas(texture_options.atlas_size, texture_options.atlas_gutter, texture_options.mipmap_filter, texture_options.compress);
+    std::vector<unsigned int> atlas_entries(decode_tasks.size());
+    for(unsigned int i = 0; i < decode_tasks.size(); i++) {
+        TextureDecodeTask *task = decode_tasks[i];
+        if(pool == NULL) {
+            task->run();
+        }
+        if(error.empty() && !task->error.empty()) {
+            error = task->error;
+        }
+        if(error.empty() && task->atlas) {
+            atlas_entries[i] = atlas.add(&task->image);
+        }
+    }
+    //Entries outside the atlas keep the identity region.
+    std::map<std::string, TextureAtlasBuilder::Region> atlas_regions;
+    std::vector<GLuint> atlas_pages;
+    if(error.empty() && !atlas_textures.empty()) {
+        atlas.build();
+        std::vector<TextureImage>& pages = atlas.get_pages();
+        for(unsigned int i = 0; i < pages.size(); i++) {
+            process_image(pages[i], texture_options);
+            if(pages[i].mipmaps.size() > atlas.get_max_mip_levels()) {
+                pages[i].mipmaps.resize(atlas.get_max_mip_levels());
+            }
+            atlas_pages.push_back(Texture::upload(pages[i]));
+            atlas_stats.data_size += pages[i].get_data_size();
+        }
+        atlas_stats.page_count = atlas.get_stats().page_count;
+        atlas_stats.texture_count = atlas.get_stats().texture_count;
+        atlas_stats.occupancy = atlas.get_stats().occupancy;
+    }
+    for(unsigned int i = 0; i < decode_tasks.size() && error.empty(); i++) {
+        TextureDecodeTask *task = decode_tasks[i];
+        TextureAtlasBuilder::Region region;
+        if(task->atlas && atlas.get_region(atlas_entries[i], region)) {
+            for(unsigned int j = 0; j < task->names.size(); j++) {
+                context->add_texture(task->names[j], atlas_pages[region.page]);
+                atlas_regions[task->names[j]] = region;
+            }
+            TextureTiming timing;
+            timing.name = task->names[0];
+            timing.cached = task->cached;
+            timing.decode_time = task->decode_time;
+            timing.process_time = timing.upload_time = 0;
+            timing.texel_count = task->image.get_texel_count();
+            timing.data_size = 0;
+            timing.psnr = 0;
+            texture_timings.push_back(timing);
+        } else {
+            if(task->atlas) {
+                //Decoded larger than declared, and too large for a page
+                Uint64 start = SDL_GetPerformanceCounter();
+                task->psnr = process_image(task->image, texture_options);
+                task->process_time += get_elapsed_time(start);
+            }
+            texture_timings.push_back(upload_texture(*context, task));
+        }
+    }
+    for(unsigned int i = 0; i < decode_tasks.size(); i++) {
+        delete decode_tasks[i];
+    }
+    if(!error.empty()) {
+        delete context;
+        throw U3D_ERROR << error;
+    }
+    for(std::map<std::string, LitTextureShader *>::iterator i = shaders.begin(); i != shaders.end(); i++) {
+        ShaderGroup *group = context->get_shader_group(i->first);
+        for(int j = 0; group != NULL && j < 8; j++) {
+            if((group->atlas_channels & (1 << j)) == 0) continue;
+            static const float identity[4] = {1.0f, 1.0f, 0.0f, 0.0f};
+            std::map<std::string, TextureAtlasBuilder::Region>::iterator region = atlas_regions.find(group->texture_names[j]);
+            group->set_texture_region(j, region != atlas_regions.end() ? region->second.transform : identity);
+        }
+    }
     return context;
 }
 
 SceneGraph *FileStructure::create_scenegraph(const View *view, int pass_index) {
-    ViewResource *rsc = views[view->resource_name];
-    std::string& root_node_name = rsc->passes[pass_index].root_node_name;
-    U3D_LOG << "Root node = " << root_node_name << std::endl;
-    Node *root_node = nodes[root_node_name];
-    Matrix4f root_node_transform;
-    if(!get_world_transform(&root_node_transform, root_node, nodes[""])) {
+    std::map<std::string, ViewResource *>::iterator rsc = views.find(view->resource_name);
+    if(rsc == views.end() || rsc->second == NULL || pass_index < 0 || static_cast<size_t>(pass_index) >= rsc->second->passes.size()) {
+        U3D_WARNING << "View resource \"" << view->resource_name << "\" not found." << std::endl;
+        return NULL;
+    }
+    ViewResource::Pass& pass = rsc->second->passes[pass_index];
+    U3D_LOG << "Root node = " << pass.root_node_name << std::endl;
+    compile_hierarchy();
+    hierarchy.update();
+    Node *root_node = get_node(pass.root_node_name);
+    unsigned int root = root_node == NULL ? TransformHierarchy::NONE : hierarchy.get_primary_instance(node_indices[root_node]);
+    if(root == TransformHierarchy::NONE) {
         U3D_WARNING << "Root node does not belong to the World." << std::endl;
         return NULL;
     }
@@ -309,50 +1011,220 @@ SceneGraph *FileStructure::create_scenegraph(const View *view, int pass_index) {
         U3D_WARNING << "View node does not belong to the World." << std::endl;
         return NULL;
     }
-    SceneGraph *scene = new SceneGraph(*view, rsc->passes[pass_index], view_transform);
+    SceneGraph *scene = new SceneGraph(*view, pass, view_transform);
     U3D_LOG << "View transform = " << view_transform << std::endl;
-    for(std::map<std::string, Node *>::iterator i = nodes.begin(); i != nodes.end(); i++) {
-        Matrix4f world_transform;
-        Light *light = dynamic_cast<Light *>(i->second);
-        if(light != NULL && !light->resource_name.empty()) {
-            if(get_world_transform(&world_transform, i->second, nodes[""])) {
-                U3D_LOG << "Light node " << light->resource_name << " found." << std::endl;
-                LightResource *light_rsc = lights[light->resource_name];
-                scene->register_light(*light_rsc, world_transform);
-            }
-            continue;
+    for(unsigned int i = 0; i < node_list.size(); i++) {
+        //Every parent path of a node is a separate instance of it.
+        Light *light = node_cast<Light>(node_list[i]);
+        if(light == NULL || light->resource_name.empty()) continue;
+        std::map<std::string, LightResource *>::iterator light_rsc = lights.find(light->resource_name);
+        if(light_rsc == lights.end() || light_rsc->second == NULL) continue;
+        const std::vector<unsigned int>& instances = hierarchy.get_instances(i);
+        if(!instances.empty()) {
+            U3D_LOG << "Light node " << light->resource_name << " found." << std::endl;
+        }
+        for(unsigned int j = 0; j < instances.size(); j++) {
+            scene->register_light(*light_rsc->second, hierarchy.get_world_transform(instances[j]));
+        }
+    }
+    //Models are registered in the order of the subtree below the root, with
+    //a group per instance, so that the scene can bound and cull whole subtrees.
+    std::vector<std::pair<unsigned int, unsigned int> > open_groups;
+    for(unsigned int i = root; i < hierarchy.get_entry(root).end; i++) {
+        const TransformHierarchy::Entry& entry = hierarchy.get_entry(i);
+        while(!open_groups.empty() && open_groups.back().second <= i) {
+            scene->close_group(open_groups.back().first);
+            open_groups.pop_back();
         }
-        Model *model = dynamic_cast<Model *>(i->second);
+        open_groups.push_back(std::make_pair(scene->open_group(node_names[entry.node]), entry.end));
+        Model *model = node_cast<Model>(node_list[entry.node]);
         if(model != NULL && !model->resource_name.empty()) {
-            if(get_world_transform(&world_transform, i->second, root_node)) {
+            std::map<std::string, ModelResource *>::iterator model_rsc = models.find(model->resource_name);
+            if(model_rsc != models.end() && model_rsc->second != NULL) {
                 U3D_LOG << "Model node " << model->resource_name << " found." << std::endl;
-                ModelResource *model_rsc = models[model->resource_name];
-                scene->register_model(*model, *model_rsc, root_node_transform * world_transform);
+                scene->register_model(node_names[entry.node], *model, *model_rsc->second, hierarchy.get_world_transform(i), i);
             }
-            continue;
         }
     }
+    while(!open_groups.empty()) {
+        scene->close_group(open_groups.back().first);
+        open_groups.pop_back();
+    }
     U3D_LOG << "SceneGraph created." << std::endl;
     return scene;
 }
 
+//Maps each node to its children and the index of the parent entry naming it
+void FileStructure::build_child_map(std::map<std::string, std::vector<std::pair<std::string, unsigned int> > >& tree)
+{
+    for(std::map<std::string, Node *>::iterator i = nodes.begin(); i != nodes.end(); i++) {
+        if(i->second == NULL) continue;
+        for(unsigned int j = 0; j < i->second->parents.size(); j++) {
+            tree[i->second->parents[j].name].push_back(std::make_pair(i->first, j));
+        }
+    }
+}
+
+void FileStructure::compile_hierarchy()
+{
+    if(hierarchy_valid) return;
+    std::map<std::string, unsigned int> indices;
+    std::vector<const Node *> const_nodes;
+    node_list.clear();
+    node_names.clear();
+    node_indices.clear();
+    for(std::map<std::string, Node *>::iterator i = nodes.begin(); i != nodes.end(); i++) {
+        if(i->second == NULL) continue;
+        indices[i->first] = node_list.size();
+        node_indices[i->second] = node_list.size();
+        node_list.push_back(i->second);
+        node_names.push_back(i->first);
+        const_nodes.push_back(i->second);
+    }
+    hierarchy.build(const_nodes, indices, indices[""]);
+    hierarchy_valid = true;
+}
+
+bool FileStructure::get_world_transform(Matrix4f *mat, const Node *node, const Node *root)
+{
+    if(node == NULL || root == NULL) return false;
+    if(root != get_node("")) return get_path_transform(mat, node, root);
+    compile_hierarchy();
+    hierarchy.update();
+    std::map<const Node *, unsigned int>::iterator index = node_indices.find(node);
+    if(index == node_indices.end()) return false;
+    unsigned int instance = hierarchy.get_primary_instance(index->second);
+    if(instance == TransformHierarchy::NONE) return false;
+    *mat = (*mat) * hierarchy.get_world_transform(instance);
+    return true;
+}
+
+void FileStructure::get_world_transforms(std::vector<Matrix4f>& transforms, const Node *node, const Node *root)
+{
+    if(node == NULL || root == NULL) return;
+    if(root != get_node("")) {
+        get_path_transforms(transforms, node, root);
+        return;
+    }
+    compile_hierarchy();
+    hierarchy.update();
+    std::map<const Node *, unsigned int>::iterator index = node_indices.find(node);
+    if(index == node_indices.end()) return;
+    const std::vector<unsigned int>& instances = hierarchy.get_instances(index->second);
+    for(unsigned int i = 0; i < instances.size(); i++) {
+        transforms.push_back(hierarchy.get_world_transform(instances[i]));
+    }
+}
+
+bool FileStructure::set_parent_transform(const std::string& name, unsigned int parent_index, const Matrix4f& transform, SceneGraph *scene)
+{
+    Node *node = get_node(name);
+    if(node == NULL || parent_index >= node->parents.size()) return false;
+    node->parents[parent_index].transform = transform;
+    if(hierarchy_valid) {
+        hierarchy.set_local_transform(node_indices[node], parent_index, transform);
+    }
+    if(scene == NULL) return true;
+    //Models are registered by instance, and a subtree is a contiguous range of them.
+    compile_hierarchy();
+    hierarchy.update();
+    const std::vector<unsigned int>& instances = hierarchy.get_instances(node_indices[node]);
+    for(unsigned int i = 0; i < instances.size(); i++) {
+        if(hierarchy.get_entry(instances[i]).slot != parent_index) continue;
+        unsigned int end = hierarchy.get_entry(instances[i]).end;
+        for(unsigned int j = scene->find_model(instances[i]); j < scene->get_model_count() && scene->get_model_instance(j) < end; j++) {
+            scene->set_model_matrix(j, hierarchy.get_world_transform(scene->get_model_instance(j)));
+        }
+    }
+    return true;
+}
+
+bool FileStructure::get_path_transform(Matrix4f *mat, const Node *node, const Node *root)
+{
+    std::vector<Matrix4f> path(1, *mat);
+    if(!get_path(path, node, root)) return false;
+    *mat = multiply_chain(&path[0], path.size());
+    return true;
+}
+
+//Appends the transforms along the first path from the root down to the node.
+bool FileStructure::get_path(std::vector<Matrix4f>& path, const Node *node, const Node *root)
+{
+    if(node == root) {
+        return true;
+    } else if(node != NULL) {
+        for(std::vector<Node::Parent>::const_iterator i = node->parents.begin(); i != node->parents.end(); i++) {
+            if(get_path(path, get_node(i->name), root)) {
+                path.push_back(i->transform);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void FileStructure::get_path_transforms(std::vector<Matrix4f>& transforms, const Node *node, const Node *root)
+{
+    if(node == root) {
+        transforms.push_back(Matrix4f());
+    } else if(node != NULL) {
+        for(std::vector<Node::Parent>::const_iterator i = node->parents.begin(); i != node->parents.end(); i++) {
+            size_t first = transforms.size();
+            get_path_transforms(transforms, get_node(i->name), root);
+            for(size_t j = first; j < transforms.size(); j++) {
+                transforms[j] = transforms[j] * i->transform;
+            }
+        }
+    }
+}
+
+Picker *FileStructure::create_picker(const SceneGraph& scene, WorkerPool *pool)
+{
+    Picker *picker = new Picker();
+    for(unsigned int i = 0; i < scene.get_model_count(); i++) {
+        const std::string& name = scene.get_model_resource_name(i);
+        std::map<std::string, MeshBVH *>::iterator mesh = picker->meshes.find(name);
+        if(mesh == picker->meshes.end()) {
+            std::vector<Vector3f> triangles;
+            std::map<std::string, ModelResource *>::iterator model = models.find(name);
+            if(model != models.end() && model->second != NULL) {
+                model->second->get_triangles(triangles);
+                if(triangles.empty() && release_after_upload && decode_model(name)) {
+                    model->second->get_triangles(triangles);
+                    model->second->release_geometry();
+                }
+            }
+            MeshBVH *bvh = triangles.empty() ? NULL : new MeshBVH(triangles, pool);
+            mesh = picker->meshes.insert(std::make_pair(name, bvh)).first;
+        }
+        if(mesh->second != NULL) {
+            picker->scene.add_instance(mesh->second, scene.get_model_matrix(i));
+            picker->node_names.push_back(scene.get_model_node_name(i));
+        }
+    }
+    picker->scene.build(pool);
+    U3D_LOG << "Picker created over " << picker->scene.get_instance_count() << " instances." << std::endl;
+    return picker;
+}
+
 void FileStructure::dump_tree_recursive(FILE *fp, std::map<std::string, std::vector<std::string> >& tree, const std::string& name, int depth)
 {
     for(int i = 0; i < depth; i++) {
         fputc(' ', fp);
     }
-    Light *light = dynamic_cast<Light *>(nodes[name]);
+    Node *node = get_node(name);
+    Light *light = node_cast<Light>(node);
     if(light != NULL) {
         fprintf(fp, "Light <%s> => <%s>\n", name.c_str(), light->resource_name.c_str());
     } else {
-        Model *model = dynamic_cast<Model *>(nodes[name]);
+        Model *model = node_cast<Model>(node);
         if(model != NULL) {
             fprintf(fp, "Model <%s> => <%s>\n", name.c_str(), model->resource_name.c_str());
         } else {
-            View *view = dynamic_cast<View *>(nodes[name]);
-            if(view != NULL) {
-                ViewResource *view_rsc = views[view->resource_name];
-                ViewResource::Pass& first_pass = view_rsc->passes[0];
+            View *view = node_cast<View>(node);
+            std::map<std::string, ViewResource *>::iterator view_rsc = view == NULL ? views.end() : views.find(view->resource_name);
+            if(view_rsc != views.end() && view_rsc->second != NULL && !view_rsc->second->passes.empty()) {
+                ViewResource::Pass& first_pass = view_rsc->second->passes[0];
                 fprintf(fp, "View <%s> => <%s>\n", name.c_str(), first_pass.root_node_name.c_str());
             } else {
                 fprintf(fp, "Group <%s>\n", name.c_str());
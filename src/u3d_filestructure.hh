@@ -21,6 +21,56 @@
 
 namespace U3D
 {
+//Region of interest for partial loading, given as a world space box or a view frustum
+class LoadRegion
+{
+    BoundingBox3f box;
+    Frustum frustum;
+    bool use_frustum;
+public:
+    LoadRegion(const BoundingBox3f& box) : box(box), frustum(Matrix4f()), use_frustum(false) {}
+    LoadRegion(const Frustum& frustum) : frustum(frustum), use_frustum(true) {}
+    bool intersects(const BoundingBox3f& bounds) const
+    {
+        if(use_frustum) return frustum.intersects(bounds);
+        return !bounds.empty() && !box.empty() && bounds.min.x <= box.max.x && bounds.max.x >= box.min.x
+            && bounds.min.y <= box.max.y && bounds.max.y >= box.min.y && bounds.min.z <= box.max.z && bounds.max.z >= box.min.z;
+    }
+};
+
+//Selects the resources decoded while a file is opened
+struct LoadOptions
+{
+    //Models whose declared bounds lie outside the region are not decoded.
+    const LoadRegion *region;
+    //Decodes only the models, shaders and textures reachable from the root
+    //node of a view pass. An empty view name selects DefaultView, or else
+    //the first view of the file.
+    bool reachable_only;
+    std::string view_name;
+    unsigned int pass_index;
+    //Reads only the declaration section; FileStructure::load_continuations
+    //streams in the rest. The region must stay valid until then.
+    bool structure_only;
+    //Mipmap and compression stages run by create_context
+    TextureOptions textures;
+    //Tried before the built-in resolver of file URIs and relative paths,
+    //for images on remote hosts. Must outlive the file structure.
+    UriResolver *uri_resolver;
+    //Decoded images are looked up here by content before being decoded,
+    //and stored once processed. Must outlive the file structure.
+    const TextureCache *texture_cache;
+    //Leaves the textures outside atlases to be decoded and uploaded when
+    //first drawn, so the file structure must outlive the context. With a
+    //pool passed to create_context, which must then outlive the context
+    //too, they decode in the background while the default texture stands in.
+    bool lazy_textures;
+    //Linked shader programs are saved in this existing directory and loaded
+    //back by later runs on the same driver. Empty disables it.
+    std::string program_binary_directory;
+    LoadOptions() : region(NULL), reachable_only(false), pass_index(0), structure_only(false), uri_resolver(NULL), texture_cache(NULL), lazy_textures(false) {}
+};
+
 class FileStructure
 {
     std::map<std::string, ModelResource *> models;
@@ -30,9 +80,37 @@ class FileStructure
     std::map<std::string, LitTextureShader *> shaders;
     std::map<std::string, Material *> materials;
     std::map<std::string, Node *> nodes;
+    std::map<std::string, std::vector<std::streampos> > model_continuations, texture_continuations;
     BitStreamReader reader;
+    FileUriResolver file_resolver;
+    bool release_after_upload;
+    //Resources left undecoded by the load options, which create_context leaves out
+    std::set<std::string> skipped_models, skipped_textures, skipped_shaders;
+    LoadOptions options;
+    //End of the declaration section when the header declares it, and the
+    //first block left for load_continuations
+    std::streamoff declaration_end;
+    std::streampos continuation_start;
+    bool continuations_loaded;
+    //Node graph compiled on first use; nodes are numbered in name order.
+    TransformHierarchy hierarchy;
+    std::vector<Node *> node_list;
+    std::vector<std::string> node_names;
+    std::map<const Node *, unsigned int> node_indices;
+    bool hierarchy_valid;
+    std::vector<TextureTiming> texture_timings;
+    TextureAtlasStats atlas_stats;
+    void compile_hierarchy();
+    //Walks the parents recursively, for roots other than the World.
+    bool get_path_transform(Matrix4f *mat, const Node *node, const Node *root);
+    bool get_path(std::vector<Matrix4f>& path, const Node *node, const Node *root);
+    void get_path_transforms(std::vector<Matrix4f>& transforms, const Node *node, const Node *root);
 public:
-    FileStructure(const std::string& filename);
+    //Continuations of the resources rejected by the options are recorded
+    //but not decoded.
+    FileStructure(const std::string& filename, const LoadOptions& options = LoadOptions());
+    //Second phase of a structure-only open. Does nothing once loaded.
+    void load_continuations();
     ~FileStructure() {
         for(std::map<std::string, ModelResource *>::iterator i = models.begin(); i != models.end(); i++) delete i->second;
         for(std::map<std::string, LightResource *>::iterator i = lights.begin(); i != lights.end(); i++) delete i->second;
@@ -53,36 +131,68 @@ public:
     View *get_view(const std::string& name) {
         std::map<std::string, Node *>::iterator i = nodes.find(name);
         if(i != nodes.end()) {
-            return dynamic_cast<View *>(nodes[name]);
+            return node_cast<View>(i->second);
         } else {
             return NULL;
         }
     }
     View *get_first_view() {
         for(std::map<std::string, Node *>::iterator i = nodes.begin(); i != nodes.end(); i++) {
-            View *view = dynamic_cast<View *>(i->second);
+            View *view = node_cast<View>(i->second);
             if(view != NULL) return view;
         }
         return NULL;
     }
-    bool get_world_transform(Matrix4f *mat, const Node *node, const Node *root) {
-        if(node == root) {
-            return true;
-        } else {
-            for(std::vector<Node::Parent>::const_iterator i = node->parents.begin(); i != node->parents.end(); i++) {
-                Node *parent = nodes[i->name];
-                if(get_world_transform(mat, parent, root)) {
-                    *mat = (*mat) * i->transform;
-                    return true;
-                }
-            }
-        }
-        return false;
+    //Transform of the first path from the node up to root.
+    bool get_world_transform(Matrix4f *mat, const Node *node, const Node *root);
+    //Appends the transform of every path from the node up to root, so that
+    //a node reached through several parents yields one transform per path.
+    void get_world_transforms(std::vector<Matrix4f>& transforms, const Node *node, const Node *root);
+    //Replaces the transform a node receives from one of its parents. Only
+    //the instances below it are recomputed. The models among them are moved
+    //in the scene given, which must have been created from this file; other
+    //scenes and pickers keep the transforms they were created with.
+    bool set_parent_transform(const std::string& name, unsigned int parent_index, const Matrix4f& transform, SceneGraph *scene = NULL);
+    //When release_geometry is set, decoded meshes are freed once uploaded.
+    //Texture images are decoded on the pool, or on a pool of one thread per
+    //CPU when none is given, while the GL work stays on the calling thread.
+    GraphicsContext *create_context(bool release_geometry = false, WorkerPool *pool = NULL);
+    //Times, sizes and compression errors of the images decoded for the last
+    //context created, each named after the first texture showing it
+    const std::vector<TextureTiming>& get_texture_timings() const {
+        return texture_timings;
+    }
+    //Pages packed for the last context created. Textures in the atlas are
+    //listed in the timings with their decode time only.
+    const TextureAtlasStats& get_atlas_stats() const {
+        return atlas_stats;
+    }
+    //Decodes a model again from the continuation blocks recorded at load time.
+    bool decode_model(const std::string& name);
+    bool decode_texture(const std::string& name);
+    //Decodes the skipped resources reachable from a view pass, so that a
+    //context created afterwards can render it.
+    bool decode_reachable(const View *view, unsigned int pass_index, const LoadRegion *region = NULL);
+    const std::set<std::string>& get_skipped_models() const {
+        return skipped_models;
+    }
+    const std::set<std::string>& get_skipped_textures() const {
+        return skipped_textures;
     }
-    GraphicsContext *create_context();
+    bool reload_render_group(GraphicsContext *context, const std::string& name);
     SceneGraph *create_scenegraph(const View *view, int pass_index);
+    //Builds the ray picking hierarchy over the models of a scene. Meshes whose
+    //geometry was released after upload are decoded again for the build.
+    Picker *create_picker(const SceneGraph& scene, WorkerPool *pool = NULL);
     void dump_tree(FILE *fp);
 private:
+    bool at_continuations();
+    void read_blocks(bool defer_continuations, bool declarations_only);
+    void find_models_outside(const LoadRegion& region, std::set<std::string>& outside);
+    void decode_selected(const std::set<std::string>& model_names, const std::set<std::string>& shader_names,
+                         const std::set<std::string>& texture_names, const LoadRegion *region);
+    void build_child_map(std::map<std::string, std::vector<std::pair<std::string, unsigned int> > >& tree);
+    void decode_model_continuation(const std::string& name);
     void dump_tree_recursive(FILE *fp, std::map<std::string, std::vector<std::string> >& tree, const std::string& name, int depth);
 };
 }
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2016 Hiroka Ihara
+ *
+ * This file is part of libU3D.
+ *
+ * libU3D is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libU3D is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libU3D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "u3d_internal.hh"
+
+namespace U3D
+{
+
+std::map<GLuint, GraphicsContext::TextureReference> GraphicsContext::texture_references;
+std::map<ContentHash, GLuint> GraphicsContext::shared_textures;
+
+GraphicsContext::~GraphicsContext()
+{
+    //The provider may still be adding textures.
+    delete texture_provider;
+    delete device;
+    for(std::vector<ShaderGroup *>::iterator i = shader_groups.begin(); i != shader_groups.end(); i++) {
+        if(*i != NULL) delete *i;
+    }
+    for(std::vector<GLuint>::iterator i = textures.begin(); i != textures.end(); i++) {
+        if(*i != 0 && !is_managed(*i)) release_texture(*i);
+    }
+    delete texture_residency;
+    for(std::vector<RenderGroup *>::iterator i = render_groups.begin(); i != render_groups.end(); i++) {
+        if(*i != NULL) delete *i;
+    }
+}
+
+void GraphicsContext::set_texture(uint32_t handle, GLuint texture)
+{
+    if(texture != 0 && !is_managed(texture)) {
+        std::map<GLuint, TextureReference>::iterator i = texture_references.find(texture);
+        if(i != texture_references.end()) {
+            i->second.count++;
+        } else {
+            TextureReference reference;
+            reference.count = 1;
+            reference.shared = false;
+            texture_references.insert(std::make_pair(texture, reference));
+        }
+    }
+    if(textures[handle] != 0 && !is_managed(textures[handle])) release_texture(textures[handle]);
+    textures[handle] = texture;
+}
+
+bool GraphicsContext::is_managed(GLuint texture) const
+{
+    return texture_residency != NULL && texture_residency->contains(texture);
+}
+
+void GraphicsContext::update_textures()
+{
+    if(texture_provider != NULL) texture_provider->update(*this);
+    if(texture_residency != NULL) texture_residency->update();
+}
+
+void GraphicsContext::set_texture_residency(TextureResidency *residency)
+{
+    delete texture_residency;
+    texture_residency = residency;
+}
+
+GLuint GraphicsContext::add_managed_texture(const std::string& name, TextureImage& image, TextureSource *source)
+{
+    if(texture_residency == NULL) {
+        delete source;
+        throw U3D_ERROR << "Texture " << name << " is managed, but the context has no residency.";
+    }
+    GLuint texture = texture_residency->add(image, source);
+    set_texture(get_texture_handle(name), texture);
+    return texture;
+}
+
+void GraphicsContext::request_texture_size(uint32_t handle, float pixels)
+{
+    if(texture_residency != NULL && textures[handle] != 0) texture_residency->request(textures[handle], pixels);
+}
+
+void GraphicsContext::release_texture(GLuint texture)
+{
+    std::map<GLuint, TextureReference>::iterator i = texture_references.find(texture);
+    if(i == texture_references.end() || --i->second.count > 0) return;
+    if(i->second.shared) shared_textures.erase(i->second.content.hash);
+    texture_references.erase(i);
+    glDeleteTextures(1, &texture);
+}
+
+void GraphicsContext::add_texture(const std::string& name, GLuint texture, const TextureContent& content)
+{
+    set_texture(get_texture_handle(name), texture);
+    std::map<GLuint, TextureReference>::iterator i = texture_references.find(texture);
+    if(i != texture_references.end() && !i->second.shared && shared_textures.count(content.hash) == 0) {
+        i->second.shared = true;
+        i->second.content = content;
+        shared_textures[content.hash] = texture;
+    }
+}
+
+bool GraphicsContext::add_shared_texture(const std::string& name, const TextureContent& content)
+{
+    std::map<ContentHash, GLuint>::iterator i = shared_textures.find(content.hash);
+    if(i == shared_textures.end()) return false;
+    if(!texture_references[i->second].content.matches(content)) {
+        U3D_WARNING << "Texture " << name << " has the content hash of another texture, but not its content." << std::endl;
+        return false;
+    }
+    set_texture(get_texture_handle(name), i->second);
+    return true;
+}
+
+unsigned int GraphicsContext::get_texture_references(GLuint texture)
+{
+    std::map<GLuint, TextureReference>::const_iterator i = texture_references.find(texture);
+    return i != texture_references.end() ? i->second.count : 0;
+}
+
+}
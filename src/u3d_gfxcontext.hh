@@ -18,66 +18,198 @@
  */
 
 #pragma once
-
+
 namespace U3D
 {
+class GraphicsContext;
+class TextureResidency;
+class TextureSource;
+struct TextureImage;
+
+//What a texture was made from: the bytes it was decoded from, with the
+//options that changed it. The hash finds textures of the same content,
+//and the size and the bytes confirm the match.
+struct TextureContent
+{
+    ContentHash hash;
+    uint32_t width, height;
+    std::vector<uint8_t> bytes;
+    TextureContent() : width(0), height(0) {}
+    bool matches(const TextureContent& other) const
+    {
+        return hash == other.hash && width == other.width && height == other.height && bytes == other.bytes;
+    }
+};
+
+//Supplies the textures a context leaves out until they are first drawn.
+class TextureProvider
+{
+public:
+    virtual ~TextureProvider() {}
+    //Called once for a texture name when it is first drawn without a
+    //texture. The provider adds the texture, or a stand-in, by that name.
+    virtual void request(GraphicsContext& context, const std::string& name) = 0;
+    //Called on the GL thread before each frame is drawn.
+    virtual void update(GraphicsContext& context) = 0;
+};
+
+//Resources are looked up by handles interned from their names. A handle
+//stays valid for the lifetime of the context, and a resource added under
+//its name later on, or replacing an earlier one, is found through it.
 class GraphicsContext
 {
-    std::map<std::string, ShaderGroup *> shader_groups;
-    std::map<std::string, GLuint> textures;
-    std::map<std::string, RenderGroup *> render_groups;
+    BufferArena arena;
+    RenderDevice *device;
+    ShaderCache shader_cache;
+    NameTable shader_group_names, texture_names, render_group_names;
+    std::vector<ShaderGroup *> shader_groups;
+    std::vector<GLuint> textures;
+    TextureProvider *texture_provider;
+    std::vector<bool> texture_requested;
+    //Managed textures belong to the residency rather than being counted.
+    TextureResidency *texture_residency;
+    std::vector<RenderGroup *> render_groups;
+    //Textures are counted by their GL names over every context in the
+    //process, and deleted with their last reference. The names are only
+    //meaningful within one share group, so all the contexts of a process
+    //must be used with GL contexts of a single share group, on one thread.
+    //Shared textures keep their content to confirm matches.
+    struct TextureReference
+    {
+        unsigned int count;
+        bool shared;
+        TextureContent content;
+    };
+    static std::map<GLuint, TextureReference> texture_references;
+    static std::map<ContentHash, GLuint> shared_textures;
+    void set_texture(uint32_t handle, GLuint texture);
+    static void release_texture(GLuint texture);
+    bool is_managed(GLuint texture) const;
 public:
-    GraphicsContext() {}
-    ~GraphicsContext() {
-        for(std::map<std::string, ShaderGroup *>::iterator i = shader_groups.begin(); i != shader_groups.end(); i++) {
-            delete i->second;
-        }
-        for(std::map<std::string, GLuint>::iterator i = textures.begin(); i != textures.end(); i++) {
-            GLuint texture = i->second;
-            glDeleteTextures(1, &texture);
+    GraphicsContext() : arena(new GLBufferBackend()), device(new GLRenderDevice()), texture_provider(NULL), texture_residency(NULL) {}
+    //The context takes ownership of the backend and the device.
+    GraphicsContext(BufferBackend *buffer_backend, RenderDevice *device) : arena(buffer_backend), device(device), texture_provider(NULL), texture_residency(NULL) {}
+    ~GraphicsContext();
+    BufferArena& get_buffer_arena()
+    {
+        return arena;
+    }
+    RenderDevice& get_render_device()
+    {
+        return *device;
+    }
+    //Programs of the shader groups, which are deleted with the context
+    ShaderCache& get_shader_cache()
+    {
+        return shader_cache;
+    }
+    uint32_t get_shader_group_handle(const std::string& name)
+    {
+        uint32_t handle = shader_group_names.intern(name);
+        if(handle >= shader_groups.size()) shader_groups.resize(handle + 1, NULL);
+        return handle;
+    }
+    uint32_t get_texture_handle(const std::string& name)
+    {
+        uint32_t handle = texture_names.intern(name);
+        if(handle >= textures.size()) {
+            textures.resize(handle + 1, 0);
+            texture_requested.resize(handle + 1, false);
         }
-        for(std::map<std::string, RenderGroup *>::iterator i = render_groups.begin(); i != render_groups.end(); i++) {
-            delete i->second;
+        return handle;
+    }
+    uint32_t get_render_group_handle(const std::string& name)
+    {
+        uint32_t handle = render_group_names.intern(name);
+        if(handle >= render_groups.size()) render_groups.resize(handle + 1, NULL);
+        return handle;
+    }
+    ShaderGroup *get_shader_group(uint32_t handle)
+    {
+        return shader_groups[handle];
+    }
+    GLuint get_texture(uint32_t handle)
+    {
+        return textures[handle];
+    }
+    //As get_texture, but asks the texture provider the first time a
+    //texture is missing. Only the draw path should call this.
+    GLuint acquire_texture(uint32_t handle)
+    {
+        if(textures[handle] == 0 && texture_provider != NULL && !texture_requested[handle]) {
+            texture_requested[handle] = true;
+            texture_provider->request(*this, texture_names.get_name(handle));
         }
+        return textures[handle];
+    }
+    //The context takes ownership of the provider.
+    void set_texture_provider(TextureProvider *provider)
+    {
+        delete texture_provider;
+        texture_provider = provider;
+        texture_requested.assign(textures.size(), false);
+    }
+    //Lets the provider add the textures finished since the last frame, and
+    //the residency stream levels for the sizes requested during it.
+    void update_textures();
+    //The context takes ownership of the residency, which must be set before
+    //any managed texture is added.
+    void set_texture_residency(TextureResidency *residency);
+    TextureResidency *get_texture_residency()
+    {
+        return texture_residency;
+    }
+    //Adds a texture whose levels the residency streams, taking the contents
+    //of the image and the source. Other names refer to it through add_texture.
+    GLuint add_managed_texture(const std::string& name, TextureImage& image, TextureSource *source = NULL);
+    //Records that a texture is drawn over a model spanning the given pixels.
+    void request_texture_size(uint32_t handle, float pixels);
+    RenderGroup *get_render_group(uint32_t handle)
+    {
+        return render_groups[handle];
     }
     ShaderGroup *get_shader_group(const std::string& name)
     {
-        std::map<std::string, ShaderGroup *>::iterator i = shader_groups.find(name);
-        if(i != shader_groups.end()) {
-            return i->second;
-        } else {
-            return NULL;
-        }
+        uint32_t handle = shader_group_names.find(name);
+        return handle != NameTable::NONE ? shader_groups[handle] : NULL;
     }
     GLuint get_texture(const std::string& name)
     {
-        std::map<std::string, GLuint>::iterator i = textures.find(name);
-        if(i != textures.end()) {
-            return i->second;
-        } else {
-            return 0;
-        }
+        uint32_t handle = texture_names.find(name);
+        return handle != NameTable::NONE ? textures[handle] : 0;
     }
     RenderGroup *get_render_group(const std::string& name)
     {
-        std::map<std::string, RenderGroup *>::iterator i = render_groups.find(name);
-        if(i != render_groups.end()) {
-            return i->second;
-        } else {
-            return 0;
-        }
+        uint32_t handle = render_group_names.find(name);
+        return handle != NameTable::NONE ? render_groups[handle] : NULL;
     }
     void add_shader_group(const std::string& name, ShaderGroup *shader_group)
     {
-        shader_groups[name] = shader_group;
+        for(int i = 0; shader_group != NULL && i < 8; i++) {
+            shader_group->texture_handles[i] = get_texture_handle(shader_group->texture_names[i]);
+        }
+        shader_groups[get_shader_group_handle(name)] = shader_group;
     }
+    //The context takes a reference to the texture.
     void add_texture(const std::string& name, GLuint texture)
     {
-        textures[name] = texture;
+        set_texture(get_texture_handle(name), texture);
     }
+    //Also offers the texture to other contexts asking for the same content,
+    //a copy of which is kept while the texture is shared.
+    void add_texture(const std::string& name, GLuint texture, const TextureContent& content);
+    //Adds a texture some context already holds with the given content, and
+    //returns false if there is none.
+    bool add_shared_texture(const std::string& name, const TextureContent& content);
+    //Number of contexts and names referring to a texture
+    static unsigned int get_texture_references(GLuint texture);
     void add_render_group(const std::string& name, RenderGroup *render_group)
     {
-        render_groups[name] = render_group;
+        uint32_t handle = get_render_group_handle(name);
+        if(render_groups[handle] != NULL) {
+            delete render_groups[handle];
+        }
+        render_groups[handle] = render_group;
     }
 };
 }
@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2016 Hiroka Ihara
+ *
+ * This file is part of libU3D.
+ *
+ * libU3D is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libU3D is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libU3D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "u3d_internal.hh"
+
+namespace U3D
+{
+
+const unsigned int TransformHierarchy::NONE;
+
+void TransformHierarchy::clear()
+{
+    entries.clear();
+    local_transforms.clear();
+    world_transforms.clear();
+    dirty.clear();
+    dirty_entries.clear();
+    instances.clear();
+    primary_instances.clear();
+}
+
+void TransformHierarchy::build(const std::vector<const Node *>& nodes, const std::map<std::string, unsigned int>& indices, unsigned int root)
+{
+    clear();
+    //Children are listed in node order, then by parent record.
+    std::vector<std::vector<std::pair<unsigned int, unsigned int> > > children(nodes.size());
+    std::vector<std::vector<unsigned int> > parent_nodes(nodes.size());
+    for(unsigned int i = 0; i < nodes.size(); i++) {
+        parent_nodes[i].resize(nodes[i]->parents.size(), NONE);
+        for(unsigned int j = 0; j < nodes[i]->parents.size(); j++) {
+            std::map<std::string, unsigned int>::const_iterator parent = indices.find(nodes[i]->parents[j].name);
+            if(parent == indices.end()) continue;
+            parent_nodes[i][j] = parent->second;
+            children[parent->second].push_back(std::make_pair(i, j));
+        }
+    }
+    instances.resize(nodes.size());
+    std::vector<uint8_t> on_path(nodes.size(), 0);
+    std::set<unsigned int> cyclic;
+    append(children, root, NONE, NONE, on_path, cyclic);
+    for(std::map<std::string, unsigned int>::const_iterator i = indices.begin(); i != indices.end(); i++) {
+        if(cyclic.count(i->second) > 0) {
+            U3D_WARNING << "Node \"" << i->first << "\" is its own ancestor." << std::endl;
+        }
+    }
+    for(unsigned int i = 0; i < entries.size(); i++) {
+        if(entries[i].slot != NONE) {
+            local_transforms[i] = nodes[entries[i].node]->parents[entries[i].slot].transform;
+        }
+    }
+    world_transforms.resize(entries.size());
+    for(unsigned int i = 0; i < entries.size(); i++) {
+        const Entry& entry = entries[i];
+        world_transforms[i] = entry.parent == NONE ? local_transforms[i] : world_transforms[entry.parent] * local_transforms[i];
+    }
+    dirty.assign(entries.size(), 0);
+    //0: not visited, 1: on the current path, 2: resolved
+    std::vector<uint8_t> state(nodes.size(), 0);
+    primary_instances.assign(nodes.size(), NONE);
+    primary_instances[root] = instances[root].empty() ? NONE : instances[root][0];
+    state[root] = 2;
+    for(unsigned int i = 0; i < nodes.size(); i++) {
+        find_primary(parent_nodes, i, state);
+    }
+}
+
+void TransformHierarchy::append(const std::vector<std::vector<std::pair<unsigned int, unsigned int> > >& children,
+                                unsigned int node, unsigned int parent, unsigned int slot, std::vector<uint8_t>& on_path, std::set<unsigned int>& cyclic)
+{
+    unsigned int index = entries.size();
+    Entry entry;
+    entry.node = node, entry.parent = parent, entry.slot = slot, entry.end = index + 1;
+    entries.push_back(entry);
+    local_transforms.push_back(Matrix4f());
+    instances[node].push_back(index);
+    on_path[node] = 1;
+    for(unsigned int i = 0; i < children[node].size(); i++) {
+        unsigned int child = children[node][i].first;
+        if(on_path[child]) {
+            cyclic.insert(child);
+            continue;
+        }
+        append(children, child, index, children[node][i].second, on_path, cyclic);
+    }
+    on_path[node] = 0;
+    entries[index].end = entries.size();
+}
+
+unsigned int TransformHierarchy::find_primary(const std::vector<std::vector<unsigned int> >& parent_nodes, unsigned int node, std::vector<uint8_t>& state)
+{
+    if(state[node] != 0) return state[node] == 2 ? primary_instances[node] : NONE;
+    if(instances[node].empty()) {
+        state[node] = 2;
+        return NONE;
+    }
+    state[node] = 1;
+    for(unsigned int j = 0; j < parent_nodes[node].size() && primary_instances[node] == NONE; j++) {
+        if(parent_nodes[node][j] == NONE) continue;
+        unsigned int parent = find_primary(parent_nodes, parent_nodes[node][j], state);
+        if(parent == NONE) continue;
+        for(unsigned int k = 0; k < instances[node].size(); k++) {
+            const Entry& entry = entries[instances[node][k]];
+            if(entry.parent == parent && entry.slot == j) {
+                primary_instances[node] = instances[node][k];
+                break;
+            }
+        }
+    }
+    //A failure caused by a cycle through the current path is not final.
+    state[node] = primary_instances[node] == NONE ? 0 : 2;
+    return primary_instances[node];
+}
+
+void TransformHierarchy::set_local_transform(unsigned int node, unsigned int slot, const Matrix4f& transform)
+{
+    if(node >= instances.size()) return;
+    for(unsigned int i = 0; i < instances[node].size(); i++) {
+        unsigned int index = instances[node][i];
+        if(entries[index].slot != slot) continue;
+        local_transforms[index] = transform;
+        if(!dirty[index]) {
+            dirty[index] = 1;
+            dirty_entries.push_back(index);
+        }
+    }
+}
+
+void TransformHierarchy::update()
+{
+    if(dirty_entries.empty()) return;
+    //In entry order, a dirty entry inside an updated range is already covered.
+    std::sort(dirty_entries.begin(), dirty_entries.end());
+    unsigned int covered = 0;
+    for(unsigned int i = 0; i < dirty_entries.size(); i++) {
+        unsigned int first = dirty_entries[i];
+        dirty[first] = 0;
+        if(first < covered) continue;
+        for(unsigned int j = first; j < entries[first].end; j++) {
+            const Entry& entry = entries[j];
+            world_transforms[j] = entry.parent == NONE ? local_transforms[j] : world_transforms[entry.parent] * local_transforms[j];
+        }
+        covered = entries[first].end;
+    }
+    dirty_entries.clear();
+}
+
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2016 Hiroka Ihara
+ *
+ * This file is part of libU3D.
+ *
+ * libU3D is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libU3D is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libU3D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+namespace U3D
+{
+
+//The node graph compiled into instances: every path from the root to a node
+//is one entry, laid out in depth-first order so that parents precede their
+//children and each subtree occupies a contiguous range.
+class TransformHierarchy
+{
+public:
+    static const unsigned int NONE = 0xFFFFFFFF;
+    struct Entry
+    {
+        unsigned int node;
+        //Parent entry, and the index of the parent record of the node it came through
+        unsigned int parent, slot;
+        //One past the last entry of the subtree
+        unsigned int end;
+    };
+private:
+    std::vector<Entry> entries;
+    std::vector<Matrix4f> local_transforms, world_transforms;
+    std::vector<uint8_t> dirty;
+    std::vector<unsigned int> dirty_entries;
+    std::vector<std::vector<unsigned int> > instances;
+    std::vector<unsigned int> primary_instances;
+    void append(const std::vector<std::vector<std::pair<unsigned int, unsigned int> > >& children,
+                unsigned int node, unsigned int parent, unsigned int slot, std::vector<uint8_t>& on_path, std::set<unsigned int>& cyclic);
+    unsigned int find_primary(const std::vector<std::vector<unsigned int> >& parent_nodes, unsigned int node, std::vector<uint8_t>& state);
+public:
+    //Nodes are numbered from 0 in the order of the list, and their parents
+    //are looked up by name. Parents missing from the list are ignored.
+    void build(const std::vector<const Node *>& nodes, const std::map<std::string, unsigned int>& indices, unsigned int root);
+    void clear();
+    //Recomputes the world transforms of the subtrees below changed entries.
+    void update();
+    //Changes the transform a node receives from one of its parents.
+    void set_local_transform(unsigned int node, unsigned int slot, const Matrix4f& transform);
+    unsigned int get_entry_count() const
+    {
+        return entries.size();
+    }
+    const Entry& get_entry(unsigned int index) const
+    {
+        return entries[index];
+    }
+    const Matrix4f& get_world_transform(unsigned int index) const
+    {
+        return world_transforms[index];
+    }
+    const std::vector<unsigned int>& get_instances(unsigned int node) const
+    {
+        return instances[node];
+    }
+    //The instance reached through the first parent of each node on the way
+    //up that leads to the root; NONE when the node is not under the root.
+    unsigned int get_primary_instance(unsigned int node) const
+    {
+        return primary_instances[node];
+    }
+    bool is_dirty() const
+    {
+        return !dirty_entries.empty();
+    }
+};
+
+}
@@ -22,6 +22,8 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
+#include <deque>
 #include <algorithm>
 #include <iostream>
 #include <fstream>
@@ -33,6 +35,9 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include <GL/glew.h>
 #include <SDL.h>
@@ -40,12 +45,24 @@
 
 #include "u3d_util.hh"
 #include "u3d_math.hh"
+#include "u3d_worker.hh"
 #include "u3d_bitstream.hh"
+#include "u3d_buffer.hh"
+#include "u3d_device.hh"
 #include "u3d_shader.hh"
 #include "u3d_clod.hh"
 #include "u3d_mesh.hh"
 #include "u3d_plset.hh"
 #include "u3d_gfxcontext.hh"
+#include "u3d_renderqueue.hh"
 #include "u3d_scenegraph.hh"
+#include "u3d_hierarchy.hh"
+#include "u3d_resolver.hh"
 #include "u3d_texture.hh"
+#include "u3d_pixels.hh"
+#include "u3d_teximage.hh"
+#include "u3d_texcache.hh"
+#include "u3d_residency.hh"
+#include "u3d_atlas.hh"
+#include "u3d_bvh.hh"
 #include "u3d_filestructure.hh"
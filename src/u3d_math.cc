@@ -0,0 +1,319 @@
+/*
+ * Copyright (C) 2016 Hiroka Ihara
+ *
+ * This file is part of libU3D.
+ *
+ * libU3D is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libU3D is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libU3D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "u3d_internal.hh"
+
+namespace U3D
+{
+
+#ifdef __SSE2__
+#define U3D_SHUFFLE(x, y, z, w) _MM_SHUFFLE(w, z, y, x)
+
+namespace
+{
+//Products of 2x2 matrices packed as (a, b, c, d) = [a b; c d], and of their adjugates
+inline __m128 mat2_mul(__m128 a, __m128 b)
+{
+    return _mm_add_ps(_mm_mul_ps(a, _mm_shuffle_ps(b, b, U3D_SHUFFLE(0, 3, 0, 3))),
+                      _mm_mul_ps(_mm_shuffle_ps(a, a, U3D_SHUFFLE(1, 0, 3, 2)), _mm_shuffle_ps(b, b, U3D_SHUFFLE(2, 1, 2, 1))));
+}
+
+inline __m128 mat2_adj_mul(__m128 a, __m128 b)
+{
+    return _mm_sub_ps(_mm_mul_ps(_mm_shuffle_ps(a, a, U3D_SHUFFLE(3, 3, 0, 0)), b),
+                      _mm_mul_ps(_mm_shuffle_ps(a, a, U3D_SHUFFLE(1, 1, 2, 2)), _mm_shuffle_ps(b, b, U3D_SHUFFLE(2, 3, 0, 1))));
+}
+
+inline __m128 mat2_mul_adj(__m128 a, __m128 b)
+{
+    return _mm_sub_ps(_mm_mul_ps(a, _mm_shuffle_ps(b, b, U3D_SHUFFLE(3, 0, 3, 0))),
+                      _mm_mul_ps(_mm_shuffle_ps(a, a, U3D_SHUFFLE(1, 0, 3, 2)), _mm_shuffle_ps(b, b, U3D_SHUFFLE(2, 1, 2, 1))));
+}
+
+inline __m128 splat(__m128 v, int i)
+{
+    switch(i) {
+    case 0: return _mm_shuffle_ps(v, v, U3D_SHUFFLE(0, 0, 0, 0));
+    case 1: return _mm_shuffle_ps(v, v, U3D_SHUFFLE(1, 1, 1, 1));
+    case 2: return _mm_shuffle_ps(v, v, U3D_SHUFFLE(2, 2, 2, 2));
+    default: return _mm_shuffle_ps(v, v, U3D_SHUFFLE(3, 3, 3, 3));
+    }
+}
+
+inline void store3(float *dst, __m128 v)
+{
+    _mm_storel_pi(reinterpret_cast<__m64 *>(dst), v);
+    _mm_store_ss(dst + 2, _mm_movehl_ps(v, v));
+}
+
+//Cross product of the first three lanes; the fourth is zero for finite input.
+inline __m128 cross3(__m128 a, __m128 b)
+{
+    __m128 a_yzx = _mm_shuffle_ps(a, a, U3D_SHUFFLE(1, 2, 0, 3)), b_yzx = _mm_shuffle_ps(b, b, U3D_SHUFFLE(1, 2, 0, 3));
+    __m128 r = _mm_sub_ps(_mm_mul_ps(a, b_yzx), _mm_mul_ps(a_yzx, b));
+    return _mm_shuffle_ps(r, r, U3D_SHUFFLE(1, 2, 0, 3));
+}
+
+//Sum of the first three lanes, in every lane
+inline __m128 dot3(__m128 a, __m128 b)
+{
+    __m128 p = _mm_mul_ps(a, b);
+    return _mm_add_ps(_mm_add_ps(splat(p, 0), splat(p, 1)), splat(p, 2));
+}
+}
+#endif
+
+Matrix4f Matrix4f::create_normal_matrix() const
+{
+#ifdef __SSE2__
+    Matrix4f ret;
+    __m128 a = _mm_loadu_ps(m[0]), b = _mm_loadu_ps(m[1]), c = _mm_loadu_ps(m[2]);
+    __m128 bc = cross3(b, c), ca = cross3(c, a), ab = cross3(a, b);
+    __m128 invdet = _mm_div_ps(_mm_set1_ps(1.0f), dot3(a, bc));
+    store3(ret.m[0], _mm_mul_ps(bc, invdet));
+    store3(ret.m[1], _mm_mul_ps(ca, invdet));
+    store3(ret.m[2], _mm_mul_ps(ab, invdet));
+    return ret;
+#else
+    return create_normal_matrix_scalar();
+#endif
+}
+
+Matrix4f Matrix4f::create_normal_matrix_scalar() const
+{
+    Matrix4f ret;
+    Vector3f a(m[0][0], m[0][1], m[0][2]), b(m[1][0], m[1][1], m[1][2]), c(m[2][0], m[2][1], m[2][2]);
+    Vector3f bc = b ^ c, ca = c ^ a, ab = a ^ b;
+    float invdet = 1.0f / (a * bc);
+    ret.m[0][0] = invdet * bc.x, ret.m[0][1] = invdet * bc.y, ret.m[0][2] = invdet * bc.z;
+    ret.m[1][0] = invdet * ca.x, ret.m[1][1] = invdet * ca.y, ret.m[1][2] = invdet * ca.z;
+    ret.m[2][0] = invdet * ab.x, ret.m[2][1] = invdet * ab.y, ret.m[2][2] = invdet * ab.z;
+    return ret;
+}
+
+//Block inverse over the 2x2 submatrices. The inverse of the transpose is the
+//transpose of the inverse, so the column layout needs no special handling.
+Matrix4f Matrix4f::inverse() const
+{
+#ifdef __SSE2__
+    Matrix4f ret;
+    __m128 r0 = _mm_loadu_ps(m[0]), r1 = _mm_loadu_ps(m[1]), r2 = _mm_loadu_ps(m[2]), r3 = _mm_loadu_ps(m[3]);
+    __m128 A = _mm_movelh_ps(r0, r1), B = _mm_movehl_ps(r1, r0);
+    __m128 C = _mm_movelh_ps(r2, r3), D = _mm_movehl_ps(r3, r2);
+    //Determinants of A, B, C and D
+    __m128 det_sub = _mm_sub_ps(_mm_mul_ps(_mm_shuffle_ps(r0, r2, U3D_SHUFFLE(0, 2, 0, 2)), _mm_shuffle_ps(r1, r3, U3D_SHUFFLE(1, 3, 1, 3))),
+                                _mm_mul_ps(_mm_shuffle_ps(r0, r2, U3D_SHUFFLE(1, 3, 1, 3)), _mm_shuffle_ps(r1, r3, U3D_SHUFFLE(0, 2, 0, 2))));
+    __m128 det_A = splat(det_sub, 0), det_B = splat(det_sub, 1), det_C = splat(det_sub, 2), det_D = splat(det_sub, 3);
+    __m128 D_C = mat2_adj_mul(D, C), A_B = mat2_adj_mul(A, B);
+    __m128 X = _mm_sub_ps(_mm_mul_ps(det_D, A), mat2_mul(B, D_C));
+    __m128 W = _mm_sub_ps(_mm_mul_ps(det_A, D), mat2_mul(C, A_B));
+    __m128 Y = _mm_sub_ps(_mm_mul_ps(det_B, C), mat2_mul_adj(D, A_B));
+    __m128 Z = _mm_sub_ps(_mm_mul_ps(det_C, B), mat2_mul_adj(A, D_C));
+    __m128 tr = _mm_mul_ps(A_B, _mm_shuffle_ps(D_C, D_C, U3D_SHUFFLE(0, 2, 1, 3)));
+    tr = _mm_add_ps(tr, _mm_shuffle_ps(tr, tr, U3D_SHUFFLE(2, 3, 0, 1)));
+    tr = _mm_add_ps(tr, _mm_shuffle_ps(tr, tr, U3D_SHUFFLE(1, 0, 3, 2)));
+    __m128 det = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(det_A, det_D), _mm_mul_ps(det_B, det_C)), tr);
+    __m128 inv_det = _mm_div_ps(_mm_setr_ps(1.0f, -1.0f, -1.0f, 1.0f), det);
+    X = _mm_mul_ps(X, inv_det), Y = _mm_mul_ps(Y, inv_det);
+    Z = _mm_mul_ps(Z, inv_det), W = _mm_mul_ps(W, inv_det);
+    _mm_storeu_ps(ret.m[0], _mm_shuffle_ps(X, Y, U3D_SHUFFLE(3, 1, 3, 1)));
+    _mm_storeu_ps(ret.m[1], _mm_shuffle_ps(X, Y, U3D_SHUFFLE(2, 0, 2, 0)));
+    _mm_storeu_ps(ret.m[2], _mm_shuffle_ps(Z, W, U3D_SHUFFLE(3, 1, 3, 1)));
+    _mm_storeu_ps(ret.m[3], _mm_shuffle_ps(Z, W, U3D_SHUFFLE(2, 0, 2, 0)));
+    return ret;
+#else
+    return inverse_scalar();
+#endif
+}
+
+//Cofactor expansion over the 2x2 minors of the first and last two columns
+Matrix4f Matrix4f::inverse_scalar() const
+{
+    Matrix4f ret;
+    const float *a = m[0];
+    float *b = ret.m[0];
+    float s0 = a[0] * a[5] - a[4] * a[1], s1 = a[0] * a[6] - a[4] * a[2], s2 = a[0] * a[7] - a[4] * a[3];
+    float s3 = a[1] * a[6] - a[5] * a[2], s4 = a[1] * a[7] - a[5] * a[3], s5 = a[2] * a[7] - a[6] * a[3];
+    float c0 = a[8] * a[13] - a[12] * a[9], c1 = a[8] * a[14] - a[12] * a[10], c2 = a[8] * a[15] - a[12] * a[11];
+    float c3 = a[9] * a[14] - a[13] * a[10], c4 = a[9] * a[15] - a[13] * a[11], c5 = a[10] * a[15] - a[14] * a[11];
+    float invdet = 1.0f / (s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0);
+    b[0] = (a[5] * c5 - a[6] * c4 + a[7] * c3) * invdet;
+    b[1] = (-a[1] * c5 + a[2] * c4 - a[3] * c3) * invdet;
+    b[2] = (a[13] * s5 - a[14] * s4 + a[15] * s3) * invdet;
+    b[3] = (-a[9] * s5 + a[10] * s4 - a[11] * s3) * invdet;
+    b[4] = (-a[4] * c5 + a[6] * c2 - a[7] * c1) * invdet;
+    b[5] = (a[0] * c5 - a[2] * c2 + a[3] * c1) * invdet;
+    b[6] = (-a[12] * s5 + a[14] * s2 - a[15] * s1) * invdet;
+    b[7] = (a[8] * s5 - a[10] * s2 + a[11] * s1) * invdet;
+    b[8] = (a[4] * c4 - a[5] * c2 + a[7] * c0) * invdet;
+    b[9] = (-a[0] * c4 + a[1] * c2 - a[3] * c0) * invdet;
+    b[10] = (a[12] * s4 - a[13] * s2 + a[15] * s0) * invdet;
+    b[11] = (-a[8] * s4 + a[9] * s2 - a[11] * s0) * invdet;
+    b[12] = (-a[4] * c3 + a[5] * c1 - a[6] * c0) * invdet;
+    b[13] = (a[0] * c3 - a[1] * c1 + a[2] * c0) * invdet;
+    b[14] = (-a[12] * s3 + a[13] * s1 - a[14] * s0) * invdet;
+    b[15] = (a[8] * s3 - a[9] * s1 + a[10] * s0) * invdet;
+    return ret;
+}
+
+void transform_points(const Matrix4f& mat, const float *src, float *dst, size_t count, size_t stride)
+{
+#ifdef __SSE2__
+    __m128 c0 = _mm_loadu_ps(mat.m[0]), c1 = _mm_loadu_ps(mat.m[1]), c2 = _mm_loadu_ps(mat.m[2]), c3 = _mm_loadu_ps(mat.m[3]);
+    for(size_t i = 0; i < count; i++, src += stride, dst += stride) {
+        __m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(src[0])), _mm_mul_ps(c1, _mm_set1_ps(src[1]))),
+                              _mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(src[2])), c3));
+        store3(dst, r);
+    }
+#else
+    transform_points_scalar(mat, src, dst, count, stride);
+#endif
+}
+
+void transform_points_scalar(const Matrix4f& mat, const float *src, float *dst, size_t count, size_t stride)
+{
+    for(size_t i = 0; i < count; i++, src += stride, dst += stride) {
+        Vector3f p = mat * Vector3f(src[0], src[1], src[2]);
+        dst[0] = p.x, dst[1] = p.y, dst[2] = p.z;
+    }
+}
+
+void transform_normals(const Matrix4f& mat, const float *src, float *dst, size_t count, size_t stride)
+{
+#ifdef __SSE2__
+    Matrix4f normal_matrix = mat.create_normal_matrix();
+    __m128 c0 = _mm_loadu_ps(normal_matrix.m[0]), c1 = _mm_loadu_ps(normal_matrix.m[1]), c2 = _mm_loadu_ps(normal_matrix.m[2]);
+    for(size_t i = 0; i < count; i++, src += stride, dst += stride) {
+        __m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(src[0])), _mm_mul_ps(c1, _mm_set1_ps(src[1]))),
+                              _mm_mul_ps(c2, _mm_set1_ps(src[2])));
+        //The fourth lane is zero, so it drops out of the length.
+        __m128 sq = _mm_mul_ps(r, r);
+        sq = _mm_add_ps(sq, _mm_shuffle_ps(sq, sq, U3D_SHUFFLE(2, 3, 0, 1)));
+        sq = _mm_add_ps(sq, _mm_shuffle_ps(sq, sq, U3D_SHUFFLE(1, 0, 3, 2)));
+        store3(dst, _mm_div_ps(r, _mm_sqrt_ps(sq)));
+    }
+#else
+    transform_normals_scalar(mat, src, dst, count, stride);
+#endif
+}
+
+void transform_normals_scalar(const Matrix4f& mat, const float *src, float *dst, size_t count, size_t stride)
+{
+    Matrix4f normal_matrix = mat.create_normal_matrix_scalar();
+    for(size_t i = 0; i < count; i++, src += stride, dst += stride) {
+        Vector3f n = (normal_matrix * Vector3f(src[0], src[1], src[2])).normalize();
+        dst[0] = n.x, dst[1] = n.y, dst[2] = n.z;
+    }
+}
+
+//Transforms the center and accumulates the extent through the absolute
+//values of the linear part.
+void transform_boxes(const Matrix4f& mat, const BoundingBox3f *src, BoundingBox3f *dst, size_t count)
+{
+#ifdef __SSE2__
+    __m128 c0 = _mm_loadu_ps(mat.m[0]), c1 = _mm_loadu_ps(mat.m[1]), c2 = _mm_loadu_ps(mat.m[2]), c3 = _mm_loadu_ps(mat.m[3]);
+    __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+    __m128 a0 = _mm_and_ps(c0, abs_mask), a1 = _mm_and_ps(c1, abs_mask), a2 = _mm_and_ps(c2, abs_mask);
+    __m128 half = _mm_set1_ps(0.5f);
+    for(size_t i = 0; i < count; i++) {
+        if(src[i].empty()) {
+            dst[i] = src[i];
+            continue;
+        }
+        __m128 lo = _mm_setr_ps(src[i].min.x, src[i].min.y, src[i].min.z, 0), hi = _mm_setr_ps(src[i].max.x, src[i].max.y, src[i].max.z, 0);
+        __m128 center = _mm_mul_ps(_mm_add_ps(lo, hi), half), extent = _mm_mul_ps(_mm_sub_ps(hi, lo), half);
+        __m128 new_center = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, splat(center, 0)), _mm_mul_ps(c1, splat(center, 1))),
+                                       _mm_add_ps(_mm_mul_ps(c2, splat(center, 2)), c3));
+        __m128 new_extent = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a0, splat(extent, 0)), _mm_mul_ps(a1, splat(extent, 1))),
+                                       _mm_mul_ps(a2, splat(extent, 2)));
+        store3(&dst[i].min.x, _mm_sub_ps(new_center, new_extent));
+        store3(&dst[i].max.x, _mm_add_ps(new_center, new_extent));
+    }
+#else
+    transform_boxes_scalar(mat, src, dst, count);
+#endif
+}
+
+//Accumulates each axis from the matrix entries, picking the end of the
+//box that minimizes or maximizes every term.
+void transform_boxes_scalar(const Matrix4f& mat, const BoundingBox3f *src, BoundingBox3f *dst, size_t count)
+{
+    for(size_t k = 0; k < count; k++) {
+        if(src[k].empty()) {
+            dst[k] = src[k];
+            continue;
+        }
+        float lo[3] = {src[k].min.x, src[k].min.y, src[k].min.z}, hi[3] = {src[k].max.x, src[k].max.y, src[k].max.z};
+        float new_lo[3], new_hi[3];
+        for(int i = 0; i < 3; i++) {
+            new_lo[i] = new_hi[i] = mat.m[3][i];
+            for(int j = 0; j < 3; j++) {
+                float a = mat.m[j][i] * lo[j], b = mat.m[j][i] * hi[j];
+                new_lo[i] += std::min(a, b);
+                new_hi[i] += std::max(a, b);
+            }
+        }
+        dst[k].min = Vector3f(new_lo[0], new_lo[1], new_lo[2]);
+        dst[k].max = Vector3f(new_hi[0], new_hi[1], new_hi[2]);
+    }
+}
+
+BoundingBox3f BoundingBox3f::transform(const Matrix4f& mat) const
+{
+    BoundingBox3f ret;
+    transform_boxes(mat, this, &ret, 1);
+    return ret;
+}
+
+//The running product stays in registers from one matrix to the next.
+Matrix4f multiply_chain(const Matrix4f *matrices, size_t count)
+{
+#ifdef __SSE2__
+    __m128 c0 = _mm_setr_ps(1.0f, 0, 0, 0), c1 = _mm_setr_ps(0, 1.0f, 0, 0), c2 = _mm_setr_ps(0, 0, 1.0f, 0), c3 = _mm_setr_ps(0, 0, 0, 1.0f);
+    for(size_t i = 0; i < count; i++) {
+        const float (*b)[4] = matrices[i].m;
+        __m128 r[4];
+        for(int j = 0; j < 4; j++) {
+            r[j] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(b[j][0])), _mm_mul_ps(c1, _mm_set1_ps(b[j][1]))),
+                              _mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(b[j][2])), _mm_mul_ps(c3, _mm_set1_ps(b[j][3]))));
+        }
+        c0 = r[0], c1 = r[1], c2 = r[2], c3 = r[3];
+    }
+    Matrix4f ret;
+    _mm_storeu_ps(ret.m[0], c0);
+    _mm_storeu_ps(ret.m[1], c1);
+    _mm_storeu_ps(ret.m[2], c2);
+    _mm_storeu_ps(ret.m[3], c3);
+    return ret;
+#else
+    return multiply_chain_scalar(matrices, count);
+#endif
+}
+
+Matrix4f multiply_chain_scalar(const Matrix4f *matrices, size_t count)
+{
+    Matrix4f ret;
+    for(size_t i = 0; i < count; i++) {
+        ret = ret.multiply_scalar(matrices[i]);
+    }
+    return ret;
+}
+
+}
@@ -141,59 +141,50 @@ struct Matrix4f
         }
     }
     Matrix4f operator*(const Matrix4f& mat) const {
+#ifdef __SSE2__
         Matrix4f ret;
-        ret.m[0][0] = m[0][0] * mat.m[0][0] + m[1][0] * mat.m[0][1] + m[2][0] * mat.m[0][2] + m[3][0] * mat.m[0][3];
-        ret.m[1][0] = m[0][0] * mat.m[1][0] + m[1][0] * mat.m[1][1] + m[2][0] * mat.m[1][2] + m[3][0] * mat.m[1][3];
-        ret.m[2][0] = m[0][0] * mat.m[2][0] + m[1][0] * mat.m[2][1] + m[2][0] * mat.m[2][2] + m[3][0] * mat.m[2][3];
-        ret.m[3][0] = m[0][0] * mat.m[3][0] + m[1][0] * mat.m[3][1] + m[2][0] * mat.m[3][2] + m[3][0] * mat.m[3][3];
-
-        ret.m[0][1] = m[0][1] * mat.m[0][0] + m[1][1] * mat.m[0][1] + m[2][1] * mat.m[0][2] + m[3][1] * mat.m[0][3];
-        ret.m[1][1] = m[0][1] * mat.m[1][0] + m[1][1] * mat.m[1][1] + m[2][1] * mat.m[1][2] + m[3][1] * mat.m[1][3];
-        ret.m[2][1] = m[0][1] * mat.m[2][0] + m[1][1] * mat.m[2][1] + m[2][1] * mat.m[2][2] + m[3][1] * mat.m[2][3];
-        ret.m[3][1] = m[0][1] * mat.m[3][0] + m[1][1] * mat.m[3][1] + m[2][1] * mat.m[3][2] + m[3][1] * mat.m[3][3];
-
-        ret.m[0][2] = m[0][2] * mat.m[0][0] + m[1][2] * mat.m[0][1] + m[2][2] * mat.m[0][2] + m[3][2] * mat.m[0][3];
-        ret.m[1][2] = m[0][2] * mat.m[1][0] + m[1][2] * mat.m[1][1] + m[2][2] * mat.m[1][2] + m[3][2] * mat.m[1][3];
-        ret.m[2][2] = m[0][2] * mat.m[2][0] + m[1][2] * mat.m[2][1] + m[2][2] * mat.m[2][2] + m[3][2] * mat.m[2][3];
-        ret.m[3][2] = m[0][2] * mat.m[3][0] + m[1][2] * mat.m[3][1] + m[2][2] * mat.m[3][2] + m[3][2] * mat.m[3][3];
-
-        ret.m[0][3] = m[0][3] * mat.m[0][0] + m[1][3] * mat.m[0][1] + m[2][3] * mat.m[0][2] + m[3][3] * mat.m[0][3];
-        ret.m[1][3] = m[0][3] * mat.m[1][0] + m[1][3] * mat.m[1][1] + m[2][3] * mat.m[1][2] + m[3][3] * mat.m[1][3];
-        ret.m[2][3] = m[0][3] * mat.m[2][0] + m[1][3] * mat.m[2][1] + m[2][3] * mat.m[2][2] + m[3][3] * mat.m[2][3];
-        ret.m[3][3] = m[0][3] * mat.m[3][0] + m[1][3] * mat.m[3][1] + m[2][3] * mat.m[3][2] + m[3][3] * mat.m[3][3];
+        //Each column of the product combines the columns of this matrix.
+        __m128 c0 = _mm_loadu_ps(m[0]), c1 = _mm_loadu_ps(m[1]), c2 = _mm_loadu_ps(m[2]), c3 = _mm_loadu_ps(m[3]);
+        for(int j = 0; j < 4; j++) {
+            __m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(mat.m[j][0])), _mm_mul_ps(c1, _mm_set1_ps(mat.m[j][1]))),
+                                  _mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(mat.m[j][2])), _mm_mul_ps(c3, _mm_set1_ps(mat.m[j][3]))));
+            _mm_storeu_ps(ret.m[j], r);
+        }
         return ret;
-    }
-    Matrix4f create_normal_matrix() const {
+#else
+        return multiply_scalar(mat);
+#endif
+    }
+    //Inverse transpose of the linear part, whose columns are the cross
+    //products of the columns of the original.
+    Matrix4f create_normal_matrix() const;
+    //General inverse, valid for projections as well as affine transforms.
+    //A singular matrix yields non-finite entries.
+    Matrix4f inverse() const;
+    //Portable versions of the kernels above, which builds without SSE2 use
+    //and which the vector paths are tested against
+    Matrix4f multiply_scalar(const Matrix4f& mat) const {
         Matrix4f ret;
-        float invdet = 1.0f / (m[0][0] * m[1][1] * m[2][2] + m[0][1] * m[1][2] * m[2][0] + m[0][2] * m[1][0] * m[2][1] \
-                  - m[0][2] * m[1][1] * m[2][0] - m[0][1] * m[1][0] * m[2][2] - m[0][0] * m[1][2] * m[2][1]);
-        ret.m[0][0] = invdet * (m[1][1] * m[2][2] - m[2][1] * m[1][2]);
-        ret.m[1][0] = invdet * (m[0][2] * m[2][1] - m[0][1] * m[2][2]);
-        ret.m[2][0] = invdet * (m[0][1] * m[1][2] - m[0][2] * m[1][1]);
-        ret.m[0][1] = invdet * (m[2][0] * m[1][2] - m[1][0] * m[2][2]);
-        ret.m[1][1] = invdet * (m[0][0] * m[2][2] - m[2][0] * m[0][2]);
-        ret.m[2][1] = invdet * (m[1][0] * m[0][2] - m[0][0] * m[1][2]);
-        ret.m[0][2] = invdet * (m[1][0] * m[2][1] - m[2][0] * m[1][1]);
-        ret.m[1][2] = invdet * (m[2][0] * m[0][1] - m[0][0] * m[2][1]);
-        ret.m[2][2] = invdet * (m[0][0] * m[1][1] - m[1][0] * m[0][1]);
+        for(int j = 0; j < 4; j++) {
+            for(int i = 0; i < 4; i++) {
+                ret.m[j][i] = m[0][i] * mat.m[j][0] + m[1][i] * mat.m[j][1] + m[2][i] * mat.m[j][2] + m[3][i] * mat.m[j][3];
+            }
+        }
         return ret;
     }
-    Matrix4f inverse() const {
-        Matrix4f ret;
-        float invdet = 1.0f / (m[0][0] * m[1][1] * m[2][2] + m[0][1] * m[1][2] * m[2][0] + m[0][2] * m[1][0] * m[2][1] \
-                  - m[0][2] * m[1][1] * m[2][0] - m[0][1] * m[1][0] * m[2][2] - m[0][0] * m[1][2] * m[2][1]);
-        ret.m[0][0] = invdet * (m[1][1] * m[2][2] - m[2][1] * m[1][2]);
-        ret.m[0][1] = invdet * (m[0][2] * m[2][1] - m[0][1] * m[2][2]);
-        ret.m[0][2] = invdet * (m[0][1] * m[1][2] - m[0][2] * m[1][1]);
-        ret.m[1][0] = invdet * (m[2][0] * m[1][2] - m[1][0] * m[2][2]);
-        ret.m[1][1] = invdet * (m[0][0] * m[2][2] - m[2][0] * m[0][2]);
-        ret.m[1][2] = invdet * (m[1][0] * m[0][2] - m[0][0] * m[1][2]);
-        ret.m[2][0] = invdet * (m[1][0] * m[2][1] - m[2][0] * m[1][1]);
-        ret.m[2][1] = invdet * (m[2][0] * m[0][1] - m[0][0] * m[2][1]);
-        ret.m[2][2] = invdet * (m[0][0] * m[1][1] - m[1][0] * m[0][1]);
+    Matrix4f create_normal_matrix_scalar() const;
+    Matrix4f inverse_scalar() const;
+    //Inverse of an affine transform, whose last row is (0, 0, 0, 1)
+    Matrix4f affine_inverse() const {
+        Matrix4f ret = create_normal_matrix();
+        for(int i = 0; i < 3; i++) {
+            for(int j = 0; j < i; j++) {
+                std::swap(ret.m[i][j], ret.m[j][i]);
+            }
+        }
         ret.m[3][0] = -ret.m[0][0] * m[3][0] - ret.m[1][0] * m[3][1] - ret.m[2][0] * m[3][2];
-        ret.m[3][1] = -ret.m[0][1] * m[3][1] - ret.m[1][1] * m[3][1] - ret.m[2][1] * m[3][2];
-        ret.m[3][2] = -ret.m[0][2] * m[3][2] - ret.m[1][2] * m[3][1] - ret.m[2][2] * m[3][2];
+        ret.m[3][1] = -ret.m[0][1] * m[3][0] - ret.m[1][1] * m[3][1] - ret.m[2][1] * m[3][2];
+        ret.m[3][2] = -ret.m[0][2] * m[3][0] - ret.m[1][2] * m[3][1] - ret.m[2][2] * m[3][2];
         return ret;
     }
     static void create_perspective_projection(Matrix4f& mat, float fovy, float aspect, float near, float far)
@@ -220,6 +211,14 @@ struct Matrix4f
         ret.z = m[0][2] * v.x + m[1][2] * v.y + m[2][2] * v.z + m[3][2];
         return ret;
     }
+    //Applies the linear part only, leaving out the translation.
+    Vector3f transform_direction(const Vector3f& v) const {
+        Vector3f ret;
+        ret.x = m[0][0] * v.x + m[1][0] * v.y + m[2][0] * v.z;
+        ret.y = m[0][1] * v.x + m[1][1] * v.y + m[2][1] * v.z;
+        ret.z = m[0][2] * v.x + m[1][2] * v.y + m[2][2] * v.z;
+        return ret;
+    }
     void identity() {
         for(int i = 0; i < 4; i++) {
             for(int j = 0; j < 4; j++) {
@@ -276,6 +275,87 @@ static inline std::ostream& operator<<(std::ostream& os, const Matrix4f& mat) {
     return os << ']';
 }
 
+//Axis-aligned bounding box; a default-constructed box is empty.
+struct BoundingBox3f
+{
+    Vector3f min, max;
+    BoundingBox3f() : min(1E+30f, 1E+30f, 1E+30f), max(-1E+30f, -1E+30f, -1E+30f) {}
+    bool empty() const {
+        return min.x > max.x || min.y > max.y || min.z > max.z;
+    }
+    void extend(const Vector3f& p) {
+        min = Vector3f(std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z));
+        max = Vector3f(std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z));
+    }
+    void extend(const BoundingBox3f& box) {
+        if(box.empty()) return;
+        extend(box.min);
+        extend(box.max);
+    }
+    Vector3f center() const {
+        return (min + max) * 0.5f;
+    }
+    float surface_area() const {
+        if(empty()) return 0;
+        Vector3f d = max - min;
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+    //Bounds of the transformed box, through transform_boxes
+    BoundingBox3f transform(const Matrix4f& mat) const;
+};
+
+static inline std::ostream& operator<<(std::ostream& os, const BoundingBox3f& box)
+{
+    return os << box.min << "-" << box.max;
+}
+
+//Batch transforms over arrays whose elements lie stride floats apart, so
+//that interleaved vertex data can be transformed in place.
+void transform_points(const Matrix4f& mat, const float *src, float *dst, size_t count, size_t stride = 3);
+//Normals go through the normal matrix of mat and are renormalized.
+void transform_normals(const Matrix4f& mat, const float *src, float *dst, size_t count, size_t stride = 3);
+void transform_boxes(const Matrix4f& mat, const BoundingBox3f *src, BoundingBox3f *dst, size_t count);
+//Product of matrices[0] * matrices[1] * ... * matrices[count - 1]
+Matrix4f multiply_chain(const Matrix4f *matrices, size_t count);
+//Portable versions of the batch kernels
+void transform_points_scalar(const Matrix4f& mat, const float *src, float *dst, size_t count, size_t stride = 3);
+void transform_normals_scalar(const Matrix4f& mat, const float *src, float *dst, size_t count, size_t stride = 3);
+void transform_boxes_scalar(const Matrix4f& mat, const BoundingBox3f *src, BoundingBox3f *dst, size_t count);
+Matrix4f multiply_chain_scalar(const Matrix4f *matrices, size_t count);
+
+struct Ray
+{
+    Vector3f origin, direction;
+    Ray() {}
+    Ray(const Vector3f& origin, const Vector3f& direction) : origin(origin), direction(direction) {}
+};
+
+//Clipping planes extracted from a projection-view matrix
+struct Frustum
+{
+    float planes[6][4];
+    Frustum(const Matrix4f& mat) {
+        for(int i = 0; i < 3; i++) {
+            for(int j = 0; j < 4; j++) {
+                planes[2 * i][j] = mat.m[j][3] + mat.m[j][i];
+                planes[2 * i + 1][j] = mat.m[j][3] - mat.m[j][i];
+            }
+        }
+    }
+    //Conservative test: boxes straddling a corner of the frustum may pass.
+    bool intersects(const BoundingBox3f& box) const {
+        if(box.empty()) return false;
+        for(int i = 0; i < 6; i++) {
+            const float *p = planes[i];
+            float x = p[0] >= 0 ? box.max.x : box.min.x;
+            float y = p[1] >= 0 ? box.max.y : box.min.y;
+            float z = p[2] >= 0 ? box.max.z : box.min.z;
+            if(p[0] * x + p[1] * y + p[2] * z + p[3] < 0) return false;
+        }
+        return true;
+    }
+};
+
 struct Quaternion4f
 {
     float w, x, y, z;
@@ -61,7 +61,16 @@ CLOD_Object::CLOD_Object(bool clod_desc_flag, BitStreamReader& reader)
     }
 }
 
-CLOD_Mesh::CLOD_Mesh(BitStreamReader& reader) : CLOD_Object(true, reader)
+void CLOD_Object::release_vertex_data()
+{
+    release_vector(positions);
+    release_vector(normals);
+    release_vector(diffuse_colors);
+    release_vector(specular_colors);
+    release_vector(texcoords);
+}
+
+CLOD_Mesh::CLOD_Mesh(BitStreamReader& reader) : CLOD_Object(true, reader), ModelResource(MESH)
 {
     cur_res = 0;
     for(int i = 0; i < 3; i++) {
@@ -523,9 +532,9 @@ void CLOD_Mesh::dump_author_mesh()
     }
 }
 
-RenderGroup *CLOD_Mesh::create_render_group()
+RenderGroup *CLOD_Mesh::create_render_group(BufferArena& arena) const
 {
-    RenderGroup *group = new RenderGroup(GL_TRIANGLES, shading_descs.size());
+    RenderGroup *group = new RenderGroup(arena, GL_TRIANGLES, shading_descs.size());
     std::vector<int> face_count(shading_descs.size());
     for(unsigned int i = 0; i < faces.size(); i++) {
         face_count[faces[i].shading_id]++;
@@ -581,4 +590,33 @@ RenderGroup *CLOD_Mesh::create_render_group()
     return group;
 }
 
+size_t CLOD_Mesh::get_buffer_size_hint() const
+{
+    //Sized by the widest shading so that the estimate never falls short
+    size_t stride = 0;
+    for(unsigned int i = 0; i < shading_descs.size(); i++) {
+        size_t floats = 3;
+        if(!(attributes & EXCLUDE_NORMALS)) floats += 3;
+        if(shading_descs[i].attributes & VERTEX_DIFFUSE_COLOR) floats += 4;
+        if(shading_descs[i].attributes & VERTEX_SPECULAR_COLOR) floats += 4;
+        floats += 2 * shading_descs[i].texlayer_count;
+        stride = std::max(stride, floats);
+    }
+    return static_cast<size_t>(face_count) * 3 * stride * sizeof(GLfloat) + shading_descs.size() * BufferArena::ALIGNMENT;
+}
+
+void CLOD_Mesh::release_geometry()
+{
+    release_vertex_data();
+    release_vector(faces);
+    indexer.clear();
+    cur_res = 0;
+    bounded_positions = 0;
+    for(int i = 0; i < 3; i++) {
+        for(int j = 0; j < 8; j++) {
+            last_corners[i].texcoord[j] = 0;
+        }
+    }
+}
+
 }
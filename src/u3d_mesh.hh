@@ -24,10 +24,7 @@ namespace U3D
 
 class CLOD_Mesh : private CLOD_Object, public ModelResource
 {
-    //Mesh contents
-    std::vector<Vector3f> positions, normals;
-    std::vector<Color4f> diffuse_colors, specular_colors;
-    std::vector<TexCoord4f> texcoords;
+    //Mesh contents, beyond the vertex data of CLOD_Object
     struct Corner
     {
         uint32_t position, normal;
@@ -70,6 +67,9 @@ class CLOD_Mesh : private CLOD_Object, public ModelResource
         void add_positions(size_t n) {
             positions.insert(positions.end(), n, std::vector<uint32_t>());
         }
+        void clear() {
+            std::vector<std::vector<uint32_t> >().swap(positions);
+        }
         std::vector<uint32_t> list_inclusive_neighbors(const std::vector<Face>& faces, uint32_t position) {
             std::vector<uint32_t> neighbors;
             for(unsigned int i = 0; i < positions[position].size(); i++) {
@@ -148,12 +148,28 @@ class CLOD_Mesh : private CLOD_Object, public ModelResource
     };
     FaceIndexer indexer;
 public:
-    CLOD_Mesh() : cur_res(0) {}
+    static const Type TYPE = MESH;
+    CLOD_Mesh() : ModelResource(MESH), cur_res(0) {}
     CLOD_Mesh(BitStreamReader& reader);
     void create_base_mesh(BitStreamReader& reader);
     void update_resolution(BitStreamReader& reader);
     void dump_author_mesh();
-    RenderGroup *create_render_group();
+    RenderGroup *create_render_group(BufferArena& arena) const;
+    size_t get_buffer_size_hint() const;
+    void release_geometry();
+    void update_bounds()
+    {
+        extend_bounds(positions);
+    }
+    void get_triangles(std::vector<Vector3f>& triangles) const
+    {
+        triangles.reserve(triangles.size() + 3 * faces.size());
+        for(std::vector<Face>::const_iterator i = faces.begin(); i != faces.end(); i++) {
+            for(int j = 0; j < 3; j++) {
+                triangles.push_back(positions[i->corners[j].position]);
+            }
+        }
+    }
 };
 
 }
@@ -0,0 +1,280 @@
+/*
+ * Copyright (C) 2016 Hiroka Ihara
+ *
+ * This file is part of libU3D.
+ *
+ * libU3D is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libU3D is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libU3D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "u3d_internal.hh"
+
+namespace U3D
+{
+
+void expand_rgb_to_rgba(const uint8_t *src, size_t count, bool swap_red_blue, uint8_t *dst)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i rgb = _mm_set1_epi32(0x00FFFFFF), alpha = _mm_set1_epi32(0xFF000000);
+    const __m128i green = _mm_set1_epi32(0x0000FF00), low = _mm_set1_epi32(0x000000FF);
+    //Each load spans five texels and uses four, so it never reads past the last.
+    for(; i + 6 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 3 * i));
+        __m128i first = _mm_unpacklo_epi32(v, _mm_srli_si128(v, 3));
+        __m128i second = _mm_unpacklo_epi32(_mm_srli_si128(v, 6), _mm_srli_si128(v, 9));
+        __m128i texels = _mm_and_si128(_mm_unpacklo_epi64(first, second), rgb);
+        if(swap_red_blue) {
+            texels = _mm_or_si128(_mm_or_si128(_mm_and_si128(texels, green), _mm_srli_epi32(texels, 16)),
+                                  _mm_slli_epi32(_mm_and_si128(texels, low), 16));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 4 * i), _mm_or_si128(texels, alpha));
+    }
+#endif
+    for(; i < count; i++) {
+        dst[4 * i] = src[3 * i + (swap_red_blue ? 2 : 0)];
+        dst[4 * i + 1] = src[3 * i + 1];
+        dst[4 * i + 2] = src[3 * i + (swap_red_blue ? 0 : 2)];
+        dst[4 * i + 3] = 255;
+    }
+}
+
+void swizzle_to_rgba(const uint8_t *src, size_t count, const uint32_t shifts[4], bool opaque, uint8_t *dst)
+{
+    size_t i = 0;
+    int components = opaque ? 3 : 4;
+#ifdef __SSE2__
+    //An opaque alpha is shifted out of the way and replaced.
+    const __m128i low = _mm_set1_epi32(0x000000FF), alpha = _mm_set1_epi32(opaque ? 0xFF000000 : 0);
+    const __m128i red = _mm_cvtsi32_si128(shifts[0]), green = _mm_cvtsi32_si128(shifts[1]);
+    const __m128i blue = _mm_cvtsi32_si128(shifts[2]), opacity = _mm_cvtsi32_si128(opaque ? 32 : shifts[3]);
+    for(; i + 4 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 4 * i));
+        __m128i texels = _mm_or_si128(_mm_and_si128(_mm_srl_epi32(v, red), low),
+                                      _mm_slli_epi32(_mm_and_si128(_mm_srl_epi32(v, green), low), 8));
+        texels = _mm_or_si128(texels, _mm_slli_epi32(_mm_and_si128(_mm_srl_epi32(v, blue), low), 16));
+        texels = _mm_or_si128(texels, _mm_or_si128(_mm_slli_epi32(_mm_srl_epi32(v, opacity), 24), alpha));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 4 * i), texels);
+    }
+#endif
+    for(; i < count; i++) {
+        uint32_t texel;
+        memcpy(&texel, src + 4 * i, 4);
+        for(int j = 0; j < components; j++) dst[4 * i + j] = texel >> shifts[j];
+        if(opaque) dst[4 * i + 3] = 255;
+    }
+}
+
+void expand_luminance_to_rgba(const uint8_t *src, size_t count, uint8_t *dst)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i alpha = _mm_set1_epi32(0xFF000000);
+    for(; i + 16 <= count; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m128i low = _mm_unpacklo_epi8(v, v), high = _mm_unpackhi_epi8(v, v);
+        __m128i *out = reinterpret_cast<__m128i *>(dst + 4 * i);
+        _mm_storeu_si128(out, _mm_or_si128(_mm_unpacklo_epi16(low, low), alpha));
+        _mm_storeu_si128(out + 1, _mm_or_si128(_mm_unpackhi_epi16(low, low), alpha));
+        _mm_storeu_si128(out + 2, _mm_or_si128(_mm_unpacklo_epi16(high, high), alpha));
+        _mm_storeu_si128(out + 3, _mm_or_si128(_mm_unpackhi_epi16(high, high), alpha));
+    }
+#endif
+    for(; i < count; i++) {
+        dst[4 * i] = dst[4 * i + 1] = dst[4 * i + 2] = src[i];
+        dst[4 * i + 3] = 255;
+    }
+}
+
+void expand_luminance_alpha_to_rgba(const uint8_t *src, size_t count, uint8_t *dst)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i keep = _mm_set1_epi32(0xFFFF00FF), low = _mm_set1_epi32(0x000000FF);
+    for(; i + 8 <= count; i += 8) {
+        //Doubled 16-bit pairs read L A L A, and the first A becomes L.
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 2 * i));
+        __m128i halves[2] = {_mm_unpacklo_epi16(v, v), _mm_unpackhi_epi16(v, v)};
+        for(int j = 0; j < 2; j++) {
+            __m128i texels = _mm_or_si128(_mm_and_si128(halves[j], keep), _mm_slli_epi32(_mm_and_si128(halves[j], low), 8));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 4 * i) + j, texels);
+        }
+    }
+#endif
+    for(; i < count; i++) {
+        dst[4 * i] = dst[4 * i + 1] = dst[4 * i + 2] = src[2 * i];
+        dst[4 * i + 3] = src[2 * i + 1];
+    }
+}
+
+void expand_alpha_to_rgba(const uint8_t *src, size_t count, uint8_t *dst)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    for(; i + 16 <= count; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m128i low = _mm_unpacklo_epi8(zero, v), high = _mm_unpackhi_epi8(zero, v);
+        __m128i *out = reinterpret_cast<__m128i *>(dst + 4 * i);
+        _mm_storeu_si128(out, _mm_unpacklo_epi16(zero, low));
+        _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(zero, low));
+        _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(zero, high));
+        _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(zero, high));
+    }
+#endif
+    for(; i < count; i++) {
+        dst[4 * i] = dst[4 * i + 1] = dst[4 * i + 2] = 0;
+        dst[4 * i + 3] = src[i];
+    }
+}
+
+namespace
+{
+//Narrows four vectors of bytes held in the low bits of each 32-bit lane.
+#ifdef __SSE2__
+inline __m128i pack_bytes(__m128i a, __m128i b, __m128i c, __m128i d)
+{
+    return _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+}
+#endif
+
+void extract_channel(const uint8_t *rgba, size_t count, int channel, uint8_t *dst)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i low = _mm_set1_epi32(0x000000FF);
+    const __m128i shift = _mm_cvtsi32_si128(8 * channel);
+    for(; i + 16 <= count; i += 16) {
+        const __m128i *in = reinterpret_cast<const __m128i *>(rgba + 4 * i);
+        __m128i v[4];
+        for(int j = 0; j < 4; j++) v[j] = _mm_and_si128(_mm_srl_epi32(_mm_loadu_si128(in + j), shift), low);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), pack_bytes(v[0], v[1], v[2], v[3]));
+    }
+#endif
+    for(; i < count; i++) dst[i] = rgba[4 * i + channel];
+}
+}
+
+void extract_luminance(const uint8_t *rgba, size_t count, uint8_t *dst)
+{
+    extract_channel(rgba, count, 0, dst);
+}
+
+void extract_alpha(const uint8_t *rgba, size_t count, uint8_t *dst)
+{
+    extract_channel(rgba, count, 3, dst);
+}
+
+void extract_luminance_alpha(const uint8_t *rgba, size_t count, uint8_t *dst)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i low = _mm_set1_epi32(0x000000FF), high = _mm_set1_epi32(0x0000FF00);
+    for(; i + 8 <= count; i += 8) {
+        const __m128i *in = reinterpret_cast<const __m128i *>(rgba + 4 * i);
+        __m128i v[2];
+        for(int j = 0; j < 2; j++) {
+            __m128i texels = _mm_loadu_si128(in + j);
+            v[j] = _mm_or_si128(_mm_and_si128(texels, low), _mm_and_si128(_mm_srli_epi32(texels, 16), high));
+            //Sign extended, so that the signed saturation keeps every bit
+            v[j] = _mm_srai_epi32(_mm_slli_epi32(v[j], 16), 16);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 2 * i), _mm_packs_epi32(v[0], v[1]));
+    }
+#endif
+    for(; i < count; i++) {
+        dst[2 * i] = rgba[4 * i];
+        dst[2 * i + 1] = rgba[4 * i + 3];
+    }
+}
+
+void convert_image(TextureImage& image, GLenum format)
+{
+    if(image.compressed) {
+        throw U3D_ERROR << "Compressed texture images cannot be converted.";
+    }
+    size_t count = static_cast<size_t>(image.width) * image.height;
+    if(image.format == format && image.type == GL_UNSIGNED_BYTE) return;
+
+    std::vector<uint8_t> rgba;
+    if(image.format == GL_RGBA && image.type == GL_UNSIGNED_BYTE) {
+        rgba.swap(image.pixels);
+    } else {
+        rgba.resize(4 * count);
+        uint8_t *dst = rgba.empty() ? NULL : &rgba[0];
+        const uint8_t *src = image.pixels.empty() ? NULL : &image.pixels[0];
+        bool bgr = image.format == GL_BGR || image.format == GL_BGRA;
+        if(image.type == GL_UNSIGNED_BYTE && (image.format == GL_RGB || image.format == GL_BGR)) {
+            expand_rgb_to_rgba(src, count, bgr, dst);
+            image.internal_format = GL_RGB;
+        } else if(image.type == GL_UNSIGNED_INT_8_8_8_8 || image.type == GL_UNSIGNED_INT_8_8_8_8_REV) {
+            //Components of the packed types, in their order within the format
+            uint32_t shifts[4];
+            for(int j = 0; j < 4; j++) shifts[j] = image.type == GL_UNSIGNED_INT_8_8_8_8 ? 24 - 8 * j : 8 * j;
+            if(bgr) std::swap(shifts[0], shifts[2]);
+            swizzle_to_rgba(src, count, shifts, image.internal_format == GL_RGB, dst);
+        } else if(image.type == GL_UNSIGNED_BYTE && image.format == GL_LUMINANCE) {
+            expand_luminance_to_rgba(src, count, dst);
+            image.internal_format = GL_RGB;
+        } else if(image.type == GL_UNSIGNED_BYTE && image.format == GL_LUMINANCE_ALPHA) {
+            expand_luminance_alpha_to_rgba(src, count, dst);
+            image.internal_format = GL_RGBA;
+        } else if(image.type == GL_UNSIGNED_BYTE && image.format == GL_ALPHA) {
+            expand_alpha_to_rgba(src, count, dst);
+            image.internal_format = GL_RGBA;
+        } else {
+            throw U3D_ERROR << "Unsupported texture image format " << image.format << ".";
+        }
+    }
+    image.format = format, image.type = GL_UNSIGNED_BYTE;
+    switch(format) {
+    case GL_RGBA:
+        image.pixels.swap(rgba);
+        return;
+    case GL_LUMINANCE:
+        image.pixels.resize(count);
+        if(count > 0) extract_luminance(&rgba[0], count, &image.pixels[0]);
+        break;
+    case GL_LUMINANCE_ALPHA:
+        image.pixels.resize(2 * count);
+        if(count > 0) extract_luminance_alpha(&rgba[0], count, &image.pixels[0]);
+        break;
+    case GL_ALPHA:
+        image.pixels.resize(count);
+        if(count > 0) extract_alpha(&rgba[0], count, &image.pixels[0]);
+        break;
+    default:
+        throw U3D_ERROR << "Unsupported texture image format " << format << ".";
+    }
+    image.internal_format = format;
+}
+
+GLint get_storage_format(const TextureImage& image)
+{
+    if(image.compressed || image.type != GL_UNSIGNED_BYTE) return image.internal_format;
+    switch(image.format) {
+    case GL_RGBA:
+        return GL_RGBA8;
+    case GL_LUMINANCE:
+        return GL_LUMINANCE8;
+    case GL_LUMINANCE_ALPHA:
+        return GL_LUMINANCE8_ALPHA8;
+    case GL_ALPHA:
+        return GL_ALPHA8;
+    default:
+        return image.internal_format;
+    }
+}
+
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2016 Hiroka Ihara
+ *
+ * This file is part of libU3D.
+ *
+ * libU3D is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libU3D is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libU3D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+namespace U3D
+{
+
+//Texel layout conversions, run where images are decoded so that uploads
+//hand the driver texels already in their storage format. The kernels take
+//count texels between buffers that must not overlap.
+
+//Packed 24-bit RGB, or BGR when swap_red_blue is set, to RGBA with an
+//alpha of 255.
+void expand_rgb_to_rgba(const uint8_t *src, size_t count, bool swap_red_blue, uint8_t *dst);
+//32-bit texels read as little-endian words with red, green, blue and alpha
+//at the given bit shifts. The alpha is replaced by 255 when opaque is set.
+void swizzle_to_rgba(const uint8_t *src, size_t count, const uint32_t shifts[4], bool opaque, uint8_t *dst);
+void expand_luminance_to_rgba(const uint8_t *src, size_t count, uint8_t *dst);
+void expand_luminance_alpha_to_rgba(const uint8_t *src, size_t count, uint8_t *dst);
+//Black texels with the given alpha, as GL samples alpha textures
+void expand_alpha_to_rgba(const uint8_t *src, size_t count, uint8_t *dst);
+//Keep the red channel as the luminance, and the alpha channel, of RGBA texels.
+void extract_luminance(const uint8_t *rgba, size_t count, uint8_t *dst);
+void extract_luminance_alpha(const uint8_t *rgba, size_t count, uint8_t *dst);
+void extract_alpha(const uint8_t *rgba, size_t count, uint8_t *dst);
+
+//Converts any layout produced by Texture::decode to unsigned bytes of the
+//format: GL_RGBA, GL_LUMINANCE, GL_LUMINANCE_ALPHA or GL_ALPHA. RGBA images
+//keep GL_RGB as their internal format when opaque, with an alpha of 255.
+void convert_image(TextureImage& image, GLenum format);
+//Sized internal format matching the layout of the pixels, so that drivers
+//copy them as they are. Opaque RGBA images are stored as RGBA8 too, as
+//software GL converts every texel going into RGB storage.
+GLint get_storage_format(const TextureImage& image);
+
+}
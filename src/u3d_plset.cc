@@ -22,7 +22,7 @@
 namespace U3D
 {
 
-PointSet::PointSet(BitStreamReader& reader) : CLOD_Object(false, reader)
+PointSet::PointSet(BitStreamReader& reader) : CLOD_Object(false, reader), ModelResource(POINT_SET)
 {
     last_diffuse = 0, last_specular = 0;
     for(int i = 0; i < 8; i++) last_texcoord[i] = 0;
@@ -127,7 +127,7 @@ void PointSet::update_resolution(BitStreamReader& reader)
     }
 }
 
-LineSet::LineSet(BitStreamReader& reader) : CLOD_Object(false, reader)
+LineSet::LineSet(BitStreamReader& reader) : CLOD_Object(false, reader), ModelResource(LINE_SET)
 {
     last_diffuse = 0, last_specular = 0;
     for(int i = 0; i < 8; i++) last_texcoord[i] = 0;
@@ -248,9 +248,9 @@ void LineSet::update_resolution(BitStreamReader& reader)
     }
 }
 
-RenderGroup *PointSet::create_render_group()
+RenderGroup *PointSet::create_render_group(BufferArena& arena) const
 {
-    RenderGroup *group = new RenderGroup(GL_POINTS, shading_descs.size());
+    RenderGroup *group = new RenderGroup(arena, GL_POINTS, shading_descs.size());
     std::vector<int> point_count(shading_descs.size());
     for(unsigned int i = 0; i < points.size(); i++) {
         point_count[points[i].shading_id]++;
@@ -292,15 +292,15 @@ RenderGroup *PointSet::create_render_group()
                 }
             }
         }
-        group->load(i, data, flags, point_count[i] * 3);
+        group->load(i, data, flags, point_count[i]);
         delete[] data;
     }
     return group;
 }
 
-RenderGroup *LineSet::create_render_group()
+RenderGroup *LineSet::create_render_group(BufferArena& arena) const
 {
-    RenderGroup *group = new RenderGroup(GL_LINES, shading_descs.size());
+    RenderGroup *group = new RenderGroup(arena, GL_LINES, shading_descs.size());
     std::vector<int> line_count(shading_descs.size());
     for(unsigned int i = 0; i < lines.size(); i++) {
         line_count[lines[i].shading_id]++;
@@ -350,4 +350,23 @@ RenderGroup *LineSet::create_render_group()
     return group;
 }
 
+void PointSet::release_geometry()
+{
+    release_vertex_data();
+    release_vector(points);
+    bounded_positions = 0;
+    last_diffuse = 0, last_specular = 0;
+    for(int i = 0; i < 8; i++) last_texcoord[i] = 0;
+}
+
+void LineSet::release_geometry()
+{
+    release_vertex_data();
+    release_vector(lines);
+    indexer.clear();
+    bounded_positions = 0;
+    last_diffuse = 0, last_specular = 0;
+    for(int i = 0; i < 8; i++) last_texcoord[i] = 0;
+}
+
 }
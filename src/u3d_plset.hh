@@ -33,9 +33,15 @@ class PointSet : private CLOD_Object, public ModelResource
     std::vector<Point> points;
     uint32_t last_diffuse, last_specular, last_texcoord[8];
 public:
+    static const Type TYPE = POINT_SET;
     PointSet(BitStreamReader& reader);
     void update_resolution(BitStreamReader& reader);
-    RenderGroup *create_render_group();
+    RenderGroup *create_render_group(BufferArena& arena) const;
+    void release_geometry();
+    void update_bounds()
+    {
+        extend_bounds(positions);
+    }
 };
 
 class LineSet : private CLOD_Object, public ModelResource
@@ -71,14 +77,23 @@ class LineSet : private CLOD_Object, public ModelResource
         void set_line(uint32_t position, uint32_t line) {
             line_lists[position].push_back(line);
         }
+        void clear() {
+            std::vector<std::vector<uint32_t> >().swap(line_lists);
+        }
     };
     LineIndexer indexer;
 
     uint32_t last_diffuse, last_specular, last_texcoord[8];
 public:
+    static const Type TYPE = LINE_SET;
     LineSet(BitStreamReader& reader);
     void update_resolution(BitStreamReader& reader);
-    RenderGroup *create_render_group();
+    RenderGroup *create_render_group(BufferArena& arena) const;
+    void release_geometry();
+    void update_bounds()
+    {
+        extend_bounds(positions);
+    }
 };
 
 }
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2016 Hiroka Ihara
+ *
+ * This file is part of libU3D.
+ *
+ * libU3D is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libU3D is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libU3D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "u3d_internal.hh"
+
+namespace U3D
+{
+
+void RenderQueue::add(ShaderGroup *shader_group, ShaderProgram *program, const GLuint textures[8], RenderGroup *render_group, int element, UniformBlock *model,
+                      const BufferArena::Range& instances, GLsizei instance_count)
+{
+    const RenderGroup::RenderElement& render_element = render_group->elements[element];
+    if(render_element.count == 0) return;
+    DrawItem item;
+    item.program = program->program;
+    for(int i = 0; i < 8; i++) {
+        item.textures[i] = (shader_group->shader_channels & (1 << i)) ? textures[i] : 0;
+    }
+    item.material = shader_group->material.serial;
+    item.buffer = render_element.range.buffer;
+    item.offset = render_element.range.offset;
+    item.shader_group = shader_group;
+    item.shader_program = program;
+    item.instances = instances;
+    item.instance_count = instance_count;
+    item.render_group = render_group;
+    item.element = element;
+    item.model = model;
+    items.push_back(item);
+}
+
+RenderStats RenderQueue::submit(RenderDevice& device, UniformBlock *frame, bool sort)
+{
+    RenderStats stats;
+    if(sort) std::stable_sort(items.begin(), items.end());
+    //GL state may have been changed by the application between frames,
+    //so the first draw always sets everything it needs.
+    bool first = true;
+    GLuint current_program = 0, current_buffer = 0;
+    GLuint current_textures[8];
+    bool texture_valid[8];
+    for(int i = 0; i < 8; i++) {
+        current_textures[i] = 0;
+        texture_valid[i] = false;
+    }
+    for(std::vector<DrawItem>::iterator i = items.begin(); i != items.end(); i++) {
+        ShaderProgram& program = *i->shader_program;
+        if(first || i->program != current_program) {
+            device.use_program(i->program);
+            current_program = i->program;
+            stats.program_switches++;
+        }
+        if(program.material_serial != i->material) {
+            stats.material_switches++;
+        }
+        i->shader_group->material.load(device, program);
+        if(frame != NULL) {
+            frame->load(device, program);
+        }
+        i->model->load(device, program);
+        for(int l = 0; l < 8; l++) {
+            if(!(i->shader_group->shader_channels & (1 << l))) continue;
+            if(!texture_valid[l] || current_textures[l] != i->textures[l]) {
+                device.bind_texture(l, i->textures[l]);
+                current_textures[l] = i->textures[l];
+                texture_valid[l] = true;
+                stats.texture_switches++;
+            }
+        }
+        if(i->instance_count > 1) {
+            if(first || i->instances.buffer != current_buffer) {
+                device.bind_buffer(i->instances.buffer);
+                current_buffer = i->instances.buffer;
+                stats.buffer_switches++;
+            }
+            enable_instances(device, program, i->instances.offset, 1);
+        }
+        if(first || i->buffer != current_buffer) {
+            device.bind_buffer(i->buffer);
+            current_buffer = i->buffer;
+            stats.buffer_switches++;
+        }
+        i->render_group->render(device, i->element, program, i->instance_count);
+        if(i->instance_count > 1) {
+            //Divisors would otherwise leak into the next non-instanced draw.
+            enable_instances(device, program, 0, 0);
+        }
+        stats.draw_count++;
+        stats.instance_count += i->instance_count;
+        first = false;
+    }
+    if(!first) {
+        device.bind_buffer(0);
+    }
+    return stats;
+}
+
+void RenderQueue::enable_instances(RenderDevice& device, const ShaderProgram& program, size_t offset, GLuint divisor)
+{
+    GLint locations[2] = {program.instance_model_matrix, program.instance_normal_matrix};
+    for(int i = 0; i < 2; i++) {
+        if(locations[i] < 0) continue;
+        //A mat4 attribute occupies four consecutive locations, one per column.
+        for(int column = 0; column < 4; column++) {
+            if(divisor > 0) {
+                device.vertex_attrib_pointer(locations[i] + column, 4, INSTANCE_STRIDE, offset + sizeof(GLfloat) * (16 * i + 4 * column));
+            } else {
+                device.disable_vertex_attrib(locations[i] + column);
+            }
+            device.vertex_attrib_divisor(locations[i] + column, divisor);
+        }
+    }
+}
+
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2016 Hiroka Ihara
+ *
+ * This file is part of libU3D.
+ *
+ * libU3D is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libU3D is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libU3D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+namespace U3D
+{
+
+//Uniforms owned by the scene rather than by a shader, such as lights and model transforms.
+class UniformBlock
+{
+public:
+    virtual ~UniformBlock() {}
+    virtual void load(RenderDevice& device, ShaderProgram& program) = 0;
+};
+
+//Number of state changes actually submitted during a frame
+struct RenderStats
+{
+    unsigned int draw_count, instance_count;
+    unsigned int program_switches, texture_switches, buffer_switches, material_switches;
+    //Model instances that passed and failed the frustum test
+    unsigned int models_drawn, models_culled;
+    RenderStats() : draw_count(0), instance_count(0), program_switches(0), texture_switches(0), buffer_switches(0), material_switches(0),
+                    models_drawn(0), models_culled(0) {}
+};
+
+//Collects the draws of a frame, sorts them by the state they need and
+//submits only the state that differs from the previous draw.
+class RenderQueue
+{
+    struct DrawItem
+    {
+        //Sort key, ordered from the most to the least expensive state change
+        GLuint program;
+        GLuint textures[8];
+        uint32_t material;
+        GLuint buffer;
+        size_t offset;
+        ShaderGroup *shader_group;
+        ShaderProgram *shader_program;
+        BufferArena::Range instances;
+        GLsizei instance_count;
+        RenderGroup *render_group;
+        int element;
+        UniformBlock *model;
+        bool operator<(const DrawItem& other) const
+        {
+            if(program != other.program) return program < other.program;
+            for(int i = 0; i < 8; i++) {
+                if(textures[i] != other.textures[i]) return textures[i] < other.textures[i];
+            }
+            if(material != other.material) return material < other.material;
+            if(buffer != other.buffer) return buffer < other.buffer;
+            return offset < other.offset;
+        }
+    };
+    std::vector<DrawItem> items;
+    void enable_instances(RenderDevice& device, const ShaderProgram& program, size_t offset, GLuint divisor);
+public:
+    //Each instance holds a model matrix followed by its normal matrix.
+    static const GLsizei INSTANCE_STRIDE = 32 * sizeof(GLfloat);
+    void clear()
+    {
+        items.clear();
+    }
+    void add(ShaderGroup *shader_group, ShaderProgram *program, const GLuint textures[8], RenderGroup *render_group, int element, UniformBlock *model,
+             const BufferArena::Range& instances = BufferArena::Range(), GLsizei instance_count = 1);
+    //Draws are submitted in the order added when sort is false, which
+    //shows what sorting saves.
+    RenderStats submit(RenderDevice& device, UniformBlock *frame, bool sort = true);
+    size_t size() const { return items.size(); }
+};
+
+}
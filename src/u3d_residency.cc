@@ -0,0 +1,342 @@
+/*
+ * Copyright (C) 2016 Hiroka Ihara
+ *
+ * This file is part of libU3D.
+ *
+ * libU3D is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libU3D is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libU3D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "u3d_internal.hh"
+
+namespace U3D
+{
+
+namespace
+{
+size_t get_level_size(const TextureImage& image, unsigned int level)
+{
+    return level == 0 ? image.pixels.size() : image.mipmaps[level - 1].pixels.size();
+}
+}
+
+void GLTextureBackend::upload_levels(GLuint texture, const TextureImage& image, unsigned int first_level)
+{
+    glBindTexture(GL_TEXTURE_2D, texture);
+    Texture::upload_levels(image, first_level);
+    //Finer levels held before are released, as the new base level no longer matches them.
+    for(unsigned int level = image.mipmaps.size() + 1 - first_level; level < 32; level++) {
+        GLint width = 0;
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_WIDTH, &width);
+        if(width == 0) break;
+        glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    }
+}
+
+void MemoryTextureBackend::upload_levels(GLuint texture, const TextureImage& image, unsigned int first_level)
+{
+    std::map<GLuint, Storage>::iterator i = textures.find(texture);
+    if(i == textures.end()) {
+        throw U3D_ERROR << "Upload to texture " << texture << ", which does not exist.";
+    }
+    if(first_level > image.mipmaps.size()) {
+        throw U3D_ERROR << "Upload of level " << first_level << " of a chain of " << image.mipmaps.size() + 1 << ".";
+    }
+    Storage& storage = i->second;
+    storage.width = first_level == 0 ? image.width : image.mipmaps[first_level - 1].width;
+    storage.height = first_level == 0 ? image.height : image.mipmaps[first_level - 1].height;
+    storage.level_count = image.mipmaps.size() + 1 - first_level;
+    storage.size = 0;
+    for(unsigned int level = first_level; level <= image.mipmaps.size(); level++) {
+        storage.size += get_level_size(image, level);
+    }
+    uploaded_size += storage.size;
+    upload_count++;
+}
+
+size_t MemoryTextureBackend::get_resident_size() const
+{
+    size_t size = 0;
+    for(std::map<GLuint, Storage>::const_iterator i = textures.begin(); i != textures.end(); i++) {
+        size += i->second.size;
+    }
+    return size;
+}
+
+//Loads the full chain of a texture on a worker, which the residency polls.
+class TextureResidency::LoadTask : public WorkerPool::Task
+{
+    TextureSource *source;
+    SDL_mutex *mutex;
+    bool finished;
+public:
+    TextureImage image;
+    bool loaded;
+    LoadTask(TextureSource *source, SDL_mutex *mutex) : source(source), mutex(mutex), finished(false), loaded(false) {}
+    void run()
+    {
+        bool result = source->load(image);
+        SDL_LockMutex(mutex);
+        loaded = result;
+        finished = true;
+        SDL_UnlockMutex(mutex);
+    }
+    bool is_finished() const
+    {
+        SDL_LockMutex(mutex);
+        bool result = finished;
+        SDL_UnlockMutex(mutex);
+        return result;
+    }
+};
+
+TextureResidency::TextureResidency(TextureBackend *backend, size_t budget)
+: backend(backend), budget(budget), upload_limit(0), pool(NULL), pool_owned(false), frame(1), upload_count(0), eviction_count(0), load_count(0)
+{
+    mutex = SDL_CreateMutex();
+    if(mutex == NULL) {
+        delete backend;
+        throw U3D_ERROR << "Failed to create the mutex of a texture residency.";
+    }
+}
+
+TextureResidency::~TextureResidency()
+{
+    wait_for_loads();
+    for(std::map<GLuint, Entry>::iterator i = entries.begin(); i != entries.end(); i++) {
+        backend->delete_texture(i->first);
+        delete i->second.load;
+        delete i->second.source;
+    }
+    if(pool_owned) delete pool;
+    SDL_DestroyMutex(mutex);
+    delete backend;
+}
+
+void TextureResidency::set_worker_pool(WorkerPool *pool, bool owned)
+{
+    wait_for_loads();
+    if(pool_owned) delete this->pool;
+    this->pool = pool;
+    pool_owned = owned;
+}
+
+GLuint TextureResidency::add(TextureImage& image, TextureSource *source)
+{
+    GLuint texture = backend->create_texture();
+    Entry& entry = entries[texture];
+    entry.texture = texture;
+    std::swap(entry.image, image);
+    entry.image_level = 0;
+    entry.source = source;
+    entry.load = NULL;
+    entry.added = frame;
+    entry.size = std::max(entry.image.width, entry.image.height);
+    unsigned int level_count = entry.image.mipmaps.size() + 1;
+    entry.chain_sizes.resize(level_count);
+    size_t size = 0;
+    for(unsigned int level = level_count; level-- > 0;) {
+        size += get_level_size(entry.image, level);
+        entry.chain_sizes[level] = size;
+    }
+    entry.pixels = 0;
+    entry.last_used = 0;
+    entry.kept_level = source != NULL ? get_level(entry, INITIAL_SIZE) : 0;
+    upload(entry, get_level(entry, INITIAL_SIZE));
+    return texture;
+}
+
+void TextureResidency::request(GLuint texture, float pixels)
+{
+    std::map<GLuint, Entry>::iterator i = entries.find(texture);
+    if(i == entries.end()) return;
+    i->second.pixels = std::max(i->second.pixels, pixels);
+    i->second.last_used = frame;
+}
+
+unsigned int TextureResidency::get_level(const Entry& entry, float pixels)
+{
+    unsigned int level = 0;
+    float size = static_cast<float>(entry.size);
+    while(level + 1 < entry.chain_sizes.size() && size * 0.5f >= pixels) {
+        size *= 0.5f;
+        level++;
+    }
+    //Without a source, the levels trimmed away are gone for good.
+    return entry.source != NULL ? level : std::max(level, entry.image_level);
+}
+
+bool TextureResidency::is_more_recent(const Entry *a, const Entry *b)
+{
+    if(a->last_used != b->last_used) return a->last_used > b->last_used;
+    return a->pixels > b->pixels;
+}
+
+//The pool may be shared, but has no way to wait for some tasks only.
+void TextureResidency::wait_for_loads()
+{
+    for(std::map<GLuint, Entry>::iterator i = entries.begin(); i != entries.end(); i++) {
+        if(i->second.load != NULL && !i->second.load->is_finished()) {
+            pool->wait();
+            return;
+        }
+    }
+}
+
+bool TextureResidency::is_loaded(const Entry& entry) const
+{
+    return entry.load != NULL && entry.load->is_finished();
+}
+
+void TextureResidency::upload(Entry& entry, unsigned int level)
+{
+    if(level < entry.image_level) {
+        TextureImage image;
+        bool loaded;
+        if(entry.load != NULL) {
+            std::swap(image, entry.load->image);
+            loaded = entry.load->loaded;
+            discard_load(entry);
+        } else {
+            loaded = entry.source->load(image);
+            load_count++;
+        }
+        if(loaded && image.mipmaps.size() + 1 == entry.chain_sizes.size()) {
+            backend->upload_levels(entry.texture, image, level);
+            entry.resident_level = entry.target_level = level;
+            upload_count++;
+            return;
+        }
+        U3D_WARNING << "Texture " << entry.texture << " could not be loaded again, so it keeps its coarser levels." << std::endl;
+        delete entry.source;
+        entry.source = NULL;
+        entry.kept_level = entry.image_level;
+        //Levels finer than those kept are still dropped when asked to.
+        if(level < entry.resident_level) {
+            entry.target_level = entry.resident_level;
+            return;
+        }
+        level = entry.image_level;
+    }
+    backend->upload_levels(entry.texture, entry.image, level - entry.image_level);
+    entry.resident_level = entry.target_level = level;
+    upload_count++;
+}
+
+void TextureResidency::trim(Entry& entry)
+{
+    TextureImage& image = entry.image;
+    unsigned int count = entry.kept_level - entry.image_level;
+    TextureImage::Level& base = image.mipmaps[count - 1];
+    image.width = base.width;
+    image.height = base.height;
+    image.pixels.swap(base.pixels);
+    image.mipmaps.erase(image.mipmaps.begin(), image.mipmaps.begin() + count);
+    entry.image_level = entry.kept_level;
+}
+
+void TextureResidency::discard_load(Entry& entry)
+{
+    delete entry.load;
+    entry.load = NULL;
+}
+
+void TextureResidency::update()
+{
+    //Every texture keeps its last level, and the others go first to the
+    //most recently drawn, in the order of their on-screen size.
+    std::vector<Entry *> order;
+    size_t total = 0;
+    for(std::map<GLuint, Entry>::iterator i = entries.begin(); i != entries.end(); i++) {
+        Entry& entry = i->second;
+        entry.target_level = entry.last_used == frame ? get_level(entry, entry.pixels) : entry.resident_level;
+        total += entry.chain_sizes.back() + entry.chain_sizes[entry.kept_level];
+        order.push_back(&entry);
+    }
+    std::sort(order.begin(), order.end(), is_more_recent);
+    for(std::vector<Entry *>::iterator i = order.begin(); i != order.end(); i++) {
+        Entry& entry = **i;
+        size_t base = entry.chain_sizes.back();
+        unsigned int level = entry.target_level;
+        while(budget != 0 && level + 1 < entry.chain_sizes.size() && total + entry.chain_sizes[level] - base > budget) {
+            level++;
+        }
+        if(level > entry.target_level && level > entry.resident_level) eviction_count++;
+        total += entry.chain_sizes[level] - base;
+        entry.target_level = level;
+    }
+    //Levels are dropped before others are uploaded, so the budget holds
+    //throughout. Levels still to be loaded are dropped to those kept instead.
+    for(std::vector<Entry *>::iterator i = order.begin(); i != order.end(); i++) {
+        Entry& entry = **i;
+        if(entry.target_level <= entry.resident_level) continue;
+        bool waiting = pool != NULL && entry.target_level < entry.image_level && !is_loaded(entry);
+        upload(entry, waiting ? entry.image_level : entry.target_level);
+    }
+    //Loads are started in the order levels are uploaded in, and their levels
+    //uploaded by the first update after they finish.
+    size_t uploaded = 0;
+    for(std::vector<Entry *>::iterator i = order.begin(); i != order.end(); i++) {
+        Entry& entry = **i;
+        if(entry.target_level >= entry.resident_level) continue;
+        size_t size = entry.chain_sizes[entry.target_level];
+        bool waiting = pool != NULL && entry.target_level < entry.image_level && !is_loaded(entry);
+        if(waiting && entry.load != NULL) continue;
+        if(upload_limit != 0 && uploaded != 0 && uploaded + size > upload_limit) continue;
+        if(waiting) {
+            entry.load = new LoadTask(entry.source, mutex);
+            load_count++;
+            pool->submit(entry.load);
+        } else {
+            upload(entry, entry.target_level);
+        }
+        uploaded += size;
+    }
+    //Full chains outlive the update following their addition, so that the
+    //levels their first draws need are not loaded again. Loaded chains are
+    //let go of once their levels are no longer wanted.
+    for(std::vector<Entry *>::iterator i = order.begin(); i != order.end(); i++) {
+        Entry& entry = **i;
+        entry.pixels = 0;
+        if(entry.image_level < entry.kept_level && entry.added < frame) trim(entry);
+        if(entry.target_level >= entry.resident_level && is_loaded(entry)) discard_load(entry);
+    }
+    frame++;
+}
+
+unsigned int TextureResidency::get_resident_level(GLuint texture) const
+{
+    std::map<GLuint, Entry>::const_iterator i = entries.find(texture);
+    return i != entries.end() ? i->second.resident_level : 0;
+}
+
+TextureResidency::Statistics TextureResidency::get_statistics() const
+{
+    Statistics stats;
+    stats.budget = budget;
+    stats.resident_size = stats.full_size = stats.system_size = 0;
+    stats.texture_count = entries.size();
+    stats.upload_count = upload_count;
+    stats.eviction_count = eviction_count;
+    stats.load_count = load_count;
+    stats.pending_load_count = 0;
+    for(std::map<GLuint, Entry>::const_iterator i = entries.begin(); i != entries.end(); i++) {
+        stats.resident_size += i->second.chain_sizes[i->second.resident_level];
+        stats.full_size += i->second.chain_sizes[0];
+        stats.system_size += i->second.chain_sizes[i->second.image_level];
+        if(i->second.load != NULL && !i->second.load->is_finished()) stats.pending_load_count++;
+    }
+    return stats;
+}
+
+}
@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) 2016 Hiroka Ihara
+ *
+ * This file is part of libU3D.
+ *
+ * libU3D is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libU3D is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libU3D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+namespace U3D
+{
+
+//Produces the full mip chain of a managed texture again, for levels its
+//residency has let go of in system memory
+class TextureSource
+{
+public:
+    virtual ~TextureSource() {}
+    //Returns false when the image can no longer be produced.
+    virtual bool load(TextureImage& image) = 0;
+};
+
+//Storage of the textures a TextureResidency manages
+class TextureBackend
+{
+public:
+    virtual ~TextureBackend() {}
+    virtual GLuint create_texture() = 0;
+    //Replaces the levels of the texture with those of the image from
+    //first_level on, which becomes its base level.
+    virtual void upload_levels(GLuint texture, const TextureImage& image, unsigned int first_level) = 0;
+    virtual void delete_texture(GLuint texture) = 0;
+};
+
+class GLTextureBackend : public TextureBackend
+{
+public:
+    GLuint create_texture()
+    {
+        GLuint texture;
+        glGenTextures(1, &texture);
+        return texture;
+    }
+    void upload_levels(GLuint texture, const TextureImage& image, unsigned int first_level);
+    void delete_texture(GLuint texture)
+    {
+        glDeleteTextures(1, &texture);
+    }
+};
+
+//Records the sizes of the levels uploaded instead of their texels, so that
+//residency can be exercised without a GPU.
+class MemoryTextureBackend : public TextureBackend
+{
+    struct Storage
+    {
+        uint32_t width, height;
+        unsigned int level_count;
+        size_t size;
+    };
+    std::map<GLuint, Storage> textures;
+    GLuint next_name;
+    size_t uploaded_size;
+    unsigned int upload_count;
+public:
+    MemoryTextureBackend() : next_name(1), uploaded_size(0), upload_count(0) {}
+    GLuint create_texture()
+    {
+        Storage& storage = textures[next_name];
+        storage.width = storage.height = 0;
+        storage.level_count = 0;
+        storage.size = 0;
+        return next_name++;
+    }
+    void upload_levels(GLuint texture, const TextureImage& image, unsigned int first_level);
+    void delete_texture(GLuint texture)
+    {
+        textures.erase(texture);
+    }
+    //Base level width, or 0 for unknown textures
+    uint32_t get_width(GLuint texture) const
+    {
+        std::map<GLuint, Storage>::const_iterator i = textures.find(texture);
+        return i != textures.end() ? i->second.width : 0;
+    }
+    unsigned int get_level_count(GLuint texture) const
+    {
+        std::map<GLuint, Storage>::const_iterator i = textures.find(texture);
+        return i != textures.end() ? i->second.level_count : 0;
+    }
+    //Bytes held by the levels of every texture
+    size_t get_resident_size() const;
+    //Bytes and calls of every upload so far
+    size_t get_uploaded_size() const { return uploaded_size; }
+    unsigned int get_upload_count() const { return upload_count; }
+    size_t get_texture_count() const { return textures.size(); }
+};
+
+//Keeps resident the mip levels the textures of a context are drawn at,
+//within a byte budget. Levels finer than the on-screen size of the models
+//using a texture are dropped, and under pressure the least recently drawn
+//textures fall back to coarser levels, down to their last one. Only the
+//levels no larger than INITIAL_SIZE stay in system memory, counted against
+//the budget too, and finer ones are loaded again from the source of the
+//texture when they are uploaded. With a worker pool, sources load in the
+//background and their levels are uploaded by a later update.
+class TextureResidency
+{
+public:
+    struct Statistics
+    {
+        //Bytes of levels uploaded, of every level, and kept in system memory
+        size_t budget, resident_size, full_size, system_size;
+        unsigned int texture_count, upload_count, eviction_count;
+        //Loads of sources started, and those still running
+        unsigned int load_count, pending_load_count;
+    };
+    //Textures are added with their levels no larger than this resident.
+    static const uint32_t INITIAL_SIZE = 64;
+private:
+    class LoadTask;
+    struct Entry
+    {
+        GLuint texture;
+        //Levels from image_level on, trimmed down to those from kept_level
+        //on once the draws following the addition have been streamed
+        TextureImage image;
+        unsigned int image_level, kept_level;
+        TextureSource *source;
+        //Background load of the full chain, kept until its levels are uploaded
+        LoadTask *load;
+        uint32_t added;
+        //Larger dimension of the first level
+        uint32_t size;
+        //Bytes of the levels from each level to the last one
+        std::vector<size_t> chain_sizes;
+        unsigned int resident_level, target_level;
+        //Largest on-screen size requested since the last update
+        float pixels;
+        uint32_t last_used;
+    };
+    TextureBackend *backend;
+    size_t budget, upload_limit;
+    std::map<GLuint, Entry> entries;
+    WorkerPool *pool;
+    bool pool_owned;
+    SDL_mutex *mutex;
+    uint32_t frame;
+    unsigned int upload_count, eviction_count, load_count;
+    static bool is_more_recent(const Entry *a, const Entry *b);
+    //Coarsest level still spanning the pixels, so that it is not magnified
+    static unsigned int get_level(const Entry& entry, float pixels);
+    void wait_for_loads();
+    bool is_loaded(const Entry& entry) const;
+    void upload(Entry& entry, unsigned int level);
+    static void trim(Entry& entry);
+    static void discard_load(Entry& entry);
+public:
+    //The residency takes ownership of the backend. A budget of 0 keeps the
+    //levels the draws need whatever their size.
+    TextureResidency(TextureBackend *backend, size_t budget);
+    ~TextureResidency();
+    //Takes the contents of the image, whose mip chain should be complete,
+    //and ownership of the source. Without a source the full chain stays in
+    //system memory.
+    GLuint add(TextureImage& image, TextureSource *source = NULL);
+    bool contains(GLuint texture) const
+    {
+        return entries.count(texture) != 0;
+    }
+    //Records a draw of the texture over a model spanning the given pixels.
+    void request(GLuint texture, float pixels);
+    //Streams levels in and out for the draws requested since the last update.
+    void update();
+    //Sources are loaded on the pool from then on, which the residency owns
+    //when owned is set. Other pools must outlive it.
+    void set_worker_pool(WorkerPool *pool, bool owned = false);
+    void set_budget(size_t budget)
+    {
+        this->budget = budget;
+    }
+    //Bytes of finer levels uploaded per update, 0 for no limit. Dropping
+    //levels is never held back. The loads of sources started count against
+    //the limit as well, so that it bounds the images loaded per frame.
+    void set_upload_limit(size_t limit)
+    {
+        upload_limit = limit;
+    }
+    //Level of the full chain resident as the base level
+    unsigned int get_resident_level(GLuint texture) const;
+    Statistics get_statistics() const;
+    TextureBackend& get_backend()
+    {
+        return *backend;
+    }
+private:
+    TextureResidency(const TextureResidency&);
+    TextureResidency& operator=(const TextureResidency&);
+};
+
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2016 Hiroka Ihara
+ *
+ * This file is part of libU3D.
+ *
+ * libU3D is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libU3D is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libU3D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "u3d_internal.hh"
+
+namespace U3D
+{
+
+namespace
+{
+bool is_separator(char c)
+{
+    return c == '/' || c == '\\';
+}
+
+//A drive letter such as C: reads as a one letter scheme.
+bool has_scheme(const std::string& uri)
+{
+    size_t colon = uri.find(':');
+    if(colon == std::string::npos || colon < 2 || !isalpha(static_cast<unsigned char>(uri[0]))) return false;
+    for(size_t i = 1; i < colon; i++) {
+        char c = uri[i];
+        if(!isalnum(static_cast<unsigned char>(c)) && c != '+' && c != '-' && c != '.') return false;
+    }
+    return true;
+}
+
+bool is_absolute(const std::string& path)
+{
+    return (!path.empty() && is_separator(path[0])) || (path.size() > 2 && path[1] == ':' && is_separator(path[2]));
+}
+
+int hex_value(char c)
+{
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+std::string percent_decode(const std::string& text)
+{
+    std::string decoded;
+    for(size_t i = 0; i < text.size(); i++) {
+        if(text[i] == '%' && i + 2 < text.size() && hex_value(text[i + 1]) >= 0 && hex_value(text[i + 2]) >= 0) {
+            decoded += static_cast<char>(hex_value(text[i + 1]) * 16 + hex_value(text[i + 2]));
+            i += 2;
+        } else {
+            decoded += text[i];
+        }
+    }
+    return decoded;
+}
+}
+
+FileUriResolver::FileUriResolver(const std::string& document_path)
+{
+    size_t separator = document_path.find_last_of("/\\");
+    if(separator != std::string::npos) base_directory = document_path.substr(0, separator + 1);
+}
+
+std::string FileUriResolver::get_path(const std::string& uri) const
+{
+    static const std::string file_scheme = "file://", localhost = "localhost";
+    if(uri.compare(0, file_scheme.size(), file_scheme) == 0) {
+        std::string path = uri.substr(file_scheme.size());
+        if(path.compare(0, localhost.size(), localhost) == 0) path.erase(0, localhost.size());
+        //Paths under other hosts are not local.
+        if(path.empty() || path[0] != '/') return std::string();
+        //file:///C:/path names a drive.
+        if(path.size() > 3 && path[2] == ':' && isalpha(static_cast<unsigned char>(path[1]))) path.erase(0, 1);
+        return percent_decode(path);
+    }
+    if(uri.empty() || has_scheme(uri)) return std::string();
+    return is_absolute(uri) ? uri : base_directory + uri;
+}
+
+bool FileUriResolver::resolve(const std::string& uri, std::vector<uint8_t>& data)
+{
+    std::string path = get_path(uri);
+    if(path.empty()) return false;
+    std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+    if(!file.is_open()) return false;
+    file.seekg(0, std::ios::end);
+    std::streamoff size = file.tellg();
+    file.seekg(0, std::ios::beg);
+    if(size <= 0) return false;
+    data.resize(static_cast<size_t>(size));
+    return !file.read(reinterpret_cast<char *>(&data[0]), size).fail();
+}
+
+}
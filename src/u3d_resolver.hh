@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2016 Hiroka Ihara
+ *
+ * This file is part of libU3D.
+ *
+ * libU3D is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libU3D is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libU3D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+namespace U3D
+{
+
+//Fetches the images textures reference by URI instead of embedding them.
+//Resolvers run on the thread creating contexts.
+class UriResolver
+{
+public:
+    virtual ~UriResolver() {}
+    //Fills data with the bytes at the URI, and returns false when the
+    //resolver does not handle it or cannot read them.
+    virtual bool resolve(const std::string& uri, std::vector<uint8_t>& data) = 0;
+};
+
+//Reads file:// URIs and plain paths, relative ones from the directory of
+//the document. Other schemes are left to the resolver of the load options.
+class FileUriResolver : public UriResolver
+{
+    std::string base_directory;
+public:
+    FileUriResolver(const std::string& document_path);
+    bool resolve(const std::string& uri, std::vector<uint8_t>& data);
+    //Local path the URI names, or an empty string for other schemes and hosts
+    std::string get_path(const std::string& uri) const;
+};
+
+}
@@ -0,0 +1,376 @@
+/*
+ * Copyright (C) 2016 Hiroka Ihara
+ *
+ * This file is part of libU3D.
+ *
+ * libU3D is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libU3D is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libU3D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "u3d_internal.hh"
+
+namespace U3D
+{
+
+const RenderStats& SceneGraph::render(GraphicsContext *context)
+{
+    RenderDevice& device = context->get_render_device();
+    context->update_textures();
+    if(!batches_valid || instance_arena != &context->get_buffer_arena()) {
+        create_batches(context);
+    }
+    if(refit_bounds()) {
+        cull_valid = false;
+    }
+    if(view.update(device)) {
+        for(std::vector<LightParams>::iterator i = lights.begin(); i != lights.end(); i++) {
+            i->update(view.inverse_view_matrix);
+        }
+        light_block.update(lights);
+        for(std::vector<ModelParams>::iterator j = models.begin(); j != models.end(); j++) {
+            j->update(view);
+        }
+        for(std::vector<InstanceBatch>::iterator j = batches.begin(); j != batches.end(); j++) {
+            j->update(view);
+        }
+        for(std::vector<StaticBatch>::iterator j = static_batches.begin(); j != static_batches.end(); j++) {
+            j->params.update(view);
+        }
+        cull_valid = false;
+    }
+    if(!cull_valid) {
+        cull();
+    }
+    bool residency = context->get_texture_residency() != NULL;
+    queue.clear();
+    std::vector<unsigned int> visible;
+    for(std::vector<InstanceBatch>::iterator j = batches.begin(); j != batches.end(); j++) {
+        if(j->baked) continue;
+        visible.clear();
+        for(unsigned int m = 0; m < j->members.size(); m++) {
+            if(model_visible[j->members[m]]) visible.push_back(j->members[m]);
+        }
+        if(visible.empty()) continue;
+        RenderGroup *render_group = context->get_render_group(j->render_group);
+        if(render_group == NULL) continue;
+        if(visible.size() > 1) {
+            update_instances(*j, visible);
+        }
+        float screen_size = 0;
+        for(unsigned int m = 0; residency && m < visible.size(); m++) {
+            screen_size = std::max(screen_size, model_screen_sizes[visible[m]]);
+        }
+        //U3D_LOG << "Rendering model \"" << j->name << "\"" <<  std::endl;
+        for(unsigned int k = 0; k < render_group->elements.size(); k++) {
+            ShaderGroup *shader_group = context->get_shader_group(j->get_shader_group(k));
+            GLuint textures[8];
+            get_textures(context, shader_group, textures);
+            if(residency) request_texture_sizes(context, shader_group, screen_size);
+            if(visible.size() > 1 && shader_group->instanced_program != NULL) {
+                queue.add(shader_group, shader_group->instanced_program, textures, render_group, k, &*j, j->instances, visible.size());
+            } else {
+                for(unsigned int m = 0; m < visible.size(); m++) {
+                    queue.add(shader_group, shader_group->program, textures, render_group, k, &models[visible[m]]);
+                }
+            }
+        }
+    }
+    for(std::vector<StaticBatch>::iterator j = static_batches.begin(); j != static_batches.end(); j++) {
+        bool batch_visible = false;
+        float screen_size = 0;
+        for(unsigned int m = 0; m < j->sources.size(); m++) {
+            if(model_visible[j->sources[m].model] == 0) continue;
+            batch_visible = true;
+            screen_size = std::max(screen_size, model_screen_sizes[j->sources[m].model]);
+        }
+        if(!batch_visible) continue;
+        RenderGroup *render_group = context->get_render_group(j->render_group);
+        if(render_group == NULL) continue;
+        ShaderGroup *shader_group = context->get_shader_group(j->shader_group);
+        GLuint textures[8];
+        get_textures(context, shader_group, textures);
+        if(residency) request_texture_sizes(context, shader_group, screen_size);
+        queue.add(shader_group, shader_group->program, textures, render_group, 0, &j->params);
+    }
+    stats = queue.submit(device, &light_block);
+    stats.models_culled = models_culled;
+    stats.models_drawn = models.size() - models_culled;
+    return stats;
+}
+
+void SceneGraph::release(GraphicsContext *context)
+{
+    if(instance_arena != &context->get_buffer_arena()) return;
+    release_static_batches(context);
+    for(std::vector<InstanceBatch>::iterator i = batches.begin(); i != batches.end(); i++) {
+        instance_arena->free(i->instances);
+    }
+    batches.clear();
+    instance_arena = NULL;
+    batches_valid = false;
+}
+
+void SceneGraph::release_static_batches(GraphicsContext *context)
+{
+    for(std::vector<StaticBatch>::iterator i = static_batches.begin(); i != static_batches.end(); i++) {
+        context->add_render_group(i->group_name, NULL);
+    }
+    static_batches.clear();
+    for(std::vector<InstanceBatch>::iterator i = batches.begin(); i != batches.end(); i++) {
+        i->baked = false;
+    }
+    for(std::vector<std::pair<std::string, const ModelResource *> >::iterator i = released_sources.begin(); i != released_sources.end(); i++) {
+        context->add_render_group(i->first, i->second->create_render_group(context->get_buffer_arena()));
+    }
+    released_sources.clear();
+}
+
+void SceneGraph::set_model_matrix(unsigned int index, const Matrix4f& matrix)
+{
+    ModelParams& model = models[index];
+    if(memcmp(&model.model_matrix, &matrix, sizeof(Matrix4f)) == 0) return;
+    model.model_matrix = matrix;
+    if(view.valid) model.update(view);
+    CullNode& node = cull_nodes[model.cull_node];
+    node.bounds = node.resource->get_bounds().transform(matrix);
+    node.bounds_serial = node.resource->get_bounds_serial();
+    models_moved = true;
+    if(batches_valid) {
+        //The instance buffer is written again the next time the batch is drawn.
+        batches[model.batch].resident.clear();
+        if(batches[model.batch].baked) batches_valid = false;
+    }
+}
+
+//Refits the model nodes whose resource bounds have grown since they were
+//fitted, as when continuations are decoded after the scene was created,
+//and then every group. Returns whether any bounds changed.
+bool SceneGraph::refit_bounds()
+{
+    bool changed = models_moved;
+    models_moved = false;
+    for(std::vector<CullNode>::iterator i = cull_nodes.begin(); i != cull_nodes.end(); i++) {
+        if(i->resource == NULL || i->bounds_serial == i->resource->get_bounds_serial()) continue;
+        i->bounds = i->resource->get_bounds().transform(models[i->model].model_matrix);
+        i->bounds_serial = i->resource->get_bounds_serial();
+        changed = true;
+    }
+    if(!changed) return false;
+    for(std::vector<CullNode>::iterator i = cull_nodes.begin(); i != cull_nodes.end(); i++) {
+        if(i->model < 0) i->bounds = BoundingBox3f();
+    }
+    //Descendants follow their group in preorder, so a reverse pass folds
+    //each subtree into its group before the group is folded into its parent.
+    for(size_t i = cull_nodes.size(); i-- > 0;) {
+        if(cull_nodes[i].parent != NO_PARENT) cull_nodes[cull_nodes[i].parent].bounds.extend(cull_nodes[i].bounds);
+    }
+    return true;
+}
+
+//Texture sizes follow visibility, so they are refreshed along with it.
+void SceneGraph::cull()
+{
+    model_visible.assign(models.size(), culling_enabled ? 0 : 1);
+    models_culled = 0;
+    if(culling_enabled) {
+        Frustum frustum(view.projection_matrix * view.inverse_view_matrix);
+        for(unsigned int i = 0; i < cull_nodes.size();) {
+            const CullNode& node = cull_nodes[i];
+            if(frustum.intersects(node.bounds)) {
+                if(node.model >= 0) model_visible[node.model] = 1;
+                i++;
+            } else {
+                models_culled += node.model_count;
+                i = node.end;
+            }
+        }
+    }
+    update_screen_sizes();
+    cull_valid = true;
+}
+
+//Projects the bounding sphere of each visible model. Models the eye is
+//inside of need their textures at full resolution.
+void SceneGraph::update_screen_sizes()
+{
+    model_screen_sizes.assign(models.size(), 0.0f);
+    float pixel_scale = 0.5f * view.viewport_height * view.projection_matrix.m[1][1];
+    for(std::vector<CullNode>::const_iterator i = cull_nodes.begin(); i != cull_nodes.end(); i++) {
+        if(i->model < 0 || !model_visible[i->model] || i->bounds.empty()) continue;
+        Vector3f extent = i->bounds.max - i->bounds.min;
+        float diameter = sqrtf(extent * extent);
+        float depth = view.type == ViewParams::PERSPECTIVE ? -(view.inverse_view_matrix * i->bounds.center()).z : 1.0f;
+        if(depth <= 0.5f * diameter) {
+            model_screen_sizes[i->model] = 1E+30f;
+        } else {
+            model_screen_sizes[i->model] = diameter * pixel_scale / depth;
+        }
+    }
+}
+
+//Packs the matrices of the visible members at the head of the instance buffer.
+void SceneGraph::update_instances(InstanceBatch& batch, const std::vector<unsigned int>& visible)
+{
+    if(batch.resident == visible) return;
+    std::vector<Matrix4f> data;
+    data.reserve(2 * visible.size());
+    for(unsigned int i = 0; i < visible.size(); i++) {
+        const Matrix4f& model_matrix = models[visible[i]].model_matrix;
+        data.push_back(model_matrix);
+        data.push_back(model_matrix.create_normal_matrix());
+    }
+    instance_arena->write(batch.instances, &data[0], sizeof(Matrix4f) * data.size());
+    batch.resident = visible;
+}
+
+//Elements are merged when they share a shader, a vertex layout and a primitive type.
+typedef std::pair<std::string, std::pair<uint32_t, GLenum> > StaticBatchKey;
+
+unsigned int SceneGraph::create_static_batches(GraphicsContext *context, const StaticBatchOptions& options)
+{
+    BufferArena& arena = context->get_buffer_arena();
+    if(!batches_valid || instance_arena != &arena) {
+        create_batches(context);
+    }
+    release_static_batches(context);
+    std::vector<const ModelResource *> resources(models.size(), static_cast<const ModelResource *>(NULL));
+    for(std::vector<CullNode>::const_iterator i = cull_nodes.begin(); i != cull_nodes.end(); i++) {
+        if(i->model >= 0) resources[i->model] = i->resource;
+    }
+    //The geometry of the candidates is built in memory rather than read
+    //back from the buffers being drawn from.
+    BufferArena scratch(new MemoryBufferBackend());
+    std::vector<unsigned int> candidates;
+    std::vector<RenderGroup *> geometry;
+    for(unsigned int i = 0; i < batches.size(); i++) {
+        if(batches[i].members.size() != 1 || resources[batches[i].members[0]] == NULL) continue;
+        RenderGroup *render_group = resources[batches[i].members[0]]->create_render_group(scratch);
+        GLint vertices = 0;
+        for(unsigned int k = 0; k < render_group->elements.size(); k++) {
+            vertices += render_group->elements[k].count;
+        }
+        if(vertices == 0 || vertices > static_cast<GLint>(options.max_vertices)) {
+            delete render_group;
+            continue;
+        }
+        candidates.push_back(i);
+        geometry.push_back(render_group);
+    }
+    //A model left out of one batch is left out of all of them, which may
+    //leave another batch short of sources in turn.
+    std::vector<StaticBatchKey> keys;
+    std::vector<bool> merged(candidates.size(), true);
+    std::map<StaticBatchKey, unsigned int> source_counts;
+    for(bool changed = true; changed;) {
+        changed = false;
+        source_counts.clear();
+        for(unsigned int c = 0; c < candidates.size(); c++) {
+            for(unsigned int k = 0; merged[c] && k < geometry[c]->elements.size(); k++) {
+                if(geometry[c]->elements[k].count == 0) continue;
+                StaticBatchKey key(get_shader_name(batches[candidates[c]].shader_names, k), std::make_pair(geometry[c]->elements[k].flags, geometry[c]->mode));
+                source_counts[key]++;
+            }
+        }
+        for(unsigned int c = 0; c < candidates.size(); c++) {
+            for(unsigned int k = 0; merged[c] && k < geometry[c]->elements.size(); k++) {
+                if(geometry[c]->elements[k].count == 0) continue;
+                StaticBatchKey key(get_shader_name(batches[candidates[c]].shader_names, k), std::make_pair(geometry[c]->elements[k].flags, geometry[c]->mode));
+                if(source_counts[key] < options.min_sources) {
+                    merged[c] = false;
+                    changed = true;
+                }
+            }
+        }
+    }
+    std::map<StaticBatchKey, unsigned int> batch_indices;
+    std::vector<std::vector<GLfloat> > vertex_data;
+    for(unsigned int c = 0; c < candidates.size(); c++) {
+        if(!merged[c]) continue;
+        InstanceBatch& instance_batch = batches[candidates[c]];
+        const ModelParams& model = models[instance_batch.members[0]];
+        const RenderGroup *render_group = geometry[c];
+        for(unsigned int k = 0; k < render_group->elements.size(); k++) {
+            const RenderGroup::RenderElement& element = render_group->elements[k];
+            if(element.count == 0) continue;
+            StaticBatchKey key(get_shader_name(model.shader_names, k), std::make_pair(element.flags, render_group->mode));
+            std::map<StaticBatchKey, unsigned int>::iterator index = batch_indices.find(key);
+            if(index == batch_indices.end()) {
+                index = batch_indices.insert(std::make_pair(key, static_cast<unsigned int>(static_batches.size()))).first;
+                static_batches.push_back(StaticBatch(key.first, instance_batch.get_shader_group(k)));
+                vertex_data.push_back(std::vector<GLfloat>());
+                keys.push_back(key);
+            }
+            StaticBatch& batch = static_batches[index->second];
+            std::vector<GLfloat>& data = vertex_data[index->second];
+            int stride = __builtin_popcount(element.flags);
+            StaticBatch::Source source;
+            source.model = instance_batch.members[0];
+            source.element = k;
+            source.first = data.size() / stride;
+            batch.sources.push_back(source);
+            size_t base = data.size();
+            data.resize(base + stride * element.count);
+            scratch.read(element.range, &data[base]);
+            transform_points(model.model_matrix, &data[base], &data[base], element.count, stride);
+            if(element.flags & RenderGroup::BUFFER_NORMAL_MASK) {
+                transform_normals(model.model_matrix, &data[base + 3], &data[base + 3], element.count, stride);
+            }
+        }
+        instance_batch.baked = true;
+    }
+    for(unsigned int i = 0; i < geometry.size(); i++) {
+        delete geometry[i];
+    }
+    for(unsigned int i = 0; i < static_batches.size(); i++) {
+        StaticBatch& batch = static_batches[i];
+        uint32_t flags = keys[i].second.first;
+        //Named apart from any resource of the file and from other scenes
+        std::ostringstream name;
+        name << '\0' << "static " << this << ' ' << i;
+        batch.group_name = name.str();
+        batch.vertex_count = vertex_data[i].size() / __builtin_popcount(flags);
+        RenderGroup *render_group = new RenderGroup(arena, keys[i].second.second, 1);
+        render_group->load(0, &vertex_data[i][0], flags, batch.vertex_count);
+        context->add_render_group(batch.group_name, render_group);
+        batch.render_group = context->get_render_group_handle(batch.group_name);
+    }
+    //A source group stays while any batch drawing it from the context is not baked.
+    if(options.release_sources) {
+        std::map<uint32_t, bool> unbaked;
+        for(std::vector<InstanceBatch>::const_iterator i = batches.begin(); i != batches.end(); i++) {
+            unbaked[i->render_group] = unbaked[i->render_group] || !i->baked;
+        }
+        for(std::vector<InstanceBatch>::const_iterator i = batches.begin(); i != batches.end(); i++) {
+            if(unbaked[i->render_group] || context->get_render_group(i->render_group) == NULL) continue;
+            context->add_render_group(i->name, NULL);
+            released_sources.push_back(std::make_pair(i->name, resources[i->members[0]]));
+        }
+    }
+    view.valid = false;
+    U3D_LOG << static_batches.size() << " static batches created." << std::endl;
+    return static_batches.size();
+}
+
+bool SceneGraph::get_static_source(unsigned int batch, GLint vertex, std::string *node_name, unsigned int *element) const
+{
+    if(batch >= static_batches.size() || vertex < 0 || vertex >= static_batches[batch].vertex_count) return false;
+    const std::vector<StaticBatch::Source>& sources = static_batches[batch].sources;
+    std::vector<StaticBatch::Source>::const_iterator i = std::upper_bound(sources.begin(), sources.end(), vertex, StaticBatch::Source::precedes);
+    if(i == sources.begin()) return false;
+    i--;
+    if(node_name != NULL) *node_name = models[i->model].node_name;
+    if(element != NULL) *element = i->element;
+    return true;
+}
+
+}
@@ -25,13 +25,21 @@ namespace U3D
 class Node
 {
 public:
+    //Kind of the node, so that it can be classified without dynamic_cast
+    enum Type {
+        GROUP = 0, MODEL, LIGHT, VIEW
+    };
     struct Parent {
         std::string name;
         Matrix4f transform;
     };
     std::vector<Parent> parents;
+    //Bounds declared by the modifier chain in node space; empty when absent
+    BoundingBox3f chain_bounds;
+private:
+    Type type;
 public:
-    Node(BitStreamReader& reader)
+    Node(BitStreamReader& reader, Type type = GROUP) : type(type)
     {
         uint32_t parent_count = reader.read<uint32_t>();
         parents.resize(parent_count);
@@ -39,13 +47,29 @@ public:
             reader >> parents[i].name >> parents[i].transform;
         }
     }
-    Node() {}
+    Node() : type(GROUP) {}
     virtual ~Node() {}
+    Type get_type() const
+    {
+        return type;
+    }
 };
 
+//Returns NULL unless the node is of the type T declares.
+template<typename T> T *node_cast(Node *node)
+{
+    return node != NULL && node->get_type() == T::TYPE ? static_cast<T *>(node) : NULL;
+}
+
+template<typename T> const T *node_cast(const Node *node)
+{
+    return node != NULL && node->get_type() == T::TYPE ? static_cast<const T *>(node) : NULL;
+}
+
 class Group : public Node
 {
 public:
+    static const Type TYPE = GROUP;
     Group(BitStreamReader& reader) : Node(reader) {}
     Group() {}
 };
@@ -71,8 +95,9 @@ class View : public Node
     };
     std::vector<Backdrop> backdrops, overlays;
 public:
+    static const Type TYPE = VIEW;
     std::string resource_name;
-    View(BitStreamReader& reader) : Node(reader)
+    View(BitStreamReader& reader) : Node(reader, VIEW)
     {
         reader >> resource_name >> attributes >> near_clipping >> far_clipping;
         switch(attributes & 0x6) {
@@ -106,13 +131,15 @@ public:
 class Model : public Node
 {
     friend class SceneGraph;
+    friend class FileStructure;
 
     uint32_t visibility;
     static const uint32_t FRONT_VISIBLE = 1, BACK_VISIBLE = 2;
     Shading *shading;
 public:
+    static const Type TYPE = MODEL;
     std::string resource_name;
-    Model(BitStreamReader& reader) : Node(reader), shading(NULL)
+    Model(BitStreamReader& reader) : Node(reader, MODEL), shading(NULL)
     {
         reader >> resource_name >> visibility;
     }
@@ -129,8 +156,9 @@ public:
 class Light : public Node
 {
 public:
+    static const Type TYPE = LIGHT;
     std::string resource_name;
-    Light(BitStreamReader& reader) : Node(reader)
+    Light(BitStreamReader& reader) : Node(reader, LIGHT)
     {
         reader >> resource_name;
     }
@@ -197,6 +225,21 @@ public:
     }
 };
 
+//Limits of the static batching pass of a SceneGraph
+struct StaticBatchOptions
+{
+    //Models with more vertices keep their own buffers, as baking their
+    //transforms saves little next to the vertices copied.
+    unsigned int max_vertices;
+    //Batches that would merge fewer elements than this are not made.
+    unsigned int min_sources;
+    //Frees the render groups of the merged models, so a context using this
+    //must not be shared with scenes drawing those models. They are created
+    //again from the decoded geometry when the batches are released.
+    bool release_sources;
+    StaticBatchOptions() : max_vertices(1024), min_sources(2), release_sources(true) {}
+};
+
 class SceneGraph
 {
     struct ViewParams
@@ -208,29 +251,31 @@ class SceneGraph
         float fovy, height, near, far;
         float fog_start, fog_end;
         Color3f fog_color;
-        void load(GLuint program, const Matrix4f& model_matrix)
+        //Per-frame state derived from the view
+        Matrix4f projection_matrix, inverse_view_matrix;
+        float aspect, viewport_height;
+        bool valid;
+        //Returns true when the projection or the view has changed since the last frame.
+        bool update(RenderDevice& device)
         {
-            float viewport[4];
-            glGetFloatv(GL_VIEWPORT, viewport);
-            float aspect = viewport[2] / viewport[3];
-            Matrix4f projection_matrix;
+            GLfloat viewport[4];
+            device.get_viewport(viewport);
+            float new_aspect = viewport[2] / viewport[3];
+            Matrix4f new_inverse_view_matrix = view_matrix.affine_inverse();
+            if(valid && new_aspect == aspect && viewport[3] == viewport_height && memcmp(&new_inverse_view_matrix, &inverse_view_matrix, sizeof(Matrix4f)) == 0) {
+                return false;
+            }
+            aspect = new_aspect;
+            viewport_height = viewport[3];
+            inverse_view_matrix = new_inverse_view_matrix;
+            projection_matrix = Matrix4f();
             if(type == PERSPECTIVE) {
                 Matrix4f::create_perspective_projection(projection_matrix, fovy, aspect, near, far);
             } else if(type == ORTHOGONAL) {
                 Matrix4f::create_orthogonal_projection(projection_matrix, height, aspect, near, far);
             }
-            Matrix4f modelview_matrix = view_matrix.inverse() * model_matrix;
-            Matrix4f PVM_matrix = projection_matrix * modelview_matrix;
-            Matrix4f normal_matrix = modelview_matrix.create_normal_matrix();
-            /*U3D_LOG << "Near = " << near << ", far = " << far << std::endl;
-            U3D_LOG << "projection_matrix = " << projection_matrix << std::endl;
-            U3D_LOG << "model_matrix = " << model_matrix << std::endl;
-            U3D_LOG << "view_matrix = " << view_matrix << std::endl;
-            U3D_LOG << "PVM_matrix = " << PVM_matrix << std::endl;
-            U3D_LOG << "normal_matrix = " << normal_matrix << std::endl;*/
-            glUniformMatrix4fv(glGetUniformLocation(program, "PVM_matrix"), 1, GL_FALSE, (GLfloat *)&PVM_matrix);
-            glUniformMatrix4fv(glGetUniformLocation(program, "modelview_matrix"), 1, GL_FALSE, (GLfloat *)&modelview_matrix);
-            glUniformMatrix4fv(glGetUniformLocation(program, "normal_matrix"), 1, GL_FALSE, (GLfloat *)&normal_matrix);
+            valid = true;
+            return true;
         }
         ViewParams(const View& view, const ViewResource::Pass& view_pass, const Matrix4f& transform)
         {
@@ -251,6 +296,8 @@ class SceneGraph
                 fog_end = view_pass.fog_far;
                 fog_color = view_pass.fog_color;
             }
+            aspect = 0;
+            valid = false;
         }
     };
     struct LightParams
@@ -263,6 +310,7 @@ class SceneGraph
         Color3f color;
         float att_constant, att_linear, att_quadratic;
         float spot_angle, intensity;
+        Vector3f viewspace_position, viewspace_direction;
         LightParams(const LightResource& light, const Matrix4f& transform)
         {
             type = light.type;
@@ -275,102 +323,413 @@ class SceneGraph
             spot_angle = light.spot_angle;
             intensity = light.intensity;
         }
-        void load(GLuint program, const Matrix4f& view_matrix)
+        void update(const Matrix4f& view_matrix)
         {
-            Vector3f viewspace_position = view_matrix * position;
-            Vector3f viewspace_direction = (view_matrix.create_normal_matrix() * direction).normalize();
+            viewspace_position = view_matrix * position;
+            viewspace_direction = (view_matrix.create_normal_matrix() * direction).normalize();
             /*U3D_LOG << "Position = " << viewspace_position << std::endl;
             U3D_LOG << "Direction = " << viewspace_direction << std::endl;
             U3D_LOG << "Color = " << color << std::endl;
-            U3D_LOG << "Intensity = " << intensity << std::endl;
-            U3D_LOG << "Constant Attenuation = " << att_constant << std::endl;
-            U3D_LOG << "Linear Attenuation = " << att_linear << std::endl;
-            U3D_LOG << "Quadratic Attenuation = " << att_quadratic << std::endl;*/
-            glUniform4f(glGetUniformLocation(program, "light_color"), color.r, color.g, color.b, 1.0f);
-            switch(type) {
-            case LIGHT_DIRECTIONAL:
-                glUniform4f(glGetUniformLocation(program, "light_direction"), viewspace_direction.x, viewspace_direction.y, viewspace_direction.z, 0.0f);
-                glUniform1f(glGetUniformLocation(program, "light_intensity"), intensity);
-                break;
-            case LIGHT_POINT:
-                glUniform4f(glGetUniformLocation(program, "light_position"), viewspace_position.x, viewspace_position.y, viewspace_position.z, 1.0f);
-                glUniform1f(glGetUniformLocation(program, "light_intensity"), intensity);
-                glUniform1f(glGetUniformLocation(program, "light_att0"), att_constant);
-                glUniform1f(glGetUniformLocation(program, "light_att1"), att_linear);
-                glUniform1f(glGetUniformLocation(program, "light_att2"), att_quadratic);
-                break;
-            case LIGHT_SPOT:
-                glUniform4f(glGetUniformLocation(program, "light_direction"), viewspace_direction.x, viewspace_direction.y, viewspace_direction.z, 0.0f);
-                glUniform4f(glGetUniformLocation(program, "light_position"), viewspace_position.x, viewspace_position.y, viewspace_position.z, 1.0f);
-                glUniform1f(glGetUniformLocation(program, "light_intensity"), intensity);
-                glUniform1f(glGetUniformLocation(program, "light_att0"), att_constant);
-                glUniform1f(glGetUniformLocation(program, "light_att1"), att_linear);
-                glUniform1f(glGetUniformLocation(program, "light_att2"), att_quadratic);
-                glUniform1f(glGetUniformLocation(program, "light_spot_angle"), spot_angle);
-                break;
+            U3D_LOG << "Intensity = " << intensity << std::endl;*/
+        }
+    };
+    //Uniform arrays describing every light of the scene for the single-pass shader
+    struct LightBlock : public UniformBlock
+    {
+        int count;
+        GLfloat color[4 * ShaderGroup::MAX_LIGHTS], position[4 * ShaderGroup::MAX_LIGHTS];
+        GLfloat direction[4 * ShaderGroup::MAX_LIGHTS], attenuation[4 * ShaderGroup::MAX_LIGHTS];
+        uint32_t serial;
+        LightBlock() : count(0), serial(0) {}
+        void update(const std::vector<LightParams>& lights)
+        {
+            count = std::min(static_cast<int>(lights.size()), static_cast<int>(ShaderGroup::MAX_LIGHTS));
+            for(int i = 0; i < count; i++) {
+                const LightParams& light = lights[i];
+                GLfloat *c = color + 4 * i, *p = position + 4 * i, *d = direction + 4 * i, *a = attenuation + 4 * i;
+                c[0] = light.color.r, c[1] = light.color.g, c[2] = light.color.b, c[3] = light.type;
+                p[0] = light.viewspace_position.x, p[1] = light.viewspace_position.y, p[2] = light.viewspace_position.z, p[3] = 1.0f;
+                d[0] = light.viewspace_direction.x, d[1] = light.viewspace_direction.y, d[2] = light.viewspace_direction.z;
+                d[3] = cosf(light.spot_angle * 0.5f / 180.0f * 3.1415927f);
+                a[0] = light.att_constant, a[1] = light.att_linear, a[2] = light.att_quadratic, a[3] = light.intensity;
+            }
+            serial = ShaderProgram::create_serial();
+        }
+        void load(RenderDevice& device, ShaderProgram& program)
+        {
+            if(program.light_serial == serial) return;
+            device.uniform1i(program.light_count, count);
+            if(count > 0) {
+                device.uniform4fv(program.light_color, count, color);
+                device.uniform4fv(program.light_position, count, position);
+                device.uniform4fv(program.light_direction, count, direction);
+                device.uniform4fv(program.light_attenuation, count, attenuation);
             }
+            program.light_serial = serial;
         }
     };
-    struct ModelParams
+    struct ModelParams : public UniformBlock
     {
-        std::string name;
+        std::string name, node_name;
         Matrix4f model_matrix;
         std::vector<std::string> shader_names;
-        ModelParams(const Model& model, const ModelResource& model_rsc, const Matrix4f& transform)
+        Matrix4f PVM_matrix, modelview_matrix, normal_matrix;
+        uint32_t serial;
+        //Instance the model was registered for, its cull node, and its instance batch
+        unsigned int instance, cull_node, batch;
+        ModelParams(const std::string& node_name, const Model& model, const ModelResource& model_rsc, const Matrix4f& transform, unsigned int instance)
+        : instance(instance), cull_node(0), batch(0)
         {
             model_matrix = transform;
             name = model.resource_name;
+            this->node_name = node_name;
             if(model.shading != NULL) {
                 shader_names.assign(model.shading->shader_names.begin(), model.shading->shader_names.end());
             } else if(model_rsc.shading != NULL) {
                 shader_names.assign(model_rsc.shading->shader_names.begin(), model_rsc.shading->shader_names.end());
             }
+            serial = 0;
+        }
+        ModelParams(const std::string& name, const Matrix4f& transform) : name(name), model_matrix(transform), serial(0), instance(0), cull_node(0), batch(0) {}
+        static bool precedes(const ModelParams& model, unsigned int instance)
+        {
+            return model.instance < instance;
+        }
+        void update(const ViewParams& view)
+        {
+            modelview_matrix = view.inverse_view_matrix * model_matrix;
+            PVM_matrix = view.projection_matrix * modelview_matrix;
+            normal_matrix = modelview_matrix.create_normal_matrix();
+            serial = ShaderProgram::create_serial();
+        }
+        void load(RenderDevice& device, ShaderProgram& program)
+        {
+            if(program.model_serial == serial) return;
+            device.uniform_matrix4fv(program.PVM_matrix, 1, (GLfloat *)&PVM_matrix);
+            device.uniform_matrix4fv(program.modelview_matrix, 1, (GLfloat *)&modelview_matrix);
+            device.uniform_matrix4fv(program.normal_matrix, 1, (GLfloat *)&normal_matrix);
+            program.model_serial = serial;
+        }
+    };
+    //Models sharing a resource and shaders, drawn with one instanced call per element
+    struct InstanceBatch : public UniformBlock
+    {
+        std::string name;
+        std::vector<std::string> shader_names;
+        //Handles of the render group and of the shader of each element,
+        //resolved against the context the batches were created for
+        uint32_t render_group;
+        std::vector<uint32_t> shader_groups;
+        uint32_t default_shader_group;
+        std::vector<unsigned int> members;
+        //Members whose matrices are currently stored in the instance buffer, in order
+        std::vector<unsigned int> resident;
+        BufferArena::Range instances;
+        Matrix4f view_matrix, view_normal_matrix, projection_matrix;
+        uint32_t serial;
+        //Set when the member has been merged into the static batches
+        bool baked;
+        InstanceBatch(const ModelParams& model) : name(model.name), shader_names(model.shader_names), serial(0), baked(false) {}
+        void resolve(GraphicsContext *context)
+        {
+            render_group = context->get_render_group_handle(name);
+            shader_groups.resize(shader_names.size());
+            for(unsigned int i = 0; i < shader_names.size(); i++) {
+                shader_groups[i] = context->get_shader_group_handle(shader_names[i]);
+            }
+            default_shader_group = context->get_shader_group_handle("");
+        }
+        uint32_t get_shader_group(unsigned int element) const
+        {
+            return element < shader_groups.size() ? shader_groups[element] : default_shader_group;
         }
+        void update(const ViewParams& view)
+        {
+            view_matrix = view.inverse_view_matrix;
+            view_normal_matrix = view_matrix.create_normal_matrix();
+            projection_matrix = view.projection_matrix;
+            serial = ShaderProgram::create_serial();
+        }
+        void load(RenderDevice& device, ShaderProgram& program)
+        {
+            if(program.model_serial == serial) return;
+            device.uniform_matrix4fv(program.view_matrix, 1, (GLfloat *)&view_matrix);
+            device.uniform_matrix4fv(program.view_normal_matrix, 1, (GLfloat *)&view_normal_matrix);
+            device.uniform_matrix4fv(program.projection_matrix, 1, (GLfloat *)&projection_matrix);
+            program.model_serial = serial;
+        }
+    };
+    //Elements of different models sharing a shader and vertex layout, merged
+    //into one buffer with their world transforms baked into the vertices.
+    //The merged render group is added to the context under an internal name.
+    struct StaticBatch
+    {
+        std::string shader_name, group_name;
+        uint32_t shader_group, render_group;
+        GLint vertex_count;
+        ModelParams params;
+        //Vertex ranges of the merged elements, in ascending order of first
+        struct Source
+        {
+            unsigned int model, element;
+            GLint first;
+            static bool precedes(GLint vertex, const Source& source)
+            {
+                return vertex < source.first;
+            }
+        };
+        std::vector<Source> sources;
+        StaticBatch(const std::string& shader_name, uint32_t shader_group)
+        : shader_name(shader_name), shader_group(shader_group), render_group(0), vertex_count(0), params("", Matrix4f()) {}
+    };
+    //Node instances in preorder, each bounding the models of its subtree
+    struct CullNode
+    {
+        std::string name;
+        BoundingBox3f bounds;
+        //Parent index and the index one past the last descendant
+        unsigned int parent, end;
+        int model;
+        unsigned int model_count;
+        //Resource of a model node, which the scene must not outlive, and
+        //the serial of its bounds when the node was last fitted
+        const ModelResource *resource;
+        uint32_t bounds_serial;
     };
+    static const unsigned int NO_PARENT = ~0U;
     ViewParams view;
     std::vector<LightParams> lights;
+    LightBlock light_block;
     std::vector<ModelParams> models;
+    std::vector<CullNode> cull_nodes;
+    std::vector<unsigned int> open_groups;
+    std::vector<uint8_t> model_visible;
+    //Diameter in pixels of the bounds of each visible model, which sets the
+    //mip level its textures are kept at
+    std::vector<float> model_screen_sizes;
+    unsigned int models_culled;
+    bool culling_enabled;
+    //Set when models were moved since the bounds were last refitted
+    bool models_moved;
+    //Cleared whenever the view, the bounds or the culling setting change
+    bool cull_valid;
+    std::vector<InstanceBatch> batches;
+    std::vector<StaticBatch> static_batches;
+    //Render groups freed by the static batches, with the resource to recreate them from
+    std::vector<std::pair<std::string, const ModelResource *> > released_sources;
+    //Arena holding the instance buffers, which belongs to the last context
+    //rendered with. It is only used while that context is passed in again.
+    BufferArena *instance_arena;
+    //Cleared when models are registered after the batches were created, or
+    //when a model merged into the static batches is moved
+    bool batches_valid;
+    RenderQueue queue;
+    RenderStats stats;
+    void release_static_batches(GraphicsContext *context);
+    void create_batches(GraphicsContext *context)
+    {
+        BufferArena& arena = context->get_buffer_arena();
+        if(instance_arena == &arena) {
+            release(context);
+        } else {
+            //Buffers of another context were returned by release, or went with it.
+            static_batches.clear();
+            released_sources.clear();
+            batches.clear();
+        }
+        std::map<std::string, unsigned int> batch_indices;
+        for(unsigned int i = 0; i < models.size(); i++) {
+            std::string key = models[i].name;
+            for(unsigned int j = 0; j < models[i].shader_names.size(); j++) {
+                key += '\0' + models[i].shader_names[j];
+            }
+            std::map<std::string, unsigned int>::iterator batch = batch_indices.find(key);
+            if(batch == batch_indices.end()) {
+                batch = batch_indices.insert(std::make_pair(key, static_cast<unsigned int>(batches.size()))).first;
+                batches.push_back(InstanceBatch(models[i]));
+            }
+            batches[batch->second].members.push_back(i);
+            models[i].batch = batch->second;
+        }
+        for(std::vector<InstanceBatch>::iterator i = batches.begin(); i != batches.end(); i++) {
+            i->resolve(context);
+            if(i->members.size() < 2) continue;
+            std::vector<Matrix4f> data;
+            data.reserve(2 * i->members.size());
+            for(unsigned int j = 0; j < i->members.size(); j++) {
+                const Matrix4f& model_matrix = models[i->members[j]].model_matrix;
+                data.push_back(model_matrix);
+                data.push_back(model_matrix.create_normal_matrix());
+            }
+            i->instances = arena.allocate(sizeof(Matrix4f) * data.size(), &data[0]);
+            i->resident = i->members;
+        }
+        instance_arena = &arena;
+        batches_valid = true;
+        view.valid = false;
+    }
+    void update_instances(InstanceBatch& batch, const std::vector<unsigned int>& visible);
+    bool refit_bounds();
+    void cull();
+    void update_screen_sizes();
+    static const std::string& get_shader_name(const std::vector<std::string>& shader_names, unsigned int index)
+    {
+        static const std::string default_name;
+        return index < shader_names.size() ? shader_names[index] : default_name;
+    }
+    static void get_textures(GraphicsContext *context, const ShaderGroup *shader_group, GLuint textures[8])
+    {
+        for(int l = 0; l < 8; l++) {
+            textures[l] = (shader_group->shader_channels & (1 << l)) ? context->acquire_texture(shader_group->texture_handles[l]) : 0;
+        }
+    }
+    static void request_texture_sizes(GraphicsContext *context, const ShaderGroup *shader_group, float pixels)
+    {
+        for(int l = 0; l < 8; l++) {
+            if(shader_group->shader_channels & (1 << l)) context->request_texture_size(shader_group->texture_handles[l], pixels);
+        }
+    }
 public:
     SceneGraph(const View& view_node, const ViewResource::Pass& view_pass, const Matrix4f& transform)
-    : view(view_node, view_pass, transform) {
+    : view(view_node, view_pass, transform), models_culled(0), culling_enabled(true), models_moved(false), cull_valid(false), instance_arena(NULL),
+      batches_valid(false) {
     }
+    //Returns the instance buffers and the static batches taken from the
+    //context last rendered with. Call it before deleting that context, or
+    //the scene when the context stays in use; the scene never frees
+    //through a context otherwise, and is rebuilt on the next render.
+    void release(GraphicsContext *context);
     void register_light(const LightResource& light, const Matrix4f& transform)
     {
+        if(this->lights.size() >= static_cast<size_t>(ShaderGroup::MAX_LIGHTS)) {
+            U3D_WARNING << "Lights beyond the first " << ShaderGroup::MAX_LIGHTS << " are ignored." << std::endl;
+            return;
+        }
         this->lights.push_back(LightParams(light, transform));
+        view.valid = false;
+    }
+    //Groups nest the models registered until the matching close_group,
+    //so that whole subtrees can be culled against their combined bounds.
+    unsigned int open_group(const std::string& node_name)
+    {
+        CullNode node;
+        node.name = node_name;
+        node.parent = open_groups.empty() ? NO_PARENT : open_groups.back();
+        node.end = 0;
+        node.model = -1;
+        node.model_count = 0;
+        node.resource = NULL;
+        node.bounds_serial = 0;
+        cull_nodes.push_back(node);
+        open_groups.push_back(cull_nodes.size() - 1);
+        return cull_nodes.size() - 1;
+    }
+    void close_group(unsigned int index)
+    {
+        CullNode& node = cull_nodes[index];
+        node.end = cull_nodes.size();
+        if(node.parent != NO_PARENT) {
+            cull_nodes[node.parent].bounds.extend(node.bounds);
+            cull_nodes[node.parent].model_count += node.model_count;
+        }
+        if(!open_groups.empty() && open_groups.back() == index) {
+            open_groups.pop_back();
+        }
     }
-    void register_model(const Model& model, const ModelResource& model_rsc, const Matrix4f& transform)
-    {
-        this->models.push_back(ModelParams(model, model_rsc, transform));
-    }
-    void render(GraphicsContext *context)
-    {
-        for(std::vector<ModelParams>::iterator j = models.begin(); j != models.end(); j++) {
-            RenderGroup *render_group = context->get_render_group(j->name);
-            //U3D_LOG << "Rendering model \"" << j->name << "\"" <<  std::endl;
-            for(std::vector<LightParams>::iterator i = lights.begin(); i != lights.end(); i++) {
-                //U3D_LOG << "Light type = " << (int)i->type << std::endl;
-                for(unsigned int k = 0; k < render_group->elements.size(); k++) {
-                    ShaderGroup *shader_group;
-                    if(k < j->shader_names.size()) {
-                        shader_group = context->get_shader_group(j->shader_names[k]);
-                        //U3D_LOG << "Element " << k << ":" << j->shader_names[k] << std::endl;
-                    } else {
-                        shader_group = context->get_shader_group("");
-                        //U3D_LOG << "Element " << k << ":" << std::endl;
-                    }
-                    GLuint program = shader_group->use(i->type);
-                    i->load(program, view.view_matrix.inverse());
-                    view.load(program, j->model_matrix);
-                    for(int l = 0; l < 8; l++) {
-                        if(shader_group->shader_channels & (1 << l)) {
-                            glActiveTexture(l);
-                            glBindTexture(GL_TEXTURE_2D, context->get_texture(shader_group->texture_names[l]));
-                        }
-                    }
-                    render_group->render(k, program);
-                }
+    //Models are registered in ascending order of the instance, an index the
+    //caller can find them by when they are moved.
+    void register_model(const std::string& node_name, const Model& model, const ModelResource& model_rsc, const Matrix4f& transform,
+                        unsigned int instance = 0)
+    {
+        this->models.push_back(ModelParams(node_name, model, model_rsc, transform, instance));
+        unsigned int index = open_group(node_name);
+        models.back().cull_node = index;
+        cull_nodes[index].bounds = model_rsc.get_bounds().transform(transform);
+        cull_nodes[index].model = models.size() - 1;
+        cull_nodes[index].model_count = 1;
+        cull_nodes[index].resource = &model_rsc;
+        cull_nodes[index].bounds_serial = model_rsc.get_bounds_serial();
+        close_group(index);
+        batches_valid = false;
+    }
+    //Union of the world bounds of every instance of a node
+    bool get_subgraph_bounds(const std::string& node_name, BoundingBox3f *bounds) const
+    {
+        BoundingBox3f box;
+        bool found = false;
+        for(std::vector<CullNode>::const_iterator i = cull_nodes.begin(); i != cull_nodes.end(); i++) {
+            if(i->name == node_name) {
+                box.extend(i->bounds);
+                found = true;
             }
         }
+        if(found && bounds != NULL) *bounds = box;
+        return found;
+    }
+    void set_culling(bool enabled)
+    {
+        culling_enabled = enabled;
+        cull_valid = false;
+    }
+    //Returns the number of state changes submitted for the frame.
+    const RenderStats& render(GraphicsContext *context);
+    const RenderStats& get_render_stats() const
+    {
+        return stats;
+    }
+    //Optional pass merging the small models that are not drawn as instances
+    //into one buffer per shader and vertex layout. The vertices are taken
+    //from the decoded resources, so models whose geometry was released
+    //with the context are left as they are. Returns the number of batches.
+    unsigned int create_static_batches(GraphicsContext *context, const StaticBatchOptions& options = StaticBatchOptions());
+    unsigned int get_static_batch_count() const
+    {
+        return static_batches.size();
+    }
+    //Maps a vertex of a static batch back to the node and element it came from.
+    bool get_static_source(unsigned int batch, GLint vertex, std::string *node_name, unsigned int *element) const;
+    unsigned int get_model_count() const
+    {
+        return models.size();
+    }
+    const std::string& get_model_node_name(unsigned int index) const
+    {
+        return models[index].node_name;
+    }
+    const std::string& get_model_resource_name(unsigned int index) const
+    {
+        return models[index].name;
+    }
+    const Matrix4f& get_model_matrix(unsigned int index) const
+    {
+        return models[index].model_matrix;
+    }
+    unsigned int get_model_instance(unsigned int index) const
+    {
+        return models[index].instance;
+    }
+    //Index of the first model registered for the instance or a later one
+    unsigned int find_model(unsigned int instance) const
+    {
+        return std::lower_bound(models.begin(), models.end(), instance, ModelParams::precedes) - models.begin();
+    }
+    //Moves a model along with its bounds and instance buffer. The groups
+    //above it are refitted on the next render, and moving a model merged
+    //into the static batches releases them then.
+    void set_model_matrix(unsigned int index, const Matrix4f& matrix);
+    //World space ray through a point of the viewport given in normalized
+    //device coordinates, for a viewport of the given width / height ratio.
+    Ray get_pick_ray(float x, float y, float aspect) const
+    {
+        Vector3f origin, direction;
+        if(view.type == ViewParams::ORTHOGONAL) {
+            origin = Vector3f(x * view.height * 0.5f / aspect, y * view.height * 0.5f, 0);
+            direction = Vector3f(0, 0, -1);
+        } else {
+            float f = tanf(view.fovy * 0.5f);
+            direction = Vector3f(x * f * aspect, y * f, -1);
+        }
+        return Ray(view.view_matrix * origin, view.view_matrix.transform_direction(direction));
     }
     Matrix4f& get_view_matrix()
     {
@@ -379,6 +738,7 @@ public:
     void set_view_matrix(const Matrix4f& matrix)
     {
         view.view_matrix = matrix;
+        view.valid = false;
     }
 };
 
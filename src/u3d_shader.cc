@@ -22,11 +22,12 @@
 namespace
 {
 
-GLuint compile_shader(GLenum type, const char *src)
+GLuint compile_shader(GLenum type, const char *header, const char *src)
 {
     GLuint shader = glCreateShader(type);
 
-    glShaderSource(shader, 1, &src, NULL);
+    const char *sources[2] = {header, src};
+    glShaderSource(shader, 2, sources, NULL);
     glCompileShader(shader);
 
     GLint result, log_length;
@@ -44,11 +45,14 @@ GLuint compile_shader(GLenum type, const char *src)
     return shader;
 }
 
-GLuint link_program(GLuint vertex_shader, GLuint fragment_shader)
+GLuint link_program(GLuint vertex_shader, GLuint fragment_shader, bool retrievable)
 {
     GLuint program = glCreateProgram();
     glAttachShader(program, vertex_shader);
     glAttachShader(program, fragment_shader);
+    if(retrievable) {
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
     glLinkProgram(program);
 
     GLint result, length;
@@ -66,11 +70,81 @@ GLuint link_program(GLuint vertex_shader, GLuint fragment_shader)
     return program;
 }
 
+//Bumped whenever the layout of the binary files changes.
+const uint32_t BINARY_MAGIC = 0x50443355, BINARY_VERSION = 1;
+
+std::string get_gl_string(GLenum name)
+{
+    const GLubyte *value = glGetString(name);
+    return value != NULL ? reinterpret_cast<const char *>(value) : "";
+}
+
 }
 
 namespace U3D
 {
 
+uint32_t ShaderProgram::create_serial()
+{
+    static uint32_t serial = 0;
+    return ++serial;
+}
+
+void ShaderProgram::resolve(GLuint program)
+{
+    static const char *texcoord_attrib_names[8] = {
+        "vertex_texcoord0", "vertex_texcoord1", "vertex_texcoord2", "vertex_texcoord3",
+        "vertex_texcoord4", "vertex_texcoord5", "vertex_texcoord6", "vertex_texcoord7"
+    };
+    static const char *texuniforms[8] = {
+        "texture0", "texture1", "texture2", "texture3",
+        "texture4", "texture5", "texture6", "texture7"
+    };
+    static const char *region_uniforms[8] = {
+        "texture_region0", "texture_region1", "texture_region2", "texture_region3",
+        "texture_region4", "texture_region5", "texture_region6", "texture_region7"
+    };
+    this->program = program;
+    vertex_position = glGetAttribLocation(program, "vertex_position");
+    vertex_normal = glGetAttribLocation(program, "vertex_normal");
+    vertex_diffuse = glGetAttribLocation(program, "vertex_diffuse");
+    vertex_specular = glGetAttribLocation(program, "vertex_specular");
+    for(int i = 0; i < 8; i++) {
+        vertex_texcoord[i] = glGetAttribLocation(program, texcoord_attrib_names[i]);
+    }
+    PVM_matrix = glGetUniformLocation(program, "PVM_matrix");
+    modelview_matrix = glGetUniformLocation(program, "modelview_matrix");
+    normal_matrix = glGetUniformLocation(program, "normal_matrix");
+    instance_model_matrix = glGetAttribLocation(program, "instance_model_matrix");
+    instance_normal_matrix = glGetAttribLocation(program, "instance_normal_matrix");
+    view_matrix = glGetUniformLocation(program, "view_matrix");
+    view_normal_matrix = glGetUniformLocation(program, "view_normal_matrix");
+    projection_matrix = glGetUniformLocation(program, "projection_matrix");
+    material_diffuse = glGetUniformLocation(program, "material_diffuse");
+    material_specular = glGetUniformLocation(program, "material_specular");
+    material_ambient = glGetUniformLocation(program, "material_ambient");
+    material_emissive = glGetUniformLocation(program, "material_emissive");
+    material_reflectivity = glGetUniformLocation(program, "material_reflectivity");
+    light_count = glGetUniformLocation(program, "light_count");
+    light_color = glGetUniformLocation(program, "light_color");
+    light_position = glGetUniformLocation(program, "light_position");
+    light_direction = glGetUniformLocation(program, "light_direction");
+    light_attenuation = glGetUniformLocation(program, "light_attenuation");
+    for(int i = 0; i < 8; i++) {
+        texture_region[i] = glGetUniformLocation(program, region_uniforms[i]);
+    }
+    //Sampler bindings never change, so they are set up here once.
+    glUseProgram(program);
+    for(int i = 0; i < 8; i++) {
+        GLint location = glGetUniformLocation(program, texuniforms[i]);
+        if(location >= 0) {
+            glUniform1i(location, i);
+        }
+    }
+    glUseProgram(0);
+    model_serial = material_serial = light_serial = 0;
+}
+
 namespace
 {
 struct FormatBuffer
@@ -91,18 +165,142 @@ struct FormatBuffer
 };
 }
 
-ShaderGroup *LitTextureShader::create_shader_group(const Material* material)
+ShaderCache::~ShaderCache()
+{
+    for(std::map<ContentHash, Variant>::iterator i = variants.begin(); i != variants.end(); i++) {
+        ShaderProgram *programs[2] = {i->second.program, i->second.instanced_program};
+        for(int j = 0; j < 2; j++) {
+            if(programs[j] == NULL) continue;
+            glDeleteProgram(programs[j]->program);
+            delete programs[j];
+        }
+    }
+}
+
+void ShaderCache::set_binary_directory(const std::string& directory)
 {
-    GLuint fragment_shader;
+    binary_directory = directory;
+    if(binary_directory.empty()) return;
+    if(binary_directory[binary_directory.size() - 1] != '/') binary_directory += '/';
+    //Binaries only load into the driver that produced them.
+    driver = get_gl_string(GL_VENDOR) + '\n' + get_gl_string(GL_RENDERER) + '\n' + get_gl_string(GL_VERSION);
+}
+
+void ShaderCache::get_programs(const char *vertex_source, const char *fragment_source, ShaderProgram *&program, ShaderProgram *&instanced_program)
+{
+    ContentHasher hasher;
+    hasher.update(vertex_source, strlen(vertex_source) + 1);
+    hasher.update(fragment_source, strlen(fragment_source) + 1);
+    stats.requests++;
+    std::map<ContentHash, Variant>::iterator i = variants.find(hasher.get());
+    if(i == variants.end()) {
+        i = variants.insert(std::make_pair(hasher.get(), build(hasher.get(), vertex_source, fragment_source))).first;
+    }
+    program = i->second.program;
+    instanced_program = i->second.instanced_program;
+}
+
+ShaderCache::Variant ShaderCache::build(const ContentHash& source, const char *vertex_source, const char *fragment_source)
+{
+    static const char *headers[2] = {"#version 110\n", "#version 110\n#define INSTANCED\n"};
+    int count = GLEW_ARB_instanced_arrays && GLEW_ARB_draw_instanced ? 2 : 1;
+    bool binaries = !binary_directory.empty() && GLEW_ARB_get_program_binary;
+    ShaderProgram *programs[2] = {NULL, NULL};
+    //Compiled only when some program is not found among the binaries
+    GLuint fragment_shader = 0;
+    for(int i = 0; i < count; i++) {
+        ContentHasher key;
+        key.update(source);
+        key.update(i);
+        key.update(driver.data(), driver.size());
+        GLuint program = binaries ? load_binary(key.get()) : 0;
+        if(program == 0) {
+            if(fragment_shader == 0) {
+                fragment_shader = compile_shader(GL_FRAGMENT_SHADER, headers[0], fragment_source);
+            }
+            GLuint vertex_shader = compile_shader(GL_VERTEX_SHADER, headers[i], vertex_source);
+            program = link_program(vertex_shader, fragment_shader, binaries);
+            glDeleteShader(vertex_shader);
+            stats.programs_linked++;
+            if(binaries) save_binary(key.get(), program);
+        }
+        programs[i] = new ShaderProgram();
+        programs[i]->resolve(program);
+    }
+    if(fragment_shader != 0) {
+        glDeleteShader(fragment_shader);
+    }
+    Variant variant;
+    variant.program = programs[0];
+    variant.instanced_program = programs[1];
+    return variant;
+}
+
+std::string ShaderCache::get_binary_path(const ContentHash& key) const
+{
+    std::string path = binary_directory;
+    append_hex(path, key.high);
+    append_hex(path, key.low);
+    return path + ".bin";
+}
+
+GLuint ShaderCache::load_binary(const ContentHash& key)
+{
+    std::ifstream file(get_binary_path(key).c_str(), std::ios::in | std::ios::binary);
+    if(!file.is_open()) return 0;
+    uint32_t header[4] = {0, 0, 0, 0};
+    file.read(reinterpret_cast<char *>(header), sizeof(header));
+    if(file.fail() || header[0] != BINARY_MAGIC || header[1] != BINARY_VERSION || header[3] == 0 || header[3] > (64 << 20)) return 0;
+    std::vector<char> data(header[3]);
+    if(file.read(&data[0], data.size()).fail()) return 0;
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, header[2], &data[0], data.size());
+    //Drivers also reject binaries of builds the version string does not tell apart.
+    GLint result;
+    glGetProgramiv(program, GL_LINK_STATUS, &result);
+    if(result == GL_FALSE) {
+        glDeleteProgram(program);
+        return 0;
+    }
+    stats.binaries_loaded++;
+    return program;
+}
+
+void ShaderCache::save_binary(const ContentHash& key, GLuint program)
+{
+    GLint result, length = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &result);
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if(result == GL_FALSE || length <= 0) return;
+    std::vector<char> data(length);
+    GLenum format;
+    glGetProgramBinary(program, length, &length, &format, &data[0]);
+    if(length <= 0) return;
+    AtomicFileWriter writer(get_binary_path(key));
+    if(!writer.is_open()) return;
+    uint32_t header[4] = {BINARY_MAGIC, BINARY_VERSION, format, static_cast<uint32_t>(length)};
+    writer.get_stream().write(reinterpret_cast<const char *>(header), sizeof(header));
+    writer.get_stream().write(&data[0], length);
+    if(writer.commit()) stats.binaries_saved++;
+}
+
+ShaderGroup *LitTextureShader::create_shader_group(ShaderCache& cache, const Material* material, uint8_t atlas_channels)
+{
+    FormatBuffer fs, vs;
     {
-        FormatBuffer fs;
-        fs.print("#version 110\n"
-                 "varying vec4 fragment_color;\n");
+        atlas_channels &= shader_channels;
+        if(atlas_channels != 0) {
+            fs.print("#extension GL_ARB_shader_texture_lod : require\n");
+        }
+        fs.print("varying vec4 fragment_color;\n");
         for(int i = 0; i < 8; i++) {
             if(shader_channels & (1 << i)) {
                 fs.print("uniform sampler2D texture%d;\n", i);
                 fs.print("varying vec2 texcoord%d;\n", i);
             }
+            if(atlas_channels & (1 << i)) {
+                fs.print("uniform vec4 texture_region%d;\n", i);
+            }
         }
         fs.print("void main() {\n");
         for(int i = 0; i < 8; i++) {
@@ -111,7 +309,11 @@ ShaderGroup *LitTextureShader::create_shader_group(const Material* material)
             } else {
                 fs.print("\tvec4 layer%d_in = layer%d_out;\n", i, i - 1);
             }
-            if(shader_channels & (1 << i)) {
+            if(atlas_channels & (1 << i)) {
+                //Repeats within the region, with the mip level chosen from
+                //the unwrapped texcoords so that the wrap leaves no seam.
+                fs.print("\tvec4 layer%d_tex = texture2DGradARB(texture%d, texture_region%d.zw + fract(texcoord%d) * texture_region%d.xy, dFdx(texcoord%d) * texture_region%d.xy, dFdy(texcoord%d) * texture_region%d.xy);\n", i, i, i, i, i, i, i, i, i);
+            } else if(shader_channels & (1 << i)) {
                 fs.print("\tvec4 layer%d_tex = texture2D(texture%d, texcoord%d);\n", i, i, i);
             }
             if(i == 7) {
@@ -139,188 +341,97 @@ ShaderGroup *LitTextureShader::create_shader_group(const Material* material)
             }
         }
         fs.print("}\n");
-        fragment_shader = compile_shader(GL_FRAGMENT_SHADER, fs.buf);
-    }
-
-    const char vs_header[] =
-        "#version 110\n"
-        "attribute vec4 vertex_diffuse, vertex_specular;\n"
-        "attribute vec4 vertex_position, vertex_normal;\n"
-        "varying vec4 fragment_color;\n"
-        "uniform mat4 PVM_matrix, modelview_matrix, normal_matrix;\n"
-        "uniform vec4 material_diffuse, material_specular;\n"
-        "uniform vec4 material_ambient, material_emissive;\n"
-        "uniform float material_reflectivity;\n";
-
-    GLuint ambient_shader;
-    {
-        FormatBuffer vsa;
-        vsa.print("%s", vs_header);
-        vsa.print("uniform vec4 light_color;\n");
-        for(int i = 0; i < 8; i++) {
-            if(shader_channels & (1 << i)) {
-                vsa.print("attribute vec2 vertex_texcoord%d;\n", i);
-                vsa.print("varying vec2 texcoord%d;\n", i);
-            }
-        }
-        vsa.print("void main() {\n"
-                     "\tvec4 ambient = light_color * material_ambient;\n"
-                     "\tvec4 emissive = material_emissive;\n"
-                     "\tfragment_color = ambient + emissive;\n");
-        for(int i = 0; i < 8; i++) {
-            if(shader_channels & (1 << i)) {
-                vsa.print("\ttexcoord%d = vertex_texcoord%d * vec2(1.0, -1.0);\n", i, i);
-            }
-        }
-        vsa.print("\tgl_Position = PVM_matrix * vertex_position;\n"
-                     "}\n");
-        ambient_shader = compile_shader(GL_VERTEX_SHADER, vsa.buf);
-    }
-
-    GLuint directional_shader;
-    {
-        FormatBuffer vsd;
-        vsd.print("%s", vs_header);
-        vsd.print("uniform vec4 light_color;\n"
-                  "uniform vec4 light_direction;\n"
-                  "uniform float light_intensity;\n");
-        for(int i = 0; i < 8; i++) {
-            if(shader_channels & (1 << i)) {
-                vsd.print("attribute vec2 vertex_texcoord%d;\n", i);
-                vsd.print("varying vec2 texcoord%d;\n", i);
-            }
-        }
-        vsd.print("void main() {\n"
-                  "\tvec4 viewspace_normal = normalize(normal_matrix * vertex_normal);\n"
-                  "\tvec4 viewspace_position = modelview_matrix * vertex_position;\n"
-                  "\tvec4 viewspace_incidence = light_direction;\n"
-                  "\tvec4 viewspace_camera = normalize(-viewspace_position);\n");
-        if(attributes & USE_VERTEX_COLOR) {
-            vsd.print("\tvec4 diffuse = light_color * vertex_diffuse * max(0.0, dot(viewspace_normal, -viewspace_incidence));\n"
-                      "\tvec4 specular = light_color * vertex_specular * pow(max(0.0, dot(viewspace_camera, reflect(viewspace_incidence, viewspace_normal))), material_reflectivity);\n");
-        } else {
-            vsd.print("\tvec4 diffuse = light_color * material_diffuse * max(0.0, dot(viewspace_normal, -viewspace_incidence));\n"
-                      "\tvec4 specular = light_color * material_specular * pow(max(0.0, dot(viewspace_camera, reflect(viewspace_incidence, viewspace_normal))), material_reflectivity);\n");
-        }
-        vsd.print("\tvec4 ambient = light_color * material_ambient;\n"
-                  "\tvec4 emissive = material_emissive;\n"
-                  "\tfragment_color = light_intensity * (diffuse + specular + ambient) + emissive;\n"
-                  "\tgl_Position = PVM_matrix * vertex_position;\n");
-        for(int i = 0; i < 8; i++) {
-            if(shader_channels & (1 << i)) {
-                vsd.print("\ttexcoord%d = vertex_texcoord%d * vec2(1.0, -1.0);\n", i, i);
-            }
-        }
-        vsd.print("}\n");
-        directional_shader = compile_shader(GL_VERTEX_SHADER, vsd.buf);
-    }
-
-    GLuint point_shader;
-    {
-        FormatBuffer vsp;
-        vsp.print("%s", vs_header);
-        vsp.print("uniform vec4 light_color;\n"
-                  "uniform vec4 light_position;\n"
-                  "uniform float light_att0, light_att1, light_att2, light_intensity;\n");
-        for(int i = 0; i < 8; i++) {
-            if(shader_channels & (1 << i)) {
-                vsp.print("attribute vec2 vertex_texcoord%d;\n", i);
-                vsp.print("varying vec2 texcoord%d;\n", i);
-            }
-        }
-        vsp.print("void main() {\n"
-                  "\tvec4 viewspace_normal = normalize(normal_matrix * vertex_normal);\n"
-                  "\tvec4 viewspace_position = modelview_matrix * vertex_position;\n"
-                  "\tvec4 viewspace_incidence = normalize(viewspace_position - light_position);\n"
-                  "\tvec4 viewspace_camera = normalize(-viewspace_position);\n");
-        if(attributes & USE_VERTEX_COLOR) {
-            vsp.print("\tvec4 diffuse = light_color * vertex_diffuse * max(0.0, dot(viewspace_normal, -viewspace_incidence));\n"
-                      "\tvec4 specular = light_color * vertex_specular * pow(max(0.0, dot(viewspace_camera, reflect(viewspace_incidence, viewspace_normal))), material_reflectivity);\n");
-        } else {
-            vsp.print("\tvec4 diffuse = light_color * material_diffuse * max(0.0, dot(viewspace_normal, -viewspace_incidence));\n"
-                      "\tvec4 specular = light_color * material_specular * pow(max(0.0, dot(viewspace_camera, reflect(viewspace_incidence, viewspace_normal))), material_reflectivity);\n");
-        }
-        vsp.print("\tvec4 ambient = light_color * material_ambient;\n"
-                  "\tvec4 emissive = material_emissive;\n"
-                  "\tfloat viewspace_light_distance = length(viewspace_position - light_position);\n"
-                  "\tfloat attenuation = light_att0 + light_att1 * viewspace_light_distance + light_att2 * viewspace_light_distance * viewspace_light_distance;\n");
-        for(int i = 0; i < 8; i++) {
-            if(shader_channels & (1 << i)) {
-                vsp.print("\ttexcoord%d = vertex_texcoord%d * vec2(1.0, -1.0);\n", i, i);
-            }
-        }
-        vsp.print("\tfragment_color = light_intensity * ((diffuse + specular) / attenuation) + ambient + emissive;\n"
-                  "\tgl_Position = PVM_matrix * vertex_position;\n"
-                  "}\n");
-        point_shader = compile_shader(GL_VERTEX_SHADER, vsp.buf);
     }
 
-    GLuint spot_shader;
+    //All lights of the scene are accumulated in a single pass.
+    //Light types are stored in light_color.w, the constant, linear and quadratic
+    //attenuations and the intensity in light_attenuation, and the cosine of the
+    //half spot angle in light_direction.w.
+    //The instanced variant reads world matrices from per-instance attributes.
     {
-        FormatBuffer vss;
-        vss.print("%s", vs_header);
-        vss.print("uniform vec4 light_color;\n"
-                  "uniform vec4 light_position, light_direction;\n"
-                  "uniform float light_spot_angle, light_exponent;\n"
-                  "uniform float light_intensity, light_att0, light_att1, light_att2;\n");
+        vs.print("#define MAX_LIGHTS %d\n"
+                 "attribute vec4 vertex_diffuse, vertex_specular;\n"
+                 "attribute vec4 vertex_position, vertex_normal;\n"
+                 "varying vec4 fragment_color;\n"
+                 "#ifdef INSTANCED\n"
+                 "attribute mat4 instance_model_matrix, instance_normal_matrix;\n"
+                 "uniform mat4 view_matrix, view_normal_matrix, projection_matrix;\n"
+                 "#else\n"
+                 "uniform mat4 PVM_matrix, modelview_matrix, normal_matrix;\n"
+                 "#endif\n"
+                 "uniform vec4 material_diffuse, material_specular;\n"
+                 "uniform vec4 material_ambient, material_emissive;\n"
+                 "uniform float material_reflectivity;\n"
+                 "uniform int light_count;\n"
+                 "uniform vec4 light_color[MAX_LIGHTS], light_position[MAX_LIGHTS];\n"
+                 "uniform vec4 light_direction[MAX_LIGHTS], light_attenuation[MAX_LIGHTS];\n", ShaderGroup::MAX_LIGHTS);
         for(int i = 0; i < 8; i++) {
             if(shader_channels & (1 << i)) {
-                vss.print("attribute vec2 vertex_texcoord%d;\n", i);
-                vss.print("varying vec2 texcoord%d;\n", i);
+                vs.print("attribute vec2 vertex_texcoord%d;\n", i);
+                vs.print("varying vec2 texcoord%d;\n", i);
             }
         }
-        vss.print("void main() {\n"
-                  "\tvec4 viewspace_normal = normalize(normal_matrix * vertex_normal);\n"
-                  "\tvec4 viewspace_position = modelview_matrix * vertex_position;\n"
-                  "\tvec4 viewspace_incidence = normalize(viewspace_position - light_position);\n"
-                  "\tvec4 viewspace_camera = normalize(-viewspace_position);\n"
-                  "\tfloat viewspace_light_distance = length(viewspace_position - light_position);\n"
-                  "\tfloat attenuation = light_att0 + light_att1 * viewspace_light_distance + light_att2 * viewspace_light_distance * viewspace_light_distance;\n"
-                  "\tfloat spot_attenuation = pow(dot(light_direction, viewspace_incidence), light_exponent);\n");
+        vs.print("void main() {\n"
+                 "#ifdef INSTANCED\n"
+                 "\tmat4 modelview_matrix = view_matrix * instance_model_matrix;\n"
+                 "\tmat4 normal_matrix = view_normal_matrix * instance_normal_matrix;\n"
+                 "\tmat4 PVM_matrix = projection_matrix * modelview_matrix;\n"
+                 "#endif\n"
+                 "\tvec3 viewspace_normal = normalize((normal_matrix * vec4(vertex_normal.xyz, 0.0)).xyz);\n"
+                 "\tvec4 viewspace_position = modelview_matrix * vertex_position;\n"
+                 "\tvec3 viewspace_camera = normalize(-viewspace_position.xyz);\n");
         if(attributes & USE_VERTEX_COLOR) {
-            vss.print("\tvec4 diffuse = light_color * vertex_diffuse * max(0.0, dot(viewspace_normal, -viewspace_incidence));\n"
-                      "\tvec4 specular = light_color * vertex_specular * pow(max(0.0, dot(viewspace_camera, reflect(viewspace_incidence, viewspace_normal))), material_reflectivity);\n");
+            vs.print("\tvec4 base_diffuse = vertex_diffuse;\n"
+                     "\tvec4 base_specular = vertex_specular;\n");
         } else {
-            vss.print("\tvec4 diffuse = light_color * material_diffuse * max(0.0, dot(viewspace_normal, -viewspace_incidence));\n"
-                      "\tvec4 specular = light_color * material_specular * pow(max(0.0, dot(viewspace_camera, reflect(viewspace_incidence, viewspace_normal))), material_reflectivity);\n");
+            vs.print("\tvec4 base_diffuse = material_diffuse;\n"
+                     "\tvec4 base_specular = material_specular;\n");
         }
-        vss.print("\tvec4 ambient = light_color * material_ambient;\n"
-                  "\tvec4 emissive = material_emissive;\n");
+        vs.print("\tvec4 color = material_emissive;\n"
+                 "\tfor(int i = 0; i < MAX_LIGHTS; i++) {\n"
+                 "\t\tif(i < light_count) {\n"
+                 "\t\t\tfloat type = light_color[i].w;\n"
+                 "\t\t\tvec4 light = vec4(light_color[i].rgb, 1.0);\n"
+                 "\t\t\tvec4 ambient = light * material_ambient;\n"
+                 "\t\t\tif(type < 0.5) {\n"
+                 "\t\t\t\tcolor += ambient;\n"
+                 "\t\t\t} else {\n"
+                 "\t\t\t\tvec3 incidence = light_direction[i].xyz;\n"
+                 "\t\t\t\tfloat attenuation = 1.0, spot_attenuation = 1.0;\n"
+                 "\t\t\t\tif(type > 1.5) {\n"
+                 "\t\t\t\t\tvec3 light_vector = viewspace_position.xyz - light_position[i].xyz;\n"
+                 "\t\t\t\t\tfloat distance = length(light_vector);\n"
+                 "\t\t\t\t\tincidence = light_vector / distance;\n"
+                 "\t\t\t\t\tattenuation = light_attenuation[i].x + light_attenuation[i].y * distance + light_attenuation[i].z * distance * distance;\n"
+                 "\t\t\t\t\tif(type > 2.5) {\n"
+                 "\t\t\t\t\t\tspot_attenuation = step(light_direction[i].w, dot(light_direction[i].xyz, incidence));\n"
+                 "\t\t\t\t\t}\n"
+                 "\t\t\t\t}\n"
+                 "\t\t\t\tvec4 diffuse = light * base_diffuse * max(0.0, dot(viewspace_normal, -incidence));\n"
+                 "\t\t\t\tvec4 specular = light * base_specular * pow(max(0.0, dot(viewspace_camera, reflect(incidence, viewspace_normal))), material_reflectivity);\n"
+                 "\t\t\t\tif(type < 1.5) {\n"
+                 "\t\t\t\t\tcolor += light_attenuation[i].w * (diffuse + specular + ambient);\n"
+                 "\t\t\t\t} else {\n"
+                 "\t\t\t\t\tcolor += light_attenuation[i].w * (spot_attenuation * (diffuse + specular) / attenuation) + ambient;\n"
+                 "\t\t\t\t}\n"
+                 "\t\t\t}\n"
+                 "\t\t}\n"
+                 "\t}\n"
+                 "\tfragment_color = color;\n");
         for(int i = 0; i < 8; i++) {
             if(shader_channels & (1 << i)) {
-                vss.print("\ttexcoord%d = vertex_texcoord%d * vec2(1.0, -1.0);\n", i, i);
+                vs.print("\ttexcoord%d = vertex_texcoord%d * vec2(1.0, -1.0);\n", i, i);
             }
         }
-        vss.print("\tfragment_color = light_intensity * (spot_attenuation * (diffuse + specular) / attenuation) + ambient + emissive;\n"
-                  "\tgl_Position = PVM_matrix * vertex_position;\n"
-                  "}\n");
-        spot_shader = compile_shader(GL_VERTEX_SHADER, vss.buf);
+        vs.print("\tgl_Position = PVM_matrix * vertex_position;\n"
+                 "}\n");
     }
 
     ShaderGroup *group = new ShaderGroup();
-
-    /*FILE *fs = fopen("common.frag", "r");
-    GLuint fragment_shader = compile_shader(GL_FRAGMENT_SHADER, fs);
-    fclose(fs);
-    FILE *vsa = fopen("ambient.vert", "r");
-    GLuint ambient_shader = compile_shader(GL_VERTEX_SHADER, vsa);
-    fclose(vsa);
-    FILE *vsd = fopen("directional.vert", "r");
-    GLuint directional_shader = compile_shader(GL_VERTEX_SHADER, vsd);
-    fclose(vsd);
-    FILE *vsp = fopen("point.vert", "r");
-    GLuint point_shader = compile_shader(GL_VERTEX_SHADER, vsp);
-    fclose(vsp);
-    FILE *vss = fopen("spot.vert", "r");
-    GLuint spot_shader = compile_shader(GL_VERTEX_SHADER, vss);
-    fclose(vss);*/
-
-    group->ambient_program = link_program(ambient_shader, fragment_shader);
-    group->directional_program = link_program(directional_shader, fragment_shader);
-    group->point_program = link_program(point_shader, fragment_shader);
-    group->spot_program = link_program(spot_shader, fragment_shader);
+    cache.get_programs(vs.buf, fs.buf, group->program, group->instanced_program);
     group->material.configure(material);
     group->shader_channels = shader_channels & 0xFF;
+    group->atlas_channels = atlas_channels;
     for(int i = 0; i < 8; i++) {
         if(shader_channels & (1 << i)) {
             group->texture_names[i] = texinfos[i].name;
@@ -49,20 +49,101 @@ public:
     }
 };
 
+//Attribute and uniform locations of a linked program, resolved once at link time.
+struct ShaderProgram
+{
+    GLuint program;
+    GLint vertex_position, vertex_normal, vertex_diffuse, vertex_specular, vertex_texcoord[8];
+    GLint PVM_matrix, modelview_matrix, normal_matrix;
+    //Per-instance world matrices and the view uniforms of the instanced variant
+    GLint instance_model_matrix, instance_normal_matrix;
+    GLint view_matrix, view_normal_matrix, projection_matrix;
+    GLint material_diffuse, material_specular, material_ambient, material_emissive, material_reflectivity;
+    GLint light_count, light_color, light_position, light_direction, light_attenuation;
+    GLint texture_region[8];
+    //Serial numbers of the uniform blocks currently loaded into the program
+    uint32_t model_serial, material_serial, light_serial;
+    ShaderProgram() : program(0), model_serial(0), material_serial(0), light_serial(0) {}
+    void resolve(GLuint program);
+    //Each uniform block is tagged with a fresh serial whenever its contents change.
+    static uint32_t create_serial();
+};
+
+//Programs of a context by the hash of their generated source, so that the
+//shader resources whose variant produces the same GLSL share them. With a
+//binary directory, linked programs are saved there and loaded back on later
+//runs with the same driver. Programs are deleted with the cache.
+class ShaderCache
+{
+public:
+    struct Statistics
+    {
+        unsigned int requests, programs_linked, binaries_loaded, binaries_saved;
+    };
+private:
+    struct Variant
+    {
+        ShaderProgram *program, *instanced_program;
+    };
+    std::map<ContentHash, Variant> variants;
+    std::string binary_directory, driver;
+    Statistics stats;
+    Variant build(const ContentHash& source, const char *vertex_source, const char *fragment_source);
+    std::string get_binary_path(const ContentHash& key) const;
+    GLuint load_binary(const ContentHash& key);
+    void save_binary(const ContentHash& key, GLuint program);
+public:
+    ShaderCache()
+    {
+        memset(&stats, 0, sizeof(stats));
+    }
+    ~ShaderCache();
+    //The directory must exist; an empty one disables binaries. Must be
+    //called with the context current, as it queries the driver.
+    void set_binary_directory(const std::string& directory);
+    //Builds the programs on first request. The instanced variant defines
+    //INSTANCED in the vertex shader, and is NULL without instanced arrays.
+    void get_programs(const char *vertex_source, const char *fragment_source, ShaderProgram *&program, ShaderProgram *&instanced_program);
+    size_t get_variant_count() const
+    {
+        return variants.size();
+    }
+    const Statistics& get_statistics() const
+    {
+        return stats;
+    }
+private:
+    ShaderCache(const ShaderCache&);
+    ShaderCache& operator=(const ShaderCache&);
+};
+
 struct ShaderGroup
 {
-    GLuint point_program, spot_program, directional_program, ambient_program;
+    static const int MAX_LIGHTS = 8;
+    //Owned by the shader cache of the context and shared with every group
+    //generating the same source
+    ShaderProgram *program;
+    //NULL when the context lacks instanced arrays.
+    ShaderProgram *instanced_program;
     struct MaterialParams
     {
         Color3f ambient, diffuse, specular, emissive;
         float reflectivity, opacity;
-        void load(GLuint program)
+        //Scale in x and y and offset in z and w of each atlas channel's region
+        GLfloat texture_regions[8][4];
+        uint32_t serial;
+        void load(RenderDevice& device, ShaderProgram& program)
         {
-            glUniform4f(glGetUniformLocation(program, "material_diffuse"), diffuse.r, diffuse.g, diffuse.b, 1.0f);
-            glUniform4f(glGetUniformLocation(program, "material_specular"), specular.r, specular.g, specular.b, 1.0f);
-            glUniform4f(glGetUniformLocation(program, "material_ambient"), ambient.r, ambient.g, ambient.b, 1.0f);
-            glUniform4f(glGetUniformLocation(program, "material_emissive"), emissive.r, emissive.g, emissive.r, 1.0f);
-            glUniform1f(glGetUniformLocation(program, "material_reflectivity"), reflectivity);
+            if(program.material_serial == serial) return;
+            device.uniform4f(program.material_diffuse, diffuse.r, diffuse.g, diffuse.b, 1.0f);
+            device.uniform4f(program.material_specular, specular.r, specular.g, specular.b, 1.0f);
+            device.uniform4f(program.material_ambient, ambient.r, ambient.g, ambient.b, 1.0f);
+            device.uniform4f(program.material_emissive, emissive.r, emissive.g, emissive.r, 1.0f);
+            device.uniform1f(program.material_reflectivity, reflectivity);
+            for(int i = 0; i < 8; i++) {
+                if(program.texture_region[i] >= 0) device.uniform4fv(program.texture_region[i], 1, texture_regions[i]);
+            }
+            program.material_serial = serial;
 
             /*U3D_LOG << "Diffuse = " << diffuse << std::endl;
             U3D_LOG << "Specular = " << specular << std::endl;
@@ -78,42 +159,26 @@ struct ShaderGroup
             emissive = material->emissive;
             reflectivity = material->reflectivity;
             opacity = material->opacity;
+            for(int i = 0; i < 8; i++) {
+                texture_regions[i][0] = texture_regions[i][1] = 1.0f;
+                texture_regions[i][2] = texture_regions[i][3] = 0.0f;
+            }
+            serial = ShaderProgram::create_serial();
         }
     };
     MaterialParams material;
     uint8_t shader_channels;
+    //Channels sampling a texture atlas through texture_region
+    uint8_t atlas_channels;
     std::string texture_names[8];
-    GLuint use(uint8_t type)
+    //Texture handles in the context the group was added to
+    uint32_t texture_handles[8];
+    ShaderGroup() : program(NULL), instanced_program(NULL) {}
+    //Scale in x and y and offset in z and w of an atlas channel's region
+    void set_texture_region(int channel, const float transform[4])
     {
-        GLuint program = 0;
-        switch(type) {
-        case 0:
-            program = ambient_program;
-            break;
-        case 1:
-            program = directional_program;
-            break;
-        case 2:
-            program = point_program;
-            break;
-        case 3:
-            program = spot_program;
-            break;
-        }
-        static const char *texuniforms[8] = {
-            "texture0", "texture1", "texture2", "texture3",
-            "texture4", "texture5", "texture6", "texture7"
-        };
-        if(program != 0) {
-            glUseProgram(program);
-            material.load(program);
-            for(int i = 0; i < 8; i++) {
-                if(shader_channels & (1 << i)) {
-                    glUniform1i(glGetUniformLocation(program, texuniforms[i]), i);
-                }
-            }
-        }
-        return program;
+        memcpy(material.texture_regions[channel], transform, sizeof(material.texture_regions[channel]));
+        material.serial = ShaderProgram::create_serial();
     }
 };
 
@@ -176,7 +241,10 @@ public:
         shader_channels = 0;
         alpha_texture_channels = 0;
     }
-    ShaderGroup *create_shader_group(const Material* mat);
+    //Channels in atlas_channels wrap their texcoords into a region of an
+    //atlas page, which needs GL_ARB_shader_texture_lod. The programs come
+    //from the cache, which compiles only the variants it has not seen.
+    ShaderGroup *create_shader_group(ShaderCache& cache, const Material* mat, uint8_t atlas_channels = 0);
 };
 
 }
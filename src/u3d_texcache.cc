@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2016 Hiroka Ihara
+ *
+ * This file is part of libU3D.
+ *
+ * libU3D is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libU3D is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libU3D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "u3d_internal.hh"
+
+namespace U3D
+{
+
+namespace
+{
+//Bumped whenever the layout or the processing of the images changes.
+const uint32_t CACHE_MAGIC = 0x54443355, CACHE_VERSION = 1;
+
+void write_word(std::ostream& stream, uint32_t value)
+{
+    stream.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+uint32_t read_word(std::istream& stream)
+{
+    uint32_t value = 0;
+    stream.read(reinterpret_cast<char *>(&value), sizeof(value));
+    return value;
+}
+
+//Levels hold at most 4 bytes per texel, or their blocks when compressed.
+bool read_level(std::istream& stream, uint32_t& width, uint32_t& height, std::vector<uint8_t>& pixels)
+{
+    width = read_word(stream), height = read_word(stream);
+    uint32_t size = read_word(stream);
+    if(!stream || width > 0x10000 || height > 0x10000 || size > 4 * static_cast<uint64_t>(width + 3) * (height + 3)) return false;
+    pixels.resize(size);
+    return size == 0 || !stream.read(reinterpret_cast<char *>(&pixels[0]), size).fail();
+}
+}
+
+TextureCache::TextureCache(const std::string& directory) : directory(directory)
+{
+    if(!this->directory.empty() && this->directory[this->directory.size() - 1] != '/') this->directory += '/';
+}
+
+std::string TextureCache::get_path(const ContentHash& key) const
+{
+    std::string path = directory;
+    append_hex(path, key.high);
+    append_hex(path, key.low);
+    return path + ".tex";
+}
+
+bool TextureCache::load(const ContentHash& key, TextureImage& image) const
+{
+    std::ifstream file(get_path(key).c_str(), std::ios::in | std::ios::binary);
+    if(!file.is_open() || read_word(file) != CACHE_MAGIC || read_word(file) != CACHE_VERSION) return false;
+    image.internal_format = read_word(file);
+    image.format = read_word(file), image.type = read_word(file);
+    image.compressed = read_word(file) != 0;
+    uint32_t level_count = read_word(file);
+    if(!file || level_count == 0 || level_count > 32) return false;
+    if(!read_level(file, image.width, image.height, image.pixels)) return false;
+    image.mipmaps.resize(level_count - 1);
+    for(uint32_t i = 0; i + 1 < level_count; i++) {
+        TextureImage::Level& level = image.mipmaps[i];
+        if(!read_level(file, level.width, level.height, level.pixels)) return false;
+    }
+    return true;
+}
+
+bool TextureCache::store(const ContentHash& key, const TextureImage& image) const
+{
+    AtomicFileWriter writer(get_path(key));
+    if(!writer.is_open()) return false;
+    std::ostream& file = writer.get_stream();
+    write_word(file, CACHE_MAGIC);
+    write_word(file, CACHE_VERSION);
+    write_word(file, image.internal_format);
+    write_word(file, image.format);
+    write_word(file, image.type);
+    write_word(file, image.compressed);
+    write_word(file, image.mipmaps.size() + 1);
+    for(size_t i = 0; i <= image.mipmaps.size(); i++) {
+        const std::vector<uint8_t>& pixels = i == 0 ? image.pixels : image.mipmaps[i - 1].pixels;
+        write_word(file, i == 0 ? image.width : image.mipmaps[i - 1].width);
+        write_word(file, i == 0 ? image.height : image.mipmaps[i - 1].height);
+        write_word(file, pixels.size());
+        if(!pixels.empty()) file.write(reinterpret_cast<const char *>(&pixels[0]), pixels.size());
+    }
+    return writer.commit();
+}
+
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2016 Hiroka Ihara
+ *
+ * This file is part of libU3D.
+ *
+ * libU3D is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libU3D is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libU3D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+namespace U3D
+{
+
+//Decoded and processed texture images kept on disk under the content hash
+//of their source bytes and processing options, so that documents referring
+//to the same images skip decoding them. Entries are written to a temporary
+//file and renamed into place, so several threads and processes can share
+//a directory, which must exist.
+class TextureCache
+{
+    std::string directory;
+    std::string get_path(const ContentHash& key) const;
+public:
+    TextureCache(const std::string& directory);
+    //Returns false for missing or unreadable entries.
+    bool load(const ContentHash& key, TextureImage& image) const;
+    bool store(const ContentHash& key, const TextureImage& image) const;
+};
+
+}
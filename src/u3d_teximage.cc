@@ -0,0 +1,536 @@
+/*
+ * Copyright (C) 2016 Hiroka Ihara
+ *
+ * This file is part of libU3D.
+ *
+ * libU3D is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libU3D is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libU3D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "u3d_internal.hh"
+
+namespace U3D
+{
+
+namespace
+{
+//Steps of the table mapping linear light back to sRGB bytes
+const int LINEAR_STEPS = 16384;
+
+//sRGB transfer curves, tabulated once at start-up
+struct GammaTables
+{
+    float to_linear[256];
+    uint8_t to_srgb[LINEAR_STEPS + 1];
+    GammaTables()
+    {
+        for(int i = 0; i < 256; i++) {
+            double c = i / 255.0;
+            to_linear[i] = static_cast<float>(c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4));
+        }
+        for(int i = 0; i <= LINEAR_STEPS; i++) {
+            double l = static_cast<double>(i) / LINEAR_STEPS;
+            double c = l <= 0.0031308 ? l * 12.92 : 1.055 * pow(l, 1 / 2.4) - 0.055;
+            to_srgb[i] = static_cast<uint8_t>(c * 255 + 0.5);
+        }
+    }
+};
+
+const GammaTables gamma_tables;
+
+void to_float(const uint8_t *src, size_t pixel_count, bool gamma_correct, float *dst)
+{
+    for(size_t i = 0; i < 4 * pixel_count; i += 4) {
+        for(int j = 0; j < 3; j++) {
+            dst[i + j] = gamma_correct ? gamma_tables.to_linear[src[i + j]] : src[i + j] / 255.0f;
+        }
+        dst[i + 3] = src[i + 3] / 255.0f;
+    }
+}
+
+//Values are clamped to [0, 1] by the filters.
+void to_bytes(const float *src, size_t pixel_count, bool gamma_correct, uint8_t *dst)
+{
+    for(size_t i = 0; i < 4 * pixel_count; i += 4) {
+        for(int j = 0; j < 3; j++) {
+            dst[i + j] = gamma_correct ? gamma_tables.to_srgb[static_cast<int>(src[i + j] * LINEAR_STEPS + 0.5f)]
+                                       : static_cast<uint8_t>(src[i + j] * 255 + 0.5f);
+        }
+        dst[i + 3] = static_cast<uint8_t>(src[i + 3] * 255 + 0.5f);
+    }
+}
+
+double bessel_i0(double x)
+{
+    double sum = 1, term = 1;
+    for(int k = 1; k < 32; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+//Source texels and weights of every destination texel along one axis. All
+//texels have the same number of taps, padded with zero weights.
+struct Kernel
+{
+    unsigned int taps;
+    std::vector<uint32_t> indices;
+    std::vector<float> weights;
+    Kernel(uint32_t src_size, uint32_t dst_size, TextureOptions::MipmapFilter filter)
+    {
+        //Kaiser windowed sinc spanning three destination texels on each side
+        const double radius = 3, alpha = 4, pi = 3.14159265358979;
+        double scale = static_cast<double>(src_size) / dst_size;
+        double support = filter == TextureOptions::KAISER ? radius * scale : 0.5 * scale;
+        taps = 2 * static_cast<unsigned int>(ceil(support)) + 2;
+        indices.assign(taps * dst_size, 0);
+        weights.assign(taps * dst_size, 0);
+        for(uint32_t x = 0; x < dst_size; x++) {
+            double center = (x + 0.5) * scale;
+            int first = static_cast<int>(floor(center - support));
+            double sum = 0;
+            for(unsigned int t = 0; t < taps; t++) {
+                int i = first + static_cast<int>(t);
+                double weight;
+                if(filter == TextureOptions::KAISER) {
+                    double d = (i + 0.5 - center) / scale;
+                    if(fabs(d) >= radius) continue;
+                    double sinc = d == 0 ? 1 : sin(pi * d) / (pi * d);
+                    weight = sinc * bessel_i0(alpha * sqrt(1 - (d / radius) * (d / radius))) / bessel_i0(alpha);
+                } else {
+                    //Coverage of the texel by the destination footprint
+                    weight = std::min<double>(i + 1, center + support) - std::max<double>(i, center - support);
+                    if(weight <= 0) continue;
+                }
+                indices[x * taps + t] = std::min<int>(std::max(i, 0), src_size - 1);
+                weights[x * taps + t] = static_cast<float>(weight);
+                sum += weight;
+            }
+            for(unsigned int t = 0; t < taps; t++) {
+                weights[x * taps + t] = static_cast<float>(weights[x * taps + t] / sum);
+            }
+        }
+    }
+};
+
+//Both passes work on whole RGBA texels, one vector each.
+void resample_rows(const float *src, uint32_t src_width, uint32_t height, const Kernel& kernel, uint32_t dst_width, float *dst)
+{
+    for(uint32_t y = 0; y < height; y++) {
+        const float *row = src + 4 * static_cast<size_t>(y) * src_width;
+        for(uint32_t x = 0; x < dst_width; x++) {
+            const uint32_t *indices = &kernel.indices[x * kernel.taps];
+            const float *weights = &kernel.weights[x * kernel.taps];
+            float *out = dst + 4 * (static_cast<size_t>(y) * dst_width + x);
+#ifdef __SSE2__
+            __m128 sum = _mm_setzero_ps();
+            for(unsigned int t = 0; t < kernel.taps; t++) {
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[t]), _mm_loadu_ps(row + 4 * indices[t])));
+            }
+            _mm_storeu_ps(out, sum);
+#else
+            out[0] = out[1] = out[2] = out[3] = 0;
+            for(unsigned int t = 0; t < kernel.taps; t++) {
+                for(int j = 0; j < 4; j++) out[j] += weights[t] * row[4 * indices[t] + j];
+            }
+#endif
+        }
+    }
+}
+
+void resample_columns(const float *src, uint32_t width, const Kernel& kernel, uint32_t dst_height, float *dst)
+{
+    size_t row_size = 4 * static_cast<size_t>(width);
+    for(uint32_t y = 0; y < dst_height; y++) {
+        const uint32_t *indices = &kernel.indices[y * kernel.taps];
+        const float *weights = &kernel.weights[y * kernel.taps];
+        float *out = dst + y * row_size;
+        for(size_t i = 0; i < row_size; i += 4) {
+#ifdef __SSE2__
+            __m128 sum = _mm_setzero_ps();
+            for(unsigned int t = 0; t < kernel.taps; t++) {
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[t]), _mm_loadu_ps(src + indices[t] * row_size + i)));
+            }
+            //Negative lobes of the Kaiser filter ring past the valid range.
+            _mm_storeu_ps(out + i, _mm_min_ps(_mm_max_ps(sum, _mm_setzero_ps()), _mm_set1_ps(1.0f)));
+#else
+            for(int j = 0; j < 4; j++) {
+                float sum = 0;
+                for(unsigned int t = 0; t < kernel.taps; t++) sum += weights[t] * src[indices[t] * row_size + i + j];
+                out[i + j] = std::min(std::max(sum, 0.0f), 1.0f);
+            }
+#endif
+        }
+    }
+}
+
+//Loads the 4x4 block at (x, y), clamping to the image.
+void load_block(const uint8_t *rgba, uint32_t width, uint32_t height, uint32_t x, uint32_t y, uint8_t block[64])
+{
+    for(uint32_t j = 0; j < 4; j++) {
+        uint32_t row = std::min(y + j, height - 1);
+        for(uint32_t i = 0; i < 4; i++) {
+            memcpy(block + 4 * (4 * j + i), rgba + 4 * (static_cast<size_t>(row) * width + std::min(x + i, width - 1)), 4);
+        }
+    }
+}
+
+void store_block(const uint8_t block[64], uint32_t width, uint32_t height, uint32_t x, uint32_t y, uint8_t *rgba)
+{
+    for(uint32_t j = 0; j < 4 && y + j < height; j++) {
+        for(uint32_t i = 0; i < 4 && x + i < width; i++) {
+            memcpy(rgba + 4 * (static_cast<size_t>(y + j) * width + x + i), block + 4 * (4 * j + i), 4);
+        }
+    }
+}
+
+uint16_t pack_565(const float color[3])
+{
+    int r = std::min(std::max(static_cast<int>(color[0] * (31 / 255.0f) + 0.5f), 0), 31);
+    int g = std::min(std::max(static_cast<int>(color[1] * (63 / 255.0f) + 0.5f), 0), 63);
+    int b = std::min(std::max(static_cast<int>(color[2] * (31 / 255.0f) + 0.5f), 0), 31);
+    return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+void unpack_565(uint16_t value, int color[3])
+{
+    int r = (value >> 11) & 31, g = (value >> 5) & 63, b = value & 31;
+    color[0] = (r << 3) | (r >> 2), color[1] = (g << 2) | (g >> 4), color[2] = (b << 3) | (b >> 2);
+}
+
+//BC1 blocks with color0 <= color1 have three colors and black; BC3 always has four.
+void get_color_palette(uint16_t color0, uint16_t color1, bool four_colors, int palette[4][3])
+{
+    unpack_565(color0, palette[0]);
+    unpack_565(color1, palette[1]);
+    for(int j = 0; j < 3; j++) {
+        if(four_colors || color0 > color1) {
+            palette[2][j] = (2 * palette[0][j] + palette[1][j]) / 3;
+            palette[3][j] = (palette[0][j] + 2 * palette[1][j]) / 3;
+        } else {
+            palette[2][j] = (palette[0][j] + palette[1][j]) / 2;
+            palette[3][j] = 0;
+        }
+    }
+}
+
+//Picks the nearest palette entry for every texel and returns the squared error.
+uint32_t select_colors(const uint8_t block[64], const int palette[4][3], uint32_t& indices)
+{
+    uint32_t error = 0;
+    indices = 0;
+    for(int i = 0; i < 16; i++) {
+        int best = 0, best_distance = 0x7FFFFFFF;
+        for(int k = 0; k < 4; k++) {
+            int dr = block[4 * i] - palette[k][0], dg = block[4 * i + 1] - palette[k][1], db = block[4 * i + 2] - palette[k][2];
+            int distance = dr * dr + dg * dg + db * db;
+            if(distance < best_distance) best = k, best_distance = distance;
+        }
+        indices |= static_cast<uint32_t>(best) << (2 * i);
+        error += best_distance;
+    }
+    return error;
+}
+
+//Orders the endpoints for the four color mode and selects the indices.
+uint32_t fit_colors(const uint8_t block[64], uint16_t color0, uint16_t color1, uint16_t& packed0, uint16_t& packed1, uint32_t& indices)
+{
+    if(color0 < color1) std::swap(color0, color1);
+    packed0 = color0, packed1 = color1;
+    int palette[4][3];
+    get_color_palette(color0, color1, true, palette);
+    if(color0 == color1) {
+        //Index 0 decodes to the same color in either mode.
+        indices = 0;
+        uint32_t error = 0;
+        for(int i = 0; i < 16; i++) {
+            for(int j = 0; j < 3; j++) error += (block[4 * i + j] - palette[0][j]) * (block[4 * i + j] - palette[0][j]);
+        }
+        return error;
+    }
+    return select_colors(block, palette, indices);
+}
+
+//Endpoints from the principal axis of the block colors, refined by least
+//squares against the selected indices.
+void encode_color_block(const uint8_t block[64], uint8_t out[8])
+{
+    float mean[3] = {0, 0, 0}, min[3] = {255, 255, 255}, max[3] = {0, 0, 0};
+    for(int i = 0; i < 16; i++) {
+        for(int j = 0; j < 3; j++) {
+            mean[j] += block[4 * i + j] / 16.0f;
+            min[j] = std::min<float>(min[j], block[4 * i + j]);
+            max[j] = std::max<float>(max[j], block[4 * i + j]);
+        }
+    }
+    float covariance[6] = {0, 0, 0, 0, 0, 0};
+    for(int i = 0; i < 16; i++) {
+        float r = block[4 * i] - mean[0], g = block[4 * i + 1] - mean[1], b = block[4 * i + 2] - mean[2];
+        covariance[0] += r * r, covariance[1] += r * g, covariance[2] += r * b;
+        covariance[3] += g * g, covariance[4] += g * b, covariance[5] += b * b;
+    }
+    float axis[3] = {max[0] - min[0], max[1] - min[1], max[2] - min[2]};
+    for(int k = 0; k < 8; k++) {
+        float x = covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2];
+        float y = covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2];
+        float z = covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2];
+        float norm = std::max(fabsf(x), std::max(fabsf(y), fabsf(z)));
+        if(norm < 1e-6f) break;
+        axis[0] = x / norm, axis[1] = y / norm, axis[2] = z / norm;
+    }
+    float length = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+    float t_min = 0, t_max = 0;
+    if(length > 1e-6f) {
+        t_min = 1e30f, t_max = -1e30f;
+        for(int i = 0; i < 16; i++) {
+            float t = ((block[4 * i] - mean[0]) * axis[0] + (block[4 * i + 1] - mean[1]) * axis[1] + (block[4 * i + 2] - mean[2]) * axis[2]) / length;
+            t_min = std::min(t_min, t), t_max = std::max(t_max, t);
+        }
+    }
+    float end0[3], end1[3];
+    for(int j = 0; j < 3; j++) {
+        end0[j] = mean[j] + t_max * axis[j], end1[j] = mean[j] + t_min * axis[j];
+    }
+    uint16_t color0, color1;
+    uint32_t indices;
+    uint32_t error = fit_colors(block, pack_565(end0), pack_565(end1), color0, color1, indices);
+
+    static const float weights[4] = {1.0f, 0.0f, 2 / 3.0f, 1 / 3.0f};
+    for(int iteration = 0; iteration < 2 && error > 0 && color0 != color1; iteration++) {
+        float aa = 0, ab = 0, bb = 0, ax[3] = {0, 0, 0}, bx[3] = {0, 0, 0};
+        for(int i = 0; i < 16; i++) {
+            float a = weights[(indices >> (2 * i)) & 3], b = 1 - a;
+            aa += a * a, ab += a * b, bb += b * b;
+            for(int j = 0; j < 3; j++) ax[j] += a * block[4 * i + j], bx[j] += b * block[4 * i + j];
+        }
+        float det = aa * bb - ab * ab;
+        if(fabsf(det) < 1e-6f) break;
+        for(int j = 0; j < 3; j++) {
+            end0[j] = (ax[j] * bb - bx[j] * ab) / det;
+            end1[j] = (bx[j] * aa - ax[j] * ab) / det;
+        }
+        uint16_t refined0, refined1;
+        uint32_t refined_indices;
+        uint32_t refined_error = fit_colors(block, pack_565(end0), pack_565(end1), refined0, refined1, refined_indices);
+        if(refined_error >= error) break;
+        error = refined_error, color0 = refined0, color1 = refined1, indices = refined_indices;
+    }
+    out[0] = color0 & 0xFF, out[1] = color0 >> 8;
+    out[2] = color1 & 0xFF, out[3] = color1 >> 8;
+    for(int i = 0; i < 4; i++) out[4 + i] = (indices >> (8 * i)) & 0xFF;
+}
+
+void decode_color_block(const uint8_t in[8], bool four_colors, uint8_t block[64])
+{
+    uint16_t color0 = in[0] | (in[1] << 8), color1 = in[2] | (in[3] << 8);
+    uint32_t indices = in[4] | (in[5] << 8) | (in[6] << 16) | (static_cast<uint32_t>(in[7]) << 24);
+    int palette[4][3];
+    get_color_palette(color0, color1, four_colors, palette);
+    for(int i = 0; i < 16; i++) {
+        const int *color = palette[(indices >> (2 * i)) & 3];
+        block[4 * i] = color[0], block[4 * i + 1] = color[1], block[4 * i + 2] = color[2];
+        block[4 * i + 3] = !four_colors && color0 <= color1 && ((indices >> (2 * i)) & 3) == 3 ? 0 : 255;
+    }
+}
+
+//Eight interpolated alphas when alpha0 > alpha1, else six and the extremes
+void get_alpha_palette(int alpha0, int alpha1, int palette[8])
+{
+    palette[0] = alpha0, palette[1] = alpha1;
+    if(alpha0 > alpha1) {
+        for(int k = 2; k < 8; k++) palette[k] = ((8 - k) * alpha0 + (k - 1) * alpha1) / 7;
+    } else {
+        for(int k = 2; k < 6; k++) palette[k] = ((6 - k) * alpha0 + (k - 1) * alpha1) / 5;
+        palette[6] = 0, palette[7] = 255;
+    }
+}
+
+uint32_t select_alphas(const uint8_t block[64], int alpha0, int alpha1, uint64_t& indices)
+{
+    int palette[8];
+    get_alpha_palette(alpha0, alpha1, palette);
+    uint32_t error = 0;
+    indices = 0;
+    for(int i = 0; i < 16; i++) {
+        int best = 0, best_distance = 0x7FFFFFFF;
+        for(int k = 0; k < 8; k++) {
+            int distance = (block[4 * i + 3] - palette[k]) * (block[4 * i + 3] - palette[k]);
+            if(distance < best_distance) best = k, best_distance = distance;
+        }
+        indices |= static_cast<uint64_t>(best) << (3 * i);
+        error += best_distance;
+    }
+    return error;
+}
+
+//Tries the full range in the eight alpha mode, and the range between the
+//extremes in the six alpha mode when the block holds 0 or 255.
+void encode_alpha_block(const uint8_t block[64], uint8_t out[8])
+{
+    int min = 255, max = 0, inner_min = 255, inner_max = 0;
+    for(int i = 0; i < 16; i++) {
+        int alpha = block[4 * i + 3];
+        min = std::min(min, alpha), max = std::max(max, alpha);
+        if(alpha != 0 && alpha != 255) inner_min = std::min(inner_min, alpha), inner_max = std::max(inner_max, alpha);
+    }
+    int alpha0 = max, alpha1 = min;
+    uint64_t indices;
+    uint32_t error = select_alphas(block, alpha0, alpha1, indices);
+    if(error > 0 && (min == 0 || max == 255)) {
+        if(inner_min > inner_max) inner_min = inner_max = min;
+        uint64_t inner_indices;
+        uint32_t inner_error = select_alphas(block, inner_min, inner_max, inner_indices);
+        if(inner_error < error) alpha0 = inner_min, alpha1 = inner_max, indices = inner_indices;
+    }
+    out[0] = alpha0, out[1] = alpha1;
+    for(int i = 0; i < 6; i++) out[2 + i] = (indices >> (8 * i)) & 0xFF;
+}
+
+void decode_alpha_block(const uint8_t in[8], uint8_t block[64])
+{
+    int palette[8];
+    get_alpha_palette(in[0], in[1], palette);
+    uint64_t indices = 0;
+    for(int i = 0; i < 6; i++) indices |= static_cast<uint64_t>(in[2 + i]) << (8 * i);
+    for(int i = 0; i < 16; i++) block[4 * i + 3] = palette[(indices >> (3 * i)) & 7];
+}
+
+void encode_blocks(const uint8_t *rgba, uint32_t width, uint32_t height, uint8_t *blocks, bool alpha)
+{
+    uint8_t block[64];
+    for(uint32_t y = 0; y < height; y += 4) {
+        for(uint32_t x = 0; x < width; x += 4) {
+            load_block(rgba, width, height, x, y, block);
+            if(alpha) {
+                encode_alpha_block(block, blocks);
+                blocks += 8;
+            }
+            encode_color_block(block, blocks);
+            blocks += 8;
+        }
+    }
+}
+
+void decode_blocks(const uint8_t *blocks, uint32_t width, uint32_t height, uint8_t *rgba, bool alpha)
+{
+    uint8_t block[64];
+    for(uint32_t y = 0; y < height; y += 4) {
+        for(uint32_t x = 0; x < width; x += 4) {
+            decode_color_block(blocks + (alpha ? 8 : 0), alpha, block);
+            if(alpha) decode_alpha_block(blocks, block);
+            blocks += alpha ? 16 : 8;
+            store_block(block, width, height, x, y, rgba);
+        }
+    }
+}
+
+}
+
+void generate_mipmaps(TextureImage& image, TextureOptions::MipmapFilter filter, bool gamma_correct)
+{
+    if(image.compressed || image.format != GL_RGBA || image.type != GL_UNSIGNED_BYTE) {
+        throw U3D_ERROR << "Mipmaps can only be generated from 8-bit RGBA images.";
+    }
+    image.mipmaps.clear();
+    if(filter == TextureOptions::NO_MIPMAPS) return;
+    uint32_t width = image.width, height = image.height;
+    std::vector<float> level(4 * static_cast<size_t>(width) * height), rows, next;
+    to_float(image.pixels.empty() ? NULL : &image.pixels[0], static_cast<size_t>(width) * height, gamma_correct, level.empty() ? NULL : &level[0]);
+    while(width > 1 || height > 1) {
+        uint32_t next_width = std::max<uint32_t>(width / 2, 1), next_height = std::max<uint32_t>(height / 2, 1);
+        rows.resize(4 * static_cast<size_t>(next_width) * height);
+        next.resize(4 * static_cast<size_t>(next_width) * next_height);
+        resample_rows(&level[0], width, height, Kernel(width, next_width, filter), next_width, &rows[0]);
+        resample_columns(&rows[0], next_width, Kernel(height, next_height, filter), next_height, &next[0]);
+        image.mipmaps.push_back(TextureImage::Level());
+        TextureImage::Level& mipmap = image.mipmaps.back();
+        mipmap.width = next_width, mipmap.height = next_height;
+        mipmap.pixels.resize(next.size());
+        to_bytes(&next[0], static_cast<size_t>(next_width) * next_height, gamma_correct, &mipmap.pixels[0]);
+        level.swap(next);
+        width = next_width, height = next_height;
+    }
+}
+
+size_t get_compressed_size(uint32_t width, uint32_t height, bool alpha)
+{
+    return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * (alpha ? 16 : 8);
+}
+
+void encode_bc1(const uint8_t *rgba, uint32_t width, uint32_t height, uint8_t *blocks)
+{
+    encode_blocks(rgba, width, height, blocks, false);
+}
+
+void encode_bc3(const uint8_t *rgba, uint32_t width, uint32_t height, uint8_t *blocks)
+{
+    encode_blocks(rgba, width, height, blocks, true);
+}
+
+void decode_bc1(const uint8_t *blocks, uint32_t width, uint32_t height, uint8_t *rgba)
+{
+    decode_blocks(blocks, width, height, rgba, false);
+}
+
+void decode_bc3(const uint8_t *blocks, uint32_t width, uint32_t height, uint8_t *rgba)
+{
+    decode_blocks(blocks, width, height, rgba, true);
+}
+
+double compute_psnr(const uint8_t *a, const uint8_t *b, size_t pixel_count, bool alpha)
+{
+    double sum = 0;
+    int channels = alpha ? 4 : 3;
+    for(size_t i = 0; i < pixel_count; i++) {
+        for(int j = 0; j < channels; j++) {
+            double d = static_cast<double>(a[4 * i + j]) - b[4 * i + j];
+            sum += d * d;
+        }
+    }
+    if(sum == 0) return HUGE_VAL;
+    return 10 * log10(255.0 * 255.0 * channels * pixel_count / sum);
+}
+
+double process_image(TextureImage& image, const TextureOptions& options)
+{
+    if(!options.enabled()) return 0;
+    convert_image(image, GL_RGBA);
+    generate_mipmaps(image, options.mipmap_filter, options.gamma_correct);
+    if(!options.compress || image.width == 0 || image.height == 0) return 0;
+
+    //Images declared with alpha that turn out opaque take the smaller format.
+    bool alpha = false;
+    if(image.internal_format == GL_RGBA) {
+        for(size_t i = 3; i < image.pixels.size() && !alpha; i += 4) alpha = image.pixels[i] != 255;
+    }
+    void (*encode)(const uint8_t *, uint32_t, uint32_t, uint8_t *) = alpha ? encode_bc3 : encode_bc1;
+    std::vector<uint8_t> blocks(get_compressed_size(image.width, image.height, alpha));
+    encode(&image.pixels[0], image.width, image.height, &blocks[0]);
+    std::vector<uint8_t> decoded(image.pixels.size());
+    (alpha ? decode_bc3 : decode_bc1)(&blocks[0], image.width, image.height, &decoded[0]);
+    double psnr = compute_psnr(&image.pixels[0], &decoded[0], static_cast<size_t>(image.width) * image.height, alpha);
+    image.pixels.swap(blocks);
+    for(size_t i = 0; i < image.mipmaps.size(); i++) {
+        TextureImage::Level& mipmap = image.mipmaps[i];
+        blocks.assign(get_compressed_size(mipmap.width, mipmap.height, alpha), 0);
+        encode(&mipmap.pixels[0], mipmap.width, mipmap.height, &blocks[0]);
+        mipmap.pixels.swap(blocks);
+    }
+    image.internal_format = alpha ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    image.compressed = true;
+    return psnr;
+}
+
+}
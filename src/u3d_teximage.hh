@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2016 Hiroka Ihara
+ *
+ * This file is part of libU3D.
+ *
+ * libU3D is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libU3D is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libU3D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+namespace U3D
+{
+
+//CPU stages run on decoded texture images before upload: mip chain
+//generation and S3TC block encoding. None of them touch GL.
+
+//Replaces the mipmaps of an 8-bit RGBA image with a chain down to 1x1.
+void generate_mipmaps(TextureImage& image, TextureOptions::MipmapFilter filter, bool gamma_correct);
+
+//Block codecs over 8-bit RGBA. Partial blocks at the right and bottom edges
+//are padded with the nearest edge texels. BC1 ignores alpha.
+size_t get_compressed_size(uint32_t width, uint32_t height, bool alpha);
+void encode_bc1(const uint8_t *rgba, uint32_t width, uint32_t height, uint8_t *blocks);
+void encode_bc3(const uint8_t *rgba, uint32_t width, uint32_t height, uint8_t *blocks);
+void decode_bc1(const uint8_t *blocks, uint32_t width, uint32_t height, uint8_t *rgba);
+void decode_bc3(const uint8_t *blocks, uint32_t width, uint32_t height, uint8_t *rgba);
+
+//Peak signal-to-noise ratio in dB between two 8-bit RGBA images, over RGB
+//or all four channels. Identical images give HUGE_VAL.
+double compute_psnr(const uint8_t *a, const uint8_t *b, size_t pixel_count, bool alpha);
+
+//Runs the stages selected by the options and returns the PSNR of the
+//compressed base level, or 0 when the image is left uncompressed.
+double process_image(TextureImage& image, const TextureOptions& options);
+
+}
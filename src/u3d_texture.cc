@@ -33,65 +33,371 @@ static const uint8_t default_texture[192] = {
     255, 102, 51, 255, 102, 51, 255, 102, 51, 255, 102, 51, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255
 };
 
+namespace
+{
+//Reads an image scattered over several block payloads without joining them.
+struct ChunkStream
+{
+    const std::vector<BlockPayload> *chunks;
+    Sint64 size, position;
+};
+
+Sint64 SDLCALL chunk_size(SDL_RWops *context)
+{
+    return static_cast<ChunkStream *>(context->hidden.unknown.data1)->size;
+}
+
+Sint64 SDLCALL chunk_seek(SDL_RWops *context, Sint64 offset, int whence)
+{
+    ChunkStream *stream = static_cast<ChunkStream *>(context->hidden.unknown.data1);
+    Sint64 position = offset + (whence == RW_SEEK_CUR ? stream->position : whence == RW_SEEK_END ? stream->size : 0);
+    if(position < 0 || position > stream->size) return -1;
+    return stream->position = position;
+}
+
+size_t SDLCALL chunk_read(SDL_RWops *context, void *ptr, size_t size, size_t count)
+{
+    ChunkStream *stream = static_cast<ChunkStream *>(context->hidden.unknown.data1);
+    if(size == 0) return 0;
+    count = std::min<Sint64>(count, (stream->size - stream->position) / size);
+    uint8_t *dst = static_cast<uint8_t *>(ptr);
+    Sint64 remaining = count * size, start = 0;
+    for(size_t i = 0; i < stream->chunks->size() && remaining > 0; i++) {
+        const BlockPayload& chunk = (*stream->chunks)[i];
+        if(stream->position < start + chunk.size) {
+            Sint64 offset = stream->position - start, length = std::min<Sint64>(remaining, chunk.size - offset);
+            memcpy(dst, chunk.data + offset, length);
+            dst += length, stream->position += length, remaining -= length;
+        }
+        start += chunk.size;
+    }
+    return count;
+}
+
+size_t SDLCALL chunk_write(SDL_RWops *, const void *, size_t, size_t)
+{
+    return 0;
+}
+
+int SDLCALL chunk_close(SDL_RWops *context)
+{
+    delete static_cast<ChunkStream *>(context->hidden.unknown.data1);
+    SDL_FreeRW(context);
+    return 0;
+}
+
+SDL_RWops *create_chunk_stream(const std::vector<BlockPayload>& chunks, uint32_t size)
+{
+    if(chunks.size() == 1) {
+        return SDL_RWFromConstMem(chunks[0].data, size);
+    }
+    SDL_RWops *context = SDL_AllocRW();
+    if(context == NULL) return NULL;
+    ChunkStream *stream = new ChunkStream();
+    stream->chunks = &chunks, stream->size = size, stream->position = 0;
+    context->size = chunk_size, context->seek = chunk_seek, context->read = chunk_read;
+    context->write = chunk_write, context->close = chunk_close;
+    context->type = SDL_RWOPS_UNKNOWN;
+    context->hidden.unknown.data1 = stream;
+    return context;
+}
+
+//Copies the channels in the mask from a decoded RGBA image. Single channel
+//images without alpha hold their values in the color channels.
+void composite_channels(const TextureImage& source, uint8_t channels, uint8_t *dst)
+{
+    static const uint8_t masks[4] = {8, 4, 2, 1};
+    int bits = 0;
+    for(int j = 0; j < 5; j++) bits += (channels >> j) & 1;
+    int from[4] = {0, 1, 2, 3};
+    if(channels & 16) from[0] = from[1] = from[2] = 0;
+    if(bits == 1 && source.internal_format != GL_RGBA) from[3] = 0;
+    const uint8_t *src = &source.pixels[0];
+    size_t count = static_cast<size_t>(source.width) * source.height;
+    for(int j = 0; j < 4; j++) {
+        if((channels & masks[j]) == 0 && !(j < 3 && (channels & 16))) continue;
+        for(size_t i = 0; i < count; i++) dst[4 * i + j] = src[4 * i + from[j]];
+    }
+}
+}
+
 void Texture::load_continuation(BitStreamReader& reader)
 {
     uint32_t image_index = reader.read<uint32_t>();
-    if(image_index != 0) {
-        throw U3D_ERROR << "Image index " << image_index << "does not exist.";
+    if(image_index >= images.size()) {
+        throw U3D_ERROR << "Image index " << image_index << " does not exist.";
     }
-    uint32_t bytes_read = reader.read_remainder(image_data + byte_position, byte_count - byte_position);
-    byte_position += bytes_read;
+    ContinuationImage& image = images[image_index];
+    BlockPayload payload;
+    reader.detach_remainder(payload);
+    payload.size = std::min(payload.size, image.byte_count - image.byte_position);
+    image.byte_position += payload.size;
+    image.chunks.push_back(payload);
 }
 
 Texture::Texture()
 {
-    height = 8, width = 8, type = RGB, compression_type = RAW;
-    image_data = new uint8_t[sizeof(default_texture)];
-    memcpy(image_data, default_texture, sizeof(default_texture));
-    byte_count = sizeof(default_texture);
+    height = 8, width = 8, type = RGB;
+    images.resize(1);
+    ContinuationImage& image = images[0];
+    image.compression_type = RAW, image.channels = RGB, image.attributes = 0;
+    image.byte_count = image.byte_position = sizeof(default_texture);
+    BlockPayload payload = {NULL, default_texture, sizeof(default_texture)};
+    image.chunks.push_back(payload);
+    uris_resolved = true;
 }
 
-GLuint Texture::load_texture()
+bool Texture::has_missing_image() const
 {
-    GLuint texture;
-    glGenTextures(1, &texture);
-    glBindTexture(GL_TEXTURE_2D, texture);
-    if(compression_type == RAW) {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image_data);
-    } else {
-        SDL_Surface *surface = IMG_Load_RW(SDL_RWFromMem(image_data, byte_count), true);
-        if(surface == NULL) {
-            throw U3D_ERROR << "Failed to load a texture image.";
+    for(unsigned int i = 0; i < images.size(); i++) {
+        if((images[i].attributes & EXTERNAL) && images[i].chunks.empty()) return true;
+    }
+    return false;
+}
+
+void Texture::resolve_uris(const std::vector<UriResolver *>& resolvers)
+{
+    if(uris_resolved) return;
+    uris_resolved = true;
+    for(unsigned int i = 0; i < images.size(); i++) {
+        ContinuationImage& image = images[i];
+        if((image.attributes & EXTERNAL) == 0) continue;
+        std::vector<uint8_t> data;
+        bool found = false;
+        for(unsigned int j = 0; j < image.uris.size() && !found; j++) {
+            for(unsigned int k = 0; k < resolvers.size() && !found; k++) {
+                found = resolvers[k]->resolve(image.uris[j], data) && !data.empty();
+            }
         }
-        switch(surface->format->format) {
-        case SDL_PIXELFORMAT_RGB24:
-        case SDL_PIXELFORMAT_RGB888:
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, surface->pixels);
-            break;
-        case SDL_PIXELFORMAT_BGR24:
-        case SDL_PIXELFORMAT_BGR888:
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_BGR, GL_UNSIGNED_BYTE, surface->pixels);
+        if(!found) {
+            U3D_WARNING << "No image of a texture could be fetched from " << (image.uris.empty() ? "an empty URI list" : image.uris[0]) << "." << std::endl;
+            continue;
+        }
+        //Held in words like the block payloads, and freed with them
+        BlockPayload payload;
+        payload.buffer = new uint32_t[(data.size() + 3) / 4];
+        payload.data = reinterpret_cast<const uint8_t *>(payload.buffer);
+        payload.size = data.size();
+        memcpy(payload.buffer, &data[0], data.size());
+        image.byte_count = image.byte_position = payload.size;
+        image.chunks.push_back(payload);
+    }
+}
+
+void Texture::decode_image(const ContinuationImage& source, TextureImage& image) const
+{
+    if(source.compression_type == RAW) {
+        //Texels hold the channels of the image in the order red, green, blue
+        //and alpha, with luminance in place of the colors.
+        static const uint8_t order[5] = {LUMINANCE, RED, GREEN, BLUE, ALPHA};
+        unsigned int stride = 0;
+        for(int j = 0; j < 5; j++) {
+            if(source.channels & order[j]) stride++;
+        }
+        size_t count = static_cast<size_t>(width) * height;
+        std::vector<uint8_t> texels(stride * count);
+        size_t position = 0;
+        for(unsigned int i = 0; i < source.chunks.size() && position < texels.size(); i++) {
+            size_t size = std::min<size_t>(source.chunks[i].size, texels.size() - position);
+            memcpy(&texels[position], source.chunks[i].data, size);
+            position += size;
+        }
+        image.width = width, image.height = height, image.type = GL_UNSIGNED_BYTE;
+        switch(source.channels) {
+        case RGB:
+            image.internal_format = GL_RGB, image.format = GL_RGB;
             break;
-        case SDL_PIXELFORMAT_RGBA8888:
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, surface->pixels);
+        case RGBA:
+            image.internal_format = GL_RGBA, image.format = GL_RGBA;
             break;
-        case SDL_PIXELFORMAT_BGRA8888:
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8, surface->pixels);
+        case LUMINANCE:
+            image.internal_format = image.format = GL_LUMINANCE;
             break;
-        case SDL_PIXELFORMAT_ARGB8888:
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, surface->pixels);
+        case LUMINANCE | ALPHA:
+            image.internal_format = image.format = GL_LUMINANCE_ALPHA;
             break;
-        case SDL_PIXELFORMAT_ABGR8888:
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8_REV, surface->pixels);
+        case ALPHA:
+            image.internal_format = image.format = GL_ALPHA;
             break;
         default:
-            throw U3D_ERROR << "Texture image reported to have an unrecognized format.";
+            {
+                //Other subsets of the colors are spread over black texels.
+                image.internal_format = source.channels & ALPHA ? GL_RGBA : GL_RGB, image.format = GL_RGBA;
+                image.pixels.assign(4 * count, 0);
+                unsigned int offset = 0;
+                for(int j = 1; j < 5; j++) {
+                    if((source.channels & order[j]) == 0) continue;
+                    for(size_t i = 0; i < count; i++) image.pixels[4 * i + j - 1] = texels[stride * i + offset];
+                    offset++;
+                }
+                if((source.channels & ALPHA) == 0) {
+                    for(size_t i = 0; i < count; i++) image.pixels[4 * i + 3] = 255;
+                }
+            }
+            return;
         }
-        SDL_FreeSurface(surface);
+        image.pixels.swap(texels);
+        return;
     }
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    if(source.byte_position < source.byte_count) {
+        throw U3D_ERROR << "Texture image is missing " << source.byte_count - source.byte_position << " bytes.";
+    }
+    SDL_RWops *stream = create_chunk_stream(source.chunks, source.byte_count);
+    SDL_Surface *surface = stream == NULL ? NULL : IMG_Load_RW(stream, true);
+    if(surface == NULL) {
+        throw U3D_ERROR << "Failed to load a texture image.";
+    }
+    //Formats named by their packed layout come from 32-bit words.
+    switch(surface->format->format) {
+    case SDL_PIXELFORMAT_RGB24:
+        image.internal_format = GL_RGB, image.format = GL_RGB, image.type = GL_UNSIGNED_BYTE;
+        break;
+    case SDL_PIXELFORMAT_BGR24:
+        image.internal_format = GL_RGB, image.format = GL_BGR, image.type = GL_UNSIGNED_BYTE;
+        break;
+    case SDL_PIXELFORMAT_RGB888:
+        image.internal_format = GL_RGB, image.format = GL_BGRA, image.type = GL_UNSIGNED_INT_8_8_8_8_REV;
+        break;
+    case SDL_PIXELFORMAT_BGR888:
+        image.internal_format = GL_RGB, image.format = GL_RGBA, image.type = GL_UNSIGNED_INT_8_8_8_8_REV;
+        break;
+    case SDL_PIXELFORMAT_RGBA8888:
+        image.internal_format = GL_RGBA, image.format = GL_RGBA, image.type = GL_UNSIGNED_INT_8_8_8_8;
+        break;
+    case SDL_PIXELFORMAT_BGRA8888:
+        image.internal_format = GL_RGBA, image.format = GL_BGRA, image.type = GL_UNSIGNED_INT_8_8_8_8;
+        break;
+    case SDL_PIXELFORMAT_ARGB8888:
+        image.internal_format = GL_RGBA, image.format = GL_BGRA, image.type = GL_UNSIGNED_INT_8_8_8_8_REV;
+        break;
+    case SDL_PIXELFORMAT_ABGR8888:
+        image.internal_format = GL_RGBA, image.format = GL_RGBA, image.type = GL_UNSIGNED_INT_8_8_8_8_REV;
+        break;
+    default:
+        {
+            //Palettized images, such as grayscale PNGs, are expanded by SDL.
+            bool alpha = SDL_ISPIXELFORMAT_ALPHA(surface->format->format);
+            SDL_Surface *converted = SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_ABGR8888, 0);
+            SDL_FreeSurface(surface);
+            if(converted == NULL) {
+                throw U3D_ERROR << "Texture image reported to have an unrecognized format.";
+            }
+            surface = converted;
+            image.internal_format = alpha ? GL_RGBA : GL_RGB, image.format = GL_RGBA, image.type = GL_UNSIGNED_INT_8_8_8_8_REV;
+        }
+        break;
+    }
+    image.width = surface->w, image.height = surface->h;
+    size_t row_size = static_cast<size_t>(surface->w) * surface->format->BytesPerPixel;
+    image.pixels.resize(row_size * surface->h);
+    for(int y = 0; y < surface->h; y++) {
+        memcpy(&image.pixels[y * row_size], static_cast<const uint8_t *>(surface->pixels) + y * surface->pitch, row_size);
+    }
+    SDL_FreeSurface(surface);
+}
+
+void Texture::decode(TextureImage& image) const
+{
+    if(has_missing_image()) {
+        Texture().decode(image);
+        return;
+    }
+    if(images.size() == 1) {
+        decode_image(images[0], image);
+    } else {
+        composite(image);
+    }
+    //Declared luminance and alpha textures are stored in 1 or 2 bytes.
+    GLenum format = GL_RGBA;
+    if(type == LUMINANCE) format = GL_LUMINANCE;
+    else if(type == (LUMINANCE | ALPHA)) format = GL_LUMINANCE_ALPHA;
+    else if(type == ALPHA) format = GL_ALPHA;
+    convert_image(image, format);
+    //Channels left out of the declaration read as in GL: black and opaque.
+    if(format == GL_RGBA && (type & RGBA) != RGBA && (type & LUMINANCE) == 0) {
+        static const uint8_t masks[4] = {RED, GREEN, BLUE, ALPHA};
+        static const uint8_t missing[4] = {0, 0, 0, 255};
+        size_t count = static_cast<size_t>(image.width) * image.height;
+        for(int j = 0; j < 4; j++) {
+            if(type & masks[j]) continue;
+            for(size_t i = 0; i < count; i++) image.pixels[4 * i + j] = missing[j];
+        }
+        if((type & ALPHA) == 0) image.internal_format = GL_RGB;
+    }
+}
+
+void Texture::composite(TextureImage& image) const
+{
+    //Channels missing from every image read as in GL: black and opaque.
+    TextureImage part;
+    for(unsigned int i = 0; i < images.size(); i++) {
+        decode_image(images[i], part);
+        convert_image(part, GL_RGBA);
+        if(i == 0) {
+            image.width = part.width, image.height = part.height;
+            image.internal_format = type & ALPHA ? GL_RGBA : GL_RGB, image.format = GL_RGBA, image.type = GL_UNSIGNED_BYTE;
+            image.pixels.assign(4 * static_cast<size_t>(part.width) * part.height, 0);
+            for(size_t j = 3; j < image.pixels.size(); j += 4) image.pixels[j] = 255;
+        } else if(part.width != image.width || part.height != image.height) {
+            throw U3D_ERROR << "Continuation images of a texture differ in size.";
+        }
+        if(!image.pixels.empty()) composite_channels(part, images[i].channels, &image.pixels[0]);
+    }
+}
+
+void Texture::append_content(std::vector<uint8_t>& bytes) const
+{
+    append_bytes(bytes, width);
+    append_bytes(bytes, height);
+    append_bytes(bytes, type);
+    for(unsigned int i = 0; i < images.size(); i++) {
+        append_bytes(bytes, images[i].compression_type);
+        append_bytes(bytes, images[i].channels);
+        append_bytes(bytes, images[i].byte_count);
+        //Fetched images match by their bytes wherever they came from.
+        for(unsigned int j = 0; images[i].chunks.empty() && j < images[i].uris.size(); j++) {
+            append_bytes(bytes, images[i].uris[j].data(), images[i].uris[j].size() + 1);
+        }
+        for(unsigned int j = 0; j < images[i].chunks.size(); j++) {
+            append_bytes(bytes, images[i].chunks[j].data, images[i].chunks[j].size);
+        }
+    }
+}
+
+GLuint Texture::upload(const TextureImage& image)
+{
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    upload_levels(image, 0);
     return texture;
 }
 
+void Texture::upload_levels(const TextureImage& image, unsigned int first_level)
+{
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for(unsigned int level = first_level; level <= image.mipmaps.size(); level++) {
+        uint32_t width = level == 0 ? image.width : image.mipmaps[level - 1].width;
+        uint32_t height = level == 0 ? image.height : image.mipmaps[level - 1].height;
+        const std::vector<uint8_t>& pixels = level == 0 ? image.pixels : image.mipmaps[level - 1].pixels;
+        if(image.compressed) {
+            glCompressedTexImage2D(GL_TEXTURE_2D, level - first_level, image.internal_format, width, height, 0, pixels.size(), &pixels[0]);
+        } else {
+            glTexImage2D(GL_TEXTURE_2D, level - first_level, get_storage_format(image), width, height, 0, image.format, image.type,
+                         pixels.empty() ? NULL : &pixels[0]);
+        }
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, image.mipmaps.size() - first_level);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, image.mipmaps.size() == first_level ? GL_LINEAR : GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
+GLuint Texture::load_texture()
+{
+    TextureImage image;
+    decode(image);
+    return upload(image);
+}
+
 }
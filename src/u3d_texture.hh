@@ -22,46 +22,174 @@
 namespace U3D
 {
 
+//Tightly packed pixels of a decoded texture, ready to be uploaded
+struct TextureImage
+{
+    struct Level
+    {
+        uint32_t width, height;
+        std::vector<uint8_t> pixels;
+    };
+    uint32_t width, height;
+    GLint internal_format;
+    GLenum format, type;
+    //The pixels of every level are 4x4 blocks of the internal format when set.
+    bool compressed;
+    std::vector<uint8_t> pixels;
+    //Levels below the base level, down to 1x1
+    std::vector<Level> mipmaps;
+    TextureImage() : width(0), height(0), internal_format(GL_RGB), format(GL_RGB), type(GL_UNSIGNED_BYTE), compressed(false) {}
+    //Bytes held by all levels
+    size_t get_data_size() const
+    {
+        size_t size = pixels.size();
+        for(size_t i = 0; i < mipmaps.size(); i++) size += mipmaps[i].pixels.size();
+        return size;
+    }
+    size_t get_texel_count() const
+    {
+        size_t count = static_cast<size_t>(width) * height;
+        for(size_t i = 0; i < mipmaps.size(); i++) count += static_cast<size_t>(mipmaps[i].width) * mipmaps[i].height;
+        return count;
+    }
+};
+
+//Processing applied to decoded images on the workers before upload
+struct TextureOptions
+{
+    enum MipmapFilter { NO_MIPMAPS, BOX, KAISER };
+    MipmapFilter mipmap_filter;
+    //Filters in linear light, treating the stored colors as sRGB.
+    bool gamma_correct;
+    //Encodes every level to BC1, or BC3 for images with alpha, when the
+    //context supports S3TC.
+    bool compress;
+    //Textures declared no larger than atlas_threshold in either dimension
+    //are packed into shared pages of atlas_size texels square, so that
+    //draws using them bind the same texture. 0 disables the atlas.
+    uint32_t atlas_threshold, atlas_size;
+    //Texels repeated around each packed texture. Pages keep only the mip
+    //levels the filter leaves clean within the gutter; for the default of
+    //8, 3 with BOX and 1 with KAISER.
+    uint32_t atlas_gutter;
+    //Bytes of levels kept in GL by a TextureResidency, which streams the
+    //textures outside atlases at the level their on-screen size needs.
+    //Streaming needs mipmaps, so BOX filtering replaces NO_MIPMAPS. Finer
+    //levels are decoded again when streamed back in, so the file structure
+    //must outlive the context. They decode in the background, on the pool
+    //passed to create_context, which must then outlive the context too, or
+    //on a thread of the context's own. 0 uploads every level.
+    size_t residency_budget;
+    TextureOptions() : mipmap_filter(NO_MIPMAPS), gamma_correct(true), compress(false), atlas_threshold(0), atlas_size(1024), atlas_gutter(8),
+                       residency_budget(0) {}
+    bool enabled() const
+    {
+        return mipmap_filter != NO_MIPMAPS || compress;
+    }
+};
+
+//Seconds spent on one texture and the memory it takes. The PSNR compares the
+//compressed base level with the original and is 0 for uncompressed images.
+struct TextureTiming
+{
+    std::string name;
+    //Read from the texture cache rather than decoded
+    bool cached;
+    double decode_time, process_time, upload_time;
+    size_t texel_count, data_size;
+    double psnr;
+};
+
 class Texture
 {
     uint32_t width, height;
     uint8_t type;
     static const uint8_t ALPHA = 1, BLUE = 2, GREEN = 4, RED = 8, RGB = 14, RGBA = 15, LUMINANCE = 16;
-    uint8_t compression_type;
     static const uint8_t RAW = 0, JPEG24 = 1, PNG = 2, JPEG8 = 3, TIFF = 4;
-    uint16_t attributes;
-    uint32_t byte_count, byte_position;
-    uint8_t *image_data;
-    std::string uri;
+    //One of the images whose channels make up the texture. Its bytes stay in
+    //the block buffers they arrived in, which may be several. External
+    //images list URIs to try in order instead, and take the bytes of the
+    //first one resolved as their only chunk.
+    struct ContinuationImage
+    {
+        uint8_t compression_type, channels;
+        uint16_t attributes;
+        uint32_t byte_count, byte_position;
+        std::vector<BlockPayload> chunks;
+        std::vector<std::string> uris;
+    };
+    static const uint16_t EXTERNAL = 0x0001;
+    std::vector<ContinuationImage> images;
+    bool uris_resolved;
+    bool has_missing_image() const;
+    void decode_image(const ContinuationImage& source, TextureImage& image) const;
+    void composite(TextureImage& image) const;
 public:
     Texture(BitStreamReader& reader)
     {
-        image_data = NULL;
         reader >> height >> width >> type;
         uint32_t continuation_count = reader.read<uint32_t>();
-        if(continuation_count != 1) {
-            throw U3D_ERROR << "Textures with more than one continuations are not supported.";
+        if(continuation_count == 0) {
+            throw U3D_ERROR << "Textures need at least one continuation image.";
+        }
+        uint8_t channels = 0;
+        images.resize(continuation_count);
+        for(unsigned int i = 0; i < continuation_count; i++) {
+            ContinuationImage& image = images[i];
+            reader >> image.compression_type >> image.channels >> image.attributes;
+            if(image.attributes & EXTERNAL) {
+                image.uris.resize(reader.read<uint32_t>());
+                for(unsigned int j = 0; j < image.uris.size(); j++) reader >> image.uris[j];
+                image.byte_count = 0;
+            } else {
+                reader >> image.byte_count;
+            }
+            image.byte_position = 0;
+            channels |= image.channels;
         }
-        image_data = NULL;
-        uint8_t channels;
-        reader >> compression_type >> channels >> attributes;
         if(type != channels) {
             throw U3D_ERROR << "Texture type and channel mask do not match.";
         }
-        if(attributes & 0x0001) {
-            throw U3D_ERROR << "Texture loading from URI is not currently implemented.";
-        }
-        reader >> byte_count;
-        byte_position = 0;
-        image_data = new uint8_t[byte_count];
+        uris_resolved = false;
     }
     Texture();
     ~Texture()
     {
-        if(image_data != NULL) delete[] image_data;
+        for(unsigned int i = 0; i < images.size(); i++) {
+            for(unsigned int j = 0; j < images[i].chunks.size(); j++) {
+                if(images[i].chunks[j].buffer != NULL) delete[] images[i].chunks[j].buffer;
+            }
+        }
+    }
+    //Decodes the image without touching any GL state, so that it can run
+    //on a worker thread. Several continuation images are composited into
+    //one by their channel masks, and the result is converted to the layout
+    //it is stored in for the declared channels.
+    void decode(TextureImage& image) const;
+    uint32_t get_width() const
+    {
+        return width;
     }
+    uint32_t get_height() const
+    {
+        return height;
+    }
+    //Appends the declaration and the image bytes as stored in the file, so
+    //that textures repeated under other names or in other files match.
+    //Images fetched by resolve_uris are appended by their bytes.
+    void append_content(std::vector<uint8_t>& bytes) const;
+    //Fetches the external images through the first resolver that can, once.
+    //While any of them is missing, the texture decodes to the default one.
+    void resolve_uris(const std::vector<UriResolver *>& resolvers);
+    //Must be called on the thread owning the GL context.
+    static GLuint upload(const TextureImage& image);
+    //Specifies the levels of the bound texture from first_level on, which
+    //becomes its base level.
+    static void upload_levels(const TextureImage& image, unsigned int first_level);
     GLuint load_texture();
     void load_continuation(BitStreamReader& reader);
+private:
+    Texture(const Texture&);
+    Texture& operator=(const Texture&);
 };
-
 }
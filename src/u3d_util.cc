@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2016 Hiroka Ihara
+ *
+ * This file is part of libU3D.
+ *
+ * libU3D is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libU3D is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libU3D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "u3d_internal.hh"
+
+namespace U3D
+{
+
+void append_hex(std::string& text, uint64_t value)
+{
+    static const char digits[] = "0123456789abcdef";
+    for(int shift = 60; shift >= 0; shift -= 4) text += digits[(value >> shift) & 0xF];
+}
+
+AtomicFileWriter::AtomicFileWriter(const std::string& path) : path(path)
+{
+    //Named apart from any other thread or process writing the same file
+    std::ostringstream name;
+    name << path << '.' << SDL_ThreadID() << '.' << SDL_GetPerformanceCounter();
+    temporary = name.str();
+    file.open(temporary.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+}
+
+AtomicFileWriter::~AtomicFileWriter()
+{
+    if(!file.is_open()) return;
+    file.close();
+    std::remove(temporary.c_str());
+}
+
+bool AtomicFileWriter::commit()
+{
+    if(!file.is_open()) return false;
+    bool written = !file.flush().fail();
+    file.close();
+    if(written && !file.fail() && std::rename(temporary.c_str(), path.c_str()) == 0) return true;
+    std::remove(temporary.c_str());
+    return false;
+}
+
+}
@@ -46,4 +46,125 @@ public:
 #define U3D_WARNING (std::cerr << __FILE__ ":" << __LINE__ << ":")
 #define U3D_ERROR (U3D::Error(__FILE__, __LINE__))
 
+//Interns names into dense handles numbered from 0 in order of first use.
+class NameTable
+{
+    std::map<std::string, uint32_t> handles;
+    std::vector<std::string> names;
+public:
+    static const uint32_t NONE = 0xFFFFFFFF;
+    uint32_t intern(const std::string& name)
+    {
+        std::map<std::string, uint32_t>::iterator i = handles.find(name);
+        if(i != handles.end()) return i->second;
+        handles.insert(std::make_pair(name, static_cast<uint32_t>(names.size())));
+        names.push_back(name);
+        return names.size() - 1;
+    }
+    //Returns NONE for names never interned.
+    uint32_t find(const std::string& name) const
+    {
+        std::map<std::string, uint32_t>::const_iterator i = handles.find(name);
+        if(i == handles.end()) return NONE;
+        return i->second;
+    }
+    const std::string& get_name(uint32_t handle) const
+    {
+        return names[handle];
+    }
+    uint32_t size() const
+    {
+        return names.size();
+    }
+};
+
+//128-bit digest identifying resources by content. Collisions are left to
+//chance, at odds of about 2^-64 for any two inputs.
+struct ContentHash
+{
+    uint64_t low, high;
+    ContentHash() : low(0), high(0) {}
+    bool operator<(const ContentHash& other) const
+    {
+        return high < other.high || (high == other.high && low < other.low);
+    }
+    bool operator==(const ContentHash& other) const
+    {
+        return low == other.low && high == other.high;
+    }
+};
+
+//Appends the bytes of a value as ContentHasher::update reads them, so that
+//hashing the bytes appended gives the digest of the values.
+inline void append_bytes(std::vector<uint8_t>& bytes, const void *data, size_t size)
+{
+    const uint8_t *begin = static_cast<const uint8_t *>(data);
+    bytes.insert(bytes.end(), begin, begin + size);
+}
+
+template<typename T> void append_bytes(std::vector<uint8_t>& bytes, const T& value)
+{
+    append_bytes(bytes, &value, sizeof(T));
+}
+
+//Appends the 16 lowercase hexadecimal digits of the value.
+void append_hex(std::string& text, uint64_t value);
+
+//Writes a file under a temporary name, and renames it over the path on
+//commit, so that readers of the path never see it partly written. The
+//temporary file is removed when the writer is destroyed uncommitted.
+class AtomicFileWriter
+{
+    std::string path, temporary;
+    std::ofstream file;
+public:
+    AtomicFileWriter(const std::string& path);
+    ~AtomicFileWriter();
+    bool is_open() const
+    {
+        return file.is_open();
+    }
+    std::ostream& get_stream()
+    {
+        return file;
+    }
+    //Returns false, leaving the path as it was, when the file could not be
+    //written in full or renamed.
+    bool commit();
+private:
+    AtomicFileWriter(const AtomicFileWriter&);
+    AtomicFileWriter& operator=(const AtomicFileWriter&);
+};
+
+//Two independent 64-bit streams: FNV-1a, and a multiply-xorshift mix.
+class ContentHasher
+{
+    ContentHash hash;
+public:
+    ContentHasher()
+    {
+        hash.low = 14695981039346656037ULL;
+        hash.high = 0x9E3779B97F4A7C15ULL;
+    }
+    void update(const void *data, size_t size)
+    {
+        const uint8_t *bytes = static_cast<const uint8_t *>(data);
+        uint64_t low = hash.low, high = hash.high;
+        for(size_t i = 0; i < size; i++) {
+            low = (low ^ bytes[i]) * 1099511628211ULL;
+            high = (high ^ bytes[i]) * 0xC6A4A7935BD1E995ULL;
+            high ^= high >> 47;
+        }
+        hash.low = low, hash.high = high;
+    }
+    template<typename T> void update(const T& value)
+    {
+        update(&value, sizeof(T));
+    }
+    const ContentHash& get() const
+    {
+        return hash;
+    }
+};
+
 }
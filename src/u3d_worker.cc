@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2016 Hiroka Ihara
+ *
+ * This file is part of libU3D.
+ *
+ * libU3D is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libU3D is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libU3D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "u3d_internal.hh"
+
+namespace U3D
+{
+
+WorkerPool::WorkerPool(int thread_count) : pending(0), quit(false)
+{
+    if(thread_count <= 0) {
+        thread_count = std::max(1, SDL_GetCPUCount());
+    }
+    mutex = SDL_CreateMutex();
+    task_available = SDL_CreateCond();
+    task_finished = SDL_CreateCond();
+    if(mutex == NULL || task_available == NULL || task_finished == NULL) {
+        throw U3D_ERROR << "Failed to create the synchronization objects of a worker pool.";
+    }
+    for(int i = 0; i < thread_count; i++) {
+        SDL_Thread *thread = SDL_CreateThread(thread_main, "U3D worker", this);
+        if(thread == NULL) {
+            U3D_WARNING << "Failed to create worker thread " << i << "." << std::endl;
+            break;
+        }
+        threads.push_back(thread);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    SDL_LockMutex(mutex);
+    quit = true;
+    SDL_CondBroadcast(task_available);
+    SDL_UnlockMutex(mutex);
+    for(std::vector<SDL_Thread *>::iterator i = threads.begin(); i != threads.end(); i++) {
+        SDL_WaitThread(*i, NULL);
+    }
+    SDL_DestroyCond(task_finished);
+    SDL_DestroyCond(task_available);
+    SDL_DestroyMutex(mutex);
+}
+
+void WorkerPool::submit(Task *task)
+{
+    if(threads.empty()) {
+        task->run();
+        return;
+    }
+    SDL_LockMutex(mutex);
+    tasks.push_back(task);
+    pending++;
+    SDL_CondSignal(task_available);
+    SDL_UnlockMutex(mutex);
+}
+
+void WorkerPool::wait()
+{
+    SDL_LockMutex(mutex);
+    while(pending > 0) {
+        SDL_CondWait(task_finished, mutex);
+    }
+    SDL_UnlockMutex(mutex);
+}
+
+int WorkerPool::thread_main(void *data)
+{
+    WorkerPool *pool = static_cast<WorkerPool *>(data);
+    SDL_LockMutex(pool->mutex);
+    while(true) {
+        while(pool->tasks.empty() && !pool->quit) {
+            SDL_CondWait(pool->task_available, pool->mutex);
+        }
+        if(pool->tasks.empty()) break;
+        Task *task = pool->tasks.front();
+        pool->tasks.pop_front();
+        SDL_UnlockMutex(pool->mutex);
+        task->run();
+        SDL_LockMutex(pool->mutex);
+        if(--pool->pending == 0) {
+            SDL_CondBroadcast(pool->task_finished);
+        }
+    }
+    SDL_UnlockMutex(pool->mutex);
+    return 0;
+}
+
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2016 Hiroka Ihara
+ *
+ * This file is part of libU3D.
+ *
+ * libU3D is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libU3D is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libU3D.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+namespace U3D
+{
+
+//Fixed set of SDL threads running tasks from a shared queue.
+class WorkerPool
+{
+public:
+    class Task
+    {
+    public:
+        virtual ~Task() {}
+        virtual void run() = 0;
+    };
+private:
+    std::vector<SDL_Thread *> threads;
+    SDL_mutex *mutex;
+    SDL_cond *task_available, *task_finished;
+    std::deque<Task *> tasks;
+    unsigned int pending;
+    bool quit;
+    static int thread_main(void *data);
+public:
+    //A thread count of zero uses one thread per CPU.
+    WorkerPool(int thread_count = 0);
+    ~WorkerPool();
+    //Tasks are not owned by the pool and must stay alive until wait() returns.
+    void submit(Task *task);
+    void wait();
+    unsigned int get_thread_count() const
+    {
+        return threads.size();
+    }
+private:
+    WorkerPool(const WorkerPool&);
+    WorkerPool& operator=(const WorkerPool&);
+};
+
+}